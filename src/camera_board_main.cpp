@@ -3,7 +3,12 @@
 #include <Arduino.h>
 #include <WiFiUdp.h>
 #include <esp_now.h>
+#include <esp_timer.h>
 #include <utils/WiFiHelper.h>
+#include <utils/video/AdaptiveStreamController.h>
+#include <utils/video/FrameQueue.h>
+#include <utils/video/TokenBucket.h>
+#include <utils/video/VideoProtocol.h>
 
 //**************
 // This implentation uses the esp32-cam dev board with the espressif +
@@ -12,70 +17,333 @@
 // and use of camera accordingly.
 //***** */
 // TODO Make sure we can OTA update before building box
-int target_fps = 5; // Adjust this value to change FPS
-unsigned long frame_interval_ms = 1000 / target_fps;
-const size_t CHUNK_SIZE = 1024; // Size of each UDP packet chunk
+volatile int target_fps = 5; // Adjust this value to change FPS
+volatile unsigned long frame_interval_ms = 1000 / target_fps;
+// Each datagram carries a VideoChunkHeader plus as much JPEG data as fits in
+// VIDEO_MAX_DATAGRAM_SIZE, see utils/video/VideoProtocol.h for the format
+VideoFrameChunker chunker(VIDEO_MAX_DATAGRAM_SIZE);
+// Chunks are paced by a token bucket instead of sleeping after each packet.
+// Set STREAM_RATE_BYTES_PER_SEC to 0 for burst mode (send at line rate and
+// rely on send-buffer-full retries for back pressure).
+constexpr uint32_t STREAM_RATE_BYTES_PER_SEC = 1500000; // ~12 Mbit/s
+constexpr uint32_t STREAM_BURST_BYTES = 16 * VIDEO_MAX_DATAGRAM_SIZE;
+TokenBucket sendBucket(STREAM_RATE_BYTES_PER_SEC, STREAM_BURST_BYTES);
+
+// Capture and transmit run as two tasks so the sensor fills the second
+// frame buffer (fb_count = 2) while the previous frame is still going out.
+// Capture runs on the app core, transmit on the pro core next to the WiFi
+// stack. Frames that wait longer than MAX_FRAME_AGE_MS are dropped rather
+// than sent late.
+constexpr BaseType_t CAPTURE_TASK_CORE = 1;
+constexpr BaseType_t TRANSMIT_TASK_CORE = 0;
+constexpr uint32_t PIPELINE_TASK_STACK_SIZE = 4096;
+constexpr uint32_t MAX_FRAME_AGE_MS = 250;
+FrameQueue<camera_fb_t *, 2> frameQueue(MAX_FRAME_AGE_MS,
+                                        esp_camera_fb_return);
+TaskHandle_t captureTaskHandle = nullptr;
+TaskHandle_t transmitTaskHandle = nullptr;
+
+// Adaptive bitrate: with a target set, the transmit task trades quality,
+// frame size and fps to stay within it, using its own send times and the
+// loss reports the receiver sends back to VIDEO_SOURCE_PORT. The values
+// requested by the main board are the best the controller may use.
+constexpr uint16_t VIDEO_SOURCE_PORT = VIDEO_WEB_SERVER_PORT;
+constexpr int DEFAULT_JPEG_QUALITY = 15;
+// Must match config.frame_size in setup(), the JPEG buffers are sized for it
+constexpr uint8_t MAX_FRAME_SIZE_LEVEL = STREAM_FRAME_SIZE_COUNT - 1; // VGA
+const framesize_t FRAME_SIZE_FOR_LEVEL[STREAM_FRAME_SIZE_COUNT] = {
+    FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_HVGA,
+    FRAMESIZE_VGA};
+AdaptiveStreamController streamController; // Only used from the transmit task
+StreamSettings appliedSettings = {DEFAULT_JPEG_QUALITY, MAX_FRAME_SIZE_LEVEL,
+                                  0};
+// Written by the ESP-NOW callback, picked up by the transmit task
+volatile int requestedTargetKbps = 0;
+volatile int requestedQuality = DEFAULT_JPEG_QUALITY;
+volatile int requestedFrameSizeLevel = MAX_FRAME_SIZE_LEVEL;
+volatile bool streamConfigChanged = true;
 
 WiFiHelper wifi;
-WiFiUDP udp;
+WiFiUDP udp; // Only used from the transmit task
 unsigned long lastFrameTime = 0; // Add this variable to track timing
-bool shouldBeStreaming = false;
+volatile bool shouldBeStreaming = false;
+
+// Answers a command from the main board. Sent straight from the receive
+// callback, esp_now_send only queues the frame.
+void sendCommandAck(uint16_t sequence, CameraAckStatus status,
+                    uint8_t appliedFields, uint8_t rejectedFields) {
+  CameraAck ack;
+  initCameraMessageHeader(ack.header, CameraMessageType::Ack, sequence);
+  ack.status = static_cast<uint8_t>(status);
+  ack.appliedFields = appliedFields;
+  ack.rejectedFields = rejectedFields;
+  ack.streaming = shouldBeStreaming;
+  esp_now_send(MAIN_BOARD_MAC_ADDRESS, (const uint8_t *)&ack, sizeof(ack));
+}
 
-// callback function that will be executed when data is received from main board
-camera_message mainBoardData;
+// callback function that will be executed when data is received from main
+// board. Every command is acked once applied, repeats of a command the main
+// board did not see the ack for are applied again, values are absolute.
 void cameraBoardOnDataRecv(const uint8_t *mac, const uint8_t *incomingData,
                            int len) {
-  memcpy(&mainBoardData, incomingData, sizeof(mainBoardData));
-  // Serial.print("Bytes received: ");
-  // Serial.println(len);
-  // Serial.print("Message: ");
-  // Serial.println(mainBoardData.message);
-  // Serial.print("Camera Action: ");
-  // Serial.println(mainBoardData.camera_action);
-  // Serial.print("FPS: ");
-  // Serial.println(mainBoardData.fps);
-
-  if (mainBoardData.camera_action == 1) {
-    // Turn on camera
-    shouldBeStreaming = true;
-  } else if (mainBoardData.camera_action == 0) {
-    // Turn off camera
-    shouldBeStreaming = false;
-  }
-  if (mainBoardData.fps > 0 && mainBoardData.fps <= 30) {
-    target_fps = mainBoardData.fps;
-    frame_interval_ms = 1000 / target_fps;
-  }
-  // TODO process message for setting changes
+  CameraMessageHeader header;
+  if (len <= 0 || !parseCameraMessageHeader(incomingData, len, header)) {
+    return; // Not ours
+  }
+  if (header.version != CAMERA_PROTOCOL_VERSION) {
+    sendCommandAck(header.sequence, CameraAckStatus::UnsupportedVersion, 0,
+                   0);
+    return;
+  }
+  CameraCommand command;
+  if (!parseCameraCommand(incomingData, len, command)) {
+    sendCommandAck(header.sequence, CameraAckStatus::Malformed, 0, 0);
+    return;
+  }
+  // Serial.printf("Command %u, fields 0x%02x\n", command.header.sequence,
+  // command.fields);
+
+  uint8_t rejected =
+      invalidCameraCommandFields(command, MAX_FRAME_SIZE_LEVEL + 1);
+  uint8_t applied = command.fields & ~rejected;
+  if (applied & CAMERA_FIELD_STREAMING) {
+    shouldBeStreaming = command.streaming != 0;
+  }
+  if (applied & CAMERA_FIELD_TARGET_KBPS) {
+    requestedTargetKbps = command.targetKbps;
+  }
+  if (applied & CAMERA_FIELD_QUALITY) {
+    requestedQuality = command.quality;
+  }
+  if (applied & CAMERA_FIELD_FRAME_SIZE) {
+    requestedFrameSizeLevel = command.frameSizeLevel;
+  }
+  if (applied & CAMERA_FIELD_FPS) {
+    target_fps = command.fps;
+  }
+  if (applied & ~CAMERA_FIELD_STREAMING) {
+    streamConfigChanged = true;
+  }
+  sendCommandAck(command.header.sequence,
+                 rejected ? CameraAckStatus::Rejected : CameraAckStatus::Ok,
+                 applied, rejected);
+}
+
+// Frame currently being sent, owned by the transmit task
+camera_fb_t *sendingFrame = nullptr;
+uint16_t nextChunkIndex = 0;
+unsigned long frameSendStartMs = 0;
+
+// Telemetry reported back to the main board, owned by the transmit task.
+// Frame counters are reset with every report, see reportTelemetry().
+uint32_t framesSent = 0;
+uint32_t frameBytesSent = 0;
+uint32_t frameSendMsTotal = 0;
+unsigned long telemetryTimer = 0;
+uint32_t sendBufferFullEvents = 0;
+bool reportedStreaming = false;
+uint16_t telemetrySequence = 0;
+
+void applyStreamSettings(const StreamSettings &settings) {
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (sensor && settings.jpegQuality != appliedSettings.jpegQuality) {
+    sensor->set_quality(sensor, settings.jpegQuality);
+  }
+  if (sensor && settings.frameSizeLevel != appliedSettings.frameSizeLevel) {
+    sensor->set_framesize(sensor,
+                          FRAME_SIZE_FOR_LEVEL[settings.frameSizeLevel]);
+  }
+  frame_interval_ms = 1000 / settings.fps;
+  appliedSettings = settings;
 }
 
-void captureAndTransmitFrame() {
-  // capture a frame
-  camera_fb_t *fb = esp_camera_fb_get();
-  if (!fb) {
-    // Serial.println("Frame buffer could not be acquired");
+// Feeds receiver reports to the controller and applies what it decides
+void updateStreamControl() {
+  if (streamConfigChanged) {
+    streamConfigChanged = false;
+    AdaptiveStreamConfig config;
+    config.targetBytesPerSec = uint32_t(requestedTargetKbps) * 1000 / 8;
+    config.ceiling = {uint8_t(requestedQuality),
+                      uint8_t(requestedFrameSizeLevel), uint8_t(target_fps)};
+    streamController.configure(config);
+    applyStreamSettings(streamController.settings());
+  }
+
+  uint8_t buffer[sizeof(VideoReceiverReport)];
+  while (udp.parsePacket() > 0) {
+    int length = udp.read(buffer, sizeof(buffer));
+    VideoReceiverReport report;
+    if (length > 0 && parseVideoReceiverReport(buffer, length, report)) {
+      streamController.onReceiverReport(report.framesCompleted,
+                                        report.framesDropped);
+    }
   }
 
-  size_t remaining = fb->len;
-  while (remaining) {
-    size_t toRead = min(CHUNK_SIZE, remaining);
+  if (streamController.update(millis())) {
+    applyStreamSettings(streamController.settings());
+  }
+}
+
+// Sends as many chunks of the current frame as the token bucket allows and
+// returns without waiting. Returns true once the whole frame is out.
+bool transmitFrameChunks() {
+  VideoChunk chunk;
+  while (nextChunkIndex < chunker.chunkCount()) {
+    chunker.chunkAt(nextChunkIndex, chunk);
+    size_t datagramSize = sizeof(chunk.header) + chunk.payloadLength;
+    if (!sendBucket.tryConsume(datagramSize, micros())) {
+      return false; // Out of budget, pick up here on the next pass
+    }
     udp.beginPacket(VIDEO_WEB_SERVER_IP, VIDEO_WEB_SERVER_PORT);
-    udp.write(fb->buf + (fb->len - remaining), toRead);
-    udp.endPacket();
-    remaining -= toRead;
-    delay(1); // give TCP stack a breather
+    udp.write(reinterpret_cast<const uint8_t *>(&chunk.header),
+              sizeof(chunk.header));
+    udp.write(chunk.payload, chunk.payloadLength);
+    if (!udp.endPacket()) {
+      // lwIP ran out of buffers, retry the same chunk on the next pass
+      sendBucket.refund(datagramSize);
+      sendBufferFullEvents++;
+      return false;
+    }
+    nextChunkIndex++;
   }
   // return the frame buffer back to be reused
-  esp_camera_fb_return(fb);
+  esp_camera_fb_return(sendingFrame);
+  sendingFrame = nullptr;
+  return true;
 }
+
+// Producer: grabs frames at the target fps and queues them for transmit
+void captureTask(void *) {
+  for (;;) {
+    if (!shouldBeStreaming) {
+      vTaskDelay(pdMS_TO_TICKS(20));
+      continue;
+    }
+    unsigned long currentTime = millis();
+    unsigned long sinceLastFrame = currentTime - lastFrameTime;
+    if (sinceLastFrame < frame_interval_ms) {
+      vTaskDelay(pdMS_TO_TICKS(frame_interval_ms - sinceLastFrame));
+      continue;
+    }
+    lastFrameTime = currentTime;
+
+    // Blocks until the driver has a filled buffer, i.e. while both buffers
+    // are held by the queue and the transmit task
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+      // Serial.println("Frame buffer could not be acquired");
+      continue;
+    }
+    if (frameQueue.push(fb, millis())) {
+      xTaskNotifyGive(transmitTaskHandle);
+    }
+  }
+}
+
+void reportTelemetry(unsigned long currentTime) {
+  bool streaming = shouldBeStreaming;
+  unsigned long elapsed = currentTime - telemetryTimer;
+  // Once a second while streaming, plus one final report when it stops
+  uint32_t interval = streaming || reportedStreaming
+                          ? CAMERA_STREAMING_TELEMETRY_INTERVAL_MS
+                          : CAMERA_IDLE_TELEMETRY_INTERVAL_MS;
+  if (elapsed < interval) {
+    return;
+  }
+  CameraTelemetry telemetry;
+  initCameraMessageHeader(telemetry.header, CameraMessageType::Telemetry,
+                          telemetrySequence++);
+  telemetry.achievedFps = framesSent * 1000.0f / elapsed;
+  telemetry.avgFrameBytes = framesSent ? frameBytesSent / framesSent : 0;
+  uint32_t avgSendMs = framesSent ? frameSendMsTotal / framesSent : 0;
+  telemetry.avgFrameSendMs = avgSendMs > UINT16_MAX ? UINT16_MAX : avgSendMs;
+  telemetry.sendBufferFullEvents = sendBufferFullEvents;
+  telemetry.droppedFrames =
+      frameQueue.framesDroppedFull() + frameQueue.framesDroppedStale();
+  telemetry.jpegQuality = appliedSettings.jpegQuality;
+  telemetry.frameSizeLevel = appliedSettings.frameSizeLevel;
+  telemetry.streamFps = appliedSettings.fps;
+  telemetry.adaptiveEnabled = streamController.isEnabled();
+  telemetry.budgetBytesPerSec = streamController.budgetBytesPerSec();
+  telemetry.freeHeapBytes = ESP.getFreeHeap();
+  telemetry.freePsramBytes = ESP.getFreePsram();
+  telemetry.wifiRssi = WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+  // millis() wraps after 49 days, the esp_timer clock does not
+  telemetry.uptimeSec = esp_timer_get_time() / 1000000;
+  esp_now_send(MAIN_BOARD_MAC_ADDRESS, (const uint8_t *)&telemetry,
+               sizeof(telemetry));
+  reportedStreaming = streaming;
+
+  framesSent = 0;
+  frameBytesSent = 0;
+  frameSendMsTotal = 0;
+  telemetryTimer = currentTime;
+}
+
+// Consumer: sends queued frames, paced by the token bucket
+void transmitTask(void *) {
+  for (;;) {
+    updateStreamControl();
+    reportTelemetry(millis());
+
+    if (!shouldBeStreaming) {
+      // Hand every buffer back to the driver, a half sent frame is dropped
+      if (sendingFrame) {
+        esp_camera_fb_return(sendingFrame);
+        sendingFrame = nullptr;
+      }
+      frameQueue.releaseAll();
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+      continue;
+    }
+
+    if (!sendingFrame) {
+      camera_fb_t *fb;
+      uint32_t capturedAtMs;
+      if (!frameQueue.pop(fb, capturedAtMs, millis())) {
+        // Sleep until the capture task queues something
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+        continue;
+      }
+      if (chunker.beginFrame(fb->buf, fb->len, capturedAtMs) == 0) {
+        esp_camera_fb_return(fb);
+        continue;
+      }
+      sendingFrame = fb;
+      nextChunkIndex = 0;
+      frameSendStartMs = millis();
+    }
+
+    size_t frameBytes = sendingFrame->len;
+    if (transmitFrameChunks()) {
+      uint32_t sendMs = millis() - frameSendStartMs;
+      framesSent++;
+      frameBytesSent += frameBytes;
+      frameSendMsTotal += sendMs;
+      streamController.onFrameSent(frameBytes, sendMs);
+    } else {
+      // Out of tokens or lwIP buffers, let them refill
+      vTaskDelay(1);
+    }
+  }
+}
+
+void onConnectivityChanged(ConnectivityEvent event) {
+  if (event == ConnectivityEvent::LinkUp) {
+    // Also follows the access point to a new channel after a reconnect
+    wifi.setupEspNow(true, cameraBoardOnDataRecv);
+  }
+}
+
 void setup() {
   Serial.begin(115200);
   // Enable for detailed debug output (for when the gremlins strike)
   // Serial.setDebugOutput(true);
   // esp_log_level_set("*", ESP_LOG_VERBOSE);
-  // True to setup OTA updates, false to skip time syncing
-  wifi.connectAndSyncTime(true, false);
-  wifi.setupEspNow(true, cameraBoardOnDataRecv);
+  // True to setup OTA updates, false to skip time syncing. Connects in the
+  // background, ESP-NOW starts once the link is up.
+  wifi.addListener(onConnectivityChanged);
+  wifi.begin(true, false);
 
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
@@ -98,10 +366,12 @@ void setup() {
   config.pin_reset = -1;
   config.xclk_freq_hz = 20000000;
   config.pixel_format = PIXFORMAT_JPEG;
-  config.frame_size = FRAMESIZE_VGA;
-  config.jpeg_quality = 15;
+  config.frame_size = FRAME_SIZE_FOR_LEVEL[MAX_FRAME_SIZE_LEVEL];
+  config.jpeg_quality = DEFAULT_JPEG_QUALITY;
   config.fb_location = CAMERA_FB_IN_PSRAM;
   config.fb_count = 2;
+  // Always hand out the newest frame when both buffers are full
+  config.grab_mode = CAMERA_GRAB_LATEST;
 
   if (esp_camera_init(&config) != ESP_OK) {
     // Serial.println("Camera init failed");
@@ -110,37 +380,20 @@ void setup() {
   // Serial.printf("PSRAM size: %d bytes\n", ESP.getPsramSize());
 
   // Serial.println("Camera initialized successfully");
+  // Bind the stream's source port so receiver reports can come back to it
+  udp.begin(VIDEO_SOURCE_PORT);
+  xTaskCreatePinnedToCore(transmitTask, "transmit", PIPELINE_TASK_STACK_SIZE,
+                          nullptr, 1, &transmitTaskHandle, TRANSMIT_TASK_CORE);
+  xTaskCreatePinnedToCore(captureTask, "capture", PIPELINE_TASK_STACK_SIZE,
+                          nullptr, 1, &captureTaskHandle, CAPTURE_TASK_CORE);
   delay(1000); // Allow time for devices to initialize
   // Serial.println("Initialization complete.!");
 }
 
-int fpsCounter = 0;
-unsigned long fpsTimer = 0;
 void loop() {
   // Maintain WiFi connection and handles OTA updates
   wifi.maintain();
-
-  if (!shouldBeStreaming) {
-    return; // Not streaming, skip the rest of the loop
-  }
-
-  // Check if enough time has passed since last frame
-  unsigned long currentTime = millis();
-  if (currentTime - lastFrameTime < frame_interval_ms) {
-    return; // Not time for next frame yet
-  }
-
-  captureAndTransmitFrame();
-  lastFrameTime = currentTime;
-
-  // Update FPS counter
-  fpsCounter++;
-  if (currentTime - fpsTimer >= 1000) {
-    // Serial.print("FPS: ");
-    // Serial.println(fpsCounter);
-    fpsCounter = 0;
-    fpsTimer = currentTime;
-  }
-
+  // Capture, transmit, stream control and telemetry happen in their own tasks,
+  // see captureTask() and transmitTask()
   delay(10); // Small delay to avoid overwhelming the loop
-}
\ No newline at end of file
+}
@@ -1,47 +1,49 @@
 #include "CameraDevice.h"
 
 CameraDevice::CameraDevice(
-    const std::string &name) //, const uint8_t macAddress[6])
+    const char *name) //, const uint8_t macAddress[6])
     : Device(name) {
   // memcpy(this->cameraBoardMacAddress, macAddress, 6);
 }
 
-void CameraDevice::setCameraMessage(String message, int camera_action,
-                                    int fps) {
-
-  strncpy(this->cameraMessage.message, message.c_str(),
-          sizeof(this->cameraMessage.message) - 1);
-  this->cameraMessage.message[sizeof(this->cameraMessage.message) - 1] =
-      '\0'; // Ensure null-termination
-  this->cameraMessage.camera_action = camera_action;
-  this->cameraMessage.fps = fps;
-}
-
-// TODO Cleanest way to do this here would be to have a time check for last
-// retry and only retry every x seconds
 void CameraDevice::update() {
-  if (this->shouldBeOnState != this->isOn() &&
-      this->currentlySendingEspNowCommand &&
-      this->currentRetryCount < MAX_ESP_NOW_RETRIES) {
-    this->currentRetryCount++;
-    // Desired state differs from actual state, attempt to correct
-    if (this->shouldBeOnState) {
-      turnOn();
-    } else {
-      turnOff();
-    }
+  CameraAck ack;
+  while (acks.pop(ack)) {
+    handleAck(ack);
+  }
+  CameraTelemetry newTelemetry;
+  while (telemetryUpdates.pop(newTelemetry)) {
+    applyTelemetry(newTelemetry, millis());
   }
 
-  if (this->currentRetryCount >= MAX_ESP_NOW_RETRIES) {
-    this->currentlySendingEspNowCommand = false;
+  // Not acknowledged yet, the camera board applies repeats harmlessly
+  if (commandRetry.poll(millis())) {
+    attemptSend(this->pendingCommand);
+  }
+  if (commandRetry.isFailed()) {
     this->setErrorState(true);
   }
 }
 
-bool CameraDevice::attemptSend(const camera_message &message) {
+void CameraDevice::sendPendingCommand() {
+  initCameraMessageHeader(pendingCommand.header, CameraMessageType::Command,
+                          nextSequence++);
+  pendingCommand.streaming = this->shouldBeOnState;
+  pendingCommand.fps = this->fps;
+  pendingCommand.quality = this->quality;
+  pendingCommand.frameSizeLevel = this->frameSizeLevel;
+  pendingCommand.targetKbps = this->targetKbps;
+  uint32_t now = millis();
+  commandRetry.start(now);
+  if (commandRetry.poll(now)) {
+    attemptSend(pendingCommand);
+  }
+}
+
+bool CameraDevice::attemptSend(const CameraCommand &command) {
   esp_err_t result =
-      esp_now_send(CAMERA_BOARD_MAC_ADDRESS, (const uint8_t *)&message,
-                   sizeof(camera_message));
+      esp_now_send(CAMERA_BOARD_MAC_ADDRESS, (const uint8_t *)&command,
+                   sizeof(CameraCommand));
 
   if (result == ESP_OK) {
     return true;
@@ -50,49 +52,140 @@ bool CameraDevice::attemptSend(const camera_message &message) {
   return false;
 }
 
-// State will be set by onDataSent callback in main.cpp -> This guarantees
-// camera state represents true state of camera board.
+// State is only taken from the camera board's ack, so it represents the true
+// state of the camera board rather than MAC-layer delivery
+void CameraDevice::handleAck(const CameraAck &ack) {
+  // Acks for commands that were superseded by a newer one are ignored
+  if (!commandRetry.isActive() ||
+      ack.header.sequence != pendingCommand.header.sequence) {
+    return;
+  }
+  commandRetry.succeed();
+  pendingCommand.fields = 0;
+  this->setErrorState(ack.status !=
+                      static_cast<uint8_t>(CameraAckStatus::Ok));
+  this->setState(ack.streaming != 0);
+}
+
+// What the stream is set to is versioned like the rest of the state and
+// goes out straight away. Counters, rates, heap and uptime move with every
+// report, so they only bump the version every TELEMETRY_PUBLISH_INTERVAL_MS.
+void CameraDevice::applyTelemetry(const CameraTelemetry &newTelemetry,
+                                  uint32_t nowMs) {
+  bool settingsChanged =
+      newTelemetry.jpegQuality != telemetry.jpegQuality ||
+      newTelemetry.frameSizeLevel != telemetry.frameSizeLevel ||
+      newTelemetry.streamFps != telemetry.streamFps ||
+      newTelemetry.adaptiveEnabled != telemetry.adaptiveEnabled;
+  telemetry = newTelemetry;
+  if (settingsChanged ||
+      nowMs - telemetryVersionMs >= TELEMETRY_PUBLISH_INTERVAL_MS) {
+    telemetryVersionMs = nowMs;
+    markStateChanged();
+  }
+}
+
 void CameraDevice::turnOn() {
-  setCameraMessage("Camera On", 1, this->fps);
-  attemptSend(this->cameraMessage);
+  this->shouldBeOnState = true;
+  queueField(CAMERA_FIELD_STREAMING);
+  sendPendingCommand();
 }
 void CameraDevice::turnOff() {
-  setCameraMessage("Camera Off", 0, this->fps);
-  attemptSend(this->cameraMessage);
+  this->shouldBeOnState = false;
+  queueField(CAMERA_FIELD_STREAMING);
+  sendPendingCommand();
 }
 
 void CameraDevice::applyState(JsonVariantConst desired) {
-  // FPS needs to be set first since turnOn and turnOff use it
+  // Everything below is collected into one command, sent at the end
   if (desired["fps"].is<JsonVariantConst>()) {
     int newFps = desired["fps"].as<int>();
-    if (newFps > 0 && newFps <= 30) {
+    if (newFps >= CAMERA_MIN_FPS && newFps <= CAMERA_MAX_FPS) {
       this->setFps(newFps);
-      setCameraMessage("Camera FPS", 2, this->fps);
-      attemptSend(this->cameraMessage);
+      queueField(CAMERA_FIELD_FPS);
     } else {
       // Serial.println("Invalid FPS value received, must be between 1 and 30");
     }
   }
+  // Quality and frame size are the best the stream may use, the camera board
+  // drops below them on its own when a target bitrate is set
+  if (desired["quality"].is<JsonVariantConst>()) {
+    int newQuality = desired["quality"].as<int>();
+    if (newQuality >= CAMERA_MIN_QUALITY && newQuality <= CAMERA_MAX_QUALITY &&
+        newQuality != this->quality) {
+      this->quality = newQuality;
+      markStateChanged();
+      queueField(CAMERA_FIELD_QUALITY);
+    }
+  }
+  if (desired["frameSize"].is<const char *>()) {
+    int level = streamFrameSizeLevel(desired["frameSize"].as<const char *>());
+    if (level >= 0 && level != this->frameSizeLevel) {
+      this->frameSizeLevel = level;
+      markStateChanged();
+      queueField(CAMERA_FIELD_FRAME_SIZE);
+    }
+  }
+  if (desired["targetKbps"].is<JsonVariantConst>()) {
+    int newTargetKbps = desired["targetKbps"].as<int>();
+    if (newTargetKbps >= 0 && newTargetKbps <= UINT16_MAX &&
+        newTargetKbps != this->targetKbps) {
+      this->targetKbps = newTargetKbps;
+      markStateChanged();
+      queueField(CAMERA_FIELD_TARGET_KBPS);
+    }
+  }
   if (desired["state"].is<JsonVariantConst>()) {
     this->shouldBeOnState = desired["state"].as<bool>();
-    this->currentRetryCount = 0;
-    this->currentlySendingEspNowCommand = true;
-    if (this->shouldBeOnState) {
-      turnOn();
-    } else {
-      turnOff();
-    }
+    queueField(CAMERA_FIELD_STREAMING);
   }
+  if (pendingCommand.fields) {
+    sendPendingCommand();
+  }
+}
+
+void CameraDevice::desiredStateFilter(JsonDocument &filter) {
+  filter["fps"] = true;
+  filter["quality"] = true;
+  filter["frameSize"] = true;
+  filter["targetKbps"] = true;
+  filter["state"] = true;
 }
 
 void CameraDevice::reportState(JsonDocument &doc) {
   doc["state"] = this->isOn();
   doc["error"] = this->hasError();
   doc["fps"] = this->getFps();
+  doc["quality"] = this->quality;
+  doc["frameSize"] = STREAM_FRAME_SIZES[this->frameSizeLevel].name;
+  doc["targetKbps"] = this->targetKbps;
+  doc["achievedFps"] = this->telemetry.achievedFps;
+  doc["sendBufferFull"] = this->telemetry.sendBufferFullEvents;
+
+  // What the camera board is actually streaming with right now
+  JsonObject stream = doc["stream"].to<JsonObject>();
+  uint8_t level = this->telemetry.frameSizeLevel < STREAM_FRAME_SIZE_COUNT
+                      ? this->telemetry.frameSizeLevel
+                      : STREAM_FRAME_SIZE_COUNT - 1;
+  stream["adaptive"] = this->telemetry.adaptiveEnabled != 0;
+  stream["quality"] = this->telemetry.jpegQuality;
+  stream["frameSize"] = STREAM_FRAME_SIZES[level].name;
+  stream["fps"] = this->telemetry.streamFps;
+  stream["budgetKbps"] = this->telemetry.budgetBytesPerSec * 8 / 1000;
+
+  // Camera board health, to tune the stream from the dashboard
+  JsonObject board = doc["board"].to<JsonObject>();
+  board["avgFrameBytes"] = this->telemetry.avgFrameBytes;
+  board["avgFrameSendMs"] = this->telemetry.avgFrameSendMs;
+  board["droppedFrames"] = this->telemetry.droppedFrames;
+  board["freeHeap"] = this->telemetry.freeHeapBytes;
+  board["freePsram"] = this->telemetry.freePsramBytes;
+  board["rssi"] = this->telemetry.wifiRssi;
+  board["uptimeSec"] = this->telemetry.uptimeSec;
 }
 
-void CameraDevice::logState(FirebaseMapValue &map) {
-  map.add("state", FirebaseBooleanValue(this->isOn()))
-      .add("error", FirebaseBooleanValue(this->hasError()))
-      .add("fps", FirebaseIntegerValue(this->getFps()));
+void CameraDevice::logState(JsonDocument &doc) {
+  doc["state"] = this->isOn();
+  doc["error"] = this->hasError();
+  doc["fps"] = this->getFps();
 }
\ No newline at end of file
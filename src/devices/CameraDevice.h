@@ -1,14 +1,12 @@
 #pragma once
 #include "../config/Credentials.h"
 #include "../utils/MessageTypes.h"
+#include "../utils/RetryBackoff.h"
+#include "../utils/SpscQueue.h"
+#include "../utils/video/AdaptiveStreamController.h"
 #include "Device.h"
 #include <esp_now.h>
 
-// Conflicting sensor_t definition between esp_camera and arduinojson
-#define sensor_t camera_sensor_t
-#include <esp_camera.h>
-#undef sensor_t
-
 // This class encompases the management of the camera device from a state and
 // communication perspective The actual camera board will run a separate
 // firmware that receives commands from this class to start and stop streaming,
@@ -16,7 +14,7 @@
 
 class CameraDevice : public Device {
 public:
-  CameraDevice(const std::string &name); //, const uint8_t macAddress[6]);
+  CameraDevice(const char *name); //, const uint8_t macAddress[6]);
   void begin() override{};
   void update() override;
   // Using override calls to start and stop streams
@@ -24,14 +22,29 @@ public:
   void turnOff() override;
   void reportState(JsonDocument &doc) override;
   void applyState(JsonVariantConst desired) override;
-  void logState(FirebaseMapValue &map) override;
+  void desiredStateFilter(JsonDocument &filter) override;
+  void logState(JsonDocument &doc) override;
   bool shouldBeOn() { return shouldBeOnState; }
-  void setErrorState(bool state) { errorState = state; }
+  void setErrorState(bool state) {
+    if (errorState != state) {
+      errorState = state;
+      markStateChanged();
+    }
+  }
   bool hasError() { return errorState; }
   int getFps() { return fps; }
-  void setFps(int newFps) { fps = newFps; }
+  void setFps(int newFps) {
+    if (fps != newFps) {
+      fps = newFps;
+      markStateChanged();
+    }
+  }
 
-  void setCameraMessage(String message, int camera_action, int fps);
+  // Called from the ESP-NOW receive callback, handled in update()
+  void onCommandAck(const CameraAck &ack) { acks.push(ack); }
+  void onTelemetry(const CameraTelemetry &telemetry) {
+    telemetryUpdates.push(telemetry);
+  }
 
 private:
   // Used to track desired state from Firebase database
@@ -39,13 +52,42 @@ private:
   // Used to track if there was an error sending command to camera board
   bool errorState = false;
   int fps = 5;
-  // Initialize memory to send all commands for camera control
-  camera_message cameraMessage;
+  // Stream tuning, 0 target leaves quality and frame size fixed
+  int targetKbps = 0;
+  int quality = 12;
+  int frameSizeLevel = STREAM_FRAME_SIZE_COUNT - 1;
+  // Latest telemetry from the camera board, applied in update()
+  CameraTelemetry telemetry = {};
+  // Telemetry alone republishes the state at most this often
+  static constexpr uint32_t TELEMETRY_PUBLISH_INTERVAL_MS = 30000;
+  uint32_t telemetryVersionMs = 0; // When telemetry last bumped the version
+  // ESP-NOW callback -> update()
+  SpscQueue<CameraTelemetry, 4> telemetryUpdates;
+
+  // Fields that changed since the last acked command. Everything set by one
+  // applyState() goes out as a single command, and changes made while a
+  // command is unacknowledged are folded into its resend.
+  CameraCommand pendingCommand = {};
+  uint16_t nextSequence = 0;
+  SpscQueue<CameraAck, 4> acks; // ESP-NOW callback -> update()
 
-  // ESP-NOW retry variables
-  bool currentlySendingEspNowCommand = false;
-  int currentRetryCount = 0;
-  static constexpr int MAX_ESP_NOW_RETRIES = 5;
+  // Resends the pending command until the camera board acks it. After the
+  // deadline the camera is flagged as errored and probed in the background,
+  // the first ack clears the error again.
+  static constexpr RetryPolicy COMMAND_RETRY_POLICY = {
+      20,    // initialDelayMs, an ack normally takes a few ms
+      500,   // maxDelayMs
+      2,     // multiplier
+      25,    // jitterPercent
+      3000,  // deadlineMs
+      10000, // probeIntervalMs
+  };
+  RetryBackoff commandRetry{COMMAND_RETRY_POLICY};
 
-  bool attemptSend(const camera_message &message);
+  void queueField(uint8_t field) { pendingCommand.fields |= field; }
+  // Sends pendingCommand under a new sequence number
+  void sendPendingCommand();
+  bool attemptSend(const CameraCommand &command);
+  void handleAck(const CameraAck &ack);
+  void applyTelemetry(const CameraTelemetry &newTelemetry, uint32_t nowMs);
 };
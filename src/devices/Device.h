@@ -1,52 +1,85 @@
 #pragma once
-#include "../utils/firebase/FirebaseTypes.h"
 #include <Arduino.h>
 #include <ArduinoJson.h>
-#include <map>
+#include <string_view>
+
+#include "DeviceRegistry.h"
 
 class Device {
 public:
-  Device(const std::string &name = "unregistered") : name(name) {
+  static constexpr size_t MAX_DEVICES = 8;
+  using Registry = DeviceRegistry<Device, MAX_DEVICES>;
+
+  // name is kept by reference, pass a string literal
+  Device(const char *name = "unregistered") : name(name) {
     // Safe auto-registration
-    registry()[name] = this;
+    registry().add(this->name, this);
     state = false;
   } // todo: Figure out way to not have name in html depend on this name
   ~Device() {
     // Unregister device on destruction
-    registry().erase(name);
+    registry().remove(name, this);
   }
 
-  static Device *getDevice(const std::string &name) {
-    // Serial.printf("Looking up device by name: %s\n", name.c_str());
-    auto it = registry().find(name);
-    return (it != registry().end()) ? it->second : nullptr;
+  static Device *getDevice(std::string_view name) {
+    // Serial.printf("Looking up device by name: %.*s\n", int(name.size()),
+    // name.data());
+    return registry().find(name);
   }
 
+  // The name is null terminated, it always comes from a C string
+  const char *getName() const { return name.data(); }
+
   virtual void begin() = 0;
   virtual void update() = 0; // called in main loop
   virtual void turnOn() = 0;
   virtual void turnOff() = 0;
   // Functions to handle state syncing between webpage and esp32 using firebase
+  // desired is always the whole desired state, partial updates are merged
+  // into the current one first (see DesiredStateMerge.h)
   virtual void applyState(JsonVariantConst desired) = 0;
+  // Keys applyState() reads, used as a parse filter so anything else in the
+  // desired tree is skipped. Keeps everything unless a device narrows it.
+  virtual void desiredStateFilter(JsonDocument &filter) { filter.set(true); }
   virtual void reportState(JsonDocument &doc) = 0;
-  virtual void logState(FirebaseMapValue &map) = 0;
+  // Fields recorded with log events, kept as JSON so they can be spooled
+  virtual void logState(JsonDocument &doc) = 0;
 
-  // Return const reference to the entire registry
-  static const std::map<std::string, Device *> &getAllDevices() {
+  // Return const reference to the entire registry, iterate it as
+  // for (const auto &[name, device] : Device::getAllDevices())
+  static const Registry &getAllDevices() {
     return registry();
   }
   virtual bool isOn() { return state; }
-  virtual void setState(bool newState) { state = newState; }
-  virtual void setOverrideMode(bool mode) { overrideMode = mode; }
+  virtual void setState(bool newState) {
+    if (state != newState) {
+      state = newState;
+      markStateChanged();
+    }
+  }
+  virtual void setOverrideMode(bool mode) {
+    if (overrideMode != mode) {
+      overrideMode = mode;
+      markStateChanged();
+    }
+  }
   virtual bool getOverrideMode() { return overrideMode; }
 
+  // Bumped whenever something reportState() writes may have changed, so the
+  // publisher can skip devices that have not moved since the last upload
+  uint32_t getStateVersion() const { return stateVersion; }
+
+protected:
+  void markStateChanged() { stateVersion++; }
+
 private:
   bool state;
   bool overrideMode = false;
-  std::string name;
+  uint32_t stateVersion = 0;
+  std::string_view name;
   // Singleton accessor for registry
-  static std::map<std::string, Device *> &registry() {
-    static std::map<std::string, Device *> instance;
+  static Registry &registry() {
+    static Registry instance;
     return instance;
   }
 };
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+
+// Fixed-capacity name -> object table kept sorted by name, so lookups are a
+// binary search over a flat array and nothing is allocated. Names are
+// string_views and must outlive the registry, in practice they are the string
+// literals the devices are constructed with.
+// Registration happens during static initialization and lookups from the
+// control loop, it is not thread safe. No Arduino dependencies.
+template <typename T, size_t Capacity> class DeviceRegistry {
+public:
+  struct Entry {
+    std::string_view name;
+    T *device;
+  };
+
+  // Adds or replaces name. Returns false when the table is full.
+  bool add(std::string_view name, T *device) {
+    Entry *it = lowerBound(name);
+    if (it != mutableEnd() && it->name == name) {
+      it->device = device;
+      return true;
+    }
+    if (count == Capacity) {
+      return false;
+    }
+    std::move_backward(it, mutableEnd(), mutableEnd() + 1);
+    *it = Entry{name, device};
+    count++;
+    return true;
+  }
+
+  // Removes name, but only while it still maps to device
+  void remove(std::string_view name, const T *device) {
+    Entry *it = lowerBound(name);
+    if (it != mutableEnd() && it->name == name && it->device == device) {
+      std::move(it + 1, mutableEnd(), it);
+      count--;
+    }
+  }
+
+  T *find(std::string_view name) const {
+    const Entry *it = lowerBound(name);
+    return it != end() && it->name == name ? it->device : nullptr;
+  }
+
+  // Iterated in name order
+  const Entry *begin() const { return entries; }
+  const Entry *end() const { return entries + count; }
+  size_t size() const { return count; }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  Entry *mutableEnd() { return entries + count; }
+  Entry *lowerBound(std::string_view name) {
+    return std::lower_bound(entries, mutableEnd(), name, lessThan);
+  }
+  const Entry *lowerBound(std::string_view name) const {
+    return std::lower_bound(begin(), end(), name, lessThan);
+  }
+  static bool lessThan(const Entry &entry, std::string_view name) {
+    return entry.name < name;
+  }
+
+  Entry entries[Capacity] = {};
+  size_t count = 0;
+};
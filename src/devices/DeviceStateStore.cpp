@@ -0,0 +1,83 @@
+#include "DeviceStateStore.h"
+#include "../utils/Hash.h"
+#include <cstdio>
+#include <cstring>
+
+size_t DeviceStateStore::restoreAll() {
+  size_t restored = 0;
+  for (const auto &[name, device] : Device::getAllDevices()) {
+    if (restore(*device)) {
+      restored++;
+    }
+  }
+  return restored;
+}
+
+bool DeviceStateStore::restore(Device &device) {
+  JsonDocument desired;
+  if (!load(device, desired)) {
+    return false;
+  }
+  device.applyState(desired.as<JsonVariantConst>());
+  return true;
+}
+
+bool DeviceStateStore::load(const Device &device, JsonDocument &desired) {
+  Header header;
+  size_t length = loadBlob(device, header);
+  return length > 0 &&
+         !deserializeMsgPack(desired, blob + sizeof(Header), length);
+}
+
+bool DeviceStateStore::update(const Device &device, JsonVariantConst desired) {
+  if (measureMsgPack(desired) > MAX_STATE_SIZE) {
+    return true; // Too big to keep, still apply it
+  }
+  uint8_t payload[MAX_STATE_SIZE];
+  size_t length = serializeMsgPack(desired, payload, sizeof(payload));
+  uint32_t hash = fnv1a(payload, length);
+
+  Header stored;
+  if (loadBlob(device, stored) == length && stored.hash == hash) {
+    return false;
+  }
+
+  Header header = {MAGIC, FORMAT_VERSION, uint16_t(length), hash};
+  memcpy(blob, &header, sizeof(header));
+  memcpy(blob + sizeof(header), payload, length);
+  char key[KEY_SIZE];
+  keyFor(device, key);
+  store.put(key, blob, sizeof(header) + length);
+  return true;
+}
+
+bool DeviceStateStore::clear(const Device &device) {
+  char key[KEY_SIZE];
+  keyFor(device, key);
+  return store.remove(key);
+}
+
+void DeviceStateStore::keyFor(const Device &device, char *key) {
+  const char *name = device.getName();
+  snprintf(key, KEY_SIZE, "ds%08x",
+           unsigned(fnv1a(reinterpret_cast<const uint8_t *>(name),
+                          strlen(name))));
+}
+
+size_t DeviceStateStore::loadBlob(const Device &device, Header &header) {
+  char key[KEY_SIZE];
+  keyFor(device, key);
+  size_t size = store.get(key, blob, sizeof(blob));
+  if (size < sizeof(Header)) {
+    return 0;
+  }
+  memcpy(&header, blob, sizeof(Header));
+  size_t length = size - sizeof(Header);
+  // Older formats are dropped, the cloud state replaces them once online
+  if (header.magic != MAGIC || header.version != FORMAT_VERSION ||
+      header.length != length ||
+      fnv1a(blob + sizeof(Header), length) != header.hash) {
+    return 0;
+  }
+  return length;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "../utils/KeyValueStore.h"
+#include "Device.h"
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+
+// Keeps the last desired state applied to each device in persistent storage
+// so the board comes back from a reboot or brownout with its overrides,
+// thresholds and schedules instead of the compile-time defaults, before the
+// network is up.
+//
+// Each device's state is one small blob: a header with a format version and
+// the FNV-1a hash of the payload, then the desired document (as filtered by
+// desiredStateFilter()) in MessagePack. The hash doubles as the state's
+// version, update() compares against it so reapplying the same state, e.g.
+// the cloud snapshot after a reconnect, costs no flash write.
+//
+// Control loop only, like the devices themselves.
+class DeviceStateStore {
+public:
+  static constexpr size_t MAX_STATE_SIZE = 256; // MessagePack payload
+  static constexpr uint8_t FORMAT_VERSION = 1;
+
+  explicit DeviceStateStore(KeyValueStore &store) : store(store) {}
+
+  // Applies the saved state to every registered device, call after their
+  // begin(). Returns the number of devices restored.
+  size_t restoreAll();
+  bool restore(Device &device);
+  // Reads the state saved for device into desired, false when there is none
+  bool load(const Device &device, JsonDocument &desired);
+
+  // Saves desired for device unless it matches what is stored. Returns
+  // false when it matched, i.e. the device already has this state; true
+  // means it is new and should be applied (even if saving failed).
+  bool update(const Device &device, JsonVariantConst desired);
+
+  // Forgets a device's state, it starts from its defaults on the next boot
+  bool clear(const Device &device);
+
+private:
+  struct Header {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t length; // Payload bytes
+    uint32_t hash;   // FNV-1a of the payload
+  } __attribute__((packed));
+  static_assert(sizeof(Header) == 8, "Header must stay 8 bytes");
+  static constexpr uint8_t MAGIC = 0x5D;
+  static constexpr size_t KEY_SIZE = KeyValueStore::MAX_KEY_LENGTH + 1;
+
+  // Device names can be longer than an NVS key, so the key is derived from
+  // the name's hash, e.g. "ds3f2a9c01"
+  static void keyFor(const Device &device, char *key);
+  // Reads and checks the blob, returns the payload length or 0
+  size_t loadBlob(const Device &device, Header &header);
+
+  KeyValueStore &store;
+  uint8_t blob[sizeof(Header) + MAX_STATE_SIZE];
+};
@@ -8,7 +8,7 @@
 // place.
 class HeatLamp : public Device {
 public:
-  HeatLamp(const std::string &name, uint8_t pin, float onTempF, float offTempF)
+  HeatLamp(const char *name, uint8_t pin, float onTempF, float offTempF)
       : Device(name), pin(pin), onAboveTempF(onTempF), offAboveTempF(offTempF) {
   }
 
@@ -44,10 +44,16 @@ public:
   }
 
   void setHeatLampTemps(float onTempF, float offTempF) {
+    if (onTempF != onAboveTempF || offTempF != offAboveTempF) {
+      markStateChanged();
+    }
     this->onAboveTempF = onTempF;
     this->offAboveTempF = offTempF;
   }
 
+  float getOnAboveTempF() const { return onAboveTempF; }
+  float getOffAboveTempF() const { return offAboveTempF; }
+
   void applyState(JsonVariantConst desired) override {
     if (desired["state"].is<JsonVariantConst>()) {
       this->setOverrideMode(true); // Manual override
@@ -72,16 +78,22 @@ public:
     }
   }
 
+  void desiredStateFilter(JsonDocument &filter) override {
+    filter["state"] = true;
+    filter["onAbove"] = true;
+    filter["offAbove"] = true;
+  }
+
   void reportState(JsonDocument &doc) override {
     doc["state"] = this->isOn();
     doc["onAbove"] = onAboveTempF;
     doc["offAbove"] = offAboveTempF;
   }
 
-  void logState(Values::MapValue &heatLampState) override {
-    heatLampState.add("state", Values::BooleanValue(this->isOn()))
-        .add("onAbove", Values::DoubleValue(this->onAboveTempF))
-        .add("offAbove", Values::DoubleValue(this->offAboveTempF));
+  void logState(JsonDocument &heatLampState) override {
+    heatLampState["state"] = this->isOn();
+    heatLampState["onAbove"] = this->onAboveTempF;
+    heatLampState["offAbove"] = this->offAboveTempF;
   }
 
 private:
@@ -5,7 +5,7 @@
 
 class Light : public Device {
 public:
-  Light(const std::string &name, uint8_t pin, TimeOfDay onTime,
+  Light(const char *name, uint8_t pin, TimeOfDay onTime,
         TimeOfDay offTime)
       : Device(name), pin(pin), onTime(onTime), offTime(offTime) {}
 
@@ -65,7 +65,16 @@ public:
     }
   }
 
+  void desiredStateFilter(JsonDocument &filter) override {
+    filter["state"] = true;
+    filter["onTime"] = true;
+    filter["offTime"] = true;
+  }
+
   void setOnOffTimes(TimeOfDay newOnTime, TimeOfDay newOffTime) {
+    if (newOnTime != onTime || newOffTime != offTime) {
+      markStateChanged();
+    }
     this->onTime = newOnTime;
     this->offTime = newOffTime;
   }
@@ -76,10 +85,10 @@ public:
     doc["offTime"] = offTime.toString();
   }
 
-  void logState(Values::MapValue &lightState) override {
-    lightState.add("state", Values::BooleanValue(this->isOn()))
-        .add("onTime", Values::StringValue(this->onTime.toString()))
-        .add("offTime", Values::StringValue(this->offTime.toString()));
+  void logState(JsonDocument &lightState) override {
+    lightState["state"] = this->isOn();
+    lightState["onTime"] = this->onTime.toString();
+    lightState["offTime"] = this->offTime.toString();
   }
 
 private:
@@ -0,0 +1,10 @@
+#pragma once
+// Host stand-in for the AHT20 driver, readings come from
+// nativeHal::setAht20Reading(), see NativeHal.h
+#include "Adafruit_Sensor.h"
+
+class Adafruit_AHTX0 {
+public:
+  bool begin();
+  bool getEvent(sensors_event_t *humidity, sensors_event_t *temperature);
+};
@@ -0,0 +1,15 @@
+#pragma once
+// Host stand-in for the MLX90614 driver, readings come from
+// nativeHal::setMlx90614Reading(), see NativeHal.h
+
+class Adafruit_MLX90614 {
+public:
+  bool begin();
+  void writeEmissivity(double value) { emissivity = value; }
+  double readEmissivity() { return emissivity; }
+  double readObjectTempF();
+  double readAmbientTempF();
+
+private:
+  double emissivity = 1.0;
+};
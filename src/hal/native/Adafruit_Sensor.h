@@ -0,0 +1,7 @@
+#pragma once
+// The fields of Adafruit's unified sensor event the firmware reads
+
+struct sensors_event_t {
+  float temperature = 0;       // Celsius
+  float relative_humidity = 0; // Percent
+};
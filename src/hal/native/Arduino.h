@@ -0,0 +1,123 @@
+#pragma once
+// Host stand-in for the parts of the Arduino core the firmware uses, so
+// device and protocol code builds in the native environment. Only what the
+// code actually calls is here, see NativeHal.h for the controls tests and
+// benchmarks use to drive it.
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <math.h>
+#include <string>
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+
+#define constrain(amt, low, high)                                              \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
+
+// Just enough of Arduino's String for the firmware and for ArduinoJson's
+// String support (ARDUINOJSON_ENABLE_ARDUINO_STRING)
+class String {
+public:
+  String() = default;
+  String(const char *value) : value(value ? value : "") {}
+  String(const std::string &value) : value(value) {}
+  explicit String(int number) : value(std::to_string(number)) {}
+
+  String &operator=(const char *other) {
+    value = other ? other : "";
+    return *this;
+  }
+  bool concat(const char *other) { return concat(other, strlen(other)); }
+  bool concat(const char *other, size_t length) {
+    value.append(other, length);
+    return true;
+  }
+  bool concat(char c) {
+    value.push_back(c);
+    return true;
+  }
+  String &operator+=(const char *other) {
+    concat(other);
+    return *this;
+  }
+  String &operator+=(const String &other) {
+    value += other.value;
+    return *this;
+  }
+  bool operator==(const char *other) const { return value == other; }
+  bool operator==(const String &other) const { return value == other.value; }
+
+  const char *c_str() const { return value.c_str(); }
+  unsigned int length() const { return value.size(); }
+  int indexOf(char c) const {
+    size_t index = value.find(c);
+    return index == std::string::npos ? -1 : int(index);
+  }
+  String substring(unsigned int from) const {
+    return from < value.size() ? String(value.substr(from)) : String();
+  }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < value.size()
+               ? String(value.substr(from, to - from))
+               : String();
+  }
+  long toInt() const { return strtol(value.c_str(), nullptr, 10); }
+  bool startsWith(const char *prefix) const {
+    return value.compare(0, strlen(prefix), prefix) == 0;
+  }
+  bool endsWith(const char *suffix) const {
+    size_t length = strlen(suffix);
+    return value.size() >= length &&
+           value.compare(value.size() - length, length, suffix) == 0;
+  }
+
+private:
+  std::string value;
+};
+
+inline String operator+(String lhs, const char *rhs) {
+  lhs += rhs;
+  return lhs;
+}
+inline String operator+(String lhs, const String &rhs) {
+  lhs += rhs;
+  return lhs;
+}
+
+// ArduinoJson also recognizes the type Arduino uses for concatenations
+class StringSumHelper : public String {};
+
+// Serial output goes to stdout
+class HardwareSerial {
+public:
+  void begin(unsigned long) {}
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+  }
+  void print(const char *text) { fputs(text, stdout); }
+  void print(const String &text) { print(text.c_str()); }
+  void println(const char *text = "") { puts(text); }
+  void println(const String &text) { println(text.c_str()); }
+};
+extern HardwareSerial Serial;
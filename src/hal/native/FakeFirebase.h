@@ -0,0 +1,165 @@
+#pragma once
+// In-memory stand-ins for the Realtime Database and Firestore REST endpoints
+// the firmware talks to. They take the same request bodies FirebaseWrapper
+// sends (a JSON value for set, a multi-location object for update, a
+// document for create, {"writes": [...]} for a batch write) so the host can
+// measure building and applying them without a network.
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class FakeRtdb {
+public:
+  // PUT <path>.json
+  bool set(const char *path, const char *json) {
+    JsonDocument value;
+    if (!receive(json, value)) {
+      return false;
+    }
+    node(path).set(value.as<JsonVariantConst>());
+    return true;
+  }
+
+  // PATCH <path>.json with {"relative/key": value, ...}
+  bool update(const char *path, const char *json) {
+    JsonDocument body;
+    if (!receive(json, body) || !body.is<JsonObjectConst>()) {
+      return false;
+    }
+    std::string childPath;
+    for (JsonPairConst entry : body.as<JsonObjectConst>()) {
+      childPath = path;
+      childPath += '/';
+      childPath += entry.key().c_str();
+      node(childPath.c_str()).set(entry.value());
+    }
+    return true;
+  }
+
+  // Null when nothing is stored at path
+  JsonVariantConst get(const char *path) const {
+    JsonVariantConst current = root.as<JsonVariantConst>();
+    forEachSegment(path, [&](const char *segment, size_t length) {
+      current = current[std::string(segment, length)];
+    });
+    return current;
+  }
+
+  uint32_t requests() const { return requestCount; }
+  size_t bytesReceived() const { return receivedBytes; }
+  void clear() {
+    root.clear();
+    requestCount = 0;
+    receivedBytes = 0;
+  }
+
+private:
+  bool receive(const char *json, JsonDocument &doc) {
+    requestCount++;
+    receivedBytes += strlen(json);
+    return !deserializeJson(doc, json);
+  }
+
+  JsonVariant node(const char *path) {
+    JsonVariant current = root.as<JsonVariant>();
+    forEachSegment(path, [&](const char *segment, size_t length) {
+      std::string key(segment, length);
+      if (!current[key].is<JsonObject>()) {
+        current[key].to<JsonObject>();
+      }
+      current = current[key];
+    });
+    return current;
+  }
+
+  template <typename Function>
+  static void forEachSegment(const char *path, Function function) {
+    while (*path) {
+      const char *end = strchr(path, '/');
+      size_t length = end ? size_t(end - path) : strlen(path);
+      if (length > 0) {
+        function(path, length);
+      }
+      path += end ? length + 1 : length;
+    }
+  }
+
+  JsonDocument root;
+  uint32_t requestCount = 0;
+  size_t receivedBytes = 0;
+};
+
+class FakeFirestore {
+public:
+  struct Document {
+    std::string collection;
+    std::string fields; // JSON
+    // Full resource name for documents written by a batch, created ones
+    // get a generated id and leave it empty
+    std::string name;
+  };
+
+  // POST .../documents/<collection>
+  bool createDocument(const char *collection, const char *json) {
+    requestCount++;
+    receivedBytes += strlen(json);
+    JsonDocument fields;
+    if (deserializeJson(fields, json) || !fields.is<JsonObjectConst>()) {
+      return false;
+    }
+    documents.push_back({collection, json, ""});
+    return true;
+  }
+
+  // POST .../documents:batchWrite. Only update writes are supported, each
+  // replaces the document with that name or creates it.
+  bool batchWrite(const char *json) {
+    requestCount++;
+    receivedBytes += strlen(json);
+    JsonDocument body;
+    if (deserializeJson(body, json) || !body["writes"].is<JsonArrayConst>()) {
+      return false;
+    }
+    for (JsonVariantConst write : body["writes"].as<JsonArrayConst>()) {
+      const char *name = write["update"]["name"];
+      if (!name) {
+        return false;
+      }
+      Document document;
+      document.name = name;
+      const char *relative = strstr(name, "/documents/");
+      std::string path = relative ? relative + strlen("/documents/") : name;
+      document.collection = path.substr(0, path.rfind('/'));
+      serializeJson(write["update"]["fields"], document.fields);
+      upsert(document);
+    }
+    return true;
+  }
+
+  const std::vector<Document> &all() const { return documents; }
+  uint32_t requests() const { return requestCount; }
+  size_t bytesReceived() const { return receivedBytes; }
+  void clear() {
+    documents.clear();
+    requestCount = 0;
+    receivedBytes = 0;
+  }
+
+private:
+  void upsert(const Document &document) {
+    for (Document &existing : documents) {
+      if (existing.name == document.name) {
+        existing = document;
+        return;
+      }
+    }
+    documents.push_back(document);
+  }
+
+  std::vector<Document> documents;
+  uint32_t requestCount = 0;
+  size_t receivedBytes = 0;
+};
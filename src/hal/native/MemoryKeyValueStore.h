@@ -0,0 +1,42 @@
+#pragma once
+// Host stand-in for NVS, see KeyValueStore.h. Counts writes so wear can be
+// checked, e.g. that applying an unchanged state writes nothing.
+#include "../../utils/KeyValueStore.h"
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+class MemoryKeyValueStore : public KeyValueStore {
+public:
+  size_t get(const char *key, uint8_t *buffer, size_t size) override {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.empty() ||
+        it->second.size() > size) {
+      return 0;
+    }
+    memcpy(buffer, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+
+  bool put(const char *key, const uint8_t *data, size_t length) override {
+    if (strlen(key) > MAX_KEY_LENGTH) {
+      return false;
+    }
+    values[key].assign(data, data + length);
+    writeCount++;
+    return true;
+  }
+
+  bool remove(const char *key) override { return values.erase(key) > 0; }
+
+  uint32_t writes() const { return writeCount; }
+  void clear() {
+    values.clear();
+    writeCount = 0;
+  }
+
+private:
+  std::map<std::string, std::vector<uint8_t>> values;
+  uint32_t writeCount = 0;
+};
@@ -0,0 +1,110 @@
+#include "NativeHal.h"
+#include "Adafruit_AHTX0.h"
+#include "Adafruit_MLX90614.h"
+#include "Arduino.h"
+#include "esp_now.h"
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+namespace {
+using SteadyClock = std::chrono::steady_clock;
+const SteadyClock::time_point bootTime = SteadyClock::now();
+bool fakeClock = false;
+uint64_t fakeMicros = 0;
+
+time_t localTime = 1704067200; // 2024-01-01 00:00:00
+uint8_t pins[256] = {};
+
+bool sensorsPresent = true;
+float aht20TemperatureC = 22.0f;
+float aht20Humidity = 45.0f;
+double mlxObjectTempF = 75.0;
+double mlxAmbientTempF = 72.0;
+
+nativeHal::EspNowSendHook espNowHook;
+uint32_t espNowPackets = 0;
+
+uint64_t nowMicros() {
+  if (fakeClock) {
+    return fakeMicros;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             SteadyClock::now() - bootTime)
+      .count();
+}
+} // namespace
+
+namespace nativeHal {
+
+void setMillis(uint32_t ms) {
+  fakeClock = true;
+  fakeMicros = uint64_t(ms) * 1000;
+}
+void advanceMillis(uint32_t ms) {
+  fakeClock = true;
+  fakeMicros += uint64_t(ms) * 1000;
+}
+void useRealClock() { fakeClock = false; }
+
+void setLocalTime(time_t epochSec) { localTime = epochSec; }
+
+uint8_t pinState(uint8_t pin) { return pins[pin]; }
+
+void setAht20Reading(float temperatureC, float humidity) {
+  aht20TemperatureC = temperatureC;
+  aht20Humidity = humidity;
+}
+void setMlx90614Reading(double objectTempF, double ambientTempF) {
+  mlxObjectTempF = objectTempF;
+  mlxAmbientTempF = ambientTempF;
+}
+void setSensorsPresent(bool present) { sensorsPresent = present; }
+
+void setEspNowSendHook(EspNowSendHook hook) { espNowHook = std::move(hook); }
+uint32_t espNowPacketsSent() { return espNowPackets; }
+
+} // namespace nativeHal
+
+unsigned long millis() { return nowMicros() / 1000; }
+unsigned long micros() { return nowMicros(); }
+
+void delay(unsigned long ms) {
+  if (fakeClock) {
+    fakeMicros += uint64_t(ms) * 1000;
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t value) { pins[pin] = value; }
+int digitalRead(uint8_t pin) { return pins[pin]; }
+
+bool getLocalTime(struct tm *info, uint32_t) {
+  if (localTime == 0) {
+    return false;
+  }
+  localtime_r(&localTime, info);
+  return true;
+}
+
+esp_err_t esp_now_send(const uint8_t *peerAddress, const uint8_t *data,
+                       size_t length) {
+  espNowPackets++;
+  return espNowHook ? espNowHook(peerAddress, data, length) : ESP_OK;
+}
+
+bool Adafruit_AHTX0::begin() { return sensorsPresent; }
+
+bool Adafruit_AHTX0::getEvent(sensors_event_t *humidity,
+                              sensors_event_t *temperature) {
+  humidity->relative_humidity = aht20Humidity;
+  temperature->temperature = aht20TemperatureC;
+  return true;
+}
+
+bool Adafruit_MLX90614::begin() { return sensorsPresent; }
+double Adafruit_MLX90614::readObjectTempF() { return mlxObjectTempF; }
+double Adafruit_MLX90614::readAmbientTempF() { return mlxAmbientTempF; }
@@ -0,0 +1,36 @@
+#pragma once
+// Controls for the host stand-ins in this directory. Everything starts out
+// behaving like a quiet, healthy board: the clock follows real time, pins
+// read back what was written, sensors return room temperature and every
+// ESP-NOW send succeeds.
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+
+namespace nativeHal {
+
+// Clock. Once setMillis() has been called the clock only moves through
+// setMillis() and advanceMillis(), useRealClock() switches back.
+void setMillis(uint32_t ms);
+void advanceMillis(uint32_t ms);
+void useRealClock();
+
+// Time returned by getLocalTime(), 0 makes it fail like before NTP sync
+void setLocalTime(time_t epochSec);
+
+uint8_t pinState(uint8_t pin);
+
+// I2C sensors, NaN makes a read fail
+void setAht20Reading(float temperatureC, float humidity);
+void setMlx90614Reading(double objectTempF, double ambientTempF);
+void setSensorsPresent(bool present); // begin() fails when false
+
+// ESP-NOW. The hook sees every packet and decides what esp_now_send()
+// returns, without one packets are counted and dropped.
+using EspNowSendHook =
+    std::function<int(const uint8_t *peer, const uint8_t *data, size_t)>;
+void setEspNowSendHook(EspNowSendHook hook);
+uint32_t espNowPacketsSent();
+
+} // namespace nativeHal
@@ -0,0 +1,17 @@
+#pragma once
+// Host stand-in for ESP-NOW sending. Packets go to the hook set with
+// nativeHal::setEspNowSendHook(), see NativeHal.h.
+#include <cstddef>
+#include <cstdint>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef enum {
+  ESP_NOW_SEND_SUCCESS = 0,
+  ESP_NOW_SEND_FAIL,
+} esp_now_send_status_t;
+
+esp_err_t esp_now_send(const uint8_t *peerAddress, const uint8_t *data,
+                       size_t length);
@@ -1,4 +1,5 @@
 #include "devices/CameraDevice.h"
+#include "devices/DeviceStateStore.h"
 #include "esp_log.h"
 #include "utils/firebase/FirebaseWrapper.h"
 #include <Arduino.h>
@@ -6,6 +7,11 @@
 #include <devices/Light.h>
 #include <sensors/AHT20.h>
 #include <sensors/MLX90614.h>
+#include <sensors/SensorHistory.h>
+#include <sensors/SensorPublishPolicy.h>
+#include <utils/Instrumentation.h>
+#include <utils/NvsKeyValueStore.h>
+#include <utils/TaskScheduler.h>
 #include <utils/TimeOfDay.h>
 #include <utils/WiFiHelper.h>
 
@@ -20,8 +26,16 @@
 // Firebase setup using FirebaseClient class wrapper
 FirebaseWrapper firebaseApp(FIREBASE_WEB_API_KEY, FIREBASE_USER_EMAIL,
                             FIREBASE_USER_PASSWORD, FIREBASE_DATABASE_URL);
-// Base path for all data in Firebase
-String BASE_PATH = FirebaseWrapper::getBaseDatabasePath();
+// Fixed paths written every tick, built at compile time
+constexpr FirebasePath STATUS_TIME_PATH = FIREBASE_PATH("/status/time");
+constexpr FirebasePath AHT20_TEMPERATURE_PATH =
+    FIREBASE_PATH("/sensors/AHT20/reported/temperature");
+constexpr FirebasePath AHT20_HUMIDITY_PATH =
+    FIREBASE_PATH("/sensors/AHT20/reported/humidity");
+constexpr FirebasePath MLX_AMBIENT_TEMP_PATH =
+    FIREBASE_PATH("/sensors/MLX90614/reported/ambientTempF");
+constexpr FirebasePath MLX_OBJECT_TEMP_PATH =
+    FIREBASE_PATH("/sensors/MLX90614/reported/objectTempF");
 
 // Pin definitions
 constexpr uint8_t HEAT_LAMP_PIN = 0; // Pin for heat lamp relay
@@ -36,6 +50,10 @@ HeatLamp heatLamp("heatLamp", HEAT_LAMP_PIN, HEAT_LAMP_ON_ABOVE_TEMP_F,
                   HEAT_LAMP_OFF_ABOVE_TEMP_F);
 Light roomLight("lights", LIGHT_PIN, TimeOfDay(0, 0),
                 TimeOfDay(23, 59)); // Lights on from 7:30AM to 8PM
+// Last applied desired state of every device, restored at boot so the
+// constants above only apply on a board that never got one
+NvsKeyValueStore deviceStateNvs("deviceState");
+DeviceStateStore deviceStates(deviceStateNvs);
 
 // Sensor instances
 // Adjusted for grout surface of tanks
@@ -44,39 +62,145 @@ constexpr double MLX90614_EMISSIVITY = 0.94;
 MLX90614 mlxSensor(MLX90614_EMISSIVITY);
 AHT20 aht20Sensor;
 
+// Upload policies, readings inside the deadband are held back until the
+// max interval so a stable enclosure mostly sends heartbeats
+const SensorPublishConfig TEMPERATURE_PUBLISH_CONFIG = {0.3f, 0.0f, 5000,
+                                                        300000};
+const SensorPublishConfig HUMIDITY_PUBLISH_CONFIG = {1.0f, 0.0f, 5000, 300000};
+// Steady state history goes up hourly from SensorHistory, individual
+// Firestore events are only logged for significant moves
+const SensorPublishConfig TEMPERATURE_LOG_CONFIG = {0.5f, 0.0f, 60000, 0};
+const SensorPublishConfig HUMIDITY_LOG_CONFIG = {2.0f, 0.0f, 60000, 0};
+
+SensorPublishPolicy aht20TemperaturePolicy(TEMPERATURE_PUBLISH_CONFIG);
+SensorPublishPolicy aht20HumidityPolicy(HUMIDITY_PUBLISH_CONFIG);
+SensorPublishPolicy mlxObjectTempPolicy(TEMPERATURE_PUBLISH_CONFIG);
+SensorPublishPolicy mlxAmbientTempPolicy(TEMPERATURE_PUBLISH_CONFIG);
+SensorPublishPolicy aht20TemperatureLogPolicy(TEMPERATURE_LOG_CONFIG);
+SensorPublishPolicy aht20HumidityLogPolicy(HUMIDITY_LOG_CONFIG);
+SensorPublishPolicy mlxObjectTempLogPolicy(TEMPERATURE_LOG_CONFIG);
+SensorPublishPolicy mlxAmbientTempLogPolicy(TEMPERATURE_LOG_CONFIG);
+
+// Recent readings with 1 min / 15 min / 1 h aggregates, uploaded once per
+// hour instead of one document per reading
+SensorHistory aht20History(SENSOR_HISTORY_RESOLUTION);
+SensorHistory mlxHistory(SENSOR_HISTORY_RESOLUTION);
+uint32_t aht20LastUploadedHour = 0;
+uint32_t mlxLastUploadedHour = 0;
+// NTP time is needed to bucket history, anything before this is unsynced
+constexpr time_t MIN_VALID_EPOCH_SEC = 1700000000;
+
+void recordHistory(SensorHistory &history,
+                   const std::optional<std::tuple<float, float>> &reading,
+                   time_t epochSec) {
+  if (!reading || epochSec < MIN_VALID_EPOCH_SEC) {
+    return;
+  }
+  auto [first, second] = *reading;
+  history.add(uint32_t(epochSec), {first, second});
+}
+
+// Uploads every finished hour not sent yet. The first hour seen after boot
+// is only a baseline, a failed upload is retried on the next call.
+void uploadHistory(const char *sensorName, const SensorHistory &history,
+                   uint32_t &lastUploadedHour, const char *label1,
+                   const char *label2) {
+  if (history.empty()) {
+    return;
+  }
+  uint32_t newestSec = history.newestTimeSec();
+  uint32_t currentHour = newestSec - newestSec % 3600;
+  if (lastUploadedHour == 0) {
+    lastUploadedHour = currentHour - 3600;
+  }
+  while (lastUploadedHour + 3600 < currentHour) {
+    if (!firebaseApp.logSensorHistory(sensorName, history,
+                                      lastUploadedHour + 3600, label1,
+                                      label2)) {
+      return;
+    }
+    lastUploadedHour += 3600;
+  }
+}
+
+// Both values of a reading are logged together, so when either one is due
+// the pair is logged and both policies restart from it
+bool isLogDue(const std::optional<std::tuple<float, float>> &reading,
+              SensorPublishPolicy &firstPolicy,
+              SensorPublishPolicy &secondPolicy, unsigned long now) {
+  if (!reading) {
+    return false;
+  }
+  auto [first, second] = *reading;
+  if (!firstPolicy.isDue(first, now) && !secondPolicy.isDue(second, now)) {
+    return false;
+  }
+  firstPolicy.markPublished(first, now);
+  secondPolicy.markPublished(second, now);
+  return true;
+}
+
 // This camera device instance is used for firebase state management
 // Camera streaming is handled in camera_board_main.cpp running on the
 // camera-board
 CameraDevice camera("camera");
 
-// callback that makes sure firebase state is synced after data is sent
-// successfully to start/stop streaming camera board. This runs after esp-now
-// data is processed by camera-board
-void onDataSentToCameraBoard(const uint8_t *mac_addr,
-                             esp_now_send_status_t status) {
-  // Serial.print("\r\nLast Packet Send Status:\t");
-  bool success = (status == ESP_NOW_SEND_SUCCESS);
-  // Serial.println(success ? "Delivery Success" : "Delivery Fail");
-
-  if (success) {
-    camera.setErrorState(false);
-    // Serial.println("Setting camera state");
-    // We can now trust the command was received, so use desired state
-    if (camera.shouldBeOn()) {
-      camera.setState(true);
-    } else {
-      camera.setState(false);
-    }
-  } else {
-    // Serial.println("Failed to send camera command");
-    // TODO Have error code for firebase
+// callback for acks and telemetry from the camera board. Camera state is
+// only updated from acks, so it reflects what the camera board applied
+void onDataRecvFromCameraBoard(const uint8_t *mac, const uint8_t *incomingData,
+                               int len) {
+  if (len <= 0) {
+    return;
+  }
+  CameraAck ack;
+  CameraTelemetry telemetry;
+  if (parseCameraAck(incomingData, len, ack)) {
+    camera.onCommandAck(ack);
+  } else if (parseCameraTelemetry(incomingData, len, telemetry)) {
+    camera.onTelemetry(telemetry);
   }
 }
 
 WiFiHelper wifi;
 
+// Network users follow the connection, the control loop does not wait for it
+void onConnectivityChanged(ConnectivityEvent event) {
+  switch (event) {
+  case ConnectivityEvent::LinkUp:
+    // Also moves the camera board peer to the access point's channel
+    wifi.setupEspNow(false, onDataRecvFromCameraBoard);
+    break;
+  case ConnectivityEvent::Online:
+    firebaseApp.setNetworkAvailable(true);
+    break;
+  case ConnectivityEvent::Offline:
+    firebaseApp.setNetworkAvailable(false);
+    break;
+  default:
+    break;
+  }
+}
+
+// Runs the periodic jobs below from loop(), higher priority first
+TaskScheduler scheduler([]() -> uint32_t { return millis(); });
+constexpr uint8_t CAMERA_TASK_PRIORITY = 3;
+constexpr uint8_t CONTROL_TASK_PRIORITY = 2;
+constexpr uint8_t PUBLISH_TASK_PRIORITY = 1;
+constexpr uint8_t LOG_TASK_PRIORITY = 0;
+
+void updateCameraTask();
+void updateDevicesTask();
+void publishStatesTask();
+void readSensorsTask();
+void logSensorsTask();
+#ifdef ENABLE_INSTRUMENTATION
+void reportInstrumentationTask();
+#endif
+int devicesTaskId = TaskScheduler::INVALID_TASK;
+
 void setup() {
   Serial.begin(115200);
+  INSTRUMENT_BEGIN([]() -> uint32_t { return micros(); });
   // Enable for detailed debug output (for when the gremlins strike)
   // Serial.setDebugOutput(true);
   // esp_log_level_set("*", ESP_LOG_VERBOSE);
@@ -86,94 +210,193 @@ void setup() {
   aht20Sensor.begin();
   heatLamp.begin();
   roomLight.begin();
+  deviceStateNvs.begin();
+  deviceStates.restoreAll();
   // wifi.setFirebaseWrapper(&firebaseApp); // Set the FirebaseWrapper
-  wifi.connectAndSyncTime(true, true);
-  wifi.setupEspNow(
-      false, nullptr,
-      onDataSentToCameraBoard); // This file is uploaded to the main board
-
-  // Start firebase app with a stream path to listen for commands
-  firebaseApp.begin((BASE_PATH + String("/devices")).c_str());
-  delay(1000); // Allow time for devices to initialize
+  // Connects in the background, ESP-NOW and Firebase start from the listener
+  wifi.addListener(onConnectivityChanged);
+  wifi.begin(true, true);
+
+  // Start firebase app streaming only the desired state, so the reported
+  // state written under /devices is not sent back. It stays idle until the
+  // connection is up.
+  firebaseApp.begin(FIREBASE_DESIRED_PATH, &deviceStates);
+
+  scheduler.addPeriodic("camera", 10, updateCameraTask, CAMERA_TASK_PRIORITY);
+  devicesTaskId = scheduler.addPeriodic("devices", 1000, updateDevicesTask,
+                                        CONTROL_TASK_PRIORITY);
+  scheduler.addPeriodic("sensors", 5000, readSensorsTask,
+                        CONTROL_TASK_PRIORITY);
+  scheduler.addPeriodic("publishStates", 3000, publishStatesTask,
+                        PUBLISH_TASK_PRIORITY);
+  // Offset from the sensor read so it always sees the fresh readings
+  scheduler.addPeriodic("logSensors", 5000, logSensorsTask, LOG_TASK_PRIORITY,
+                        100);
+#ifdef ENABLE_INSTRUMENTATION
+  scheduler.addPeriodic("instrumentation", 60000, reportInstrumentationTask,
+                        LOG_TASK_PRIORITY);
+#endif
   // Serial.println("Initialization complete.!");
 }
 
-unsigned long lastDeviceLoopUpdate = 0;
-unsigned long lastPublishedStateUpdate = 0;
-unsigned long lastSensorUpdate = 0;
-unsigned long lastSensorLogUpdate = 0;
+// Latest readings, shared between the sensor and logging tasks
+std::optional<std::tuple<float, float>> aht20Reading;
+std::optional<std::tuple<float, float>> mlxReading;
 
-void loop() {
-  unsigned long now = millis();
-  wifi.maintain();    // Keep Wi-Fi alive and handle OTA updates
-  firebaseApp.loop(); // Process Firebase app tasks
-  // Process camera state changes if any -> Done as fast as possible for esp-now
-  camera.update();
+// Process camera state changes if any -> Done as fast as possible for esp-now
+void updateCameraTask() { camera.update(); }
 
-  // Allow time to be accessed in the rest of the loop
+void updateDevicesTask() {
+  // The light schedule needs the time of day, it keeps its state until NTP
+  // answered
   struct tm timeInfo;
-  char timeBuffer[20];
-
-  // Run the rest of the periodic tasks every 1 second
-  if (now - lastDeviceLoopUpdate >= 1000) {
-    lastDeviceLoopUpdate = now;
-    roomLight.update();
-
-    // Read time from NTP
-    struct tm timeInfo;
-    char timeBuffer[20];
-    if (wifi.getLocalTimeWithDST(timeInfo)) {
-      strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", &timeInfo);
+  if (!wifi.getLocalTimeWithDST(timeInfo)) {
+    return;
+  }
+  roomLight.update();
+
+  char timeBuffer[20] = {0};
+  strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", &timeInfo);
+  firebaseApp.setValue(STATUS_TIME_PATH, timeBuffer);
+}
+
+// Publish states every 3 seconds - Seems stable compared to this in 1s loop
+void publishStatesTask() {
+  INSTRUMENT_SCOPE("publish");
+  firebaseApp.publishReportedStates();
+}
+
+void readSensorsTask() {
+  unsigned long now = millis();
+  {
+    INSTRUMENT_SCOPE("aht20");
+    aht20Reading = aht20Sensor.readData();
+  }
+  // I2C reads are slow, let the camera retries in between
+  scheduler.yield();
+  {
+    INSTRUMENT_SCOPE("mlx");
+    mlxReading = mlxSensor.readData();
+  }
+  if (!aht20Reading) {
+    INSTRUMENT_COUNT("aht20Failed");
+  }
+  if (!mlxReading) {
+    INSTRUMENT_COUNT("mlxFailed");
+  }
+
+  if (aht20Reading) {
+    auto [temperatureF, humidity] = *aht20Reading;
+    // update heat lamp state
+    heatLamp.update(temperatureF);
+
+    // Crossing a heat lamp cutoff is published right away
+    float onAbove = heatLamp.getOnAboveTempF();
+    float offAbove = heatLamp.getOffAboveTempF();
+    aht20TemperaturePolicy.setThresholds({onAbove, offAbove});
+    aht20TemperatureLogPolicy.setThresholds({onAbove, offAbove});
+
+    if (aht20TemperaturePolicy.update(temperatureF, now)) {
+      firebaseApp.setValue(AHT20_TEMPERATURE_PATH, temperatureF);
     }
-    firebaseApp.setValue((BASE_PATH + String("/status/time")).c_str(),
-                         timeBuffer);
-  }
-
-  // Publish states every 3 seconds - Seems stable compared to this in 1s loop
-  if (now - lastPublishedStateUpdate >= 3000) {
-    firebaseApp.publishReportedStates();
-    lastPublishedStateUpdate = now;
-  }
-
-  if (now - lastSensorUpdate >= 5000) {
-    lastSensorUpdate = now;
-    // Compute a fresh timestamp string for lastUpdateTime
-    struct tm sensorTimeInfo;
-    char sensorTimeBuffer[20] = {0};
-    auto aht20Reading = aht20Sensor.readData();
-    auto mlxReading = mlxSensor.readData();
-
-    if (aht20Reading) {
-      auto [temperatureF, humidity] = *aht20Reading;
-      // update heat lamp state
-      heatLamp.update(temperatureF);
-
-      firebaseApp.setValue(
-          (BASE_PATH + String("/sensors/AHT20/reported/temperature")).c_str(),
-          temperatureF);
-      firebaseApp.setValue(
-          (BASE_PATH + String("/sensors/AHT20/reported/humidity")).c_str(),
-          humidity);
+    if (aht20HumidityPolicy.update(humidity, now)) {
+      firebaseApp.setValue(AHT20_HUMIDITY_PATH, humidity);
     }
-    if (mlxReading) {
-      auto [objectTemp, ambientTemp] = *mlxReading;
-      firebaseApp.setValue(
-          (BASE_PATH + String("/sensors/MLX90614/reported/ambientTempF"))
-              .c_str(),
-          ambientTemp);
-      firebaseApp.setValue(
-          (BASE_PATH + String("/sensors/MLX90614/reported/objectTempF"))
-              .c_str(),
-          objectTemp);
+  }
+  if (mlxReading) {
+    auto [objectTemp, ambientTemp] = *mlxReading;
+    if (mlxAmbientTempPolicy.update(ambientTemp, now)) {
+      firebaseApp.setValue(MLX_AMBIENT_TEMP_PATH, ambientTemp);
     }
-
-    // Log sensor data every minute
-    if (now - lastSensorLogUpdate >= 60000) {
-      firebaseApp.logSensorEvent("MLX90614", mlxReading, "objectTempF",
-                                 "ambientTempF");
-      firebaseApp.logSensorEvent("AHT20", aht20Reading, "temperatureF",
-                                 "humidity");
-      lastSensorLogUpdate = now;
+    if (mlxObjectTempPolicy.update(objectTemp, now)) {
+      firebaseApp.setValue(MLX_OBJECT_TEMP_PATH, objectTemp);
     }
   }
+}
+
+// History and Firestore logging, runs after each sensor read
+void logSensorsTask() {
+  // History is kept by wall clock hour
+  if (!wifi.isTimeSynced()) {
+    return;
+  }
+  unsigned long now = millis();
+  time_t epochSec = time(nullptr);
+  recordHistory(aht20History, aht20Reading, epochSec);
+  recordHistory(mlxHistory, mlxReading, epochSec);
+  uploadHistory("AHT20", aht20History, aht20LastUploadedHour, "temperatureF",
+                "humidity");
+  uploadHistory("MLX90614", mlxHistory, mlxLastUploadedHour, "objectTempF",
+                "ambientTempF");
+
+  // Log sensor events when a value moved enough, at most once a minute
+  if (isLogDue(mlxReading, mlxObjectTempLogPolicy, mlxAmbientTempLogPolicy,
+               now)) {
+    firebaseApp.logSensorEvent("MLX90614", mlxReading, "objectTempF",
+                               "ambientTempF");
+  }
+  if (isLogDue(aht20Reading, aht20TemperatureLogPolicy, aht20HumidityLogPolicy,
+               now)) {
+    firebaseApp.logSensorEvent("AHT20", aht20Reading, "temperatureF",
+                               "humidity");
+  }
+}
+
+#ifdef ENABLE_INSTRUMENTATION
+constexpr FirebasePath INSTRUMENTATION_PATH =
+    FIREBASE_PATH("/status/instrumentation");
+
+// Hot path timings since the last report, printed to serial and written to
+// the database as one document, see Instrumentation::report()
+void reportInstrumentationTask() {
+  JsonDocument doc;
+  Instrumentation::get().report(doc.to<JsonObject>());
+  // How often the 1 s control tick was late: skipped periods, overruns and
+  // the worst start delay in ms, counted since boot
+  const ScheduledTaskStats *tick = scheduler.stats(devicesTaskId);
+  if (tick) {
+    JsonArray values = doc["tick"].to<JsonArray>();
+    values.add(tick->skippedPeriods);
+    values.add(tick->overruns);
+    values.add(tick->maxJitterMs);
+  }
+  // Firebase TLS handshakes since boot: count, failures, average and worst
+  // duration in ms, and the heap the open connections hold
+  const TlsStats &tls = firebaseApp.getTlsStats();
+  JsonArray tlsValues = doc["tls"].to<JsonArray>();
+  tlsValues.add(tls.handshakes.load());
+  tlsValues.add(tls.failures.load());
+  tlsValues.add(tls.averageHandshakeMs());
+  tlsValues.add(tls.maxHandshakeMs.load());
+  tlsValues.add(tls.residentBytes.load());
+  // Writes that never reached the database since boot: commands dropped on a
+  // full queue, reported states too big for a command and log events refused
+  // on a full spool
+  JsonArray lostValues = doc["firebaseLost"].to<JsonArray>();
+  lostValues.add(firebaseApp.getDroppedCommands());
+  lostValues.add(firebaseApp.getOversizedReports());
+  lostValues.add(firebaseApp.getRefusedLogRecords());
+  serializeJson(doc, Serial);
+  Serial.println();
+  firebaseApp.setValue(INSTRUMENTATION_PATH, doc.as<JsonVariantConst>());
+  Instrumentation::get().reset();
+}
+#endif
+
+void loop() {
+  INSTRUMENT_SCOPE("loop");
+  INSTRUMENT_HEAP(ESP.getFreeHeap());
+  {
+    INSTRUMENT_SCOPE("wifi");
+    wifi.maintain(); // Keep Wi-Fi alive and handle OTA updates
+  }
+  {
+    INSTRUMENT_SCOPE("firebase");
+    firebaseApp.loop(); // Apply desired state received by the network task
+  }
+  scheduler.run();
+
+  // Send everything written this tick as one multi-location update
+  INSTRUMENT_SCOPE("flush");
+  firebaseApp.flushWrites();
 }
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+#include "../utils/TimeSeriesBuffer.h"
+
+// History for the two-value sensors: one hour of raw readings at the 5 s
+// sensor period, stored to 0.01 of a unit (degrees F, %RH)
+constexpr size_t SENSOR_HISTORY_SAMPLES = 720;
+constexpr float SENSOR_HISTORY_RESOLUTION = 0.01f;
+using SensorHistory = TimeSeriesBuffer<2, SENSOR_HISTORY_SAMPLES>;
@@ -0,0 +1,103 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+struct SensorPublishConfig {
+  // A change has to be at least this big to be published, whichever of the
+  // two is larger applies
+  float absoluteDeadband = 0.0f;
+  float relativeDeadband = 0.0f; // Fraction of the last published value
+  // Changes inside the deadband are never sent more often than minIntervalMs,
+  // and the value is refreshed at least every maxIntervalMs (0 = never)
+  uint32_t minIntervalMs = 0;
+  uint32_t maxIntervalMs = 0;
+};
+
+// Decides when one sensor value is worth uploading. Values that cross one of
+// the thresholds (e.g. a heat lamp cutoff) are published straight away, even
+// inside the minimum interval, so the dashboard sees what the devices react
+// to. No Arduino dependencies, time is passed in by the caller.
+class SensorPublishPolicy {
+public:
+  static constexpr size_t MAX_THRESHOLDS = 4;
+
+  SensorPublishPolicy() = default;
+  explicit SensorPublishPolicy(const SensorPublishConfig &config)
+      : cfg(config) {}
+
+  void configure(const SensorPublishConfig &config) { cfg = config; }
+  const SensorPublishConfig &config() const { return cfg; }
+
+  // Replaces the thresholds, extra values past MAX_THRESHOLDS are ignored
+  void setThresholds(std::initializer_list<float> values) {
+    thresholdCount = 0;
+    for (float value : values) {
+      if (thresholdCount == MAX_THRESHOLDS) {
+        break;
+      }
+      thresholds[thresholdCount++] = value;
+    }
+  }
+
+  // True when value should be published now. Does not record anything, call
+  // markPublished() once it has actually been sent.
+  bool isDue(float value, uint32_t nowMs) const {
+    if (std::isnan(value)) {
+      return false;
+    }
+    if (!hasPublished) {
+      return true;
+    }
+    if (crossesThreshold(value)) {
+      return true;
+    }
+    uint32_t elapsedMs = nowMs - lastPublishedMs;
+    if (cfg.maxIntervalMs && elapsedMs >= cfg.maxIntervalMs) {
+      return true;
+    }
+    if (elapsedMs < cfg.minIntervalMs) {
+      return false;
+    }
+    float deadband = std::fmax(cfg.absoluteDeadband,
+                               cfg.relativeDeadband * std::fabs(lastValue));
+    float change = std::fabs(value - lastValue);
+    return deadband > 0.0f ? change >= deadband : change > 0.0f;
+  }
+
+  void markPublished(float value, uint32_t nowMs) {
+    hasPublished = true;
+    lastValue = value;
+    lastPublishedMs = nowMs;
+  }
+
+  // isDue() and markPublished() in one step
+  bool update(float value, uint32_t nowMs) {
+    if (!isDue(value, nowMs)) {
+      return false;
+    }
+    markPublished(value, nowMs);
+    return true;
+  }
+
+  bool hasValue() const { return hasPublished; }
+  float lastPublishedValue() const { return lastValue; }
+
+private:
+  bool crossesThreshold(float value) const {
+    for (size_t i = 0; i < thresholdCount; i++) {
+      if ((lastValue < thresholds[i]) != (value < thresholds[i])) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  SensorPublishConfig cfg;
+  float thresholds[MAX_THRESHOLDS] = {};
+  size_t thresholdCount = 0;
+  bool hasPublished = false;
+  float lastValue = 0.0f;
+  uint32_t lastPublishedMs = 0;
+};
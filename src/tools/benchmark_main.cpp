@@ -0,0 +1,540 @@
+//**************
+// Host benchmarks for the main board's hot paths. Builds with
+// `pio run -e native` and runs from .pio/build/native/program. The device,
+// protocol and instrumentation code is the firmware's own, compiled against
+// the stand-ins in src/hal/native.
+//
+// Each benchmark is calibrated until one run takes at least --min-ms, then
+// the best of --runs runs is reported in nanoseconds per operation. Results
+// can be saved and later compared, the program exits with 1 when anything
+// got slower than the saved baseline by more than --tolerance percent.
+//
+//   program
+//   program --filter applyState --runs 5
+//   program --save baseline.txt
+//   program --compare baseline.txt --tolerance 15
+//***** */
+// Left out of `pio test` builds, the test runners bring their own main()
+#ifndef PIO_UNIT_TESTING
+#include "../devices/CameraDevice.h"
+#include "../devices/Device.h"
+#include "../devices/DeviceStateStore.h"
+#include "../devices/HeatLamp.h"
+#include "../devices/Light.h"
+#include "../hal/native/FakeFirebase.h"
+#include "../hal/native/MemoryKeyValueStore.h"
+#include "../hal/native/NativeHal.h"
+#include "../sensors/SensorHistory.h"
+#include "../utils/ArenaAllocator.h"
+#include "../utils/Hash.h"
+#include "../utils/Instrumentation.h"
+#include "../utils/MessageTypes.h"
+#include "../utils/TimeOfDay.h"
+#include "../utils/Timestamp.h"
+#include "../utils/firebase/DesiredStreamPath.h"
+#include "../utils/firebase/FirebaseMessages.h"
+#include "../utils/firebase/FirebasePaths.h"
+#include "../utils/firebase/RtdbWriteBatch.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Keeps the compiler from dropping work whose result is never used
+template <typename T> inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+uint64_t steadyNanos() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Benchmark {
+  const char *name;
+  std::function<void(uint64_t iterations)> run;
+};
+
+struct Result {
+  std::string name;
+  double nsPerOp;
+};
+
+struct Options {
+  const char *filter = nullptr;
+  const char *savePath = nullptr;
+  const char *comparePath = nullptr;
+  double tolerancePercent = 10;
+  uint32_t minMs = 100;
+  int runs = 3;
+};
+
+// Sizes are taken from the firmware so the host measures the same work
+constexpr size_t DESIRED_STATE_ARENA_SIZE = 4096;
+constexpr size_t PATH_BUFFER_SIZE = 128;
+
+// Desired state as it arrives from the stream, with the keys the web app
+// adds that the devices never read
+const char HEAT_LAMP_DESIRED[] =
+    R"({"state":true,"onAbove":75.5,"offAbove":82,"label":"Basking lamp",)"
+    R"("icon":"lamp","order":2,"history":[74.1,74.8,75.2,75.9,76.3],)"
+    R"("ui":{"collapsed":false,"color":"#ff8800"}})";
+const char LIGHT_DESIRED[] =
+    R"({"state":false,"onTime":"08:00","offTime":"20:30","label":"UVB",)"
+    R"("icon":"sun","order":1,"schedule":{"mon":["08:00","20:30"],)"
+    R"("tue":["08:00","20:30"],"wed":["08:00","20:30"]}})";
+const char CAMERA_DESIRED[] =
+    R"({"state":true,"fps":10,"quality":12,"frameSize":"VGA",)"
+    R"("targetKbps":800,"label":"Tank cam","order":3,)"
+    R"("ui":{"overlay":true,"zoom":1.5}})";
+
+HeatLamp heatLamp("heatLamp", 4, 75, 82);
+Light light("lights", 5, TimeOfDay(8, 0), TimeOfDay(20, 30));
+CameraDevice camera("camera");
+
+uint32_t hostMicros() { return uint32_t(steadyNanos() / 1000); }
+
+// Parses like FirebaseWrapper::applyDesiredState()
+void applyFiltered(Device &device, const char *json,
+                   ArenaAllocator<DESIRED_STATE_ARENA_SIZE> &arena) {
+  JsonDocument filter(&arena);
+  device.desiredStateFilter(filter);
+  JsonDocument doc(&arena);
+  if (!deserializeJson(doc, json, DeserializationOption::Filter(filter))) {
+    device.applyState(doc.as<JsonVariantConst>());
+  }
+}
+
+// Parses everything on the heap, the way it was done before the filter
+void applyUnfiltered(Device &device, const char *json) {
+  JsonDocument doc;
+  if (!deserializeJson(doc, json)) {
+    device.applyState(doc.as<JsonVariantConst>());
+  }
+}
+
+// Stores the filtered desired state of every device, like applying the
+// cloud snapshot does
+void saveDesiredStates(DeviceStateStore &states) {
+  static const struct {
+    Device *device;
+    const char *json;
+  } desiredStates[] = {
+      {&heatLamp, HEAT_LAMP_DESIRED},
+      {&light, LIGHT_DESIRED},
+      {&camera, CAMERA_DESIRED},
+  };
+  for (const auto &item : desiredStates) {
+    JsonDocument filter;
+    item.device->desiredStateFilter(filter);
+    JsonDocument doc;
+    deserializeJson(doc, item.json, DeserializationOption::Filter(filter));
+    states.update(*item.device, doc.as<JsonVariantConst>());
+  }
+}
+
+std::vector<Benchmark> makeBenchmarks() {
+  static ArenaAllocator<DESIRED_STATE_ARENA_SIZE> arena;
+  std::vector<Benchmark> benchmarks;
+
+  struct DeviceCase {
+    const char *filtered;
+    const char *heap;
+    Device *device;
+    const char *json;
+  };
+  static const DeviceCase deviceCases[] = {
+      {"applyState/heatLamp/filtered", "applyState/heatLamp/heap", &heatLamp,
+       HEAT_LAMP_DESIRED},
+      {"applyState/light/filtered", "applyState/light/heap", &light,
+       LIGHT_DESIRED},
+      {"applyState/camera/filtered", "applyState/camera/heap", &camera,
+       CAMERA_DESIRED},
+  };
+  for (const DeviceCase &item : deviceCases) {
+    benchmarks.push_back({item.filtered, [item](uint64_t iterations) {
+                            for (uint64_t i = 0; i < iterations; i++) {
+                              applyFiltered(*item.device, item.json, arena);
+                            }
+                          }});
+    benchmarks.push_back({item.heap, [item](uint64_t iterations) {
+                            for (uint64_t i = 0; i < iterations; i++) {
+                              applyUnfiltered(*item.device, item.json);
+                            }
+                          }});
+  }
+
+  // Builds, serializes and fingerprints every device like the publisher
+  benchmarks.push_back({"reportState/all", [](uint64_t iterations) {
+                          char buffer[512];
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            for (const auto &[name, device] :
+                                 Device::getAllDevices()) {
+                              JsonDocument doc;
+                              device->reportState(doc);
+                              Fnv1aWriter hash;
+                              serializeJson(doc, hash);
+                              size_t length =
+                                  serializeJson(doc, buffer, sizeof(buffer));
+                              doNotOptimize(hash.value());
+                              doNotOptimize(length);
+                            }
+                          }
+                        }});
+
+  benchmarks.push_back(
+      {"path/string", [](uint64_t iterations) {
+         for (uint64_t i = 0; i < iterations; i++) {
+           String path = String(FIREBASE_BASE_PATH) + "/devices/" +
+                         heatLamp.getName() + "/reported";
+           doNotOptimize(path);
+         }
+       }});
+  benchmarks.push_back({"path/snprintf", [](uint64_t iterations) {
+                          char path[PATH_BUFFER_SIZE];
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            snprintf(path, sizeof(path),
+                                     FIREBASE_BASE_PATH "/devices/%s/reported",
+                                     heatLamp.getName());
+                            doNotOptimize(path);
+                          }
+                        }});
+  benchmarks.push_back({"path/fixed", [](uint64_t iterations) {
+                          char path[PATH_BUFFER_SIZE];
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            FirebasePath fixed = FIREBASE_PATH("/status/time");
+                            doNotOptimize(fixed);
+                            memcpy(path, fixed.value, fixed.length + 1);
+                            doNotOptimize(path);
+                          }
+                        }});
+
+  benchmarks.push_back({"time/formatTimestamp", [](uint64_t iterations) {
+                          char buffer[32];
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            size_t length = formatTimestamp(
+                                buffer, sizeof(buffer), 1704067200 + i, 500);
+                            doNotOptimize(length);
+                          }
+                        }});
+  benchmarks.push_back({"time/timeOfDayToString", [](uint64_t iterations) {
+                          TimeOfDay time(8, 30);
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            String text = time.toString();
+                            doNotOptimize(text);
+                          }
+                        }});
+  benchmarks.push_back({"time/timeOfDayFromString", [](uint64_t iterations) {
+                          String text("20:30");
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            TimeOfDay time = TimeOfDay::fromString(text);
+                            doNotOptimize(time);
+                          }
+                        }});
+
+  // Registry against the std::map keyed on std::string it replaced, looked
+  // up with names from the stream like the wrapper does
+  static const char *const lookupNames[] = {"heatLamp", "lights", "camera",
+                                            "missing"};
+  benchmarks.push_back({"registry/find", [](uint64_t iterations) {
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            Device *device =
+                                Device::getDevice(lookupNames[i & 3]);
+                            doNotOptimize(device);
+                          }
+                        }});
+  benchmarks.push_back({"registry/stdMap", [](uint64_t iterations) {
+                          static std::map<std::string, Device *> devices = {
+                              {"heatLamp", &heatLamp},
+                              {"lights", &light},
+                              {"camera", &camera}};
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            auto it = devices.find(lookupNames[i & 3]);
+                            Device *device =
+                                it == devices.end() ? nullptr : it->second;
+                            doNotOptimize(device);
+                          }
+                        }});
+
+  // Boot restore of every device, and the snapshot after a reconnect that
+  // matches what is stored and must not write
+  benchmarks.push_back({"deviceState/restoreAll", [](uint64_t iterations) {
+                          static MemoryKeyValueStore nvs;
+                          static DeviceStateStore states(nvs);
+                          static bool saved = false;
+                          if (!saved) {
+                            saveDesiredStates(states);
+                            saved = true;
+                          }
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            size_t restored = states.restoreAll();
+                            doNotOptimize(restored);
+                          }
+                        }});
+  benchmarks.push_back(
+      {"deviceState/unchangedUpdate", [](uint64_t iterations) {
+         static MemoryKeyValueStore nvs;
+         static DeviceStateStore states(nvs);
+         JsonDocument desired;
+         deserializeJson(desired, HEAT_LAMP_DESIRED);
+         states.update(heatLamp, desired.as<JsonVariantConst>());
+         for (uint64_t i = 0; i < iterations; i++) {
+           bool changed =
+               states.update(heatLamp, desired.as<JsonVariantConst>());
+           doNotOptimize(changed);
+         }
+       }});
+
+  // Every stream event is classified by path before its payload is touched
+  static const char *const streamPaths[] = {"/", "/heatLamp", "/camera/fps",
+                                            "/lights"};
+  benchmarks.push_back(
+      {"stream/classifyPath", [](uint64_t iterations) {
+         char name[FIREBASE_DEVICE_NAME_SIZE];
+         char field[FIREBASE_FIELD_PATH_SIZE];
+         for (uint64_t i = 0; i < iterations; i++) {
+           DesiredStreamPath kind =
+               classifyDesiredStreamPath("put", streamPaths[i & 3], name,
+                                         sizeof(name), field, sizeof(field));
+           doNotOptimize(kind);
+         }
+       }});
+
+  // One loop tick's worth of writes, sent as a single multi-location update
+  benchmarks.push_back(
+      {"rtdb/batchedUpdate", [](uint64_t iterations) {
+         static FakeRtdb rtdb;
+         RtdbWriteBatch batch(FIREBASE_BASE_PATH);
+         std::string body;
+         for (uint64_t i = 0; i < iterations; i++) {
+           batch.add(FIREBASE_BASE_PATH "/status/time", "2024-01-01T00:00:00Z");
+           batch.add(FIREBASE_BASE_PATH "/sensors/temperature", 78.4);
+           batch.add(FIREBASE_BASE_PATH "/sensors/humidity", 61.2);
+           batch.add(FIREBASE_BASE_PATH "/sensors/baskingTemp", 94.7);
+           body.clear();
+           batch.serialize(body);
+           rtdb.update(batch.path().c_str(), body.c_str());
+           batch.clear();
+         }
+         rtdb.clear();
+       }});
+
+  // One reading per sensor period into a full history, and the hourly
+  // upload's summary of the last hour of minutes
+  benchmarks.push_back({"history/add", [](uint64_t iterations) {
+                          static SensorHistory history(
+                              SENSOR_HISTORY_RESOLUTION);
+                          static uint32_t timeSec = 1704067200;
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            timeSec += 5;
+                            bool added = history.add(
+                                timeSec, {78.0f + (i & 15) * 0.1f, 61.2f});
+                            doNotOptimize(added);
+                          }
+                        }});
+  benchmarks.push_back(
+      {"history/summarizeHour", [](uint64_t iterations) {
+         static SensorHistory history(SENSOR_HISTORY_RESOLUTION);
+         if (history.empty()) {
+           for (uint32_t t = 0; t < 2 * 3600; t += 5) {
+             history.add(1704067200 + t, {78.0f + (t % 80) * 0.01f, 61.2f});
+           }
+         }
+         uint32_t newestSec = history.newestTimeSec();
+         uint32_t hourStartSec = newestSec - newestSec % 3600 - 3600;
+         for (uint64_t i = 0; i < iterations; i++) {
+           SensorHistory::Aggregate hour = history.summarize(
+               TimeSeriesLevel::Minute, hourStartSec, hourStartSec + 3600);
+           doNotOptimize(hour);
+         }
+       }});
+
+  benchmarks.push_back(
+      {"camera/commandRoundTrip", [](uint64_t iterations) {
+         CameraCommand command = {};
+         command.fields = CAMERA_FIELDS_ALL;
+         command.streaming = 1;
+         command.fps = 10;
+         command.quality = 12;
+         command.frameSizeLevel = 2;
+         command.targetKbps = 800;
+         CameraCommand parsed;
+         for (uint64_t i = 0; i < iterations; i++) {
+           initCameraMessageHeader(command.header, CameraMessageType::Command,
+                                   uint16_t(i));
+           bool ok = parseCameraCommand(reinterpret_cast<uint8_t *>(&command),
+                                        sizeof(command), parsed) &&
+                     invalidCameraCommandFields(
+                         parsed, STREAM_FRAME_SIZE_COUNT) == 0;
+           doNotOptimize(ok);
+         }
+       }});
+  benchmarks.push_back(
+      {"camera/telemetryParse", [](uint64_t iterations) {
+         CameraTelemetry telemetry = {};
+         initCameraMessageHeader(telemetry.header, CameraMessageType::Telemetry,
+                                 1);
+         CameraTelemetry parsed;
+         for (uint64_t i = 0; i < iterations; i++) {
+           bool ok = parseCameraTelemetry(
+               reinterpret_cast<uint8_t *>(&telemetry), sizeof(telemetry),
+               parsed);
+           doNotOptimize(ok);
+         }
+       }});
+
+  benchmarks.push_back({"instrumentation/scopedTimer", [](uint64_t iterations) {
+                          Instrumentation::get().begin(hostMicros);
+                          int probe = Instrumentation::get().timer("bench");
+                          for (uint64_t i = 0; i < iterations; i++) {
+                            ScopedTimer timer(probe);
+                          }
+                          Instrumentation::get().reset();
+                        }});
+  return benchmarks;
+}
+
+double measure(const Benchmark &benchmark, const Options &opts) {
+  uint64_t minNanos = uint64_t(opts.minMs) * 1000000;
+  uint64_t iterations = 1;
+  uint64_t elapsed = 0;
+  // Grow until one run is long enough to trust the clock
+  for (;;) {
+    uint64_t start = steadyNanos();
+    benchmark.run(iterations);
+    elapsed = steadyNanos() - start;
+    if (elapsed >= minNanos || iterations >= (uint64_t(1) << 40)) {
+      break;
+    }
+    uint64_t scale = elapsed > 0 ? minNanos * 12 / 10 / elapsed : 100;
+    iterations *= scale < 2 ? 2 : scale > 100 ? 100 : scale;
+  }
+  double best = double(elapsed) / iterations;
+  for (int run = 1; run < opts.runs; run++) {
+    uint64_t start = steadyNanos();
+    benchmark.run(iterations);
+    double nsPerOp = double(steadyNanos() - start) / iterations;
+    if (nsPerOp < best) {
+      best = nsPerOp;
+    }
+  }
+  return best;
+}
+
+// One "name nsPerOp" line per benchmark
+bool saveResults(const char *path, const std::vector<Result> &results) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+  for (const Result &result : results) {
+    fprintf(file, "%s %.3f\n", result.name.c_str(), result.nsPerOp);
+  }
+  return fclose(file) == 0;
+}
+
+bool loadResults(const char *path, std::map<std::string, double> &results) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  char name[128];
+  double nsPerOp;
+  while (fscanf(file, "%127s %lf", name, &nsPerOp) == 2) {
+    results[name] = nsPerOp;
+  }
+  fclose(file);
+  return true;
+}
+
+void printUsage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--filter text] [--min-ms n] [--runs n]\n"
+          "          [--save file] [--compare file] [--tolerance percent]\n",
+          program);
+}
+
+bool parseOptions(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--filter" && hasValue) {
+      opts.filter = argv[++i];
+    } else if (arg == "--min-ms" && hasValue) {
+      opts.minMs = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--runs" && hasValue) {
+      opts.runs = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--save" && hasValue) {
+      opts.savePath = argv[++i];
+    } else if (arg == "--compare" && hasValue) {
+      opts.comparePath = argv[++i];
+    } else if (arg == "--tolerance" && hasValue) {
+      opts.tolerancePercent = atof(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseOptions(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  std::map<std::string, double> baseline;
+  if (opts.comparePath && !loadResults(opts.comparePath, baseline)) {
+    fprintf(stderr, "cannot read %s\n", opts.comparePath);
+    return 2;
+  }
+
+  // Fixed clock and a healthy camera board that takes every command
+  nativeHal::setMillis(0);
+  nativeHal::setLocalTime(1704110400); // 2024-01-01 12:00 UTC
+  heatLamp.begin();
+  light.begin();
+
+  std::vector<Result> results;
+  int regressions = 0;
+  for (const Benchmark &benchmark : makeBenchmarks()) {
+    if (opts.filter && !strstr(benchmark.name, opts.filter)) {
+      continue;
+    }
+    double nsPerOp = measure(benchmark, opts);
+    results.push_back({benchmark.name, nsPerOp});
+    printf("%-32s %12.1f ns/op", benchmark.name, nsPerOp);
+    auto previous = baseline.find(benchmark.name);
+    if (previous != baseline.end() && previous->second > 0) {
+      double change = (nsPerOp / previous->second - 1) * 100;
+      bool regressed = change > opts.tolerancePercent;
+      regressions += regressed;
+      printf("  %+6.1f%%%s", change, regressed ? "  REGRESSION" : "");
+    }
+    printf("\n");
+  }
+
+  if (opts.savePath && !saveResults(opts.savePath, results)) {
+    fprintf(stderr, "cannot write %s\n", opts.savePath);
+    return 2;
+  }
+  if (regressions > 0) {
+    printf("%d benchmark(s) slower than %s by more than %.1f%%\n",
+           regressions, opts.comparePath, opts.tolerancePercent);
+    return 1;
+  }
+  return 0;
+}
+#endif // PIO_UNIT_TESTING
@@ -0,0 +1,523 @@
+//**************
+// Reference receiver for the camera board UDP video stream. Builds on a
+// Linux/macOS host with `pio run -e video-receiver` and runs from
+// .pio/build/video-receiver/program.
+//
+// Receive mode (default): listens on VIDEO_WEB_SERVER_PORT, reassembles frames
+// (see utils/video/VideoProtocol.h), optionally appends them to an MJPEG file
+// and/or serves them as multipart MJPEG over HTTP, and prints one line of
+// stream metrics per second. A VideoReceiverReport with loss counters is sent
+// back to the stream's source once per second.
+//
+// Replay mode: reads an MJPEG file (concatenated JPEGs, e.g. one written by
+// receive mode) and sends it with the same framing the camera board uses, with
+// optional simulated loss and reordering. Running both on loopback lets
+// streaming changes be benchmarked without the camera hardware.
+//
+//   program --port 5005 --out capture.mjpeg --http 8080
+//   program --replay capture.mjpeg --to 127.0.0.1:5005 --fps 20 --loss 0.01
+//***** */
+#include "../utils/video/VideoProtocol.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr int DEFAULT_PORT = 5005; // Matches Credentials.h.template
+constexpr size_t REASSEMBLY_SLOTS = 4; // Frames in flight at once
+volatile sig_atomic_t running = 1;
+
+uint32_t steadyMillis() {
+  using namespace std::chrono;
+  return static_cast<uint32_t>(
+      duration_cast<milliseconds>(steady_clock::now().time_since_epoch())
+          .count());
+}
+
+struct Options {
+  int port = DEFAULT_PORT;
+  const char *outPath = nullptr;
+  int httpPort = 0;
+  bool sameClock = false;
+  // Replay mode
+  const char *replayPath = nullptr;
+  std::string toHost = "127.0.0.1";
+  int toPort = DEFAULT_PORT;
+  int fps = 10;
+  double loss = 0.0;
+  double reorder = 0.0;
+  int loops = 1;
+};
+
+void printUsage(const char *name) {
+  printf("Usage:\n"
+         "  %s [--port N] [--out file.mjpeg] [--http PORT] [--same-clock]\n"
+         "  %s --replay file.mjpeg [--to HOST[:PORT]] [--fps N]\n"
+         "     [--loss P] [--reorder P] [--loops N]\n"
+         "\n"
+         "--same-clock reports absolute latency, only valid when the sender\n"
+         "shares this host's steady clock (replay mode on the same machine).\n",
+         name, name);
+}
+
+bool parseOptions(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--port" && hasValue) {
+      opts.port = atoi(argv[++i]);
+    } else if (arg == "--out" && hasValue) {
+      opts.outPath = argv[++i];
+    } else if (arg == "--http" && hasValue) {
+      opts.httpPort = atoi(argv[++i]);
+    } else if (arg == "--same-clock") {
+      opts.sameClock = true;
+    } else if (arg == "--replay" && hasValue) {
+      opts.replayPath = argv[++i];
+    } else if (arg == "--to" && hasValue) {
+      std::string target = argv[++i];
+      size_t colon = target.find(':');
+      opts.toHost = target.substr(0, colon);
+      if (colon != std::string::npos) {
+        opts.toPort = atoi(target.c_str() + colon + 1);
+      }
+    } else if (arg == "--fps" && hasValue) {
+      opts.fps = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--loss" && hasValue) {
+      opts.loss = atof(argv[++i]);
+    } else if (arg == "--reorder" && hasValue) {
+      opts.reorder = atof(argv[++i]);
+    } else if (arg == "--loops" && hasValue) {
+      opts.loops = std::max(1, atoi(argv[++i]));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Multipart MJPEG over HTTP, every connected client gets every frame
+class MjpegHttpServer {
+public:
+  bool begin(int port) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+      return false;
+    }
+    int yes = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+            0 ||
+        listen(listenFd, 4) < 0) {
+      close(listenFd);
+      listenFd = -1;
+      return false;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    return true;
+  }
+
+  int fd() const { return listenFd; }
+
+  void acceptClients() {
+    int client;
+    while ((client = accept(listenFd, nullptr, nullptr)) >= 0) {
+      // Request is ignored, every path serves the stream
+      static const char header[] =
+          "HTTP/1.0 200 OK\r\n"
+          "Cache-Control: no-cache\r\n"
+          "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+      if (sendAll(client, header, sizeof(header) - 1)) {
+        clients.push_back(client);
+      } else {
+        close(client);
+      }
+    }
+  }
+
+  void sendFrame(const uint8_t *data, size_t length) {
+    char partHeader[96];
+    int headerLength = snprintf(partHeader, sizeof(partHeader),
+                                "--frame\r\nContent-Type: image/jpeg\r\n"
+                                "Content-Length: %zu\r\n\r\n",
+                                length);
+    for (auto it = clients.begin(); it != clients.end();) {
+      bool ok = sendAll(*it, partHeader, headerLength) &&
+                sendAll(*it, data, length) && sendAll(*it, "\r\n", 2);
+      if (ok) {
+        ++it;
+      } else {
+        close(*it);
+        it = clients.erase(it);
+      }
+    }
+  }
+
+private:
+  static bool sendAll(int fd, const void *data, size_t length) {
+    const char *p = static_cast<const char *>(data);
+    while (length) {
+      ssize_t sent = send(fd, p, length, MSG_NOSIGNAL);
+      if (sent <= 0) {
+        return false;
+      }
+      p += sent;
+      length -= sent;
+    }
+    return true;
+  }
+
+  int listenFd = -1;
+  std::vector<int> clients;
+};
+
+// Per-second window of stream metrics
+struct WindowStats {
+  uint32_t frames = 0;
+  uint64_t frameBytes = 0;
+  uint64_t datagramBytes = 0;
+  uint32_t datagrams = 0;
+  uint64_t latencySumMs = 0;
+  uint32_t latencyMaxMs = 0;
+  uint64_t assemblySumMs = 0;
+  uint32_t assemblyMaxMs = 0;
+};
+
+// Remembers when the first chunk of frameId was stored. Frames the
+// reassembler has evicted since never complete, so beyond its slot count
+// the oldest entry goes.
+void trackFirstChunk(std::unordered_map<uint32_t, uint32_t> &firstChunkMs,
+                     uint32_t frameId, uint32_t nowMs) {
+  if (!firstChunkMs.emplace(frameId, nowMs).second ||
+      firstChunkMs.size() <= REASSEMBLY_SLOTS) {
+    return;
+  }
+  auto oldest = firstChunkMs.begin();
+  for (auto it = firstChunkMs.begin(); it != firstChunkMs.end(); ++it) {
+    if (static_cast<int32_t>(it->first - oldest->first) < 0) {
+      oldest = it;
+    }
+  }
+  firstChunkMs.erase(oldest);
+}
+
+int runReceiver(const Options &opts) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return 1;
+  }
+  int bufferSize = 4 * 1024 * 1024;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(opts.port);
+  if (bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    perror("bind");
+    return 1;
+  }
+
+  FILE *out = nullptr;
+  if (opts.outPath) {
+    out = fopen(opts.outPath, "wb");
+    if (!out) {
+      perror("fopen");
+      return 1;
+    }
+  }
+
+  MjpegHttpServer http;
+  if (opts.httpPort && !http.begin(opts.httpPort)) {
+    perror("http server");
+    return 1;
+  }
+
+  printf("Listening for video on UDP %d%s\n", opts.port,
+         opts.httpPort ? ", serving MJPEG over HTTP" : "");
+  printf("  time  fps   KB/s  frame_KB  done  drop  dup stale  inval"
+         "  lat_avg lat_max  asm_avg asm_max\n");
+
+  VideoFrameReassembler reassembler(REASSEMBLY_SLOTS);
+  VideoFrameReassembler::Stats lastStats;
+  WindowStats window;
+  // Host arrival time of the first chunk stored for each frame in flight,
+  // never more entries than the reassembler has slots
+  std::unordered_map<uint32_t, uint32_t> firstChunkMs;
+  uint32_t senderRestarts = 0;
+  // Smallest (arrival - capture) seen so far, the best estimate of the clock
+  // offset between sender and receiver when they do not share a clock
+  bool haveOffset = false;
+  int64_t minOffsetMs = 0;
+
+  // Loss reports go back to wherever the stream comes from, the camera board
+  // uses them to adapt its bitrate
+  sockaddr_in sender{};
+  bool haveSender = false;
+
+  std::vector<uint8_t> datagram(65536);
+  uint32_t startMs = steadyMillis();
+  uint32_t windowStartMs = startMs;
+
+  while (running) {
+    pollfd fds[2] = {{sock, POLLIN, 0}, {http.fd(), POLLIN, 0}};
+    int ready = poll(fds, http.fd() >= 0 ? 2 : 1, 100);
+    if (ready > 0 && (fds[1].revents & POLLIN)) {
+      http.acceptClients();
+    }
+
+    while (ready > 0 && (fds[0].revents & POLLIN)) {
+      sockaddr_in from{};
+      socklen_t fromLength = sizeof(from);
+      ssize_t length =
+          recvfrom(sock, datagram.data(), datagram.size(), MSG_DONTWAIT,
+                   reinterpret_cast<sockaddr *>(&from), &fromLength);
+      if (length <= 0) {
+        break;
+      }
+      sender = from;
+      haveSender = true;
+      uint32_t nowMs = steadyMillis();
+      window.datagrams++;
+      window.datagramBytes += length;
+
+      auto result = reassembler.push(datagram.data(), length);
+      if (reassembler.stats().senderRestarts != senderRestarts) {
+        // The frames in flight were dropped with the old stream
+        senderRestarts = reassembler.stats().senderRestarts;
+        firstChunkMs.clear();
+      }
+      if (result == VideoFrameReassembler::PushResult::Accepted) {
+        VideoChunkHeader header;
+        parseVideoChunkHeader(datagram.data(), length, header);
+        trackFirstChunk(firstChunkMs, header.frameId, nowMs);
+      }
+      if (result != VideoFrameReassembler::PushResult::FrameComplete) {
+        continue;
+      }
+
+      const VideoChunkHeader &frame = reassembler.lastFrameHeader();
+      const uint8_t *data = reassembler.lastFrameData();
+      size_t frameLength = reassembler.lastFrameLength();
+      window.frames++;
+      window.frameBytes += frameLength;
+
+      int64_t offset = static_cast<int32_t>(nowMs - frame.captureTimeMs);
+      if (!haveOffset || offset < minOffsetMs) {
+        haveOffset = true;
+        minOffsetMs = offset;
+      }
+      uint32_t latency = static_cast<uint32_t>(
+          opts.sameClock ? std::max<int64_t>(offset, 0) : offset - minOffsetMs);
+      window.latencySumMs += latency;
+      window.latencyMaxMs = std::max(window.latencyMaxMs, latency);
+
+      // Not tracked when the completing chunk was the frame's only one
+      auto first = firstChunkMs.find(frame.frameId);
+      uint32_t assembly = first != firstChunkMs.end() ? nowMs - first->second
+                                                      : 0;
+      window.assemblySumMs += assembly;
+      window.assemblyMaxMs = std::max(window.assemblyMaxMs, assembly);
+      // Frames at or before this one are finished with either way
+      for (auto it = firstChunkMs.begin(); it != firstChunkMs.end();) {
+        if (static_cast<int32_t>(frame.frameId - it->first) >= 0) {
+          it = firstChunkMs.erase(it);
+        } else {
+          ++it;
+        }
+      }
+
+      if (out) {
+        fwrite(data, 1, frameLength, out);
+      }
+      http.sendFrame(data, frameLength);
+    }
+
+    uint32_t nowMs = steadyMillis();
+    uint32_t elapsed = nowMs - windowStartMs;
+    if (elapsed < 1000) {
+      continue;
+    }
+
+    const auto &stats = reassembler.stats();
+    if (haveSender) {
+      VideoReceiverReport report{};
+      report.magic = VIDEO_REPORT_MAGIC;
+      report.version = VIDEO_PROTOCOL_VERSION;
+      report.framesCompleted = stats.framesCompleted;
+      report.framesDropped = stats.framesDropped;
+      report.lastFrameId = reassembler.lastFrameHeader().frameId;
+      sendto(sock, &report, sizeof(report), 0,
+             reinterpret_cast<sockaddr *>(&sender), sizeof(sender));
+    }
+    double seconds = elapsed / 1000.0;
+    uint32_t frames = window.frames;
+    printf("%6.1f %4.1f %6.1f %9.1f %5u %5u %4u %5u %6u  %7.1f %7u  %7.1f "
+           "%7u\n",
+           (nowMs - startMs) / 1000.0, frames / seconds,
+           window.datagramBytes / 1024.0 / seconds,
+           frames ? window.frameBytes / 1024.0 / frames : 0.0,
+           stats.framesCompleted - lastStats.framesCompleted,
+           stats.framesDropped - lastStats.framesDropped,
+           stats.chunksDuplicate - lastStats.chunksDuplicate,
+           stats.chunksStale - lastStats.chunksStale,
+           stats.chunksInvalid - lastStats.chunksInvalid,
+           frames ? double(window.latencySumMs) / frames : 0.0,
+           window.latencyMaxMs,
+           frames ? double(window.assemblySumMs) / frames : 0.0,
+           window.assemblyMaxMs);
+    fflush(stdout);
+    if (out) {
+      fflush(out);
+    }
+    lastStats = stats;
+    window = WindowStats();
+    windowStartMs = nowMs;
+  }
+
+  const auto &stats = reassembler.stats();
+  printf("Total: %u frames complete, %u dropped, %u chunks received, "
+         "%u sender restarts\n",
+         stats.framesCompleted, stats.framesDropped, stats.chunksReceived,
+         stats.senderRestarts);
+  if (out) {
+    fclose(out);
+  }
+  close(sock);
+  return 0;
+}
+
+// Splits concatenated JPEGs on their start/end of image markers
+std::vector<std::vector<uint8_t>> loadMjpeg(const char *path) {
+  std::vector<std::vector<uint8_t>> frames;
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return frames;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + n);
+  }
+  fclose(file);
+
+  size_t start = SIZE_MAX;
+  for (size_t i = 0; i + 1 < bytes.size(); i++) {
+    if (bytes[i] != 0xFF) {
+      continue;
+    }
+    if (bytes[i + 1] == 0xD8 && start == SIZE_MAX) {
+      start = i;
+    } else if (bytes[i + 1] == 0xD9 && start != SIZE_MAX) {
+      frames.emplace_back(bytes.begin() + start, bytes.begin() + i + 2);
+      start = SIZE_MAX;
+      i++;
+    }
+  }
+  return frames;
+}
+
+int runReplay(const Options &opts) {
+  auto frames = loadMjpeg(opts.replayPath);
+  if (frames.empty()) {
+    fprintf(stderr, "No JPEG frames found in %s\n", opts.replayPath);
+    return 1;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in dest{};
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(opts.toPort);
+  if (sock < 0 ||
+      inet_pton(AF_INET, opts.toHost.c_str(), &dest.sin_addr) != 1) {
+    fprintf(stderr, "Invalid target %s\n", opts.toHost.c_str());
+    return 1;
+  }
+
+  printf("Replaying %zu frames to %s:%d at %d fps (loss %.3f, reorder %.3f)\n",
+         frames.size(), opts.toHost.c_str(), opts.toPort, opts.fps, opts.loss,
+         opts.reorder);
+
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  VideoFrameChunker chunker(VIDEO_MAX_DATAGRAM_SIZE);
+  std::vector<std::vector<uint8_t>> datagrams;
+  auto interval = std::chrono::microseconds(1000000 / opts.fps);
+  auto nextFrame = std::chrono::steady_clock::now();
+  uint32_t sent = 0, lost = 0;
+
+  for (int loop = 0; loop < opts.loops && running; loop++) {
+    for (const auto &frame : frames) {
+      if (!running) {
+        break;
+      }
+      std::this_thread::sleep_until(nextFrame);
+      nextFrame += interval;
+
+      uint16_t count =
+          chunker.beginFrame(frame.data(), frame.size(), steadyMillis());
+      datagrams.clear();
+      VideoChunk chunk;
+      for (uint16_t i = 0; i < count; i++) {
+        chunker.chunkAt(i, chunk);
+        if (chance(rng) < opts.loss) {
+          lost++;
+          continue;
+        }
+        std::vector<uint8_t> datagram(sizeof(chunk.header) +
+                                      chunk.payloadLength);
+        memcpy(datagram.data(), &chunk.header, sizeof(chunk.header));
+        memcpy(datagram.data() + sizeof(chunk.header), chunk.payload,
+               chunk.payloadLength);
+        datagrams.push_back(std::move(datagram));
+      }
+      // Swap neighbouring datagrams to simulate reordering on the network
+      for (size_t i = 0; i + 1 < datagrams.size(); i++) {
+        if (chance(rng) < opts.reorder) {
+          std::swap(datagrams[i], datagrams[i + 1]);
+        }
+      }
+      for (const auto &datagram : datagrams) {
+        sendto(sock, datagram.data(), datagram.size(), 0,
+               reinterpret_cast<sockaddr *>(&dest), sizeof(dest));
+        sent++;
+      }
+    }
+  }
+  printf("Sent %u datagrams, dropped %u on purpose\n", sent, lost);
+  close(sock);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parseOptions(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  signal(SIGINT, [](int) { running = 0; });
+  signal(SIGTERM, [](int) { running = 0; });
+  return opts.replayPath ? runReplay(opts) : runReceiver(opts);
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// ArduinoJson allocator backed by a fixed buffer, so documents that are built
+// and thrown away over and over (one per desired-state update) never touch
+// the heap. Allocation bumps a pointer, the block on top of the stack can
+// grow or shrink in place (ArduinoJson builds strings that way) and the whole
+// arena is reset once every block has been released, i.e. when the last
+// document using it is destroyed or cleared.
+//
+// Not thread safe, use one arena per task. When full, allocations fail and
+// ArduinoJson reports NoMemory. highWater() shows how much was ever needed.
+template <size_t Size> class ArenaAllocator : public ArduinoJson::Allocator {
+public:
+  void *allocate(size_t size) override {
+    size_t offset = used + HEADER_SIZE;
+    if (size > Size || offset + size > Size) {
+      failures++;
+      return nullptr;
+    }
+    writeHeader(used, size);
+    top = used;
+    used = offset + align(size);
+    live++;
+    if (used > peak) {
+      peak = used;
+    }
+    return buffer + offset;
+  }
+
+  void deallocate(void *ptr) override {
+    if (!ptr) {
+      return;
+    }
+    if (blockStart(ptr) == top) {
+      used = top; // Space below top stays in use until the reset
+    }
+    if (--live == 0) {
+      used = 0;
+      top = 0;
+    }
+  }
+
+  void *reallocate(void *ptr, size_t newSize) override {
+    if (!ptr) {
+      return allocate(newSize);
+    }
+    size_t start = blockStart(ptr);
+    if (start == top) {
+      size_t end = start + HEADER_SIZE + newSize;
+      if (newSize > Size || end > Size) {
+        failures++;
+        return nullptr;
+      }
+      writeHeader(start, newSize);
+      used = start + HEADER_SIZE + align(newSize);
+      if (used > peak) {
+        peak = used;
+      }
+      return ptr;
+    }
+    void *moved = allocate(newSize);
+    if (moved) {
+      size_t oldSize = readHeader(start);
+      memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+      live--; // The old block is abandoned, it is reclaimed on reset
+    }
+    return moved;
+  }
+
+  size_t capacity() const { return Size; }
+  size_t bytesUsed() const { return used; }
+  size_t highWater() const { return peak; }
+  uint32_t failedAllocations() const { return failures; }
+
+private:
+  static constexpr size_t ALIGNMENT = alignof(max_align_t);
+  static constexpr size_t HEADER_SIZE = ALIGNMENT; // Block size, kept aligned
+
+  static size_t align(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+  size_t blockStart(void *ptr) const {
+    return static_cast<uint8_t *>(ptr) - buffer - HEADER_SIZE;
+  }
+  void writeHeader(size_t start, size_t size) {
+    memcpy(buffer + start, &size, sizeof(size));
+  }
+  size_t readHeader(size_t start) const {
+    size_t size;
+    memcpy(&size, buffer + start, sizeof(size));
+    return size;
+  }
+
+  alignas(max_align_t) uint8_t buffer[Size];
+  size_t used = 0;
+  size_t top = 0; // Start of the most recent block
+  size_t live = 0;
+  size_t peak = 0;
+  uint32_t failures = 0;
+};
@@ -0,0 +1,113 @@
+#pragma once
+#include "RetryBackoff.h"
+#include <cstddef>
+#include <cstdint>
+
+enum class ConnectivityEvent : uint8_t {
+  LinkUp, // Associated with the access point and got an address
+  LinkDown,
+  Online, // Link up and, when required, the clock synced
+  Offline,
+};
+
+// Tracks the WiFi link and the wall clock and decides when to try
+// connecting again. The owner reports the link and clock state through
+// update() and starts a connection attempt whenever it returns true; the
+// association and SNTP run in the background, nothing here waits.
+//
+// While the link is down attempts back off exponentially with jitter (see
+// RetryBackoff) rather than restarting the association on every loop.
+// Listeners hear about the link and about being online as they change, so
+// network users like Firebase and ESP-NOW start and stop with them while
+// the control loop runs from boot.
+//
+// No Arduino dependencies, time and link state are passed in.
+class Connectivity {
+public:
+  using Listener = void (*)(ConnectivityEvent event);
+
+  static constexpr size_t MAX_LISTENERS = 4;
+  // An attempt gets the first delay to associate before it is restarted,
+  // the slow probing after the deadline keeps a dead access point quiet
+  static constexpr RetryPolicy RECONNECT_POLICY = {5000,   60000, 2, 25,
+                                                   300000, 60000};
+
+  explicit Connectivity(const RetryPolicy &policy = RECONNECT_POLICY,
+                        uint32_t seed = 1)
+      : reconnect(policy, seed) {}
+
+  // Whether being online also needs a valid wall clock, e.g. for timestamps
+  void setRequireTime(bool required) { requireTime = required; }
+
+  // Listeners run from update(), in the order they were added. Returns
+  // false when the table is full.
+  bool addListener(Listener listener) {
+    if (!listener || listenerCount == MAX_LISTENERS) {
+      return false;
+    }
+    listeners[listenerCount++] = listener;
+    return true;
+  }
+
+  // Returns true when a connection attempt should be started now
+  bool update(uint32_t nowMs, bool linkUp, bool timeValid) {
+    this->timeValid = timeValid;
+    bool online = linkUp && (timeValid || !requireTime);
+    // Offline is announced before the link goes and online after it came
+    // back, so listeners can rely on the link in between
+    if (!online && this->online) {
+      this->online = false;
+      notify(ConnectivityEvent::Offline);
+    }
+    if (linkUp != this->linkUp) {
+      this->linkUp = linkUp;
+      if (linkUp) {
+        reconnect.succeed();
+        notify(ConnectivityEvent::LinkUp);
+      } else {
+        linkDropCount++;
+        notify(ConnectivityEvent::LinkDown);
+      }
+    }
+    if (online && !this->online) {
+      this->online = true;
+      notify(ConnectivityEvent::Online);
+    }
+
+    if (linkUp) {
+      return false;
+    }
+    if (!reconnect.isActive()) {
+      reconnect.start(nowMs);
+    }
+    if (!reconnect.poll(nowMs)) {
+      return false;
+    }
+    attemptCount++;
+    return true;
+  }
+
+  bool isLinkUp() const { return linkUp; }
+  bool isTimeValid() const { return timeValid; }
+  bool isOnline() const { return online; }
+  // Since construction
+  uint32_t connectAttempts() const { return attemptCount; }
+  uint32_t linkDrops() const { return linkDropCount; }
+
+private:
+  void notify(ConnectivityEvent event) {
+    for (size_t i = 0; i < listenerCount; i++) {
+      listeners[i](event);
+    }
+  }
+
+  RetryBackoff reconnect;
+  Listener listeners[MAX_LISTENERS] = {};
+  size_t listenerCount = 0;
+  bool requireTime = false;
+  bool linkUp = false;
+  bool timeValid = false;
+  bool online = false;
+  uint32_t attemptCount = 0;
+  uint32_t linkDropCount = 0;
+};
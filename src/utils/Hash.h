@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// 32-bit FNV-1a. Cheap and good enough to tell whether a small document
+// changed, not for anything security related.
+constexpr uint32_t FNV1A_OFFSET_BASIS = 2166136261u;
+constexpr uint32_t FNV1A_PRIME = 16777619u;
+
+inline uint32_t fnv1a(const uint8_t *data, size_t length,
+                      uint32_t hash = FNV1A_OFFSET_BASIS) {
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * FNV1A_PRIME;
+  }
+  return hash;
+}
+
+// Writer that hashes whatever is serialized into it, so a JSON document can
+// be fingerprinted without building the string: serializeJson(doc, writer)
+class Fnv1aWriter {
+public:
+  size_t write(uint8_t c) {
+    hash = (hash ^ c) * FNV1A_PRIME;
+    return 1;
+  }
+  size_t write(const uint8_t *data, size_t length) {
+    hash = fnv1a(data, length, hash);
+    return length;
+  }
+  uint32_t value() const { return hash; }
+
+private:
+  uint32_t hash = FNV1A_OFFSET_BASIS;
+};
+
+// CRC-32 (IEEE 802.3, the zlib one). Bitwise, slow but tableless, fine for
+// the small records it checks. Pass the previous result to continue a CRC.
+inline uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
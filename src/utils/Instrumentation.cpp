@@ -0,0 +1,64 @@
+#include "Instrumentation.h"
+#include <cstring>
+
+uint32_t LatencyHistogram::percentileUs(uint8_t percent) const {
+  if (samples == 0) {
+    return 0;
+  }
+  // Rank of the sample at the percentile, rounded up
+  uint64_t rank = (uint64_t(samples) * percent + 99) / 100;
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      // The bucket bound can overshoot what was actually measured
+      uint32_t bound = i == 0 ? 0 : uint32_t((uint64_t(1) << i) - 1);
+      return bound < maxUs ? bound : maxUs;
+    }
+  }
+  return maxUs;
+}
+
+int Instrumentation::probe(const char *name, Kind kind) {
+  for (size_t id = 0; id < probeCount; id++) {
+    if (probes[id].kind == kind && strcmp(probes[id].name, name) == 0) {
+      return int(id);
+    }
+  }
+  if (probeCount == MAX_PROBES) {
+    return INVALID_PROBE;
+  }
+  probes[probeCount].name = name;
+  probes[probeCount].kind = kind;
+  return int(probeCount++);
+}
+
+void Instrumentation::report(JsonObject out) const {
+  JsonObject timers = out["t"].to<JsonObject>();
+  JsonObject counters = out["c"].to<JsonObject>();
+  for (size_t id = 0; id < probeCount; id++) {
+    const Probe &probe = probes[id];
+    if (probe.kind == Kind::Counter) {
+      counters[probe.name] = probe.total;
+      continue;
+    }
+    JsonArray values = timers[probe.name].to<JsonArray>();
+    values.add(probe.histogram.count());
+    values.add(probe.histogram.percentileUs(50));
+    values.add(probe.histogram.percentileUs(99));
+    values.add(probe.histogram.max());
+  }
+  JsonArray heap = out["heap"].to<JsonArray>();
+  heap.add(lastFreeHeap);
+  heap.add(minFreeHeap == UINT32_MAX ? 0 : minFreeHeap);
+}
+
+void Instrumentation::reset() {
+  for (size_t id = 0; id < probeCount; id++) {
+    probes[id].histogram.reset();
+    probes[id].total = 0;
+  }
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+
+// Lightweight timing and counters for the control loop's hot paths.
+//
+// INSTRUMENT_SCOPE("name") times the rest of the enclosing block into a
+// log2 latency histogram, INSTRUMENT_COUNT("name") bumps a counter and
+// INSTRUMENT_HEAP(freeBytes) tracks the lowest free heap seen. Probes are
+// looked up once per call site and kept in a fixed table, so recording is
+// two clock reads and a few adds. Everything compiles to nothing unless
+// ENABLE_INSTRUMENTATION is defined.
+//
+// Not thread safe, only record from the control loop (the Arduino loop
+// task). No Arduino dependencies, the microsecond clock is passed to
+// INSTRUMENT_BEGIN().
+
+// Bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us and the last bucket
+// everything from about 4 s up
+constexpr size_t LATENCY_BUCKET_COUNT = 24;
+
+class LatencyHistogram {
+public:
+  void record(uint32_t us) {
+    size_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    buckets[bucket < LATENCY_BUCKET_COUNT ? bucket
+                                          : LATENCY_BUCKET_COUNT - 1]++;
+    samples++;
+    totalUs += us;
+    if (us > maxUs) {
+      maxUs = us;
+    }
+  }
+
+  // Upper bound of the bucket holding the given percentile, 0 when empty
+  uint32_t percentileUs(uint8_t percent) const;
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return maxUs; }
+  uint32_t average() const { return samples ? totalUs / samples : 0; }
+  uint32_t bucket(size_t index) const { return buckets[index]; }
+  void reset() { *this = LatencyHistogram(); }
+
+private:
+  uint32_t buckets[LATENCY_BUCKET_COUNT] = {};
+  uint32_t samples = 0;
+  uint64_t totalUs = 0;
+  uint32_t maxUs = 0;
+};
+
+class Instrumentation {
+public:
+  using Clock = uint32_t (*)(); // Microseconds, e.g. micros()
+
+  static constexpr size_t MAX_PROBES = 16;
+  static constexpr int INVALID_PROBE = -1;
+
+  static Instrumentation &get() {
+    static Instrumentation instance;
+    return instance;
+  }
+
+  void begin(Clock microsClock) { clock = microsClock; }
+  uint32_t now() const { return clock ? clock() : 0; }
+
+  // Returns the probe for name, creating it on first use. Names are kept by
+  // reference, pass string literals. INVALID_PROBE when the table is full.
+  int timer(const char *name) { return probe(name, Kind::Timer); }
+  int counter(const char *name) { return probe(name, Kind::Counter); }
+
+  void record(int id, uint32_t us) {
+    if (valid(id)) {
+      probes[id].histogram.record(us);
+    }
+  }
+  void add(int id, uint32_t amount = 1) {
+    if (valid(id)) {
+      probes[id].total += amount;
+    }
+  }
+  void sampleHeap(uint32_t freeBytes) {
+    lastFreeHeap = freeBytes;
+    if (freeBytes < minFreeHeap) {
+      minFreeHeap = freeBytes;
+    }
+  }
+
+  const LatencyHistogram *histogram(int id) const {
+    return valid(id) ? &probes[id].histogram : nullptr;
+  }
+  uint32_t count(int id) const { return valid(id) ? probes[id].total : 0; }
+
+  // Compact report, e.g. for one RTDB document or serializeJson(doc, Serial):
+  // {"t":{"loop":[count,p50,p99,max],...},"c":{"name":n,...},
+  //  "heap":[free,minFree]}. Times are in microseconds.
+  void report(JsonObject out) const;
+  // Starts a new measurement window. The heap low-water mark is kept.
+  void reset();
+
+private:
+  enum class Kind : uint8_t { Timer, Counter };
+  struct Probe {
+    const char *name = nullptr;
+    Kind kind = Kind::Timer;
+    LatencyHistogram histogram;
+    uint32_t total = 0;
+  };
+
+  int probe(const char *name, Kind kind);
+  bool valid(int id) const { return id >= 0 && size_t(id) < probeCount; }
+
+  Clock clock = nullptr;
+  Probe probes[MAX_PROBES];
+  size_t probeCount = 0;
+  uint32_t lastFreeHeap = 0;
+  uint32_t minFreeHeap = UINT32_MAX;
+};
+
+// Records the time from construction to the end of the scope
+class ScopedTimer {
+public:
+  explicit ScopedTimer(int probe)
+      : probe(probe), startUs(Instrumentation::get().now()) {}
+  ~ScopedTimer() {
+    Instrumentation &instrumentation = Instrumentation::get();
+    instrumentation.record(probe, instrumentation.now() - startUs);
+  }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  int probe;
+  uint32_t startUs;
+};
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+
+#ifdef ENABLE_INSTRUMENTATION
+#define INSTRUMENT_BEGIN(clock) Instrumentation::get().begin(clock)
+#define INSTRUMENT_SCOPE(name)                                                 \
+  static const int INSTRUMENT_CONCAT(instrumentProbe, __LINE__) =              \
+      Instrumentation::get().timer(name);                                      \
+  ScopedTimer INSTRUMENT_CONCAT(instrumentTimer, __LINE__)(                    \
+      INSTRUMENT_CONCAT(instrumentProbe, __LINE__))
+#define INSTRUMENT_COUNT(name)                                                 \
+  do {                                                                         \
+    static const int instrumentProbe = Instrumentation::get().counter(name);   \
+    Instrumentation::get().add(instrumentProbe);                               \
+  } while (0)
+#define INSTRUMENT_HEAP(freeBytes) Instrumentation::get().sampleHeap(freeBytes)
+#else
+#define INSTRUMENT_BEGIN(clock) ((void)0)
+#define INSTRUMENT_SCOPE(name) ((void)0)
+#define INSTRUMENT_COUNT(name) ((void)0)
+#define INSTRUMENT_HEAP(freeBytes) ((void)0)
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Small persistent key-value storage for values that have to survive a
+// reboot, e.g. NVS on the board (NvsKeyValueStore.h) or memory on the host
+// (hal/native/MemoryKeyValueStore.h). Keys are short C strings, at most
+// MAX_KEY_LENGTH characters because NVS allows no more.
+class KeyValueStore {
+public:
+  static constexpr size_t MAX_KEY_LENGTH = 15;
+
+  virtual ~KeyValueStore() = default;
+
+  // Copies the value into buffer and returns its length, 0 when the key is
+  // missing or the value does not fit
+  virtual size_t get(const char *key, uint8_t *buffer, size_t size) = 0;
+  virtual bool put(const char *key, const uint8_t *data, size_t length) = 0;
+  virtual bool remove(const char *key) = 0;
+};
@@ -0,0 +1,264 @@
+#include "LogSpool.h"
+#include "Hash.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+constexpr uint16_t RECORD_MAGIC = 0x4C53; // "SL"
+constexpr uint32_t META_MAGIC = 0x4C535031;
+
+struct RecordHeader {
+  uint16_t magic;
+  uint16_t length;
+  uint32_t crc;
+};
+constexpr size_t RECORD_HEADER_SIZE = sizeof(RecordHeader);
+
+long fileSize(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size < 0 ? 0 : size;
+}
+
+// Reads the record at the current position, false at the end of the file or
+// on a torn or corrupt record
+bool readRecord(FILE *file, uint8_t *buffer, size_t bufferSize,
+                size_t &length) {
+  RecordHeader header;
+  if (fread(&header, 1, RECORD_HEADER_SIZE, file) != RECORD_HEADER_SIZE ||
+      header.magic != RECORD_MAGIC || header.length == 0 ||
+      header.length > LogSpool::MAX_RECORD_SIZE) {
+    return false;
+  }
+  length = header.length;
+  if (!buffer || length > bufferSize) {
+    // Only validating, read through a small scratch buffer
+    uint8_t scratch[64];
+    uint32_t crc = 0;
+    size_t remaining = length;
+    while (remaining > 0) {
+      size_t chunk = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
+      if (fread(scratch, 1, chunk, file) != chunk) {
+        return false;
+      }
+      crc = crc32(scratch, chunk, crc);
+      remaining -= chunk;
+    }
+    return crc == header.crc;
+  }
+  return fread(buffer, 1, length, file) == length &&
+         crc32(buffer, length) == header.crc;
+}
+} // namespace
+
+LogSpool::LogSpool(const char *directory, size_t segmentBytes,
+                   uint32_t maxSegments)
+    : directory(directory), segmentBytes(segmentBytes),
+      maxSegments(maxSegments ? maxSegments : 1) {}
+
+bool LogSpool::begin() {
+  if (mkdir(directory.c_str(), 0775) != 0 && errno != EEXIST) {
+    ready = false;
+    return false;
+  }
+  if (!loadMeta()) {
+    // Nothing usable to resume from, start over
+    firstSegment = lastSegment = 0;
+    committedOffset = 0;
+    dropped = 0;
+    remove(segmentPath(0).c_str());
+  }
+
+  // A write cut short by a reset leaves a partial record at the end of the
+  // active segment, appending after it would hide everything that follows
+  long valid = validLength(lastSegment);
+  lastSegmentLength = valid;
+  ready = true;
+  if (valid < fileSize(segmentPath(lastSegment))) {
+    startSegment();
+  }
+  if (committedOffset > uint32_t(fileSize(segmentPath(firstSegment)))) {
+    committedOffset = 0;
+  }
+  rewind();
+  return saveMeta();
+}
+
+bool LogSpool::append(const uint8_t *data, size_t length) {
+  if (!ready || !data || length == 0 || length > MAX_RECORD_SIZE) {
+    return false;
+  }
+  size_t recordSize = RECORD_HEADER_SIZE + length;
+  if (lastSegmentLength > 0 &&
+      size_t(lastSegmentLength) + recordSize > segmentBytes) {
+    startSegment();
+  }
+
+  FILE *file = fopen(segmentPath(lastSegment).c_str(), "ab");
+  if (!file) {
+    return false;
+  }
+  RecordHeader header = {RECORD_MAGIC, uint16_t(length), crc32(data, length)};
+  bool ok = fwrite(&header, 1, RECORD_HEADER_SIZE, file) ==
+                RECORD_HEADER_SIZE &&
+            fwrite(data, 1, length, file) == length;
+  ok = fclose(file) == 0 && ok;
+  if (ok) {
+    lastSegmentLength += recordSize;
+  } else {
+    // Keep the damage out of the way of later records
+    startSegment();
+  }
+  return ok;
+}
+
+size_t LogSpool::read(uint8_t *buffer, size_t bufferSize) {
+  while (ready && readSegment <= lastSegment) {
+    FILE *file = fopen(segmentPath(readSegment).c_str(), "rb");
+    size_t length = 0;
+    bool found = file && fseek(file, readOffset, SEEK_SET) == 0 &&
+                 readRecord(file, buffer, bufferSize, length);
+    if (file) {
+      fclose(file);
+    }
+    if (found) {
+      readOffset += RECORD_HEADER_SIZE + length;
+      if (length <= bufferSize) {
+        return length;
+      }
+      continue; // Too big for the caller, skip it
+    }
+    // End of this segment, or the rest of it is unreadable
+    if (readSegment == lastSegment) {
+      return 0;
+    }
+    readSegment++;
+    readOffset = 0;
+  }
+  return 0;
+}
+
+void LogSpool::commit() {
+  if (!ready) {
+    return;
+  }
+  if (readSegment == lastSegment && long(readOffset) >= lastSegmentLength &&
+      lastSegmentLength > 0) {
+    // Everything is acknowledged, start a fresh segment instead of keeping
+    // the old records around
+    removeSegmentsBefore(lastSegment + 1);
+    lastSegment++;
+    lastSegmentLength = 0;
+    firstSegment = readSegment = lastSegment;
+    committedOffset = readOffset = 0;
+  } else {
+    removeSegmentsBefore(readSegment);
+    firstSegment = readSegment;
+    committedOffset = readOffset;
+  }
+  saveMeta();
+}
+
+void LogSpool::rewind() {
+  readSegment = firstSegment;
+  readOffset = committedOffset;
+}
+
+bool LogSpool::empty() const {
+  return firstSegment == lastSegment &&
+         long(committedOffset) >= lastSegmentLength;
+}
+
+std::string LogSpool::segmentPath(uint32_t segment) const {
+  char name[24];
+  snprintf(name, sizeof(name), "/seg%08lx.log", (unsigned long)segment);
+  return directory + name;
+}
+
+std::string LogSpool::metaPath() const { return directory + "/meta"; }
+
+bool LogSpool::loadMeta() {
+  FILE *file = fopen(metaPath().c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  Meta meta;
+  bool ok = fread(&meta, 1, sizeof(meta), file) == sizeof(meta);
+  fclose(file);
+  if (!ok || meta.magic != META_MAGIC ||
+      meta.crc != crc32(reinterpret_cast<const uint8_t *>(&meta),
+                        offsetof(Meta, crc)) ||
+      meta.lastSegment < meta.firstSegment) {
+    return false;
+  }
+  firstSegment = meta.firstSegment;
+  committedOffset = meta.committedOffset;
+  lastSegment = meta.lastSegment;
+  dropped = meta.dropped;
+  return true;
+}
+
+bool LogSpool::saveMeta() {
+  Meta meta = {META_MAGIC, firstSegment, committedOffset, lastSegment,
+               dropped,    0};
+  meta.crc =
+      crc32(reinterpret_cast<const uint8_t *>(&meta), offsetof(Meta, crc));
+
+  // Write aside and rename so a reset never leaves half a meta file
+  std::string tempPath = metaPath() + ".tmp";
+  FILE *file = fopen(tempPath.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  bool ok = fwrite(&meta, 1, sizeof(meta), file) == sizeof(meta);
+  ok = fclose(file) == 0 && ok;
+  return ok && rename(tempPath.c_str(), metaPath().c_str()) == 0;
+}
+
+long LogSpool::validLength(uint32_t segment) const {
+  FILE *file = fopen(segmentPath(segment).c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  long valid = 0;
+  size_t length = 0;
+  while (readRecord(file, nullptr, 0, length)) {
+    valid += RECORD_HEADER_SIZE + length;
+  }
+  fclose(file);
+  return valid;
+}
+
+void LogSpool::startSegment() {
+  lastSegment++;
+  lastSegmentLength = 0;
+  remove(segmentPath(lastSegment).c_str()); // Leftover from an older run
+
+  while (segmentCount() > maxSegments) {
+    // Oldest segment goes, acknowledged or not
+    if (long(committedOffset) < fileSize(segmentPath(firstSegment))) {
+      dropped++;
+    }
+    remove(segmentPath(firstSegment).c_str());
+    firstSegment++;
+    committedOffset = 0;
+  }
+  if (readSegment < firstSegment) {
+    readSegment = firstSegment;
+    readOffset = 0;
+  }
+  saveMeta();
+}
+
+void LogSpool::removeSegmentsBefore(uint32_t segment) {
+  for (uint32_t s = firstSegment; s < segment; s++) {
+    remove(segmentPath(s).c_str());
+  }
+}
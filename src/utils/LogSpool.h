@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Persistent append-only queue of small binary records, used to hold log
+// events while the board is offline and drain them once it is back.
+//
+// Records live in numbered segment files (seg<N>.log) inside a directory on
+// a flash filesystem mounted into the VFS (e.g. /littlefs/logspool), each
+// record framed as magic, length and CRC-32 of the payload. When the spool
+// holds maxSegments segments the oldest is deleted to make room, so the
+// newest events survive a long outage. A small meta file remembers the
+// first segment and how far into it records have been acknowledged.
+//
+// Reading is two-phase: read() walks records past the acknowledged point,
+// commit() acknowledges everything read so far and rewind() goes back to
+// the last acknowledged record, e.g. when an upload failed. Records are
+// therefore delivered at least once.
+//
+// Only uses stdio, so it runs unchanged against a directory on the host.
+class LogSpool {
+public:
+  static constexpr size_t MAX_RECORD_SIZE = 1024;
+
+  LogSpool(const char *directory, size_t segmentBytes = 8 * 1024,
+           uint32_t maxSegments = 16);
+
+  // Creates the directory if needed and restores the read position. Safe to
+  // call again after the filesystem was remounted.
+  bool begin();
+
+  bool append(const uint8_t *data, size_t length);
+
+  // Copies the next unread record into buffer and returns its length, or 0
+  // when there is nothing left to read
+  size_t read(uint8_t *buffer, size_t bufferSize);
+  void commit();
+  void rewind();
+
+  // True when every record has been acknowledged
+  bool empty() const;
+  uint32_t segmentCount() const { return lastSegment - firstSegment + 1; }
+  // Segments deleted while still holding unacknowledged records
+  uint32_t droppedSegments() const { return dropped; }
+
+private:
+  struct Meta {
+    uint32_t magic;
+    uint32_t firstSegment;
+    uint32_t committedOffset;
+    uint32_t lastSegment;
+    uint32_t dropped;
+    uint32_t crc;
+  };
+
+  std::string segmentPath(uint32_t segment) const;
+  std::string metaPath() const;
+  bool loadMeta();
+  bool saveMeta();
+  // Length of the valid records at the start of a segment
+  long validLength(uint32_t segment) const;
+  void startSegment();
+  void removeSegmentsBefore(uint32_t segment);
+
+  std::string directory;
+  size_t segmentBytes;
+  uint32_t maxSegments;
+  bool ready = false;
+
+  uint32_t firstSegment = 0;
+  uint32_t committedOffset = 0;
+  uint32_t lastSegment = 0;
+  uint32_t dropped = 0;
+  // Size of the segment being appended to
+  long lastSegmentLength = 0;
+
+  // Read cursor, ahead of the committed position while a batch is in flight
+  uint32_t readSegment = 0;
+  uint32_t readOffset = 0;
+};
@@ -0,0 +1,76 @@
+#include "MessageTypes.h"
+#include <cstring>
+
+namespace {
+template <typename T>
+bool parseCameraMessage(const uint8_t *data, size_t length,
+                        CameraMessageType type, T &message) {
+  CameraMessageHeader header;
+  if (!parseCameraMessageHeader(data, length, header) ||
+      header.version != CAMERA_PROTOCOL_VERSION ||
+      header.type != static_cast<uint8_t>(type) || length < sizeof(T)) {
+    return false;
+  }
+  memcpy(&message, data, sizeof(T));
+  return true;
+}
+} // namespace
+
+void initCameraMessageHeader(CameraMessageHeader &header,
+                             CameraMessageType type, uint16_t sequence) {
+  header.magic = CAMERA_PROTOCOL_MAGIC;
+  header.version = CAMERA_PROTOCOL_VERSION;
+  header.type = static_cast<uint8_t>(type);
+  header.flags = 0;
+  header.sequence = sequence;
+}
+
+bool parseCameraMessageHeader(const uint8_t *data, size_t length,
+                              CameraMessageHeader &header) {
+  if (!data || length < sizeof(CameraMessageHeader)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(CameraMessageHeader));
+  return header.magic == CAMERA_PROTOCOL_MAGIC;
+}
+
+bool parseCameraCommand(const uint8_t *data, size_t length,
+                        CameraCommand &command) {
+  if (!parseCameraMessage(data, length, CameraMessageType::Command, command)) {
+    return false;
+  }
+  command.fields &= CAMERA_FIELDS_ALL;
+  return true;
+}
+
+bool parseCameraAck(const uint8_t *data, size_t length, CameraAck &ack) {
+  return parseCameraMessage(data, length, CameraMessageType::Ack, ack);
+}
+
+bool parseCameraTelemetry(const uint8_t *data, size_t length,
+                          CameraTelemetry &telemetry) {
+  return parseCameraMessage(data, length, CameraMessageType::Telemetry,
+                            telemetry);
+}
+
+uint8_t invalidCameraCommandFields(const CameraCommand &command,
+                                   uint8_t frameSizeCount) {
+  uint8_t invalid = 0;
+  if ((command.fields & CAMERA_FIELD_STREAMING) && command.streaming > 1) {
+    invalid |= CAMERA_FIELD_STREAMING;
+  }
+  if ((command.fields & CAMERA_FIELD_FPS) &&
+      (command.fps < CAMERA_MIN_FPS || command.fps > CAMERA_MAX_FPS)) {
+    invalid |= CAMERA_FIELD_FPS;
+  }
+  if ((command.fields & CAMERA_FIELD_QUALITY) &&
+      (command.quality < CAMERA_MIN_QUALITY ||
+       command.quality > CAMERA_MAX_QUALITY)) {
+    invalid |= CAMERA_FIELD_QUALITY;
+  }
+  if ((command.fields & CAMERA_FIELD_FRAME_SIZE) &&
+      command.frameSizeLevel >= frameSizeCount) {
+    invalid |= CAMERA_FIELD_FRAME_SIZE;
+  }
+  return invalid;
+}
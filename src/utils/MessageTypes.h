@@ -1,7 +1,131 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 
-struct camera_message {
-  char message[32];
-  int camera_action;
-  int fps;
+// ESP-NOW protocol between the main board and the camera board.
+// Every message starts with a CameraMessageHeader. Messages are packed and
+// little endian like the video stream (both boards are ESP32s), so they are
+// sent as-is. The header layout stays the same in every version, which lets
+// a board tell the sender it speaks a different version.
+// This file has no Arduino dependencies so the codec also builds on a host.
+
+constexpr uint8_t CAMERA_PROTOCOL_MAGIC = 0xCA;
+constexpr uint8_t CAMERA_PROTOCOL_VERSION = 2;
+
+enum class CameraMessageType : uint8_t {
+  Command = 1,   // Main board -> camera board
+  Ack = 2,       // Camera board -> main board, reply to a command
+  Telemetry = 3, // Camera board -> main board, periodic
+};
+
+struct __attribute__((packed)) CameraMessageHeader {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t type;      // CameraMessageType
+  uint8_t flags;     // Reserved, always 0 for now
+  uint16_t sequence; // Counts up per command, acks echo the command's
+};
+static_assert(sizeof(CameraMessageHeader) == 6,
+              "CameraMessageHeader must be packed");
+
+// Bits for CameraCommand::fields, the parameters a command carries
+enum CameraCommandField : uint8_t {
+  CAMERA_FIELD_STREAMING = 1 << 0,
+  CAMERA_FIELD_FPS = 1 << 1,
+  CAMERA_FIELD_QUALITY = 1 << 2,
+  CAMERA_FIELD_FRAME_SIZE = 1 << 3,
+  CAMERA_FIELD_TARGET_KBPS = 1 << 4,
+};
+constexpr uint8_t CAMERA_FIELDS_ALL = 0x1F;
+
+// Values the camera board accepts
+constexpr uint8_t CAMERA_MIN_FPS = 1;
+constexpr uint8_t CAMERA_MAX_FPS = 30;
+constexpr uint8_t CAMERA_MIN_QUALITY = 4;
+constexpr uint8_t CAMERA_MAX_QUALITY = 63;
+
+// Everything that changed since the last command goes out as one message.
+// Values are absolute, so a command that is sent twice does no harm.
+struct __attribute__((packed)) CameraCommand {
+  CameraMessageHeader header;
+  uint8_t fields;    // CameraCommandField bits, the rest is ignored
+  uint8_t streaming; // 1 to stream, 0 to stop
+  uint8_t fps;
+  // Best JPEG quality to use (esp32-camera scale, lower is better)
+  uint8_t quality;
+  // Largest frame size level, see STREAM_FRAME_SIZES in
+  // utils/video/AdaptiveStreamController.h
+  uint8_t frameSizeLevel;
+  uint16_t targetKbps; // 0 turns adaptive streaming off
+};
+static_assert(sizeof(CameraCommand) == 13, "CameraCommand must be packed");
+
+enum class CameraAckStatus : uint8_t {
+  Ok = 0,
+  Rejected = 1,           // Some fields were out of range, see rejectedFields
+  UnsupportedVersion = 2, // Nothing was applied
+  Malformed = 3,          // Nothing was applied
+};
+
+// Sent by the camera board for every command once it has been applied, so
+// the main board knows the command arrived and what state it left behind
+struct __attribute__((packed)) CameraAck {
+  CameraMessageHeader header; // Sequence of the command
+  uint8_t status;             // CameraAckStatus
+  uint8_t appliedFields;
+  uint8_t rejectedFields;
+  uint8_t streaming; // Streaming state after the command
+};
+static_assert(sizeof(CameraAck) == 10, "CameraAck must be packed");
+
+// Sent from the camera board back to the main board about once per second
+// while streaming, once more when streaming stops and every
+// CAMERA_IDLE_TELEMETRY_INTERVAL_MS while idle. Per-frame numbers cover the
+// time since the previous message, counters are cumulative since boot.
+constexpr uint32_t CAMERA_STREAMING_TELEMETRY_INTERVAL_MS = 1000;
+constexpr uint32_t CAMERA_IDLE_TELEMETRY_INTERVAL_MS = 10000;
+
+struct __attribute__((packed)) CameraTelemetry {
+  CameraMessageHeader header;
+  float achievedFps;
+  uint32_t avgFrameBytes;
+  uint16_t avgFrameSendMs;       // First to last chunk of a frame
+  uint32_t sendBufferFullEvents; // Chunks lwIP had no buffer for
+  uint32_t droppedFrames; // Frames dropped before sending, queue full or stale
+  // Settings currently in use, picked by the adaptive controller when a
+  // target bitrate is set
+  uint8_t jpegQuality;
+  uint8_t frameSizeLevel;
+  uint8_t streamFps;
+  uint8_t adaptiveEnabled;
+  uint32_t budgetBytesPerSec;
+  uint32_t freeHeapBytes;
+  uint32_t freePsramBytes;
+  int8_t wifiRssi; // dBm, 0 when not connected
+  uint32_t uptimeSec;
 };
+static_assert(sizeof(CameraTelemetry) == 45,
+              "CameraTelemetry must be packed");
+
+// Fills in the header for a message of this protocol version
+void initCameraMessageHeader(CameraMessageHeader &header,
+                             CameraMessageType type, uint16_t sequence);
+
+// Returns true when the message starts with a header of this protocol, of any
+// version. Use it to answer messages from a different version.
+bool parseCameraMessageHeader(const uint8_t *data, size_t length,
+                              CameraMessageHeader &header);
+
+// Return true when data holds a well formed message of the given type for
+// this protocol version. Longer messages are accepted, the extra bytes are
+// ignored.
+bool parseCameraCommand(const uint8_t *data, size_t length,
+                        CameraCommand &command);
+bool parseCameraAck(const uint8_t *data, size_t length, CameraAck &ack);
+bool parseCameraTelemetry(const uint8_t *data, size_t length,
+                          CameraTelemetry &telemetry);
+
+// Fields of the command whose values are out of range. frameSizeCount is the
+// number of frame size levels the camera supports.
+uint8_t invalidCameraCommandFields(const CameraCommand &command,
+                                   uint8_t frameSizeCount);
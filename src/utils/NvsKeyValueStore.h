@@ -0,0 +1,43 @@
+#pragma once
+#include "KeyValueStore.h"
+#include <Preferences.h>
+
+// KeyValueStore on one NVS namespace through the Arduino Preferences library.
+// NVS writes are wear levelled, but callers should still skip writing values
+// that did not change.
+class NvsKeyValueStore : public KeyValueStore {
+public:
+  // The namespace name is kept by reference, at most 15 characters
+  explicit NvsKeyValueStore(const char *name) : name(name) {}
+
+  // Opens the namespace, call from setup() before using the store
+  bool begin() {
+    opened = preferences.begin(name, false);
+    return opened;
+  }
+
+  size_t get(const char *key, uint8_t *buffer, size_t size) override {
+    // isKey() first, a missing key would log an NVS error
+    if (!opened || !preferences.isKey(key)) {
+      return 0;
+    }
+    size_t length = preferences.getBytesLength(key);
+    if (length == 0 || length > size) {
+      return 0;
+    }
+    return preferences.getBytes(key, buffer, length);
+  }
+
+  bool put(const char *key, const uint8_t *data, size_t length) override {
+    return opened && preferences.putBytes(key, data, length) == length;
+  }
+
+  bool remove(const char *key) override {
+    return opened && preferences.remove(key);
+  }
+
+private:
+  const char *name;
+  Preferences preferences;
+  bool opened = false;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+
+struct RetryPolicy {
+  uint32_t initialDelayMs = 20; // Wait after the first attempt
+  uint32_t maxDelayMs = 1000;
+  uint8_t multiplier = 2;
+  // Every wait is randomized by up to this much either way, so peers that
+  // failed together do not retry in lockstep
+  uint8_t jitterPercent = 25;
+  uint32_t deadlineMs = 3000; // Gives up on an operation after this long
+  // Once given up, keeps trying this often in the background, 0 never does
+  uint32_t probeIntervalMs = 30000;
+};
+
+// Decides when to (re)send something that needs an answer, e.g. a command to
+// an ESP-NOW peer that has to be acknowledged. After start() the first
+// attempt is due right away, then the wait between attempts grows by the
+// multiplier up to maxDelayMs. When the deadline passes without succeed()
+// the operation is marked failed and attempts continue at the slow probe
+// interval until succeed() or the next start().
+//
+// The owner calls poll() regularly and sends whenever it returns true.
+// No Arduino dependencies, time is passed in and the jitter comes from a
+// seeded generator, so runs can be replayed exactly on a host.
+class RetryBackoff {
+public:
+  enum class State {
+    Idle,     // Nothing to send
+    Retrying, // Waiting for an answer, inside the deadline
+    Failed,   // Deadline passed, probing at probeIntervalMs
+  };
+
+  explicit RetryBackoff(const RetryPolicy &policy = RetryPolicy(),
+                        uint32_t seed = 1)
+      : policy(policy), random(seed ? seed : 1) {}
+
+  // Begins a new operation, dropping whatever was in progress
+  void start(uint32_t nowMs) {
+    currentState = State::Retrying;
+    startedMs = nowMs;
+    nextAttemptMs = nowMs;
+    delayMs = policy.initialDelayMs;
+    attemptCount = 0;
+  }
+
+  // The answer arrived, nothing more to send
+  void succeed() { currentState = State::Idle; }
+
+  // Returns true when an attempt should be sent now
+  bool poll(uint32_t nowMs) {
+    if (currentState == State::Idle) {
+      return false;
+    }
+    if (currentState == State::Retrying &&
+        nowMs - startedMs >= policy.deadlineMs) {
+      currentState = State::Failed;
+      failureCount++;
+      nextAttemptMs = nowMs + jittered(policy.probeIntervalMs);
+      return false;
+    }
+    if (currentState == State::Failed && policy.probeIntervalMs == 0) {
+      return false;
+    }
+    // Signed difference keeps working across the millis() wrap
+    if (static_cast<int32_t>(nowMs - nextAttemptMs) < 0) {
+      return false;
+    }
+    attemptCount++;
+    if (currentState == State::Failed) {
+      nextAttemptMs = nowMs + jittered(policy.probeIntervalMs);
+      return true;
+    }
+    nextAttemptMs = nowMs + jittered(delayMs);
+    uint32_t grown = delayMs * policy.multiplier;
+    delayMs = grown > policy.maxDelayMs || grown < delayMs ? policy.maxDelayMs
+                                                           : grown;
+    return true;
+  }
+
+  State state() const { return currentState; }
+  bool isActive() const { return currentState != State::Idle; }
+  bool isFailed() const { return currentState == State::Failed; }
+  // Attempts since the last start(), probes included
+  uint32_t attempts() const { return attemptCount; }
+  // Operations that ran into the deadline since construction
+  uint32_t failures() const { return failureCount; }
+
+private:
+  uint32_t jittered(uint32_t ms) {
+    if (policy.jitterPercent == 0 || ms == 0) {
+      return ms;
+    }
+    uint32_t spread = static_cast<uint64_t>(ms) * policy.jitterPercent / 100;
+    uint32_t offset = nextRandom() % (2 * spread + 1);
+    return ms - spread + offset;
+  }
+  // xorshift32, plenty for spreading retries
+  uint32_t nextRandom() {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return random;
+  }
+
+  RetryPolicy policy;
+  uint32_t random;
+  State currentState = State::Idle;
+  uint32_t startedMs = 0;
+  uint32_t nextAttemptMs = 0;
+  uint32_t delayMs = 0;
+  uint32_t attemptCount = 0;
+  uint32_t failureCount = 0;
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free single-producer/single-consumer ring buffer.
+// Exactly one task may call push() and exactly one (other) task may call
+// pop()/peek(). Storage is inline so the queue never allocates.
+// Only uses std::atomic, so it builds the same on ESP32 and on a host.
+template <typename T, size_t Capacity> class SpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+public:
+  // Producer side. Returns false when full, the item is not stored.
+  bool push(const T &item) {
+    size_t tail = tailIndex.load(std::memory_order_relaxed);
+    size_t head = headIndex.load(std::memory_order_acquire);
+    if (tail - head == Capacity) {
+      return false;
+    }
+    slots[tail & MASK] = item;
+    tailIndex.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side, zero-copy variant of push(). Returns the slot for the
+  // next item to be filled in place, or null when full. The item becomes
+  // visible to the consumer on publish().
+  T *reserve() {
+    size_t tail = tailIndex.load(std::memory_order_relaxed);
+    size_t head = headIndex.load(std::memory_order_acquire);
+    return tail - head == Capacity ? nullptr : &slots[tail & MASK];
+  }
+  void publish() {
+    tailIndex.store(tailIndex.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+  }
+
+  // Consumer side. Returns false when empty.
+  bool pop(T &item) {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    size_t tail = tailIndex.load(std::memory_order_acquire);
+    if (head == tail) {
+      return false;
+    }
+    item = slots[head & MASK];
+    headIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Pointer to the oldest item without removing it, or null.
+  // Stays valid until the next pop().
+  T *peek() {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    size_t tail = tailIndex.load(std::memory_order_acquire);
+    return head == tail ? nullptr : &slots[head & MASK];
+  }
+
+  // Consumer side. Removes the oldest item without copying it out, used
+  // after processing it through peek().
+  bool drop() {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) {
+      return false;
+    }
+    headIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Approximate when called from a third task
+  size_t size() const {
+    return tailIndex.load(std::memory_order_acquire) -
+           headIndex.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  static constexpr size_t MASK = Capacity - 1;
+  // Indices only ever increase; unsigned wrap keeps tail - head correct
+  std::atomic<size_t> headIndex{0};
+  std::atomic<size_t> tailIndex{0};
+  T slots[Capacity];
+};
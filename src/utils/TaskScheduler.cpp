@@ -0,0 +1,164 @@
+#include "TaskScheduler.h"
+
+int TaskScheduler::addPeriodic(const char *name, uint32_t periodMs,
+                               TaskFunction function, uint8_t priority,
+                               uint32_t initialDelayMs) {
+  if (periodMs == 0) {
+    return INVALID_TASK;
+  }
+  return add(name, periodMs, initialDelayMs, function, priority);
+}
+
+int TaskScheduler::addOnce(const char *name, uint32_t delayMs,
+                           TaskFunction function, uint8_t priority) {
+  return add(name, 0, delayMs, function, priority);
+}
+
+int TaskScheduler::add(const char *name, uint32_t periodMs, uint32_t delayMs,
+                       TaskFunction function, uint8_t priority) {
+  if (!function) {
+    return INVALID_TASK;
+  }
+  for (size_t id = 0; id < MAX_TASKS; id++) {
+    // A task may not reuse its own slot while it is still running
+    if (!tasks[id].active && !tasks[id].running) {
+      Task &task = tasks[id];
+      task = Task();
+      task.name = name;
+      task.function = function;
+      task.periodMs = periodMs;
+      task.dueMs = clock() + delayMs;
+      task.priority = priority;
+      task.active = true;
+      return int(id);
+    }
+  }
+  return INVALID_TASK;
+}
+
+void TaskScheduler::cancel(int id) {
+  if (validId(id)) {
+    tasks[id].active = false;
+  }
+}
+
+void TaskScheduler::runAfter(int id, uint32_t delayMs) {
+  if (validId(id)) {
+    tasks[id].dueMs = clock() + delayMs;
+    tasks[id].rescheduled = tasks[id].running;
+  }
+}
+
+void TaskScheduler::setPeriod(int id, uint32_t periodMs) {
+  if (validId(id) && tasks[id].periodMs > 0 && periodMs > 0) {
+    tasks[id].periodMs = periodMs;
+  }
+}
+
+size_t TaskScheduler::run(size_t maxRuns) {
+  size_t runs = 0;
+  while (runs < maxRuns) {
+    uint32_t nowMs = clock();
+    int id = nextDue(nowMs, currentPriority);
+    if (id < 0) {
+      break;
+    }
+    runTask(id, nowMs);
+    runs++;
+  }
+  return runs;
+}
+
+size_t TaskScheduler::yield() {
+  if (currentPriority < 0) {
+    return 0; // Not inside a task, run() is the way in
+  }
+  return run();
+}
+
+uint32_t TaskScheduler::msUntilNext() const {
+  uint32_t nowMs = clock();
+  uint32_t best = UINT32_MAX;
+  for (const Task &task : tasks) {
+    if (!task.active || task.running) {
+      continue;
+    }
+    int32_t until = timeUntil(task.dueMs, nowMs);
+    if (until <= 0) {
+      return 0;
+    }
+    if (uint32_t(until) < best) {
+      best = until;
+    }
+  }
+  return best;
+}
+
+const ScheduledTaskStats *TaskScheduler::stats(int id) const {
+  return validId(id) ? &tasks[id].stats : nullptr;
+}
+
+const char *TaskScheduler::name(int id) const {
+  return validId(id) ? tasks[id].name : nullptr;
+}
+
+bool TaskScheduler::isActive(int id) const { return validId(id); }
+
+int TaskScheduler::nextDue(uint32_t nowMs, int minPriority) const {
+  int best = -1;
+  for (size_t id = 0; id < MAX_TASKS; id++) {
+    const Task &task = tasks[id];
+    if (!task.active || task.running || int(task.priority) <= minPriority ||
+        timeUntil(task.dueMs, nowMs) > 0) {
+      continue;
+    }
+    if (best < 0 || task.priority > tasks[best].priority ||
+        (task.priority == tasks[best].priority &&
+         timeUntil(task.dueMs, tasks[best].dueMs) < 0)) {
+      best = int(id);
+    }
+  }
+  return best;
+}
+
+void TaskScheduler::runTask(int id, uint32_t nowMs) {
+  Task &task = tasks[id];
+  task.stats.lastJitterMs = nowMs - task.dueMs;
+  if (task.stats.lastJitterMs > task.stats.maxJitterMs) {
+    task.stats.maxJitterMs = task.stats.lastJitterMs;
+  }
+
+  int previousPriority = currentPriority;
+  currentPriority = task.priority;
+  task.running = true;
+  task.function();
+  task.running = false;
+  currentPriority = previousPriority;
+
+  uint32_t endMs = clock();
+  task.stats.runs++;
+  task.stats.lastRunMs = endMs - nowMs;
+  if (task.stats.lastRunMs > task.stats.maxRunMs) {
+    task.stats.maxRunMs = task.stats.lastRunMs;
+  }
+
+  // The task may have cancelled or rescheduled itself while running
+  if (!task.active || task.rescheduled) {
+    task.rescheduled = false;
+    return;
+  }
+  if (task.periodMs == 0) {
+    task.active = false;
+    return;
+  }
+  if (task.stats.lastRunMs > task.periodMs) {
+    task.stats.overruns++;
+  }
+  task.dueMs += task.periodMs;
+  // Skip whole periods that are already gone instead of catching up
+  if (timeUntil(task.dueMs, endMs) <= 0) {
+    uint32_t skipped = (endMs - task.dueMs) / task.periodMs + 1;
+    task.stats.skippedPeriods += skipped;
+    task.dueMs += skipped * task.periodMs;
+  }
+}
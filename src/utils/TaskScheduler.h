@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Cooperative scheduler for the main loop. Tasks are plain functions run
+// either periodically or once after a delay. Each call to run() executes the
+// tasks that are due, highest priority first and earliest deadline first
+// within a priority, so a slow job only delays the ones behind it instead of
+// everything that follows it in loop().
+//
+// Periodic tasks keep a fixed rate: the next deadline is the previous one
+// plus the period, and periods that were missed entirely are skipped rather
+// than run back to back. Per task the scheduler tracks how late each run
+// started (jitter), how long it took and how often it overran its period.
+//
+// A long task can call yield() between steps to let due tasks with a higher
+// priority run in the middle of it.
+//
+// No Arduino dependencies, time comes from the clock function passed in.
+struct ScheduledTaskStats {
+  uint32_t runs = 0;
+  uint32_t overruns = 0;       // Runs that took longer than the period
+  uint32_t skippedPeriods = 0; // Periods dropped because the task was late
+  uint32_t lastJitterMs = 0;
+  uint32_t maxJitterMs = 0;
+  uint32_t lastRunMs = 0;
+  uint32_t maxRunMs = 0;
+};
+
+class TaskScheduler {
+public:
+  using Clock = uint32_t (*)();
+  using TaskFunction = void (*)();
+
+  static constexpr size_t MAX_TASKS = 16;
+  static constexpr int INVALID_TASK = -1;
+
+  explicit TaskScheduler(Clock clock) : clock(clock) {}
+
+  // Returns a task id, or INVALID_TASK when the table is full. Higher
+  // priority values run first.
+  int addPeriodic(const char *name, uint32_t periodMs, TaskFunction function,
+                  uint8_t priority = 0, uint32_t initialDelayMs = 0);
+  int addOnce(const char *name, uint32_t delayMs, TaskFunction function,
+              uint8_t priority = 0);
+
+  void cancel(int id);
+  // Moves the next run of a task, e.g. to retry sooner or back off
+  void runAfter(int id, uint32_t delayMs);
+  void setPeriod(int id, uint32_t periodMs);
+
+  // Runs due tasks until none are left or maxRuns tasks ran. Returns the
+  // number of tasks that ran.
+  size_t run(size_t maxRuns = MAX_TASKS);
+
+  // Called from inside a task, runs due tasks with a higher priority than
+  // the calling one. Returns the number of tasks that ran.
+  size_t yield();
+
+  // Time until the next task is due, 0 if one is due now and UINT32_MAX if
+  // nothing is scheduled
+  uint32_t msUntilNext() const;
+
+  const ScheduledTaskStats *stats(int id) const;
+  const char *name(int id) const;
+  // For iterating over stats, ids are 0..MAX_TASKS-1 and unused ones are
+  // reported as not active
+  bool isActive(int id) const;
+
+private:
+  struct Task {
+    const char *name = nullptr;
+    TaskFunction function = nullptr;
+    uint32_t periodMs = 0; // 0 for one-shot tasks
+    uint32_t dueMs = 0;
+    uint8_t priority = 0;
+    bool active = false;
+    bool running = false;
+    bool rescheduled = false; // runAfter() called while running
+    ScheduledTaskStats stats;
+  };
+
+  int add(const char *name, uint32_t periodMs, uint32_t delayMs,
+          TaskFunction function, uint8_t priority);
+  // Most urgent due task with a priority above minPriority, or -1
+  int nextDue(uint32_t nowMs, int minPriority) const;
+  void runTask(int id, uint32_t nowMs);
+  bool validId(int id) const {
+    return id >= 0 && size_t(id) < MAX_TASKS && tasks[id].active;
+  }
+  // Signed distance between two times, valid across millis() wrap
+  static int32_t timeUntil(uint32_t dueMs, uint32_t nowMs) {
+    return int32_t(dueMs - nowMs);
+  }
+
+  Clock clock;
+  Task tasks[MAX_TASKS];
+  // Priority of the task currently running, -1 outside of tasks
+  int currentPriority = -1;
+};
@@ -17,10 +17,16 @@ public:
 
   bool operator>=(const TimeOfDay &other) const { return !(*this < other); }
 
+  bool operator==(const TimeOfDay &other) const {
+    return hour == other.hour && minute == other.minute;
+  }
+
+  bool operator!=(const TimeOfDay &other) const { return !(*this == other); }
+
   // Get current local time from ESP32 NTP (handles PST/PDT if tz set)
   static TimeOfDay now() {
     struct tm timeinfo;
-    if (!getLocalTime(&timeinfo)) {
+    if (!getLocalTime(&timeinfo, 0)) { // Do not wait for NTP
       // Serial.println("Failed to obtain time");
       return TimeOfDay(0, 0);
     }
@@ -51,7 +57,7 @@ public:
     struct tm timeinfo;
     char timeBuffer[20];
 
-    if (!getLocalTime(&timeinfo)) {
+    if (!getLocalTime(&timeinfo, 0)) { // Do not wait for NTP
       // Serial.println("Failed to obtain time");
       return String("1970-01-01T00:00:00Z");
     }
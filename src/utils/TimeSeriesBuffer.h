@@ -0,0 +1,249 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Fixed-memory history for a sensor with Channels values per reading (e.g.
+// temperature and humidity). Readings are stored as compact samples, a
+// uint16 seconds delta from the previous sample plus one int16 per channel
+// quantized to resolution, in a ring of Capacity samples. Alongside the raw
+// ring, min/max/mean aggregates are rolled up into wall-clock aligned
+// 1 minute, 15 minute and 1 hour buckets, each kept in its own ring.
+//
+// Everything is sized at compile time, nothing allocates after construction.
+// No Arduino dependencies, timestamps are seconds passed in by the caller.
+enum class TimeSeriesLevel : uint8_t { Minute, QuarterHour, Hour };
+
+template <size_t Channels> struct TimeSeriesAggregate {
+  uint32_t startSec = 0;
+  uint16_t count = 0;
+  int16_t min[Channels] = {};
+  int16_t max[Channels] = {};
+  int32_t sum[Channels] = {};
+
+  void add(const int16_t *values) {
+    for (size_t c = 0; c < Channels; c++) {
+      if (count == 0 || values[c] < min[c]) {
+        min[c] = values[c];
+      }
+      if (count == 0 || values[c] > max[c]) {
+        max[c] = values[c];
+      }
+      sum[c] += values[c];
+    }
+    count++;
+  }
+
+  void merge(const TimeSeriesAggregate &other) {
+    if (other.count == 0) {
+      return;
+    }
+    for (size_t c = 0; c < Channels; c++) {
+      if (count == 0 || other.min[c] < min[c]) {
+        min[c] = other.min[c];
+      }
+      if (count == 0 || other.max[c] > max[c]) {
+        max[c] = other.max[c];
+      }
+      sum[c] += other.sum[c];
+    }
+    if (count == 0) {
+      startSec = other.startSec;
+    }
+    count += other.count;
+  }
+
+  // Quantized mean, rounded to nearest
+  int16_t mean(size_t channel) const {
+    if (count == 0) {
+      return 0;
+    }
+    return int16_t(lround(double(sum[channel]) / count));
+  }
+};
+
+template <size_t Channels, size_t Capacity> class TimeSeriesBuffer {
+public:
+  using Aggregate = TimeSeriesAggregate<Channels>;
+
+  static constexpr size_t LEVEL_COUNT = 3;
+  static constexpr uint32_t LEVEL_PERIOD_SEC[LEVEL_COUNT] = {60, 15 * 60,
+                                                             60 * 60};
+  // Two hours of minutes so an upload missed during an outage can still be
+  // built an hour later, a day of quarter hours and two days of hours
+  static constexpr size_t MINUTE_BUCKETS = 120;
+  static constexpr size_t QUARTER_HOUR_BUCKETS = 96;
+  static constexpr size_t HOUR_BUCKETS = 48;
+
+  explicit TimeSeriesBuffer(float resolution = 0.01f)
+      : resolution(resolution) {}
+
+  // Appends a reading. Readings older than the newest one are rejected.
+  bool add(uint32_t timeSec, const float (&values)[Channels]) {
+    if (sampleCount > 0 && timeSec < newestSec) {
+      return false;
+    }
+    Sample sample;
+    // Gaps longer than the delta can hold are clamped, the aggregates still
+    // land in the right buckets since they use timeSec directly
+    uint32_t delta = sampleCount > 0 ? timeSec - newestSec : 0;
+    sample.deltaSec = delta > UINT16_MAX ? UINT16_MAX : uint16_t(delta);
+    for (size_t c = 0; c < Channels; c++) {
+      sample.values[c] = quantize(values[c]);
+    }
+
+    if (sampleCount == Capacity) {
+      // Evicting the oldest moves the start time up to the next sample
+      size_t next = (head + 1) % Capacity;
+      oldestSec += samples[next].deltaSec;
+      head = next;
+      sampleCount--;
+    }
+    if (sampleCount == 0) {
+      oldestSec = timeSec;
+    }
+    samples[(head + sampleCount) % Capacity] = sample;
+    sampleCount++;
+    newestSec = timeSec;
+
+    minutes.add(timeSec, sample.values);
+    quarterHours.add(timeSec, sample.values);
+    hours.add(timeSec, sample.values);
+    return true;
+  }
+
+  size_t size() const { return sampleCount; }
+  static constexpr size_t capacity() { return Capacity; }
+  bool empty() const { return sampleCount == 0; }
+  uint32_t newestTimeSec() const { return newestSec; }
+  float getResolution() const { return resolution; }
+
+  // Calls fn(timeSec, const int16_t *values) for every sample, oldest first
+  template <typename Fn> void forEachSample(Fn fn) const {
+    uint32_t timeSec = oldestSec;
+    for (size_t i = 0; i < sampleCount; i++) {
+      const Sample &sample = samples[(head + i) % Capacity];
+      if (i > 0) {
+        timeSec += sample.deltaSec;
+      }
+      fn(timeSec, sample.values);
+    }
+  }
+
+  // Closed buckets for a level, index 0 is the oldest
+  size_t aggregateCount(TimeSeriesLevel level) const {
+    return ring(level).size();
+  }
+  const Aggregate &aggregateAt(TimeSeriesLevel level, size_t index) const {
+    return ring(level).at(index);
+  }
+  // Bucket still being filled, count is 0 before the first sample
+  const Aggregate &openAggregate(TimeSeriesLevel level) const {
+    return ring(level).open;
+  }
+
+  // Merges every closed bucket of level that starts in [fromSec, toSec)
+  Aggregate summarize(TimeSeriesLevel level, uint32_t fromSec,
+                      uint32_t toSec) const {
+    Aggregate result;
+    const LevelRing &levelRing = ring(level);
+    for (size_t i = 0; i < levelRing.size(); i++) {
+      const Aggregate &bucket = levelRing.at(i);
+      if (bucket.startSec >= fromSec && bucket.startSec < toSec) {
+        result.merge(bucket);
+      }
+    }
+    return result;
+  }
+
+  float toValue(int16_t quantized) const { return quantized * resolution; }
+
+  int16_t quantize(float value) const {
+    float scaled = std::round(value / resolution);
+    if (!(scaled > INT16_MIN)) { // Also catches NaN
+      return INT16_MIN + 1;
+    }
+    return scaled < INT16_MAX ? int16_t(scaled) : INT16_MAX;
+  }
+
+private:
+  struct Sample {
+    uint16_t deltaSec;
+    int16_t values[Channels];
+  };
+
+  // Ring of closed buckets plus the one being filled. Buckets are aligned
+  // to multiples of the period.
+  template <size_t Buckets> struct AggregateRing {
+    uint32_t periodSec;
+    Aggregate open;
+    Aggregate buckets[Buckets];
+    size_t first = 0;
+    size_t count = 0;
+
+    explicit AggregateRing(uint32_t periodSec) : periodSec(periodSec) {}
+
+    void add(uint32_t timeSec, const int16_t *values) {
+      uint32_t startSec = timeSec - timeSec % periodSec;
+      if (open.count > 0 && open.startSec != startSec) {
+        close();
+      }
+      if (open.count == 0) {
+        open.startSec = startSec;
+      }
+      open.add(values);
+    }
+
+    void close() {
+      if (count == Buckets) {
+        first = (first + 1) % Buckets;
+        count--;
+      }
+      buckets[(first + count) % Buckets] = open;
+      count++;
+      open = Aggregate();
+    }
+  };
+
+  // Uniform read access to the three differently sized rings
+  struct LevelRing {
+    const Aggregate *buckets;
+    size_t bucketCount;
+    size_t first;
+    size_t count;
+    const Aggregate &open;
+
+    size_t size() const { return count; }
+    const Aggregate &at(size_t index) const {
+      return buckets[(first + index) % bucketCount];
+    }
+  };
+
+  template <size_t Buckets>
+  static LevelRing view(const AggregateRing<Buckets> &r) {
+    return LevelRing{r.buckets, Buckets, r.first, r.count, r.open};
+  }
+
+  LevelRing ring(TimeSeriesLevel level) const {
+    switch (level) {
+    case TimeSeriesLevel::Minute:
+      return view(minutes);
+    case TimeSeriesLevel::QuarterHour:
+      return view(quarterHours);
+    default:
+      return view(hours);
+    }
+  }
+
+  float resolution;
+  Sample samples[Capacity];
+  size_t head = 0;
+  size_t sampleCount = 0;
+  uint32_t oldestSec = 0;
+  uint32_t newestSec = 0;
+
+  AggregateRing<MINUTE_BUCKETS> minutes{LEVEL_PERIOD_SEC[0]};
+  AggregateRing<QUARTER_HOUR_BUCKETS> quarterHours{LEVEL_PERIOD_SEC[1]};
+  AggregateRing<HOUR_BUCKETS> hours{LEVEL_PERIOD_SEC[2]};
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+// Formats a UTC timestamp the way Firestore expects it,
+// e.g. 2024-01-01T12:00:00Z or 2024-01-01T12:00:00.000000500Z. Writes into
+// the caller's buffer (32 bytes is enough) and returns the length, 0 when it
+// does not fit.
+inline size_t formatTimestamp(char *out, size_t size, uint64_t sec,
+                              uint32_t nano) {
+  // Latest second and nanosecond Firestore accepts
+  if (sec > 0x3afff4417f)
+    sec = 0x3afff4417f;
+
+  if (nano > 0x3b9ac9ff)
+    nano = 0x3b9ac9ff;
+
+  time_t now = sec;
+  struct tm ts;
+  gmtime_r(&now, &ts); // UTC
+  size_t length = strftime(out, size, "%Y-%m-%dT%H:%M:%S", &ts);
+  if (length == 0) {
+    return 0;
+  }
+  int written = nano > 0 ? snprintf(out + length, size - length, ".%09uZ",
+                                    static_cast<unsigned>(nano))
+                         : snprintf(out + length, size - length, "Z");
+  if (written < 0 || size_t(written) >= size - length) {
+    return 0;
+  }
+  return length + written;
+}
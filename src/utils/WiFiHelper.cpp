@@ -2,7 +2,8 @@
 // #include "firebase/FirebaseWrapper.h" // Include to resolve incomplete type
 
 // Initialize static members
-camera_message WiFiHelper::receivedData;
+CameraCommand WiFiHelper::receivedData;
+std::atomic<bool> WiFiHelper::linkUp{false};
 // FirebaseWrapper *WiFiHelper::firebaseWrapper = nullptr;
 
 WiFiHelper::WiFiHelper() {}
@@ -16,7 +17,7 @@ void WiFiHelper::defaultOnDataSent(const uint8_t *mac_addr,
 
 void WiFiHelper::defaultOnDataRecv(const uint8_t *mac_addr, const uint8_t *data,
                                    int data_len) {
-  memcpy(&receivedData, data, sizeof(receivedData));
+  parseCameraCommand(data, data_len, receivedData);
   // Serial.print("Bytes received: ");
   // Serial.println(data_len);
 }
@@ -47,6 +48,12 @@ void WiFiHelper::setupOTA() {
 
 void WiFiHelper::setupEspNow(bool isCameraBoard, RecvCallback recvCb,
                              SendCallback sendCb) {
+  if (espNowStarted) {
+    // The access point may have moved the radio to another channel
+    peerInfo.channel = WiFi.channel();
+    esp_now_mod_peer(&peerInfo);
+    return;
+  }
   if (esp_now_init() != ESP_OK) {
     // Serial.println("Error initializing ESP-NOW");
     return;
@@ -57,6 +64,10 @@ void WiFiHelper::setupEspNow(bool isCameraBoard, RecvCallback recvCb,
     memcpy(peerInfo.peer_addr, MAIN_BOARD_MAC_ADDRESS, 6);
   } else {
     esp_now_register_send_cb(sendCb ? sendCb : defaultOnDataSent);
+    // Main board only listens when it wants camera board stats
+    if (recvCb) {
+      esp_now_register_recv_cb(recvCb);
+    }
     memcpy(peerInfo.peer_addr, CAMERA_BOARD_MAC_ADDRESS, 6);
   }
 
@@ -70,82 +81,70 @@ void WiFiHelper::setupEspNow(bool isCameraBoard, RecvCallback recvCb,
     // Serial.println("Failed to add peer");
     return;
   }
+  espNowStarted = true;
   // Serial.println("ESP-NOW initialized");
 }
 
-void WiFiHelper::connectAndSyncTime(bool shouldSetupOTA,
-                                    bool shouldSetupTimeSync) {
+void WiFiHelper::begin(bool shouldSetupOTA, bool shouldSetupTimeSync) {
   // Serial.print("Connecting to ");
   // Serial.println(WIFI_SSID);
+  this->shouldSetupOTA = shouldSetupOTA;
+  this->shouldSetupTimeSync = shouldSetupTimeSync;
+  connectivity.setRequireTime(shouldSetupTimeSync);
 
+  WiFi.onEvent(onWiFiEvent);
   WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  // Reconnects are paced by maintain(), the driver retrying on its own after
+  // every disconnect would defeat the backoff
+  WiFi.setAutoReconnect(false);
+  maintain(); // First attempt right away
+}
 
-  uint8_t attempt = 0;
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(WIFI_RETRY_DELAY_MS);
-    // Serial.print(".");
-    if (++attempt > MAX_WIFI_RETRIES) {
-      // Serial.println("\nWiFi connection failed!");
-      // // Only log if FirebaseWrapper is available (it won't be during
-      // initial
-      // // setup)
-      // if (firebaseWrapper) {
-      //   firebaseWrapper->logStatusEvent(
-      //       "WiFi connection failed after max retries", "error");
-      // }
-      return;
-    }
+void WiFiHelper::onWiFiEvent(arduino_event_id_t event) {
+  switch (event) {
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    linkUp.store(true, std::memory_order_relaxed);
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    linkUp.store(false, std::memory_order_relaxed);
+    break;
+  default:
+    break;
   }
-  delay(1000); // Wait a moment for connection to stabilize
-  // Serial.println("\nWiFi connected!");
-  // // Only log if FirebaseWrapper is available
-  // if (firebaseWrapper) {
-  //   firebaseWrapper->logStatusEvent("WiFi connected successfully",
-  //   "info");
-  // }
-  // Serial.print("IP Address: ");
-  // Serial.println(WiFi.localIP());
-  // Serial.print("MAC Address: ");
-  // Serial.println(WiFi.macAddress());
+}
 
-  if (shouldSetupOTA) {
-    setupOTA();
+void WiFiHelper::maintain() {
+  bool timeValid =
+      shouldSetupTimeSync && time(nullptr) >= MIN_VALID_EPOCH_SEC;
+  if (connectivity.update(millis(), linkUp.load(std::memory_order_relaxed),
+                          timeValid)) {
+    // Serial.println("WiFi down, connecting...");
+    // Drops an attempt that is still associating before starting over
+    WiFi.disconnect();
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  }
+  if (!connectivity.isLinkUp()) {
+    return;
   }
 
-  if (shouldSetupTimeSync) {
+  // Both keep running on their own across reconnects once started
+  if (shouldSetupOTA && !otaStarted) {
+    setupOTA();
+    otaStarted = true;
+  }
+  if (shouldSetupTimeSync && !timeSyncStarted) {
     // Serial.println("Synchronizing time with NTP server...");
     configTzTime(tzInfo, ntpServer);
-
-    struct tm timeinfo;
-    while (!getLocalTime(&timeinfo)) {
-      // Serial.println("Waiting for NTP time sync...");
-      delay(500);
-    }
-
-    // Serial.print("Time synced: ");
-    // Serial.println(asctime(&timeinfo));
+    timeSyncStarted = true;
   }
-}
-
-void WiFiHelper::maintain() {
-  if (WiFi.status() != WL_CONNECTED) {
-    // Serial.println("WiFi lost, reconnecting...");
-    // // This will work since maintain() is called after FirebaseApp is
-    // // initialized
-    // if (firebaseWrapper) {
-    //   firebaseWrapper->logStatusEvent("WiFi connection lost,
-    //   reconnecting",
-    //                                   "warning");
-    // }
-    WiFi.disconnect();
-    WiFi.reconnect();
+  if (otaStarted) {
+    ArduinoOTA.handle();
   }
-  ArduinoOTA.handle();
 }
 
 bool WiFiHelper::getLocalTimeWithDST(struct tm &timeinfo) {
-  if (!getLocalTime(&timeinfo)) {
+  if (!getLocalTime(&timeinfo, 0)) {
     // Serial.println("Failed to obtain time");
     return false;
   }
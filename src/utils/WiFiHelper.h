@@ -1,9 +1,11 @@
 #pragma once
 #include "../config/Credentials.h"
+#include "Connectivity.h"
 #include "MessageTypes.h"
 #include <Arduino.h>
 #include <ArduinoOTA.h>
 #include <WiFi.h>
+#include <atomic>
 #include <esp_now.h>
 
 // // Forward declaration to avoid circular dependency
@@ -13,7 +15,9 @@
 using SendCallback = void (*)(const uint8_t *, esp_now_send_status_t);
 using RecvCallback = void (*)(const uint8_t *, const uint8_t *, int);
 
-// Class to manage WiFi, ESP-NOW, OTA, and NTP time sync
+// Class to manage WiFi, ESP-NOW, OTA, and NTP time sync. Nothing here blocks:
+// begin() only starts the connection, maintain() reconnects with backoff and
+// reports link and time sync changes to the listeners, see Connectivity.h.
 class WiFiHelper {
 public:
   WiFiHelper();
@@ -28,19 +32,40 @@ public:
   static void defaultOnDataRecv(const uint8_t *mac_addr, const uint8_t *data,
                                 int data_len);
   void setupOTA();
+  // Needs the link up for the channel, calling it again after a reconnect
+  // moves the peer to the access point's current channel
   void setupEspNow(bool isCameraBoard = false, RecvCallback recvCb = nullptr,
                    SendCallback sendCb = nullptr);
-  void connectAndSyncTime(bool shouldSetupOTA = false,
-                          bool shouldSetupTimeSync = false);
+  // Starts connecting and returns right away. With time sync, being online
+  // also waits for the first NTP answer.
+  void begin(bool shouldSetupOTA = false, bool shouldSetupTimeSync = false);
+  // Call from loop(), runs the listeners when something changed
   void maintain();
+  bool addListener(Connectivity::Listener listener) {
+    return connectivity.addListener(listener);
+  }
+  bool isLinkUp() const { return connectivity.isLinkUp(); }
+  bool isOnline() const { return connectivity.isOnline(); }
+  bool isTimeSynced() const { return connectivity.isTimeValid(); }
+  // Fails right away instead of waiting while the time is not synced
   bool getLocalTimeWithDST(struct tm &timeinfo);
 
-  static camera_message receivedData;
+  static CameraCommand receivedData;
   esp_now_peer_info_t peerInfo;
 
 private:
-  static constexpr int WIFI_RETRY_DELAY_MS = 250;
-  static constexpr int MAX_WIFI_RETRIES = 30;
+  static void onWiFiEvent(arduino_event_id_t event);
+  // Set from the WiFi event task, read by maintain()
+  static std::atomic<bool> linkUp;
+
+  Connectivity connectivity;
+  bool shouldSetupOTA = false;
+  bool shouldSetupTimeSync = false;
+  bool otaStarted = false;
+  bool timeSyncStarted = false;
+  bool espNowStarted = false;
+  // Anything before this is the clock running from boot, not NTP time
+  static constexpr time_t MIN_VALID_EPOCH_SEC = 1704067200; // 2024-01-01
   static constexpr const char *ntpServer = "pool.ntp.org";
   static constexpr const char *tzInfo = "PST8PDT,M3.2.0/2,M11.1.0/2";
   // static FirebaseWrapper *firebaseWrapper; // Static pointer for callback
@@ -0,0 +1,99 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Stream events below a device's whole state only carry what was written.
+// A put at a path replaces the value there. A patch replaces each child it
+// holds, like RTDB's update(), and child keys can be paths themselves. A
+// null value removes the key. Merging the event into the state applied last
+// gives the device's whole desired state again, which is what applyState()
+// and DeviceStateStore expect.
+// No Arduino dependencies.
+constexpr size_t DESIRED_KEY_SIZE = 32;
+// Largest merged state, as MessagePack, that filterDesiredState() handles
+constexpr size_t DESIRED_PACKED_SIZE = 512;
+
+// Object holding the last segment of a slash separated path below parent,
+// created on the way, with that segment copied into key. Null when a segment
+// is empty or does not fit.
+inline JsonObject desiredStateParent(JsonObject parent, const char *path,
+                                     char *key, size_t keySize) {
+  for (;;) {
+    size_t length = strcspn(path, "/");
+    if (length == 0 || length >= keySize) {
+      return JsonObject();
+    }
+    memcpy(key, path, length);
+    key[length] = '\0';
+    if (path[length] == '\0') {
+      return parent;
+    }
+    JsonObject child = parent[key].as<JsonObject>();
+    if (child.isNull()) {
+      child = parent[key].to<JsonObject>();
+    }
+    parent = child;
+    path += length + 1;
+  }
+}
+
+inline void setDesiredValue(JsonObject state, const char *path,
+                            JsonVariantConst value) {
+  char key[DESIRED_KEY_SIZE];
+  JsonObject parent = desiredStateParent(state, path, key, sizeof(key));
+  if (parent.isNull()) {
+    return;
+  }
+  if (value.isNull()) {
+    parent.remove(key);
+  } else {
+    parent[key] = value;
+  }
+}
+
+// Applies a put or patch event at path, relative to the device's state and
+// empty for the whole state
+inline void mergeDesiredEvent(JsonDocument &state, const char *path,
+                              JsonVariantConst data, bool patch) {
+  if (!patch && *path == '\0') {
+    state.set(data);
+    return;
+  }
+  JsonObject target = state.is<JsonObject>() ? state.as<JsonObject>()
+                                             : state.to<JsonObject>();
+  if (!patch) {
+    setDesiredValue(target, path, data);
+    return;
+  }
+  if (*path != '\0') {
+    char key[DESIRED_KEY_SIZE];
+    JsonObject parent = desiredStateParent(target, path, key, sizeof(key));
+    if (parent.isNull()) {
+      return;
+    }
+    target = parent[key].as<JsonObject>();
+    if (target.isNull()) {
+      target = parent[key].to<JsonObject>();
+    }
+  }
+  for (JsonPairConst child : data.as<JsonObjectConst>()) {
+    setDesiredValue(target, child.key().c_str(), child.value());
+  }
+}
+
+// Copies what filter keeps of state into out, the same as parsing with
+// DeserializationOption::Filter. A merged state is only filtered afterwards
+// because the event alone does not say where in the filter it belongs.
+// Returns false when state is too big.
+inline bool filterDesiredState(JsonVariantConst state, JsonDocument &filter,
+                               JsonDocument &out) {
+  uint8_t packed[DESIRED_PACKED_SIZE];
+  if (measureMsgPack(state) > sizeof(packed)) {
+    return false;
+  }
+  size_t length = serializeMsgPack(state, packed, sizeof(packed));
+  return !deserializeMsgPack(out, packed, length,
+                             DeserializationOption::Filter(filter));
+}
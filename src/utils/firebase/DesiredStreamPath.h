@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// The board streams only the desired node (FIREBASE_DESIRED_PATH), laid out
+// as desired/<device>, so event paths are relative to it.
+enum class DesiredStreamPath : uint8_t {
+  Snapshot, // "/", every device's desired state
+  Device,   // "/<device>", one device's desired state
+  Field,    // "/<device>/<field...>", part of one device's desired state
+  Ignored,  // Not a put or patch, or a path that does not fit
+};
+
+// Splits "<device>/<field...>" into the device name and the path below it,
+// empty for the whole state. Returns false when either does not fit.
+inline bool splitDesiredPath(const char *path, char *name, size_t nameSize,
+                             char *field, size_t fieldSize) {
+  size_t length = strcspn(path, "/");
+  const char *rest = path[length] == '/' ? path + length + 1 : path + length;
+  size_t restLength = strlen(rest);
+  if (length == 0 || length >= nameSize || restLength >= fieldSize) {
+    return false;
+  }
+  memcpy(name, path, length);
+  name[length] = '\0';
+  memcpy(field, rest, restLength + 1);
+  return true;
+}
+
+// Classifies a stream event by its type and path alone, before the payload
+// is copied or parsed. Only put and patch carry data, keep-alive, cancel and
+// auth_revoked are Ignored. For Device and Field the name is copied into
+// name and the path below the device into field.
+inline DesiredStreamPath
+classifyDesiredStreamPath(const char *event, const char *path, char *name,
+                          size_t nameSize, char *field, size_t fieldSize) {
+  if (strcmp(event, "put") != 0 && strcmp(event, "patch") != 0) {
+    return DesiredStreamPath::Ignored;
+  }
+  if (*path == '/') {
+    path++;
+  }
+  if (*path == '\0') {
+    return DesiredStreamPath::Snapshot;
+  }
+  if (!splitDesiredPath(path, name, nameSize, field, fieldSize)) {
+    return DesiredStreamPath::Ignored;
+  }
+  return *field == '\0' ? DesiredStreamPath::Device : DesiredStreamPath::Field;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Messages passed between the control loop and the Firebase network task,
+// see FirebaseWrapper. Both are fixed size so the queues never allocate.
+constexpr size_t FIREBASE_PATH_SIZE = 112;
+constexpr size_t FIREBASE_PAYLOAD_SIZE = 512;
+constexpr size_t FIREBASE_DEVICE_NAME_SIZE = 32;
+constexpr size_t FIREBASE_FIELD_PATH_SIZE = 64;
+
+// Control loop -> network task
+struct FirebaseCommand {
+  enum class Type : uint8_t {
+    SetString,   // payload is a C string
+    SetFloat,    // number
+    SetJson,     // payload is a JSON document
+    LogRecord,   // payload is a spool record, length bytes
+    FlushWrites, // end of a control tick, send the batched writes
+  };
+  Type type;
+  uint16_t length;
+  float number;
+  char path[FIREBASE_PATH_SIZE];
+  char payload[FIREBASE_PAYLOAD_SIZE];
+};
+
+// Network task -> control loop
+struct DesiredStateUpdate {
+  bool initial; // From the stream's snapshot on (re)connect, not a change
+  // json only holds the children that were written, not the whole value
+  bool patch;
+  char deviceName[FIREBASE_DEVICE_NAME_SIZE];
+  // Slash separated path below the device that json was written to, empty
+  // for the whole state
+  char field[FIREBASE_FIELD_PATH_SIZE];
+  char json[FIREBASE_PAYLOAD_SIZE];
+};
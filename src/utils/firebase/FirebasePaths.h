@@ -0,0 +1,27 @@
+#pragma once
+#include "../../config/Credentials.h"
+#include <cstddef>
+
+// Fixed database paths, concatenated at compile time from the credential
+// string macros so writing to them never builds a String at runtime.
+#define FIREBASE_BASE_PATH                                                     \
+  "users/" FIREBASE_USER_ID "/tanks/" FIREBASE_TANK_NAME
+// Written by the web app as desired/<device> and streamed by the board.
+// Reported state stays at devices/<device>/reported, outside the stream.
+#define FIREBASE_DESIRED_PATH FIREBASE_BASE_PATH "/desired"
+#define FIREBASE_DEVICES_PATH FIREBASE_BASE_PATH "/devices"
+#define FIREBASE_LOG_BASE_PATH                                                 \
+  "user_logs/" FIREBASE_USER_NAME "/tanks/" FIREBASE_TANK_NAME
+
+// Handle for a fixed path: the literal and its length, so the path can be
+// copied into a command without measuring it again
+struct FirebasePath {
+  const char *value;
+  size_t length;
+};
+
+// FIREBASE_PATH("/status/time") is the handle for <base path>/status/time
+#define FIREBASE_PATH(suffix)                                                  \
+  FirebasePath {                                                               \
+    FIREBASE_BASE_PATH suffix, sizeof(FIREBASE_BASE_PATH suffix) - 1           \
+  }
@@ -1,22 +1,62 @@
 #include "FirebaseWrapper.h"
+#include <LittleFS.h>
 
 // Static member initialization
-String FirebaseWrapper::lastUpdatedDeviceName = "";
+FirebaseWrapper *FirebaseWrapper::networkInstance = nullptr;
+uint32_t FirebaseWrapper::logSpoolBatchId = 0;
+uint8_t FirebaseWrapper::logSpoolBatchSize = 0;
+bool FirebaseWrapper::logSpoolBatchDone = false;
+bool FirebaseWrapper::logSpoolBatchFailed = false;
+
+namespace {
+constexpr const char *LOG_SPOOL_TASK_PREFIX = "spoolLogTask:";
+
+// Rebuilds a Firestore value from spooled JSON
+Values::Value toFirestoreValue(JsonVariantConst value) {
+  if (value.is<bool>()) {
+    return Values::Value(Values::BooleanValue(value.as<bool>()));
+  }
+  if (value.is<int64_t>()) {
+    return Values::Value(Values::IntegerValue(value.as<int64_t>()));
+  }
+  if (value.is<double>()) {
+    return Values::Value(Values::DoubleValue(value.as<double>()));
+  }
+  if (value.is<const char *>()) {
+    return Values::Value(Values::StringValue(value.as<const char *>()));
+  }
+  if (value.is<JsonObjectConst>()) {
+    Values::MapValue map;
+    for (JsonPairConst field : value.as<JsonObjectConst>()) {
+      map.add(field.key().c_str(), toFirestoreValue(field.value()));
+    }
+    return Values::Value(map);
+  }
+  return Values::Value(Values::NullValue());
+}
+} // namespace
 
 FirebaseWrapper::FirebaseWrapper(const char *apiKey, const char *email,
                                  const char *password, const char *dbUrl)
     : userAuth(apiKey, email, password), asyncClient(sslClient),
-      databaseUrl(dbUrl) {}
+      writeBatch(FIREBASE_BASE_PATH), databaseUrl(dbUrl) {}
 
-void FirebaseWrapper::begin(const char *dataStreamPath) {
+void FirebaseWrapper::begin(const char *dataStreamPath,
+                            DeviceStateStore *deviceStates) {
+  this->deviceStates = deviceStates;
   // Attach ssl clients to their respective async clients
   asyncClient.setClient(sslClient);
   dataStreamClient.setClient(dataStreamSslClient);
 
   sslClient.setInsecure(); // skip cert check for now
-  sslClient.setHandshakeTimeout(5);
+  sslClient.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT_SEC);
   dataStreamSslClient.setInsecure();
-  dataStreamSslClient.setHandshakeTimeout(5);
+  dataStreamSslClient.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT_SEC);
+
+  // Log spool lives on the data partition, formatted on first use
+  logSpoolMounted = LittleFS.begin(true) && logSpool.begin();
+  // Whatever is left from before the reboot goes out as soon as possible
+  logBatchBacklog = logSpoolMounted && !logSpool.empty();
 
   // Initialize app with async client and user auth, no callback
   initializeApp(asyncClient, app, getAuth(userAuth));
@@ -38,49 +78,102 @@ void FirebaseWrapper::begin(const char *dataStreamPath) {
     // dataStreamPath);
     subscribeValue(dataStreamPath);
   }
-}
-String FirebaseWrapper::getBaseDatabasePath() {
-  return "users/" + String(FIREBASE_USER_ID) + "/tanks/" +
-         String(FIREBASE_TANK_NAME);
-};
-
-String FirebaseWrapper::getBaseLogPath() {
-  return "user_logs/" + String(FIREBASE_USER_NAME) + "/tanks/" +
-         String(FIREBASE_TANK_NAME);
-};
 
+  // From here on only the network task touches the clients
+  networkInstance = this;
+  xTaskCreate(networkTask, "firebase", NETWORK_TASK_STACK_SIZE, this, 1,
+              &networkTaskHandle);
+}
 void FirebaseWrapper::logSensorEvent(
     const char *sensorName, std::optional<std::tuple<float, float>> sensorData,
     const char *label1, const char *label2) {
-  String documentPath =
-      getBaseLogPath() + "/sensors/" + String(sensorName) + "/events/";
-
-  // Use current time in seconds since epoch
-  time_t now;
-  time(&now);
-  Values::TimestampValue timeStampV(getTimestampString(now, 0));
-
-  Document<Values::Value> doc("timeString", Values::Value(timeStampV));
-
-  Values::MapValue map;
+  JsonDocument fields;
+  JsonObject data = fields["data"].to<JsonObject>();
   if (sensorData) {
     auto [sensorValue, sensorValue2] = *sensorData;
-    Values::DoubleValue sensorValueV(sensorValue);
-    Values::DoubleValue sensorValue2V(sensorValue2);
-    map.add(label1, Values::Value(sensorValueV))
-        .add(label2, Values::Value(sensorValue2V));
+    data[label1] = sensorValue;
+    data[label2] = sensorValue2;
   } else {
-    Values::StringValue errorMsgV("sensor read failed");
-    map.add("error", Values::Value(errorMsgV));
+    data["error"] = "sensor read failed";
   }
+  char collection[FIREBASE_PATH_SIZE];
+  snprintf(collection, sizeof(collection), "sensors/%s/events", sensorName);
+  postLogRecord(collection, time(nullptr), fields);
+}
 
-  doc.add("data", Values::Value(map));
+namespace {
+// Minute means as comma separated deltas from the previous present minute,
+// the first one absolute, in units of the resolution. Minutes without data
+// are left empty, e.g. "7712,3,,-1".
+String encodeMinuteMeans(const SensorHistory &history, size_t channel,
+                         uint32_t hourStartSec) {
+  String encoded;
+  encoded.reserve(240);
+  int32_t previous = 0;
+  bool havePrevious = false;
+  size_t next = 0;
+  size_t count = history.aggregateCount(TimeSeriesLevel::Minute);
+  for (uint32_t minute = 0; minute < 60; minute++) {
+    uint32_t startSec = hourStartSec + minute * 60;
+    while (next < count &&
+           history.aggregateAt(TimeSeriesLevel::Minute, next).startSec <
+               startSec) {
+      next++;
+    }
+    if (minute > 0) {
+      encoded += ',';
+    }
+    if (next == count ||
+        history.aggregateAt(TimeSeriesLevel::Minute, next).startSec !=
+            startSec) {
+      continue;
+    }
+    int32_t mean =
+        history.aggregateAt(TimeSeriesLevel::Minute, next).mean(channel);
+    encoded += String(havePrevious ? mean - previous : mean);
+    previous = mean;
+    havePrevious = true;
+  }
+  return encoded;
+}
 
-  // Async call with callback function.
-  this->firestoreDocs.createDocument(
-      this->asyncClient, Firestore::Parent(FIREBASE_PROJECT_ID), documentPath,
-      DocumentMask(), doc, &FirebaseWrapper::onLogResultStatic,
-      "createDocumentTask");
+void summarizeChannel(JsonObject summary, const SensorHistory &history,
+                      const SensorHistory::Aggregate &hour, size_t channel,
+                      uint32_t hourStartSec) {
+  summary["min"] = history.toValue(hour.min[channel]);
+  summary["max"] = history.toValue(hour.max[channel]);
+  summary["mean"] = history.toValue(hour.mean(channel));
+  summary["minutes"] = encodeMinuteMeans(history, channel, hourStartSec);
+}
+} // namespace
+
+bool FirebaseWrapper::logSensorHistory(const char *sensorName,
+                                       const SensorHistory &history,
+                                       uint32_t hourStartSec,
+                                       const char *label1,
+                                       const char *label2) {
+  SensorHistory::Aggregate hour = history.summarize(
+      TimeSeriesLevel::Minute, hourStartSec, hourStartSec + 3600);
+  if (hour.count == 0) {
+    return true;
+  }
+  JsonDocument fields;
+  fields["samples"] = hour.count;
+  fields["resolution"] = history.getResolution();
+  JsonObject data = fields["data"].to<JsonObject>();
+  summarizeChannel(data[label1].to<JsonObject>(), history, hour, 0,
+                   hourStartSec);
+  summarizeChannel(data[label2].to<JsonObject>(), history, hour, 1,
+                   hourStartSec);
+
+  // A noisy hour can outgrow a command, the hourly summary still fits
+  if (measureMsgPack(fields) > FIREBASE_PAYLOAD_SIZE - 64) {
+    data[label1].remove("minutes");
+    data[label2].remove("minutes");
+  }
+  char collection[FIREBASE_PATH_SIZE];
+  snprintf(collection, sizeof(collection), "sensors/%s/hourly", sensorName);
+  return postLogRecord(collection, hourStartSec, fields);
 }
 
 // void FirebaseWrapper::logStatusEvent(const char *statusMessage,
@@ -102,73 +195,391 @@ void FirebaseWrapper::logSensorEvent(
 //       "createDocumentTask");
 // }
 
-void FirebaseWrapper::logDeviceEvent(Values::MapValue &map,
+void FirebaseWrapper::logDeviceEvent(JsonVariantConst data,
                                      const char *deviceName,
                                      const char *event_type,
                                      const char *event_desc) {
+  JsonDocument fields;
+  fields["eventType"] = event_type;
+  fields["eventDesc"] = event_desc;
+  fields["data"] = data;
+  char collection[FIREBASE_PATH_SIZE];
+  snprintf(collection, sizeof(collection), "devices/%s/events", deviceName);
+  postLogRecord(collection, time(nullptr), fields);
+}
 
-  String documentPath =
-      getBaseLogPath() + "/devices/" + String(deviceName) + "/events/";
-
-  // Use current time in seconds since epoch
-  time_t now;
-  time(&now);
-  Values::TimestampValue timeStampV(getTimestampString(now, 0));
+// Records are MessagePack {"c": collection under the log path, "t": epoch
+// seconds when the event happened, "f": document fields}
+bool FirebaseWrapper::postLogRecord(const char *collection, time_t timeSec,
+                                    JsonDocument &fields) {
+  if (logSpoolFull.load(std::memory_order_relaxed)) {
+    refusedLogRecords++;
+    return false;
+  }
+  JsonDocument record;
+  record["c"] = collection;
+  record["t"] = int64_t(timeSec);
+  record["f"] = fields;
+  if (measureMsgPack(record) > FIREBASE_PAYLOAD_SIZE) {
+    return false;
+  }
+  FirebaseCommand *command =
+      reserveCommand(FirebaseCommand::Type::LogRecord, "");
+  if (!command) {
+    return false;
+  }
+  command->length = serializeMsgPack(record, command->payload,
+                                     sizeof(command->payload));
+  commands.publish();
+  return true;
+}
 
-  Values::StringValue eventTypeV(event_type);
-  Values::StringValue eventDescV(event_desc);
+void FirebaseWrapper::spoolLogRecord(const uint8_t *record, size_t length) {
+  if (logSpoolMounted && logSpool.append(record, length)) {
+    if (logBatchQueued++ == 0) {
+      logBatchOldestMs = millis();
+    }
+    logSpoolFull.store(logSpool.segmentCount() >= LOG_SPOOL_MAX_SEGMENTS,
+                       std::memory_order_relaxed);
+    return;
+  }
+  // No spool to fall back on, send straight away as a batch of one
+  JsonDocument decoded;
+  LogWrite write;
+  if (ready() && decodeLogWrite(record, length, FIREBASE_LOG_BASE_PATH,
+                                decoded, write)) {
+    Writes writes(logRecordWrite(write));
+    firestoreDocs.batchWrite(asyncClient,
+                             Firestore::Parent(FIREBASE_PROJECT_ID), writes,
+                             &FirebaseWrapper::onLogResultStatic,
+                             "batchWriteTask");
+  }
+}
 
+Write FirebaseWrapper::logRecordWrite(const LogWrite &write) {
+  Values::TimestampValue timeStampV(write.timeString);
   Document<Values::Value> doc("timeString", Values::Value(timeStampV));
-  doc.add("eventType", Values::Value(eventTypeV))
-      .add("eventDesc", Values::Value(eventDescV))
-      .add("data", Values::Value(map));
-  // Async call with callback function.
-  this->firestoreDocs.createDocument(
-      this->asyncClient, Firestore::Parent(FIREBASE_PROJECT_ID), documentPath,
-      DocumentMask(), doc, &FirebaseWrapper::onLogResultStatic,
-      "createDocumentTask");
+  for (JsonPairConst field : write.fields) {
+    doc.add(field.key().c_str(), toFirestoreValue(field.value()));
+  }
+  doc.setName(write.path);
+  // No precondition, writing the same document again just replaces it
+  return Write(DocumentMask(), doc, Precondition());
+}
+
+bool FirebaseWrapper::logBatchDue() const {
+  if (logBatchRetrying) {
+    return millis() - logBatchFailedMs >= LOG_BATCH_INTERVAL_MS;
+  }
+  return logBatchBacklog || logBatchQueued >= LOG_BATCH_MAX_RECORDS ||
+         (logBatchQueued > 0 &&
+          millis() - logBatchOldestMs >= LOG_BATCH_INTERVAL_MS);
+}
+
+// Spooled records go out LOG_BATCH_MAX_RECORDS at a time as one Firestore
+// batchWrite, so a batch costs one request instead of one per event. The
+// records are only acknowledged once every write in the batch succeeded, a
+// failed batch is sent again after LOG_BATCH_INTERVAL_MS.
+void FirebaseWrapper::drainLogSpool() {
+  if (!logSpoolMounted) {
+    return;
+  }
+  if (logSpoolBatchSize > 0) {
+    bool failed = logSpoolBatchFailed;
+    if (!logSpoolBatchDone) {
+      if (millis() - logSpoolBatchSentMs <= LOG_SPOOL_TIMEOUT_MS) {
+        return;
+      }
+      failed = true;
+    }
+    if (failed) {
+      logSpool.rewind();
+      logBatchQueued += logSpoolBatchSize;
+      logBatchRetrying = true;
+      logBatchFailedMs = millis();
+    } else {
+      logSpool.commit();
+      logBatchRetrying = false;
+      // A full batch may have left more behind
+      logBatchBacklog = logSpoolBatchSize == LOG_BATCH_MAX_RECORDS &&
+                        !logSpool.empty();
+      logSpoolFull.store(logSpool.segmentCount() >= LOG_SPOOL_MAX_SEGMENTS,
+                         std::memory_order_relaxed);
+    }
+    logSpoolBatchSize = 0;
+    return;
+  }
+  if (!ready() || logSpool.empty() || !logBatchDue()) {
+    return;
+  }
+
+  std::optional<Writes> writes;
+  uint8_t sent = readLogBatch(
+      logSpool, FIREBASE_LOG_BASE_PATH, logSpoolRecord, sizeof(logSpoolRecord),
+      LOG_BATCH_MAX_RECORDS, [&](const LogWrite &write) {
+        if (writes) {
+          writes->add(logRecordWrite(write));
+        } else {
+          writes.emplace(logRecordWrite(write));
+        }
+      });
+  logBatchQueued = logBatchQueued > sent ? logBatchQueued - sent : 0;
+  if (sent == 0) {
+    logSpool.commit();
+    logBatchBacklog = false;
+    return;
+  }
+
+  logSpoolBatchId++;
+  String taskId = String(LOG_SPOOL_TASK_PREFIX) + String(logSpoolBatchId);
+  logSpoolBatchDone = false;
+  logSpoolBatchFailed = false;
+  logSpoolBatchSentMs = millis();
+  logSpoolBatchSize = sent;
+  firestoreDocs.batchWrite(asyncClient, Firestore::Parent(FIREBASE_PROJECT_ID),
+                           *writes, &FirebaseWrapper::onLogResultStatic,
+                           taskId);
 }
 
 void FirebaseWrapper::loop() {
-  app.loop();
-
-  // One time initialization to update devices to last desired state in database
-  // Struggled getting this done in setup since the database connections dont
-  // have time to settle
-  if (app.ready() && !devicesInitialized) {
-    fetchAndApplyDesiredStates();
-    devicesInitialized = true;
-  }
-
-  if (app.ready() && !FirebaseWrapper::lastUpdatedDeviceName.isEmpty()) {
-    auto device = Device::getDevice(
-        FirebaseWrapper::lastUpdatedDeviceName.c_str()); // get device pointer
-    if (device) {
-      Values::MapValue map;
-      device->logState(map);
-      logDeviceEvent(map, FirebaseWrapper::lastUpdatedDeviceName.c_str(),
-                     "update_state", "");
+  DesiredStateUpdate *update;
+  while ((update = desiredUpdates.peek())) {
+    applyDesiredState(*update);
+    desiredUpdates.drop();
+  }
+}
+
+void FirebaseWrapper::applyDesiredState(const DesiredStateUpdate &update) {
+  auto device = Device::getDevice(update.deviceName); // get device pointer
+  if (!device) {
+    return;
+  }
+  // The documents release the arena when they go out of scope
+  JsonDocument filter(&desiredStateArena);
+  device->desiredStateFilter(filter);
+  // A patch or a value below the device only holds what changed. It is
+  // merged into the state saved last, or into nothing without a store, and
+  // the result filtered. Whole states are filtered while parsing.
+  bool merge = update.patch || update.field[0] != '\0';
+  JsonDocument doc(&desiredStateArena);
+  JsonDocument state;
+  DeserializationError err =
+      merge ? deserializeJson(doc, update.json)
+            : deserializeJson(doc, update.json,
+                              DeserializationOption::Filter(filter));
+  if (err) {
+    // Serial.printf("Failed to parse JSON: %s\n", err.c_str());
+    if (update.initial) {
+      logDeviceEvent(state, update.deviceName, "error", err.c_str());
+    }
+    return;
+  }
+  JsonDocument merged(&desiredStateArena);
+  if (merge) {
+    JsonDocument current(&desiredStateArena);
+    if (deviceStates) {
+      deviceStates->load(*device, current);
+    }
+    mergeDesiredEvent(current, update.field, doc.as<JsonVariantConst>(),
+                      update.patch);
+    if (!filterDesiredState(current.as<JsonVariantConst>(), filter,
+                            merged)) {
+      return;
     }
+  }
+  JsonVariantConst desired = merge ? merged.as<JsonVariantConst>()
+                                   : doc.as<JsonVariantConst>();
+  // Unchanged, e.g. the snapshot after a reconnect or the state restored at
+  // boot. Otherwise it is saved before applying it.
+  if (deviceStates && !deviceStates->update(*device, desired)) {
+    return;
+  }
+  device->applyState(desired);
+  device->logState(state);
+  if (update.initial) {
+    logDeviceEvent(state, update.deviceName, "initial_state",
+                   "Initial desired state applied to device successfully");
+  } else {
+    logDeviceEvent(state, update.deviceName, "update_state", "");
+  }
+}
 
-    FirebaseWrapper::lastUpdatedDeviceName = "";
+FirebaseCommand *FirebaseWrapper::reserveCommand(FirebaseCommand::Type type,
+                                                 const char *path,
+                                                 size_t pathLength) {
+  FirebaseCommand *command = commands.reserve();
+  // A truncated path would write somewhere else, drop it instead
+  if (!command || pathLength >= sizeof(command->path)) {
+    droppedCommands++;
+    return nullptr;
   }
+  command->type = type;
+  command->length = 0;
+  command->number = 0;
+  memcpy(command->path, path, pathLength);
+  command->path[pathLength] = '\0';
+  return command;
 }
 
 void FirebaseWrapper::setValue(const char *path, const char *value) {
-  if (app.ready()) {
-    database.set<const char *>(asyncClient, path, value,
-                               &FirebaseWrapper::onSetResultStatic,
-                               "dbSetTask");
+  if (!value || strlen(value) >= FIREBASE_PAYLOAD_SIZE) {
+    droppedCommands++;
+    return;
+  }
+  FirebaseCommand *command =
+      reserveCommand(FirebaseCommand::Type::SetString, path);
+  if (command) {
+    strcpy(command->payload, value);
+    commands.publish();
+    writesPending = true;
   }
 }
 
 void FirebaseWrapper::setValue(const char *path, float value) {
-  if (app.ready()) {
-    database.set<float>(asyncClient, path, value,
-                        &FirebaseWrapper::onSetResultStatic, "dbSetTask");
+  FirebaseCommand *command =
+      reserveCommand(FirebaseCommand::Type::SetFloat, path);
+  if (command) {
+    command->number = value;
+    commands.publish();
+    writesPending = true;
   }
 }
 
+void FirebaseWrapper::setValue(const FirebasePath &path, const char *value) {
+  if (!value || strlen(value) >= FIREBASE_PAYLOAD_SIZE) {
+    droppedCommands++;
+    return;
+  }
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetString,
+                                            path.value, path.length);
+  if (command) {
+    strcpy(command->payload, value);
+    commands.publish();
+    writesPending = true;
+  }
+}
+
+void FirebaseWrapper::setValue(const FirebasePath &path, float value) {
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetFloat,
+                                            path.value, path.length);
+  if (command) {
+    command->number = value;
+    commands.publish();
+    writesPending = true;
+  }
+}
+
+void FirebaseWrapper::setValue(const FirebasePath &path,
+                               JsonVariantConst value) {
+  if (measureJson(value) >= FIREBASE_PAYLOAD_SIZE) {
+    droppedCommands++;
+    return;
+  }
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetJson,
+                                            path.value, path.length);
+  if (command) {
+    serializeJson(value, command->payload, sizeof(command->payload));
+    commands.publish();
+    writesPending = true;
+  }
+}
+
+void FirebaseWrapper::flushWrites() {
+  if (!writesPending) {
+    return;
+  }
+  if (reserveCommand(FirebaseCommand::Type::FlushWrites, "")) {
+    commands.publish();
+    writesPending = false;
+  }
+}
+
+void FirebaseWrapper::setNetworkAvailable(bool available) {
+  if (available && !networkAvailable.load(std::memory_order_relaxed)) {
+    // Whatever changed while offline was never sent
+    reportedStates.invalidate();
+  }
+  networkAvailable.store(available, std::memory_order_relaxed);
+}
+
+void FirebaseWrapper::networkTask(void *parameter) {
+  FirebaseWrapper *self = static_cast<FirebaseWrapper *>(parameter);
+  for (;;) {
+    self->networkLoop();
+    vTaskDelay(pdMS_TO_TICKS(NETWORK_TASK_INTERVAL_MS));
+  }
+}
+
+void FirebaseWrapper::networkLoop() {
+  // Without a link the clients would only time out connecting. Commands are
+  // still drained and dropped below so the queue keeps moving.
+  if (networkAvailable.load(std::memory_order_relaxed)) {
+    app.loop();
+  }
+  networkReady.store(ready(), std::memory_order_relaxed);
+  if (legacyMigrationPending && ready()) {
+    migrateLegacyDesiredStates();
+  }
+
+  FirebaseCommand *command;
+  while ((command = commands.peek())) {
+    executeCommand(*command);
+    commands.drop();
+  }
+
+  drainLogSpool();
+}
+
+void FirebaseWrapper::executeCommand(const FirebaseCommand &command) {
+  switch (command.type) {
+  case FirebaseCommand::Type::SetString:
+    if (ready() && !writeBatch.add(command.path, command.payload)) {
+      database.set<const char *>(asyncClient, command.path, command.payload,
+                                 &FirebaseWrapper::onSetResultStatic,
+                                 "dbSetTask");
+    }
+    break;
+  case FirebaseCommand::Type::SetFloat:
+    if (ready() && !writeBatch.add(command.path, command.number)) {
+      database.set<float>(asyncClient, command.path, command.number,
+                          &FirebaseWrapper::onSetResultStatic, "dbSetTask");
+    }
+    break;
+  case FirebaseCommand::Type::SetJson: {
+    JsonDocument doc;
+    if (!ready() || deserializeJson(doc, command.payload) ||
+        writeBatch.add(command.path, doc)) {
+      break;
+    }
+    // convert ArduinoJson → Firebase object_t
+    object_t json(command.payload);
+    database.set<object_t>(asyncClient, command.path, json,
+                           onSetResultStatic, "publishState");
+    break;
+  }
+  case FirebaseCommand::Type::LogRecord:
+    spoolLogRecord(reinterpret_cast<const uint8_t *>(command.payload),
+                   command.length);
+    break;
+  case FirebaseCommand::Type::FlushWrites:
+    sendBatchedWrites();
+    break;
+  }
+}
+
+void FirebaseWrapper::sendBatchedWrites() {
+  if (writeBatch.empty() || !ready()) {
+    return;
+  }
+  String jsonStr;
+  writeBatch.serialize(jsonStr);
+  writeBatch.clear();
+  object_t json(jsonStr.c_str());
+  database.update<object_t>(asyncClient, writeBatch.path().c_str(), json,
+                            &FirebaseWrapper::onSetResultStatic,
+                            "dbBatchUpdate");
+}
+
 void FirebaseWrapper::subscribeValue(const char *path) {
   database.get(dataStreamClient, path, dataStreamCallback,
                true /* SSE mode (HTTP Streaming) */, "dbStreamTask");
@@ -194,29 +605,34 @@ void FirebaseWrapper::dataStreamCallback(AsyncResult &aResult) {
   if (aResult.available()) {
     RealtimeDatabaseResult &streamResult = aResult.to<RealtimeDatabaseResult>();
     if (streamResult.isStream()) {
-      String path = streamResult.dataPath();
-      String end_identifier = "/desired";
       // Serial.printf("Full path recieved for streamResult: %s\n",
-      // path.c_str());
-      if (path.endsWith(end_identifier)) {
-        String deviceName = path.substring(
-            1, path.length() -
-                   end_identifier.length()); // strip /devices/ and /desired
-        // Serial.printf("Received desired state for device name: %s\n",
-        // deviceName.c_str());
-        auto it = Device::getDevice(deviceName.c_str());
-        if (it) {                                              // nullptr check
-          String payloadStr = streamResult.to<const char *>(); // get raw JSON
-          JsonDocument doc; // adjust size as needed
-          DeserializationError err = deserializeJson(doc, payloadStr);
-          if (!err) {
-            it->applyState(doc.as<JsonVariantConst>());
-            lastUpdatedDeviceName = deviceName;
-          } else {
-            // Serial.printf("Failed to parse JSON: %s\n",
-            // err.c_str());
-          }
+      // streamResult.dataPath().c_str());
+      // Applied by the control loop, see FirebaseWrapper::loop(). The
+      // payload is copied straight from the stream buffer into the queue.
+      String event = streamResult.event();
+      String path = streamResult.dataPath();
+      bool patch = event == "patch";
+      char deviceName[FIREBASE_DEVICE_NAME_SIZE];
+      char field[FIREBASE_FIELD_PATH_SIZE];
+      switch (classifyDesiredStreamPath(event.c_str(), path.c_str(),
+                                        deviceName, sizeof(deviceName), field,
+                                        sizeof(field))) {
+      case DesiredStreamPath::Snapshot:
+        if (networkInstance) {
+          networkInstance->postDesiredSnapshot(
+              streamResult.to<const char *>(), patch);
+        }
+        break;
+      case DesiredStreamPath::Device:
+      case DesiredStreamPath::Field:
+        if (networkInstance) {
+          networkInstance->postDesiredState(deviceName,
+                                            streamResult.to<const char *>(),
+                                            false, patch, field);
         }
+        break;
+      case DesiredStreamPath::Ignored:
+        break;
       }
     } else {
       // Serial.println("----------------------------");
@@ -231,50 +647,167 @@ void FirebaseWrapper::dataStreamCallback(AsyncResult &aResult) {
 }
 
 void FirebaseWrapper::publishReportedStates() {
+  // Nothing is recorded as published unless it can actually be sent
+  if (!networkReady.load(std::memory_order_relaxed)) {
+    return;
+  }
   const auto &allDevices = Device::getAllDevices();
+  reportedStates.beginPass(millis());
 
   for (const auto &[name, dev] : allDevices) {
+    uint32_t version = dev->getStateVersion();
+    if (!reportedStates.mayHaveChanged(name, version)) {
+      continue;
+    }
     JsonDocument doc;
     dev->reportState(doc);
 
-    String path = FirebaseWrapper::getBaseDatabasePath() + "/devices/" +
-                  String(name.c_str()) + "/reported";
-    String jsonStr;
-    serializeJson(doc, jsonStr);
-    object_t json(jsonStr.c_str()); // convert ArduinoJson → Firebase object_t
-
-    database.set<object_t>(asyncClient, path, json, onSetResultStatic,
-                           "publishState");
+    Fnv1aWriter hash;
+    serializeJson(doc, hash);
+    if (!reportedStates.needsPublish(name, hash.value())) {
+      reportedStates.markPublished(name, version, hash.value());
+      continue;
+    }
+    char path[FIREBASE_PATH_SIZE];
+    int pathLength = snprintf(path, sizeof(path),
+                              FIREBASE_DEVICES_PATH "/%s/reported",
+                              dev->getName());
+    if (measureJson(doc) >= sizeof(FirebaseCommand::payload) ||
+        size_t(pathLength) >= sizeof(path)) {
+      // Can never be sent, skip it until it changes rather than hold up the
+      // devices after it
+      oversizedReports++;
+      reportedStates.markPublished(name, version, hash.value());
+      continue;
+    }
+    FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetJson,
+                                              path, size_t(pathLength));
+    if (!command) {
+      // Queue full, counted as dropped. The devices from here on are still
+      // unpublished and go out on the next pass.
+      return;
+    }
+    serializeJson(doc, command->payload, sizeof(command->payload));
+    commands.publish();
+    writesPending = true;
+    reportedStates.markPublished(name, version, hash.value());
   }
 }
 
-void FirebaseWrapper::fetchAndApplyDesiredStates() {
-  if (!app.ready()) {
+// The stream starts, and starts over after every reconnect, with the whole
+// desired node at "/". Each device's desired state in it is queued, the
+// control loop skips the ones it already has (see DeviceStateStore), so
+// nothing is fetched per device. A patch at "/" is a multi-location update,
+// its keys are device names or paths below a device and each value replaces
+// what is there.
+void FirebaseWrapper::postDesiredSnapshot(const char *json, bool patch) {
+  if (!patch && (!json || strcmp(json, "null") == 0)) {
+    // Empty desired node, possibly an install still on the old layout
+    legacyMigrationPending = !legacyMigrationChecked;
+    return;
+  }
+  if (patch) {
+    JsonDocument changes;
+    if (!json || deserializeJson(changes, json)) {
+      return;
+    }
+    for (JsonPairConst change : changes.as<JsonObjectConst>()) {
+      char deviceName[FIREBASE_DEVICE_NAME_SIZE];
+      char field[FIREBASE_FIELD_PATH_SIZE];
+      if (splitDesiredPath(change.key().c_str(), deviceName,
+                           sizeof(deviceName), field, sizeof(field)) &&
+          Device::getDevice(deviceName) &&
+          (*field != '\0' || !change.value().isNull())) {
+        postDesiredState(deviceName, change.value(), false, field);
+      }
+    }
     return;
   }
   const auto &allDevices = Device::getAllDevices();
-
+  JsonDocument filter;
   for (const auto &[name, device] : allDevices) {
-    String path = FirebaseWrapper::getBaseDatabasePath() + "/devices/" +
-                  String(name.c_str()) + "/desired";
-    // Serial.printf("Fetching desired state for device %s from path %s\n",
-    // name.c_str(), path.c_str());
-
-    // Using await get method since this function is called at
-    // setup
-    const char *desiredState = database.get<const char *>(asyncClient, path);
-    JsonDocument doc; // adjust size as needed
-    Values::MapValue map;
-    DeserializationError err = deserializeJson(doc, desiredState);
-    if (!err) {
-      device->applyState(doc.as<JsonVariantConst>());
-      device->logState(map);
-      logDeviceEvent(map, name.c_str(), "initial_state",
-                     "Initial desired state applied to device successfully");
-    } else {
-      logDeviceEvent(map, name.c_str(), "error", err.c_str());
+    filter[device->getName()] = true;
+  }
+  JsonDocument snapshot;
+  if (!json ||
+      deserializeJson(snapshot, json, DeserializationOption::Filter(filter))) {
+    return;
+  }
+  for (const auto &[name, device] : allDevices) {
+    JsonVariantConst desired = snapshot[device->getName()];
+    // Nothing set in the database, the restored state stays
+    if (!desired.isNull()) {
+      postDesiredState(device->getName(), desired, true);
+    }
+  }
+}
+
+// Desired state used to live next to the reported state, at
+// devices/<name>/desired, so the stream also carried every reported write
+// back to the board. Existing settings are copied to the desired node once,
+// the stream then delivers them like any other change. The old nodes are
+// left for the web app to remove.
+void FirebaseWrapper::migrateLegacyDesiredStates() {
+  legacyMigrationPending = false;
+  legacyMigrationChecked = true;
+  JsonDocument desired;
+  for (const auto &[name, device] : Device::getAllDevices()) {
+    char path[FIREBASE_PATH_SIZE];
+    snprintf(path, sizeof(path), FIREBASE_DEVICES_PATH "/%s/desired",
+             device->getName());
+    // Blocking, but runs at most once per boot and only on the old layout
+    const char *json = database.get<const char *>(asyncClient, path);
+    JsonDocument state;
+    if (json && !deserializeJson(state, json) && !state.isNull()) {
+      desired[device->getName()] = state;
     }
   }
+  if (desired.size() == 0) {
+    return;
+  }
+  String body;
+  serializeJson(desired, body);
+  object_t value(body.c_str());
+  database.update<object_t>(asyncClient, FIREBASE_DESIRED_PATH, value,
+                            &FirebaseWrapper::onSetResultStatic,
+                            "migrateDesired");
+}
+
+void FirebaseWrapper::postDesiredState(const char *deviceName,
+                                       JsonVariantConst desired, bool initial,
+                                       const char *field) {
+  char json[FIREBASE_PAYLOAD_SIZE];
+  if (measureJson(desired) >= sizeof(json)) {
+    return;
+  }
+  serializeJson(desired, json, sizeof(json));
+  postDesiredState(deviceName, json, initial, false, field);
+}
+
+void FirebaseWrapper::postDesiredState(const char *deviceName,
+                                       const char *json, bool initial,
+                                       bool patch, const char *field) {
+  // The control loop drains this quickly, wait a little rather than lose a
+  // command from the user
+  DesiredStateUpdate *update = desiredUpdates.reserve();
+  for (int attempt = 0; !update && attempt < 20; attempt++) {
+    vTaskDelay(pdMS_TO_TICKS(5));
+    update = desiredUpdates.reserve();
+  }
+  if (!json) {
+    json = ""; // Failed fetch, logged as an error by the control loop
+  }
+  if (!update || strlen(json) >= sizeof(update->json) ||
+      strlen(deviceName) >= sizeof(update->deviceName) ||
+      strlen(field) >= sizeof(update->field)) {
+    return;
+  }
+  update->initial = initial;
+  update->patch = patch;
+  strcpy(update->deviceName, deviceName);
+  strcpy(update->field, field);
+  strcpy(update->json, json);
+  desiredUpdates.publish();
 }
 
 void FirebaseWrapper::onSetResultStatic(AsyncResult &result) {
@@ -295,31 +828,40 @@ void FirebaseWrapper::onLogResultStatic(AsyncResult &result) {
     Firebase.printf("[Firebase Error] - Log -  %s code: %d\n",
                     result.error().message().c_str(), result.error().code());
   }
-}
-
-// Add helper function for proper timestamp formatting
-String FirebaseWrapper::getTimestampString(uint64_t sec, uint32_t nano) {
-  if (sec > 0x3afff4417f)
-    sec = 0x3afff4417f;
-
-  if (nano > 0x3b9ac9ff)
-    nano = 0x3b9ac9ff;
 
-  time_t now;
-  struct tm ts;
-  char buf[80];
-  now = sec;
-  ts = *gmtime(&now); // Use gmtime for UTC
-
-  String format = "%Y-%m-%dT%H:%M:%S";
-
-  if (nano > 0) {
-    String fraction = String(double(nano) / 1e9, 9);
-    fraction.remove(0, 1);
-    format += fraction;
+  // Settle the spool batch in flight, ignoring a straggler from a batch
+  // that already timed out
+  String uid = result.uid();
+  size_t prefixLength = strlen(LOG_SPOOL_TASK_PREFIX);
+  if (!uid.startsWith(LOG_SPOOL_TASK_PREFIX) ||
+      uint32_t(uid.substring(prefixLength).toInt()) != logSpoolBatchId ||
+      logSpoolBatchSize == 0) {
+    return;
+  }
+  if (result.isError()) {
+    logSpoolBatchFailed = true;
+    logSpoolBatchDone = true;
+  } else if (result.available()) {
+    logSpoolBatchFailed = logBatchWriteFailed(result);
+    logSpoolBatchDone = true;
   }
-  format += "Z"; // Always end with Z for UTC
+}
 
-  strftime(buf, sizeof(buf), format.c_str(), &ts);
-  return buf;
-}
\ No newline at end of file
+// batchWrite is not atomic, the response carries one status per write and a
+// rejected write still comes back as HTTP 200. Any non-zero code fails the
+// batch, resending the ones that did succeed only overwrites them.
+bool FirebaseWrapper::logBatchWriteFailed(AsyncResult &result) {
+  JsonDocument filter;
+  filter["status"][0]["code"] = true;
+  JsonDocument response;
+  if (deserializeJson(response, result.c_str(),
+                      DeserializationOption::Filter(filter))) {
+    return true;
+  }
+  for (JsonVariantConst status : response["status"].as<JsonArrayConst>()) {
+    if (status["code"].as<int>() != 0) {
+      return true;
+    }
+  }
+  return false;
+}
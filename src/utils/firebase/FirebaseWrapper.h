@@ -7,60 +7,201 @@
 
 #include "../../config/Credentials.h"
 #include "../../devices/Device.h"
+#include "../../devices/DeviceStateStore.h"
+#include "../../sensors/SensorHistory.h"
+#include "../ArenaAllocator.h"
+#include "../Hash.h"
+#include "../LogSpool.h"
+#include "../SpscQueue.h"
 #include "../TimeOfDay.h"
-#include <WiFiClientSecure.h>
+#include "DesiredStateMerge.h"
+#include "DesiredStreamPath.h"
+#include "FirebaseMessages.h"
+#include "FirebasePaths.h"
+#include "LogBatchWrite.h"
+#include "MeteredTlsClient.h"
+#include "ReportedStateTracker.h"
+#include "RtdbWriteBatch.h"
+#include <atomic>
 #include <optional>
 #include <tuple>
 
+// Owns the Firebase connection. Networking runs on its own FreeRTOS task so a
+// slow TLS handshake or upload never stalls the control loop: the public
+// write and log functions only post fixed-size commands into a lock-free
+// queue, and desired-state updates from the database come back through a
+// second queue that loop() applies to the devices.
+//
+// Everything public except begin() is meant for the control loop (the
+// Arduino loop task) only, each queue has exactly one producer.
 class FirebaseWrapper {
 public:
   FirebaseWrapper(const char *apiKey, const char *email, const char *password,
                   const char *dbUrl);
 
-  void begin(const char *dataStreamPath = nullptr);
+  // Sets up the clients and starts the network task. Desired state that was
+  // applied is kept in deviceStates when given.
+  void begin(const char *dataStreamPath = nullptr,
+             DeviceStateStore *deviceStates = nullptr);
+  // Applies desired-state updates received by the network task
   void loop();
+  // Gates the network task, nothing connects until the link is up. Call on
+  // connectivity changes, see WiFiHelper::addListener().
+  void setNetworkAvailable(bool available);
 
   // High-level API for DB interaction
 
-  // Explicit overloads for setting values of type const char* and float
+  // Explicit overloads for setting values of type const char* and float.
+  // Writes under the base path are batched until flushWrites().
   void setValue(const char *path, const char *value);
   void setValue(const char *path, float value);
+  // Same for fixed paths, see FIREBASE_PATH(). Nothing is allocated.
+  void setValue(const FirebasePath &path, const char *value);
+  void setValue(const FirebasePath &path, float value);
+  // A whole JSON object, it must serialize to less than
+  // FIREBASE_PAYLOAD_SIZE bytes
+  void setValue(const FirebasePath &path, JsonVariantConst value);
 
-  // Async get and stream subscribe functions
-  void subscribeValue(const char *path);
+  // Marks the end of a control tick, everything written since the last call
+  // goes out as one multi-location update
+  void flushWrites();
 
-  // Publish the reported state of all devices to Firebase
+  // Publish the reported state of devices that changed since the last call,
+  // plus a periodic full sync of every device
   void publishReportedStates();
 
-  // Fetch and apply the desired state for all devices from Firebase
-  void fetchAndApplyDesiredStates();
-
-  void logDeviceEvent(Values::MapValue &map, const char *deviceName,
+  // Log events are written to the flash spool first and uploaded from there
+  // by the network task, so events raised while offline are sent once
+  // reconnected
+  void logDeviceEvent(JsonVariantConst data, const char *deviceName,
                       const char *eventType, const char *message);
   // void logStatusEvent(const char *statusMessage, const char *status_type);
   void logSensorEvent(const char *sensorName,
                       std::optional<std::tuple<float, float>> sensorData,
                       const char *label1 = "value1",
                       const char *label2 = "value2");
-  static String getBaseDatabasePath();
+  // Logs the hour starting at hourStartSec as one document built from the
+  // minute aggregates. Returns false only when it could not be queued yet,
+  // an hour with no data counts as done.
+  bool logSensorHistory(const char *sensorName, const SensorHistory &history,
+                        uint32_t hourStartSec, const char *label1 = "value1",
+                        const char *label2 = "value2");
+
+  // Commands dropped because the network task fell behind
+  uint32_t getDroppedCommands() const { return droppedCommands; }
+  // Reported states skipped because they do not fit in a command
+  uint32_t getOversizedReports() const { return oversizedReports; }
+  // Log events refused because the spool was full
+  uint32_t getRefusedLogRecords() const { return refusedLogRecords; }
+  // Handshakes of both TLS connections since boot
+  const TlsStats &getTlsStats() const { return tlsStats; }
 
 private:
   static void onLogResultStatic(AsyncResult &r); // static callback
   static void onSetResultStatic(AsyncResult &r); // static callback
   static void dataStreamCallback(AsyncResult &result);
-  String getBaseLogPath();
-  String getTimestampString(uint64_t sec, uint32_t nano); // Add this helper
-  static String lastUpdatedDeviceName;
+
+  // Control loop side
+  FirebaseCommand *reserveCommand(FirebaseCommand::Type type,
+                                  const char *path, size_t pathLength);
+  FirebaseCommand *reserveCommand(FirebaseCommand::Type type,
+                                  const char *path) {
+    return reserveCommand(type, path, strlen(path));
+  }
+  bool postLogRecord(const char *collection, time_t timeSec,
+                     JsonDocument &fields);
+  void applyDesiredState(const DesiredStateUpdate &update);
+  static constexpr size_t COMMAND_QUEUE_SIZE = 16;
+  static constexpr size_t DESIRED_QUEUE_SIZE = 8;
+  SpscQueue<FirebaseCommand, COMMAND_QUEUE_SIZE> commands;
+  SpscQueue<DesiredStateUpdate, DESIRED_QUEUE_SIZE> desiredUpdates;
+  // Desired-state documents are parsed here instead of on the heap, the
+  // filter, the update and the state it is merged into fit comfortably
+  static constexpr size_t DESIRED_STATE_ARENA_SIZE = 8192;
+  ArenaAllocator<DESIRED_STATE_ARENA_SIZE> desiredStateArena;
+  std::atomic<bool> networkReady{false};
+  std::atomic<bool> networkAvailable{false};
+  bool writesPending = false;
+  uint32_t droppedCommands = 0;
+  uint32_t oversizedReports = 0;
+  ReportedStateTracker reportedStates;
+  DeviceStateStore *deviceStates = nullptr;
+
+  // Network task side
+  static void networkTask(void *parameter);
+  void networkLoop();
+  // Link up and authenticated
+  bool ready() {
+    return networkAvailable.load(std::memory_order_relaxed) && app.ready();
+  }
+  void executeCommand(const FirebaseCommand &command);
+  void sendBatchedWrites();
+  void subscribeValue(const char *path);
+  // Queues every device's desired state from a stream event at "/"
+  void postDesiredSnapshot(const char *json, bool patch);
+  void migrateLegacyDesiredStates();
+  void postDesiredState(const char *deviceName, const char *json,
+                        bool initial, bool patch = false,
+                        const char *field = "");
+  void postDesiredState(const char *deviceName, JsonVariantConst desired,
+                        bool initial, const char *field = "");
+  static constexpr uint32_t NETWORK_TASK_STACK_SIZE = 8192;
+  static constexpr uint32_t NETWORK_TASK_INTERVAL_MS = 5;
+  static FirebaseWrapper *networkInstance; // For the static stream callback
+  TaskHandle_t networkTaskHandle = nullptr;
+
+  // Log events waiting in flash, see drainLogSpool()
+  void spoolLogRecord(const uint8_t *record, size_t length);
+  void drainLogSpool();
+  bool logBatchDue() const;
+  // The client library's form of a spooled record's write
+  Write logRecordWrite(const LogWrite &write);
+  static bool logBatchWriteFailed(AsyncResult &result);
+  static constexpr const char *LOG_SPOOL_DIRECTORY = "/littlefs/logspool";
+  static constexpr size_t LOG_SPOOL_SEGMENT_BYTES = 8 * 1024;
+  static constexpr uint32_t LOG_SPOOL_MAX_SEGMENTS = 16;
+  // A batch goes out once this many records are waiting or the oldest has
+  // waited LOG_BATCH_INTERVAL_MS, as one batchWrite request
+  static constexpr uint8_t LOG_BATCH_MAX_RECORDS = 10;
+  static constexpr uint32_t LOG_BATCH_INTERVAL_MS = 60000;
+  static constexpr uint32_t LOG_SPOOL_TIMEOUT_MS = 30000;
+  LogSpool logSpool{LOG_SPOOL_DIRECTORY, LOG_SPOOL_SEGMENT_BYTES,
+                    LOG_SPOOL_MAX_SEGMENTS};
+  bool logSpoolMounted = false;
+  uint8_t logSpoolRecord[LogSpool::MAX_RECORD_SIZE];
+  uint32_t logSpoolBatchSentMs = 0;
+  // Records appended since the last batch went out, and when the first of
+  // them was. Leftovers from before a reboot or behind a full batch count
+  // as a backlog that goes out without waiting.
+  uint32_t logBatchQueued = 0;
+  uint32_t logBatchOldestMs = 0;
+  bool logBatchBacklog = false;
+  bool logBatchRetrying = false;
+  uint32_t logBatchFailedMs = 0;
+  // Set by the network task while the spool is at capacity, log calls are
+  // refused then instead of the spool dropping its oldest segment
+  std::atomic<bool> logSpoolFull{false};
+  uint32_t refusedLogRecords = 0;
+  // Written from the async result callback
+  static uint32_t logSpoolBatchId;
+  static uint8_t logSpoolBatchSize;
+  static bool logSpoolBatchDone;
+  static bool logSpoolBatchFailed;
   // TODO Noticed I can set expiration here for token, this might be the cause
   // of the issue where i see the website freeze
   UserAuth userAuth;
   FirebaseApp app;
-  WiFiClientSecure sslClient, dataStreamSslClient;
+  static constexpr uint32_t TLS_HANDSHAKE_TIMEOUT_SEC = 5;
+  TlsStats tlsStats;
+  MeteredTlsClient sslClient{tlsStats}, dataStreamSslClient{tlsStats};
   using AsyncClient = AsyncClientClass;
   AsyncClient asyncClient;
   AsyncClient dataStreamClient;
   RealtimeDatabase database;
+  RtdbWriteBatch writeBatch;
   Firestore::Documents firestoreDocs;
   const char *databaseUrl;
-  bool devicesInitialized = false;
+  // Set from the stream callback, the copy runs from networkLoop()
+  bool legacyMigrationPending = false;
+  bool legacyMigrationChecked = false;
 };
@@ -0,0 +1,111 @@
+#pragma once
+#include "../Hash.h"
+#include "../LogSpool.h"
+#include "../Timestamp.h"
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Turns spooled log records into Firestore writes for one batchWrite
+// request. Records are MessagePack {"c": collection under the log path,
+// "t": epoch seconds when the event happened, "f": document fields}.
+//
+// Each write is an upsert of a document named after the record's time and
+// the FNV-1a hash of its spooled bytes, e.g. 1700000000-3f2a9c01, so a batch
+// that is sent again after a lost answer leaves one copy of every event.
+// No Arduino dependencies, FirebaseWrapper maps a LogWrite onto the client
+// library's types and the host stand-ins use addLogBatchWrite().
+constexpr size_t LOG_DOCUMENT_PATH_SIZE = 192;
+
+struct LogWrite {
+  char path[LOG_DOCUMENT_PATH_SIZE]; // Below the database's documents
+  char timeString[32];               // See formatTimestamp()
+  JsonObjectConst fields;            // Points into the decoded record
+};
+
+// Decodes a spooled record into doc and describes its write, false when the
+// record is unreadable or its path does not fit
+inline bool decodeLogWrite(const uint8_t *record, size_t length,
+                           const char *basePath, JsonDocument &doc,
+                           LogWrite &write) {
+  if (deserializeMsgPack(doc, record, length) ||
+      !doc["c"].is<const char *>()) {
+    return false;
+  }
+  int64_t timeSec = doc["t"].as<int64_t>();
+  int written = snprintf(write.path, sizeof(write.path), "%s/%s/%lld-%08x",
+                         basePath, doc["c"].as<const char *>(),
+                         (long long)timeSec, unsigned(fnv1a(record, length)));
+  if (written < 0 || size_t(written) >= sizeof(write.path) ||
+      formatTimestamp(write.timeString, sizeof(write.timeString),
+                      uint64_t(timeSec), 0) == 0) {
+    return false;
+  }
+  write.fields = doc["f"].as<JsonObjectConst>();
+  return true;
+}
+
+// Reads up to maxRecords records past the spool's acknowledged point and
+// passes each one to add(const LogWrite &). Unreadable records are skipped,
+// a retry would not make them readable. Returns the number passed on; the
+// caller commits or rewinds the spool once the batch is answered.
+template <typename Add>
+uint8_t readLogBatch(LogSpool &spool, const char *basePath, uint8_t *buffer,
+                     size_t bufferSize, uint8_t maxRecords, Add add) {
+  uint8_t count = 0;
+  while (count < maxRecords) {
+    size_t length = spool.read(buffer, bufferSize);
+    if (length == 0) {
+      break;
+    }
+    JsonDocument doc;
+    LogWrite write;
+    if (!decodeLogWrite(buffer, length, basePath, doc, write)) {
+      continue;
+    }
+    add(write);
+    count++;
+  }
+  return count;
+}
+
+// value the way the Firestore REST API encodes it, integers as strings
+inline void toFirestoreJson(JsonVariantConst value, JsonObject out) {
+  if (value.is<bool>()) {
+    out["booleanValue"] = value.as<bool>();
+  } else if (value.is<int64_t>()) {
+    char integer[24];
+    snprintf(integer, sizeof(integer), "%lld",
+             (long long)value.as<int64_t>());
+    out["integerValue"] = integer;
+  } else if (value.is<double>()) {
+    out["doubleValue"] = value.as<double>();
+  } else if (value.is<const char *>()) {
+    out["stringValue"] = value.as<const char *>();
+  } else if (value.is<JsonObjectConst>()) {
+    JsonObject fields = out["mapValue"]["fields"].to<JsonObject>();
+    for (JsonPairConst field : value.as<JsonObjectConst>()) {
+      toFirestoreJson(field.value(), fields[field.key()].to<JsonObject>());
+    }
+  } else {
+    out["nullValue"] = nullptr;
+  }
+}
+
+// Appends write to a batchWrite request body, {"writes": [...]}, as the
+// client library sends it for the project's default database
+inline void addLogBatchWrite(JsonDocument &body, const char *projectId,
+                             const LogWrite &write) {
+  JsonObject document =
+      body["writes"].add<JsonObject>()["update"].to<JsonObject>();
+  char name[LOG_DOCUMENT_PATH_SIZE + 64];
+  snprintf(name, sizeof(name), "projects/%s/databases/(default)/documents/%s",
+           projectId, write.path);
+  document["name"] = name;
+  JsonObject fields = document["fields"].to<JsonObject>();
+  fields["timeString"]["timestampValue"] = write.timeString;
+  for (JsonPairConst field : write.fields) {
+    toFirestoreJson(field.value(), fields[field.key()].to<JsonObject>());
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "TlsStats.h"
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include <lwip/sockets.h>
+
+// WiFiClientSecure that records every handshake into a TlsStats and turns on
+// TCP keep-alive, so an idle connection between requests stays open through
+// NAT and a dead one is noticed instead of costing a timed out request.
+// FirebaseClient reuses an open connection for the next request to the same
+// host, each reconnect is a full handshake.
+class MeteredTlsClient : public WiFiClientSecure {
+public:
+  // Idle seconds before the first probe, seconds between probes and probes
+  // lost before the connection counts as dead
+  static constexpr int KEEP_ALIVE_IDLE_SEC = 30;
+  static constexpr int KEEP_ALIVE_INTERVAL_SEC = 10;
+  static constexpr int KEEP_ALIVE_COUNT = 3;
+
+  explicit MeteredTlsClient(TlsStats &stats) : stats(stats) {}
+
+  using WiFiClientSecure::connect;
+  int connect(IPAddress ip, uint16_t port) override {
+    uint32_t freeBefore = ESP.getFreeHeap();
+    uint32_t startMs = millis();
+    return connected(WiFiClientSecure::connect(ip, port), startMs,
+                     freeBefore);
+  }
+  int connect(const char *host, uint16_t port) override {
+    uint32_t freeBefore = ESP.getFreeHeap();
+    uint32_t startMs = millis();
+    return connected(WiFiClientSecure::connect(host, port), startMs,
+                     freeBefore);
+  }
+
+  void stop() override {
+    stats.release(heldBytes);
+    WiFiClientSecure::stop();
+  }
+
+private:
+  int connected(int result, uint32_t startMs, uint32_t freeBefore) {
+    uint32_t elapsedMs = millis() - startMs;
+    if (!result) {
+      stats.handshakeFailed();
+      return result;
+    }
+    stats.handshakeDone(elapsedMs);
+    stats.hold(heldBytes, freeBefore, ESP.getFreeHeap());
+    enableKeepAlive();
+    return result;
+  }
+
+  void enableKeepAlive() {
+    int socket = sslclient->socket;
+    int enable = 1;
+    int idle = KEEP_ALIVE_IDLE_SEC;
+    int interval = KEEP_ALIVE_INTERVAL_SEC;
+    int count = KEEP_ALIVE_COUNT;
+    setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval,
+               sizeof(interval));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+  }
+
+  TlsStats &stats;
+  uint32_t heldBytes = 0;
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string_view>
+
+// Decides which devices need their reported state published. A device is
+// skipped when its state version has not moved since the last publish, and
+// when it has moved but the document hashes the same as what was sent.
+// Every fullSyncIntervalMs a full sync republishes everything, which also
+// covers writes that failed and changes a device forgot to version.
+//
+// A full sync is a generation rather than a single pass: devices are only
+// counted as synced once markPublished() recorded them in it, so a pass cut
+// short (e.g. by a full command queue) carries on with the devices it did
+// not reach on the next pass instead of starting over.
+// Names are kept as views, they must outlive the tracker (device names do).
+// No Arduino dependencies, time is passed in by the caller.
+class ReportedStateTracker {
+public:
+  static constexpr uint32_t DEFAULT_FULL_SYNC_INTERVAL_MS = 5 * 60 * 1000;
+
+  explicit ReportedStateTracker(
+      uint32_t fullSyncIntervalMs = DEFAULT_FULL_SYNC_INTERVAL_MS)
+      : fullSyncIntervalMs(fullSyncIntervalMs) {}
+
+  // Starts a publish pass, returns true when it starts a full sync
+  bool beginPass(uint32_t nowMs) {
+    bool fullSync = !synced || nowMs - lastFullSyncMs >= fullSyncIntervalMs;
+    if (fullSync) {
+      synced = true;
+      lastFullSyncMs = nowMs;
+      generation++;
+    }
+    return fullSync;
+  }
+
+  // Cheap check before building the document
+  bool mayHaveChanged(std::string_view name, uint32_t version) const {
+    auto it = published.find(name);
+    return it == published.end() || it->second.generation != generation ||
+           it->second.version != version;
+  }
+
+  // True when the document differs from the last published one, or the
+  // device has not been synced in the current full sync yet
+  bool needsPublish(std::string_view name, uint32_t hash) const {
+    auto it = published.find(name);
+    return it == published.end() || it->second.generation != generation ||
+           it->second.hash != hash;
+  }
+
+  // Records the document as handled, sent or deliberately skipped
+  void markPublished(std::string_view name, uint32_t version, uint32_t hash) {
+    Entry &entry = published[name];
+    entry.generation = generation;
+    entry.version = version;
+    entry.hash = hash;
+  }
+
+  // Forces the next pass to republish everything, e.g. after a reconnect
+  void invalidate() { synced = false; }
+
+private:
+  struct Entry {
+    uint32_t generation = 0;
+    uint32_t version = 0;
+    uint32_t hash = 0;
+  };
+
+  uint32_t fullSyncIntervalMs;
+  bool synced = false;
+  uint32_t lastFullSyncMs = 0;
+  // Entries from older generations are due for the running full sync. Starts
+  // at 0 and the first pass makes it 1, so no entry matches before that.
+  uint32_t generation = 0;
+  std::map<std::string_view, Entry> published;
+};
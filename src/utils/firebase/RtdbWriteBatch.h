@@ -0,0 +1,91 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Collects Realtime Database writes made during one loop tick so they can be
+// sent as a single multi-location update (PATCH) at the base path instead of
+// one HTTPS request per value. Writing the same path twice in a tick keeps
+// only the latest value.
+//
+// Paths must be under the base path; RTDB rejects an update where one key is
+// an ancestor of another, so add() refuses those as well and the caller
+// should fall back to a plain set for them. Only depends on ArduinoJson.
+class RtdbWriteBatch {
+public:
+  static constexpr size_t DEFAULT_MAX_ENTRIES = 32;
+
+  explicit RtdbWriteBatch(const char *basePath,
+                          size_t maxEntries = DEFAULT_MAX_ENTRIES)
+      : basePath(basePath ? basePath : ""), maxEntries(maxEntries) {
+    while (!this->basePath.empty() && this->basePath.front() == '/') {
+      this->basePath.erase(0, 1);
+    }
+  }
+
+  // Queues value at path (absolute, including the base path). Returns false
+  // if the path cannot be batched.
+  template <typename T> bool add(const char *path, const T &value) {
+    const char *key = relativeKey(path);
+    if (!key || !canAdd(key)) {
+      return false;
+    }
+    pending[key] = value;
+    return true;
+  }
+
+  bool empty() const { return pending.size() == 0; }
+  size_t size() const { return pending.size(); }
+  const std::string &path() const { return basePath; }
+
+  // Writes the update body, e.g. {"status/time":"...","devices/x/reported":{}}
+  template <typename TString> void serialize(TString &out) const {
+    serializeJson(pending, out);
+  }
+
+  void clear() { pending.clear(); }
+
+private:
+  // Strips the base path and the slash after it, null if not under it
+  const char *relativeKey(const char *path) const {
+    if (!path) {
+      return nullptr;
+    }
+    while (*path == '/') {
+      path++;
+    }
+    if (strncmp(path, basePath.c_str(), basePath.size()) != 0 ||
+        path[basePath.size()] != '/') {
+      return nullptr;
+    }
+    const char *key = path + basePath.size() + 1;
+    return *key ? key : nullptr;
+  }
+
+  bool canAdd(const char *key) const {
+    JsonObjectConst entries = pending.as<JsonObjectConst>();
+    if (entries[key].is<JsonVariantConst>()) {
+      return true; // Overwrite
+    }
+    if (entries.size() >= maxEntries) {
+      return false;
+    }
+    for (JsonPairConst entry : entries) {
+      if (isAncestor(entry.key().c_str(), key) ||
+          isAncestor(key, entry.key().c_str())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool isAncestor(const char *ancestor, const char *path) {
+    size_t length = strlen(ancestor);
+    return strncmp(ancestor, path, length) == 0 && path[length] == '/';
+  }
+
+  std::string basePath;
+  size_t maxEntries;
+  JsonDocument pending;
+};
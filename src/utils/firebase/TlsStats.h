@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Handshake counters shared by the Firebase TLS clients (see
+// MeteredTlsClient). Written by the network task, read from anywhere.
+// No Arduino dependencies, durations and heap readings are passed in.
+struct TlsStats {
+  std::atomic<uint32_t> handshakes{0};
+  std::atomic<uint32_t> failures{0};
+  std::atomic<uint32_t> totalHandshakeMs{0};
+  std::atomic<uint32_t> maxHandshakeMs{0};
+  // Heap held by the open connections, measured as the drop in free heap
+  // across each handshake so only an estimate while other tasks allocate
+  std::atomic<uint32_t> residentBytes{0};
+
+  void handshakeFailed() { failures.fetch_add(1, std::memory_order_relaxed); }
+
+  void handshakeDone(uint32_t elapsedMs) {
+    handshakes.fetch_add(1, std::memory_order_relaxed);
+    totalHandshakeMs.fetch_add(elapsedMs, std::memory_order_relaxed);
+    uint32_t max = maxHandshakeMs.load(std::memory_order_relaxed);
+    while (elapsedMs > max &&
+           !maxHandshakeMs.compare_exchange_weak(max, elapsedMs,
+                                                 std::memory_order_relaxed)) {
+    }
+  }
+
+  // A connection's heap estimate after a handshake, replacing what it held
+  // before. held is the connection's own share, kept by the connection.
+  void hold(uint32_t &held, uint32_t freeBefore, uint32_t freeAfter) {
+    residentBytes.fetch_sub(held, std::memory_order_relaxed);
+    held = freeBefore > freeAfter ? freeBefore - freeAfter : 0;
+    residentBytes.fetch_add(held, std::memory_order_relaxed);
+  }
+
+  // The connection closed and gave its share back
+  void release(uint32_t &held) {
+    residentBytes.fetch_sub(held, std::memory_order_relaxed);
+    held = 0;
+  }
+
+  uint32_t averageHandshakeMs() const {
+    uint32_t count = handshakes.load(std::memory_order_relaxed);
+    return count ? totalHandshakeMs.load(std::memory_order_relaxed) / count
+                 : 0;
+  }
+};
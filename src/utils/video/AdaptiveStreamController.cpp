@@ -0,0 +1,213 @@
+#include "AdaptiveStreamController.h"
+#include <algorithm>
+#include <cstring>
+
+int streamFrameSizeLevel(const char *name) {
+  if (!name) {
+    return -1;
+  }
+  for (uint8_t level = 0; level < STREAM_FRAME_SIZE_COUNT; level++) {
+    if (strcmp(STREAM_FRAME_SIZES[level].name, name) == 0) {
+      return level;
+    }
+  }
+  return -1;
+}
+
+namespace {
+uint32_t pixels(uint8_t level) {
+  return uint32_t(STREAM_FRAME_SIZES[level].width) *
+         STREAM_FRAME_SIZES[level].height;
+}
+} // namespace
+
+AdaptiveStreamController::AdaptiveStreamController(const Config &config)
+    : cfg(config), current(config.ceiling) {
+  configure(config);
+}
+
+void AdaptiveStreamController::configure(const Config &config) {
+  cfg = config;
+  cfg.ceiling.frameSizeLevel = std::min<uint8_t>(cfg.ceiling.frameSizeLevel,
+                                                 STREAM_FRAME_SIZE_COUNT - 1);
+  cfg.ceiling.fps = std::max(cfg.ceiling.fps, uint8_t(1));
+  cfg.minFps = std::min(std::max(cfg.minFps, uint8_t(1)), cfg.ceiling.fps);
+  cfg.worstQuality = std::max(cfg.worstQuality, cfg.ceiling.jpegQuality);
+  cfg.softQualityLimit =
+      std::min(std::max(cfg.softQualityLimit, cfg.ceiling.jpegQuality),
+               cfg.worstQuality);
+
+  if (!isEnabled()) {
+    current = cfg.ceiling;
+  } else {
+    current.jpegQuality =
+        std::min(std::max(current.jpegQuality, cfg.ceiling.jpegQuality),
+                 cfg.worstQuality);
+    current.frameSizeLevel =
+        std::min(current.frameSizeLevel, cfg.ceiling.frameSizeLevel);
+    current.fps =
+        std::min(std::max(current.fps, cfg.minFps), cfg.ceiling.fps);
+  }
+  budget = cfg.targetBytesPerSec;
+  cleanPeriods = 0;
+  upgradeHoldPeriods = cfg.cleanPeriodsBeforeUpgrade;
+  periodsSinceUpgrade = UINT8_MAX;
+}
+
+void AdaptiveStreamController::onFrameSent(uint32_t frameBytes,
+                                           uint32_t sendTimeMs) {
+  periodBytes += frameBytes;
+  periodFrames++;
+  periodSendTimeMs += sendTimeMs;
+}
+
+void AdaptiveStreamController::onReceiverReport(uint32_t framesCompleted,
+                                                uint32_t framesDropped) {
+  // A restarted receiver starts counting from zero again
+  bool restarted =
+      framesCompleted < lastCompleted || framesDropped < lastDropped;
+  if (haveReport && !restarted) {
+    uint32_t completed = framesCompleted - lastCompleted;
+    uint32_t dropped = framesDropped - lastDropped;
+    if (completed + dropped > 0) {
+      lossRatio = float(dropped) / float(completed + dropped);
+      reportPending = true;
+    }
+  }
+  haveReport = true;
+  lastCompleted = framesCompleted;
+  lastDropped = framesDropped;
+}
+
+bool AdaptiveStreamController::update(uint32_t nowMs) {
+  if (!started) {
+    started = true;
+    periodStartMs = nowMs;
+    return false;
+  }
+  if (nowMs - periodStartMs < cfg.periodMs) {
+    return false;
+  }
+
+  uint32_t frames = periodFrames;
+  uint32_t bytes = periodBytes;
+  uint32_t sendTimeMs = periodSendTimeMs;
+  periodStartMs = nowMs;
+  periodBytes = 0;
+  periodFrames = 0;
+  periodSendTimeMs = 0;
+
+  // Nothing to judge the link by while idle
+  if (!isEnabled() || frames == 0) {
+    reportPending = false;
+    return false;
+  }
+
+  uint32_t measuredFrameBytes = bytes / frames;
+  avgFrameBytes = avgFrameBytes ? (avgFrameBytes + measuredFrameBytes) / 2
+                                : measuredFrameBytes;
+
+  uint32_t frameIntervalMs = 1000 / current.fps;
+  bool senderBehind =
+      sendTimeMs > cfg.sendTimeThreshold * frameIntervalMs * frames;
+  bool receiverLoss = reportPending && lossRatio > cfg.lossThreshold;
+  reportPending = false;
+
+  if (periodsSinceUpgrade < UINT8_MAX) {
+    periodsSinceUpgrade++;
+  }
+  if (senderBehind || receiverLoss) {
+    budget = std::max(minBudget(), uint32_t(budget * 0.7f));
+    cleanPeriods = 0;
+    if (periodsSinceUpgrade <= 2) {
+      upgradeHoldPeriods = std::min(upgradeHoldPeriods * 2, 64);
+    }
+    periodsSinceUpgrade = UINT8_MAX;
+  } else {
+    if (cleanPeriods < UINT8_MAX) {
+      cleanPeriods++;
+    }
+    if (cleanPeriods >= cfg.cleanPeriodsBeforeUpgrade) {
+      budget = std::min(cfg.targetBytesPerSec,
+                        budget + cfg.targetBytesPerSec / 10);
+    }
+    // An upgrade that held up for a while resets the wait
+    if (periodsSinceUpgrade == 10) {
+      upgradeHoldPeriods = cfg.cleanPeriodsBeforeUpgrade;
+    }
+  }
+
+  StreamSettings next = current;
+  if (predictBytesPerSec(next) > budget) {
+    while (predictBytesPerSec(next) > budget && degrade(next)) {
+    }
+  } else if (cleanPeriods >= upgradeHoldPeriods) {
+    // Only step up when the next notch leaves some headroom
+    StreamSettings candidate = next;
+    if (upgrade(candidate) &&
+        predictBytesPerSec(candidate) <= uint32_t(budget * 0.8f)) {
+      next = candidate;
+      cleanPeriods = 0;
+      periodsSinceUpgrade = 0;
+    }
+  }
+
+  if (next == current) {
+    return false;
+  }
+  // Until frames at the new settings are measured, use the model's guess
+  avgFrameBytes = predictBytesPerSec(next) / next.fps;
+  current = next;
+  return true;
+}
+
+// Frame size scales with pixel count and roughly with 1 / (quality + 5) on
+// the esp32-camera quality scale, the closed loop corrects the rest
+uint32_t AdaptiveStreamController::predictBytesPerSec(
+    const StreamSettings &settings) const {
+  float frameBytes = float(avgFrameBytes) * pixels(settings.frameSizeLevel) /
+                     pixels(current.frameSizeLevel) *
+                     (current.jpegQuality + 5.0f) /
+                     (settings.jpegQuality + 5.0f);
+  return uint32_t(frameBytes * settings.fps);
+}
+
+bool AdaptiveStreamController::degrade(StreamSettings &settings) const {
+  if (settings.jpegQuality < cfg.softQualityLimit) {
+    settings.jpegQuality = std::min<uint8_t>(
+        settings.jpegQuality + cfg.qualityStep, cfg.softQualityLimit);
+  } else if (settings.frameSizeLevel > 0) {
+    settings.frameSizeLevel--;
+  } else if (settings.fps > cfg.minFps) {
+    settings.fps = std::max<uint8_t>(settings.fps * 3 / 4, cfg.minFps);
+  } else if (settings.jpegQuality < cfg.worstQuality) {
+    settings.jpegQuality = std::min<uint8_t>(
+        settings.jpegQuality + cfg.qualityStep, cfg.worstQuality);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool AdaptiveStreamController::upgrade(StreamSettings &settings) const {
+  const StreamSettings &best = cfg.ceiling;
+  if (settings.jpegQuality > cfg.softQualityLimit) {
+    settings.jpegQuality = std::max<uint8_t>(
+        settings.jpegQuality - cfg.qualityStep, cfg.softQualityLimit);
+  } else if (settings.fps < best.fps) {
+    settings.fps = std::min<uint8_t>(
+        settings.fps + std::max(1, settings.fps / 4), best.fps);
+  } else if (settings.frameSizeLevel < best.frameSizeLevel) {
+    settings.frameSizeLevel++;
+  } else if (settings.jpegQuality > best.jpegQuality) {
+    settings.jpegQuality = std::max<uint8_t>(
+        settings.jpegQuality - cfg.qualityStep, best.jpegQuality);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint32_t AdaptiveStreamController::minBudget() const {
+  return cfg.targetBytesPerSec / 8;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Closed-loop controller that keeps the camera stream inside a bandwidth
+// budget by trading JPEG quality, frame size and fps.
+//
+// The transmit side reports every sent frame (size and time to send it) and
+// forwards receiver loss reports. Once per period update() compares the
+// measured demand against a budget that backs off multiplicatively on
+// congestion (loss or the sender falling behind) and recovers additively
+// when the link is clean, then steps the settings down or up one notch.
+// Degrade order is quality -> frame size -> fps -> quality again, upgrades
+// walk the same ladder in reverse.
+//
+// No Arduino dependencies, time is passed in so it can be simulated on a
+// host. Frame sizes are ladder levels, the camera code maps them to the
+// sensor's framesize_t.
+
+struct StreamFrameSize {
+  const char *name;
+  uint16_t width;
+  uint16_t height;
+};
+
+// Frame sizes the controller may pick from, smallest first. Never go above
+// the size the camera was initialized with, its JPEG buffers are sized for
+// that resolution.
+constexpr StreamFrameSize STREAM_FRAME_SIZES[] = {
+    {"QQVGA", 160, 120}, {"QVGA", 320, 240}, {"CIF", 400, 296},
+    {"HVGA", 480, 320},  {"VGA", 640, 480},
+};
+constexpr uint8_t STREAM_FRAME_SIZE_COUNT =
+    sizeof(STREAM_FRAME_SIZES) / sizeof(STREAM_FRAME_SIZES[0]);
+
+// Returns the ladder level for a name like "VGA", or -1 if unknown
+int streamFrameSizeLevel(const char *name);
+
+struct StreamSettings {
+  uint8_t jpegQuality; // esp32-camera scale, lower is better (0-63)
+  uint8_t frameSizeLevel;
+  uint8_t fps;
+
+  bool operator==(const StreamSettings &other) const {
+    return jpegQuality == other.jpegQuality &&
+           frameSizeLevel == other.frameSizeLevel && fps == other.fps;
+  }
+  bool operator!=(const StreamSettings &other) const {
+    return !(*this == other);
+  }
+};
+
+struct AdaptiveStreamConfig {
+  uint32_t targetBytesPerSec = 0; // 0 disables adaptation
+  // Best settings the controller may use, normally what the user asked for
+  StreamSettings ceiling = {12, STREAM_FRAME_SIZE_COUNT - 1, 10};
+  uint8_t worstQuality = 40;
+  // Quality is only lowered past this once size and fps are at minimum
+  uint8_t softQualityLimit = 25;
+  uint8_t qualityStep = 3;
+  uint8_t minFps = 2;
+  uint32_t periodMs = 1000;
+  float lossThreshold = 0.05f; // Fraction of frames dropped at receiver
+  // Sender is congested when sending takes this fraction of the interval
+  float sendTimeThreshold = 0.9f;
+  uint8_t cleanPeriodsBeforeUpgrade = 3;
+};
+
+class AdaptiveStreamController {
+public:
+  using Config = AdaptiveStreamConfig;
+
+  AdaptiveStreamController() : AdaptiveStreamController(Config()) {}
+  explicit AdaptiveStreamController(const Config &config);
+
+  // Replaces the config. Settings are clamped to the new ceiling.
+  void configure(const Config &config);
+  const Config &config() const { return cfg; }
+  bool isEnabled() const { return cfg.targetBytesPerSec > 0; }
+
+  void onFrameSent(uint32_t frameBytes, uint32_t sendTimeMs);
+  // Cumulative counters from the receiver, deltas are taken internally
+  void onReceiverReport(uint32_t framesCompleted, uint32_t framesDropped);
+
+  // Runs the control law once per period. Returns true when settings
+  // changed and should be applied to the sensor.
+  bool update(uint32_t nowMs);
+
+  const StreamSettings &settings() const { return current; }
+  uint32_t budgetBytesPerSec() const { return budget; }
+  float lastLossRatio() const { return lossRatio; }
+
+private:
+  uint32_t predictBytesPerSec(const StreamSettings &settings) const;
+  bool degrade(StreamSettings &settings) const;
+  bool upgrade(StreamSettings &settings) const;
+  uint32_t minBudget() const;
+
+  Config cfg;
+  StreamSettings current;
+  uint32_t budget = 0;
+  uint8_t cleanPeriods = 0;
+  // Upgrades that get knocked back straight away double the wait before the
+  // next one, so a link right at a ladder step does not flap
+  uint8_t upgradeHoldPeriods = 0;
+  uint8_t periodsSinceUpgrade = UINT8_MAX;
+
+  // Measurements for the current period
+  bool started = false;
+  uint32_t periodStartMs = 0;
+  uint32_t periodBytes = 0;
+  uint32_t periodFrames = 0;
+  uint32_t periodSendTimeMs = 0;
+  // Average frame size at the current settings, used to predict demand
+  uint32_t avgFrameBytes = 0;
+
+  // Receiver feedback
+  bool haveReport = false;
+  bool reportPending = false;
+  uint32_t lastCompleted = 0;
+  uint32_t lastDropped = 0;
+  float lossRatio = 0;
+};
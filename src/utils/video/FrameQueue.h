@@ -0,0 +1,75 @@
+#pragma once
+#include "../SpscQueue.h"
+#include <atomic>
+#include <cstdint>
+
+// Hand-off queue between the capture task and the transmit task.
+// Frames are buffers owned by the camera driver (camera_fb_t* on the board),
+// so every frame that is not sent has to be given back through the release
+// function. Two drop rules keep latency bounded:
+//  - push() on a full queue releases the new frame immediately
+//  - pop() releases frames that waited longer than maxAgeMs and moves on
+// Time comes from the caller so the policy can run against a fake clock.
+template <typename Frame, size_t Capacity> class FrameQueue {
+public:
+  using ReleaseFunction = void (*)(Frame);
+
+  FrameQueue(uint32_t maxAgeMs, ReleaseFunction release)
+      : maxAgeMs(maxAgeMs), release(release) {}
+
+  // Capture task only. Returns false if the frame had to be dropped.
+  bool push(Frame frame, uint32_t nowMs) {
+    if (!queue.push(Entry{frame, nowMs})) {
+      release(frame);
+      droppedFull.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Transmit task only. Gets the oldest frame that is still fresh enough,
+  // along with the time it was queued.
+  bool pop(Frame &frame, uint32_t &queuedAtMs, uint32_t nowMs) {
+    Entry entry;
+    while (queue.pop(entry)) {
+      if (nowMs - entry.queuedAtMs > maxAgeMs) {
+        release(entry.frame);
+        droppedStale.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      frame = entry.frame;
+      queuedAtMs = entry.queuedAtMs;
+      return true;
+    }
+    return false;
+  }
+
+  // Transmit task only, gives every queued frame back, e.g. when streaming
+  // stops
+  void releaseAll() {
+    Entry entry;
+    while (queue.pop(entry)) {
+      release(entry.frame);
+    }
+  }
+
+  uint32_t framesDroppedFull() const {
+    return droppedFull.load(std::memory_order_relaxed);
+  }
+  uint32_t framesDroppedStale() const {
+    return droppedStale.load(std::memory_order_relaxed);
+  }
+  size_t size() const { return queue.size(); }
+
+private:
+  struct Entry {
+    Frame frame;
+    uint32_t queuedAtMs;
+  };
+
+  SpscQueue<Entry, Capacity> queue;
+  const uint32_t maxAgeMs;
+  ReleaseFunction release;
+  std::atomic<uint32_t> droppedFull{0};
+  std::atomic<uint32_t> droppedStale{0};
+};
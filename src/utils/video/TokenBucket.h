@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+
+// Byte-rate token bucket used to pace video chunks without blocking.
+// Time is passed in by the caller (micros() on the board, a fake clock on a
+// host) so the pacing can be exercised without hardware.
+// A rate of 0 is burst mode: every send is allowed immediately.
+class TokenBucket {
+public:
+  TokenBucket(uint32_t bytesPerSecond = 0, uint32_t burstBytes = 0) {
+    configure(bytesPerSecond, burstBytes);
+  }
+
+  // Changes the rate and bucket size, the bucket starts full. burstBytes
+  // must be at least the largest single send or it will never fit.
+  void configure(uint32_t bytesPerSecond, uint32_t burstBytes) {
+    rate = bytesPerSecond;
+    capacity = static_cast<uint64_t>(burstBytes) * MICROS_PER_SECOND;
+    tokens = capacity;
+    primed = false;
+  }
+
+  // Takes bytes from the bucket if there are enough tokens for them
+  bool tryConsume(uint32_t bytes, uint32_t nowUs) {
+    if (rate == 0) {
+      return true;
+    }
+    refill(nowUs);
+    uint64_t cost = static_cast<uint64_t>(bytes) * MICROS_PER_SECOND;
+    if (tokens < cost) {
+      return false;
+    }
+    tokens -= cost;
+    return true;
+  }
+
+  // Gives back bytes taken by tryConsume() that were not sent after all, so
+  // a retried send is not charged twice
+  void refund(uint32_t bytes) {
+    tokens += static_cast<uint64_t>(bytes) * MICROS_PER_SECOND;
+    if (tokens > capacity) {
+      tokens = capacity;
+    }
+  }
+
+private:
+  static constexpr uint64_t MICROS_PER_SECOND = 1000000;
+
+  void refill(uint32_t nowUs) {
+    if (!primed) {
+      primed = true;
+      lastRefillUs = nowUs;
+      return;
+    }
+    // Unsigned subtraction keeps working across the micros() wrap
+    uint32_t elapsedUs = nowUs - lastRefillUs;
+    lastRefillUs = nowUs;
+    // Tokens are stored in byte-microseconds so no precision is lost
+    tokens += static_cast<uint64_t>(elapsedUs) * rate;
+    if (tokens > capacity) {
+      tokens = capacity;
+    }
+  }
+
+  uint32_t rate = 0;
+  uint64_t capacity = 0;
+  uint64_t tokens = 0;
+  uint32_t lastRefillUs = 0;
+  bool primed = false;
+};
@@ -0,0 +1,266 @@
+#include "VideoProtocol.h"
+#include <algorithm>
+#include <cstring>
+
+bool parseVideoChunkHeader(const uint8_t *datagram, size_t length,
+                           VideoChunkHeader &header) {
+  if (!datagram || length < VIDEO_CHUNK_HEADER_SIZE) {
+    return false;
+  }
+  memcpy(&header, datagram, VIDEO_CHUNK_HEADER_SIZE);
+  return header.magic == VIDEO_PROTOCOL_MAGIC &&
+         header.version == VIDEO_PROTOCOL_VERSION;
+}
+
+bool parseVideoReceiverReport(const uint8_t *datagram, size_t length,
+                              VideoReceiverReport &report) {
+  if (!datagram || length < sizeof(VideoReceiverReport)) {
+    return false;
+  }
+  memcpy(&report, datagram, sizeof(VideoReceiverReport));
+  return report.magic == VIDEO_REPORT_MAGIC &&
+         report.version == VIDEO_PROTOCOL_VERSION;
+}
+
+VideoFrameChunker::VideoFrameChunker(size_t maxDatagramSize)
+    : maxPayload(maxDatagramSize > VIDEO_CHUNK_HEADER_SIZE
+                     ? maxDatagramSize - VIDEO_CHUNK_HEADER_SIZE
+                     : 1) {}
+
+uint16_t VideoFrameChunker::beginFrame(const uint8_t *data, size_t length,
+                                       uint32_t captureTime) {
+  frameId++;
+  frameData = data;
+  frameLength = length;
+  captureTimeMs = captureTime;
+
+  size_t chunks = (length + maxPayload - 1) / maxPayload;
+  if (!data || chunks == 0 || chunks > UINT16_MAX || length > UINT32_MAX) {
+    count = 0;
+    return 0;
+  }
+  count = static_cast<uint16_t>(chunks);
+  return count;
+}
+
+bool VideoFrameChunker::chunkAt(uint16_t index, VideoChunk &chunk) const {
+  if (index >= count) {
+    return false;
+  }
+  size_t offset = static_cast<size_t>(index) * maxPayload;
+
+  chunk.header.magic = VIDEO_PROTOCOL_MAGIC;
+  chunk.header.version = VIDEO_PROTOCOL_VERSION;
+  chunk.header.flags = 0;
+  chunk.header.frameId = frameId;
+  chunk.header.chunkIndex = index;
+  chunk.header.chunkCount = count;
+  chunk.header.offset = static_cast<uint32_t>(offset);
+  chunk.header.frameLength = static_cast<uint32_t>(frameLength);
+  chunk.header.captureTimeMs = captureTimeMs;
+  chunk.payload = frameData + offset;
+  chunk.payloadLength = std::min(maxPayload, frameLength - offset);
+  return true;
+}
+
+VideoFrameReassembler::VideoFrameReassembler(size_t slotCount,
+                                             size_t maxFrameBytes)
+    : slots(slotCount ? slotCount : 1), maxFrameBytes(maxFrameBytes) {}
+
+VideoFrameReassembler::PushResult
+VideoFrameReassembler::push(const uint8_t *datagram, size_t length) {
+  VideoChunkHeader header;
+  if (!parseVideoChunkHeader(datagram, length, header)) {
+    counters.chunksInvalid++;
+    return PushResult::Invalid;
+  }
+  const uint8_t *payload = datagram + VIDEO_CHUNK_HEADER_SIZE;
+  size_t payloadLength = length - VIDEO_CHUNK_HEADER_SIZE;
+
+  if (header.chunkCount == 0 || header.chunkIndex >= header.chunkCount ||
+      header.frameLength == 0 || header.frameLength > maxFrameBytes ||
+      payloadLength == 0 || header.offset > header.frameLength ||
+      payloadLength > header.frameLength - header.offset) {
+    counters.chunksInvalid++;
+    return PushResult::Invalid;
+  }
+  uint32_t chunkSize = impliedChunkSize(header, payloadLength);
+  if (chunkSize == 0) {
+    counters.chunksInvalid++;
+    return PushResult::Invalid;
+  }
+
+  if (haveFloor && !isNewer(header.frameId, floorId)) {
+    if (!senderRestarted(header.frameId)) {
+      return stale();
+    }
+    restart();
+  }
+
+  Slot *slot = findSlot(header.frameId);
+  if (!slot) {
+    slot = claimSlot(header);
+    if (!slot) {
+      // Older than everything in flight and no room for it
+      if (!senderRestarted(header.frameId)) {
+        return stale();
+      }
+      restart();
+      slot = claimSlot(header);
+    }
+  }
+
+  if (slot->frameLength != header.frameLength ||
+      slot->chunkCount != header.chunkCount ||
+      (slot->chunkSize != 0 && slot->chunkSize != chunkSize)) {
+    counters.chunksInvalid++;
+    return PushResult::Invalid;
+  }
+  if (slot->received[header.chunkIndex]) {
+    counters.chunksDuplicate++;
+    return PushResult::Duplicate;
+  }
+
+  slot->chunkSize = chunkSize;
+  memcpy(slot->data.data() + header.offset, payload, payloadLength);
+  slot->received[header.chunkIndex] = true;
+  slot->chunksReceived++;
+  counters.chunksReceived++;
+  staleRun = 0;
+
+  if (slot->chunksReceived < slot->chunkCount) {
+    return PushResult::Accepted;
+  }
+
+  // Hand the buffer out without copying, the slot gets the old one back
+  lastFrame.swap(slot->data);
+  lastHeader = slot->firstHeader;
+  counters.framesCompleted++;
+  uint32_t completedId = slot->frameId;
+  release(*slot, false);
+
+  // Anything older that is still incomplete can no longer be shown in order
+  for (Slot &other : slots) {
+    if (other.inUse && isNewer(completedId, other.frameId)) {
+      release(other, true);
+    }
+  }
+  haveFloor = true;
+  floorId = completedId;
+  return PushResult::FrameComplete;
+}
+
+// Every chunk but the last carries exactly chunkSize bytes at
+// chunkIndex * chunkSize, the last one runs to the end of the frame. Returns
+// the chunk size the header implies, or 0 when offset, length and index do
+// not add up, so a bad header cannot put bytes in the wrong place.
+uint32_t
+VideoFrameReassembler::impliedChunkSize(const VideoChunkHeader &header,
+                                        size_t payloadLength) {
+  bool last = header.chunkIndex + 1 == header.chunkCount;
+  uint32_t chunkSize;
+  if (!last) {
+    chunkSize = static_cast<uint32_t>(payloadLength);
+    if (header.offset != uint64_t(header.chunkIndex) * chunkSize) {
+      return 0;
+    }
+  } else {
+    if (header.offset + payloadLength != header.frameLength) {
+      return 0;
+    }
+    if (header.chunkIndex == 0) {
+      // Single chunk frame
+      return header.offset == 0 ? header.frameLength : 0;
+    }
+    chunkSize = header.offset / header.chunkIndex;
+    if (header.offset % header.chunkIndex != 0 || payloadLength > chunkSize) {
+      return 0;
+    }
+  }
+  // The chunk count has to follow from the size, like the sender splits
+  uint64_t chunks = (uint64_t(header.frameLength) + chunkSize - 1) / chunkSize;
+  return chunks == header.chunkCount ? chunkSize : 0;
+}
+
+VideoFrameReassembler::Slot *VideoFrameReassembler::findSlot(uint32_t id) {
+  for (Slot &slot : slots) {
+    if (slot.inUse && slot.frameId == id) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+VideoFrameReassembler::Slot *
+VideoFrameReassembler::claimSlot(const VideoChunkHeader &header) {
+  Slot *target = nullptr;
+  for (Slot &slot : slots) {
+    if (!slot.inUse) {
+      target = &slot;
+      break;
+    }
+    if (!target || isNewer(target->frameId, slot.frameId)) {
+      target = &slot; // Oldest frame in flight
+    }
+  }
+
+  if (target->inUse) {
+    if (!isNewer(header.frameId, target->frameId)) {
+      return nullptr;
+    }
+    // Evicted frames count as dropped and their late chunks become stale
+    if (!haveFloor || isNewer(target->frameId, floorId)) {
+      haveFloor = true;
+      floorId = target->frameId;
+    }
+    release(*target, true);
+  }
+
+  target->inUse = true;
+  target->frameId = header.frameId;
+  target->frameLength = header.frameLength;
+  target->chunkCount = header.chunkCount;
+  target->chunksReceived = 0;
+  target->chunkSize = 0;
+  target->firstHeader = header;
+  target->firstHeader.chunkIndex = 0;
+  target->firstHeader.offset = 0;
+  target->data.resize(header.frameLength);
+  target->received.assign(header.chunkCount, false);
+  return target;
+}
+
+// Called for a chunk that would be stale. Late chunks trail the last
+// finished frame by a few frames at most and never come in long runs.
+bool VideoFrameReassembler::senderRestarted(uint32_t frameId) const {
+  if (staleRun + 1 >= RESTART_STALE_CHUNKS) {
+    return true;
+  }
+  return haveFloor && !isNewer(frameId, floorId) &&
+         floorId - frameId >= RESTART_JUMP_FRAMES;
+}
+
+// Frames in flight belong to the old stream and can never complete
+void VideoFrameReassembler::restart() {
+  for (Slot &slot : slots) {
+    if (slot.inUse) {
+      release(slot, true);
+    }
+  }
+  haveFloor = false;
+  staleRun = 0;
+  counters.senderRestarts++;
+}
+
+VideoFrameReassembler::PushResult VideoFrameReassembler::stale() {
+  counters.chunksStale++;
+  staleRun++;
+  return PushResult::Stale;
+}
+
+void VideoFrameReassembler::release(Slot &slot, bool dropped) {
+  if (dropped) {
+    counters.framesDropped++;
+  }
+  slot.inUse = false;
+}
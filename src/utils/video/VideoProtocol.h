@@ -0,0 +1,173 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Wire format for the camera board -> video receiver UDP stream.
+// Every datagram is a VideoChunkHeader followed by a slice of one JPEG frame.
+// The header is packed and little endian (ESP32 and the usual receiver hosts
+// are both little endian), so it is sent as-is without a copy.
+// This file has no Arduino dependencies so it also builds on a host for the
+// receiver and for testing.
+
+constexpr uint16_t VIDEO_PROTOCOL_MAGIC = 0x5654; // "TV" on the wire
+constexpr uint8_t VIDEO_PROTOCOL_VERSION = 1;
+// Keeps header + payload + IP/UDP headers under a 1500 byte Ethernet MTU so
+// datagrams are never fragmented
+constexpr size_t VIDEO_MAX_DATAGRAM_SIZE = 1400;
+
+struct __attribute__((packed)) VideoChunkHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t flags;          // Reserved, always 0 for now
+  uint32_t frameId;       // Increments by one per captured frame, wraps
+  uint16_t chunkIndex;    // Index of this chunk within the frame
+  uint16_t chunkCount;    // Total chunks making up the frame
+  uint32_t offset;        // Byte offset of this chunk's payload in the frame
+  uint32_t frameLength;   // Total JPEG size in bytes
+  uint32_t captureTimeMs; // Sender millis() when the frame was captured
+};
+static_assert(sizeof(VideoChunkHeader) == 24,
+              "VideoChunkHeader must be packed");
+
+constexpr size_t VIDEO_CHUNK_HEADER_SIZE = sizeof(VideoChunkHeader);
+
+// Sent by the receiver back to the source address of the stream about once
+// per second. Counters are cumulative since the receiver started.
+constexpr uint16_t VIDEO_REPORT_MAGIC = 0x5652; // "RV" on the wire
+
+struct __attribute__((packed)) VideoReceiverReport {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t flags; // Reserved, always 0 for now
+  uint32_t framesCompleted;
+  uint32_t framesDropped;
+  uint32_t lastFrameId;
+};
+static_assert(sizeof(VideoReceiverReport) == 16,
+              "VideoReceiverReport must be packed");
+
+bool parseVideoReceiverReport(const uint8_t *datagram, size_t length,
+                              VideoReceiverReport &report);
+
+// Returns true when the datagram carries a well formed header for this
+// protocol version. Does not check the payload against any frame state.
+bool parseVideoChunkHeader(const uint8_t *datagram, size_t length,
+                           VideoChunkHeader &header);
+
+// One chunk ready to send: the header and a pointer into the frame buffer,
+// so the payload never has to be copied into a staging buffer.
+struct VideoChunk {
+  VideoChunkHeader header;
+  const uint8_t *payload;
+  size_t payloadLength;
+};
+
+// Splits frames into chunks that each fit in a single datagram.
+class VideoFrameChunker {
+public:
+  explicit VideoFrameChunker(size_t maxDatagramSize = VIDEO_MAX_DATAGRAM_SIZE);
+
+  // Starts a new frame and returns the number of chunks it needs (0 if the
+  // frame is empty or too large to index). The frame data must stay valid
+  // until the last chunk has been sent.
+  uint16_t beginFrame(const uint8_t *data, size_t length,
+                      uint32_t captureTimeMs);
+
+  // Fills chunk with the chunk at index for the current frame
+  bool chunkAt(uint16_t index, VideoChunk &chunk) const;
+
+  uint32_t currentFrameId() const { return frameId; }
+  uint16_t chunkCount() const { return count; }
+  size_t payloadSize() const { return maxPayload; }
+
+private:
+  size_t maxPayload;
+  const uint8_t *frameData = nullptr;
+  size_t frameLength = 0;
+  uint32_t captureTimeMs = 0;
+  uint32_t frameId = UINT32_MAX; // First beginFrame() wraps this to 0
+  uint16_t count = 0;
+};
+
+// Rebuilds frames from chunks that may arrive lost, duplicated or reordered.
+// A few frames are kept in flight at once; frames that cannot complete are
+// dropped instead of being handed out with holes in them.
+//
+// A sender that restarts (camera board reboot, another --replay run) starts
+// over at frameId 0. A frame id far behind the last finished one, or a long
+// run of stale chunks, is taken as such a restart and the reassembler starts
+// over with it instead of waiting for the ids to pass the old ones.
+class VideoFrameReassembler {
+public:
+  // Frames a chunk may lag the last finished one and still count as late
+  static constexpr uint32_t RESTART_JUMP_FRAMES = 64;
+  // Stale chunks in a row that mean the sender started over
+  static constexpr uint32_t RESTART_STALE_CHUNKS = 32;
+
+  enum class PushResult {
+    Invalid,      // Not a video datagram or inconsistent with its frame
+    Stale,        // Belongs to a frame that was already completed or dropped
+    Duplicate,    // Chunk was already received
+    Accepted,     // Stored, frame still incomplete
+    FrameComplete // Stored and the frame is now available via lastFrameData()
+  };
+
+  struct Stats {
+    uint32_t framesCompleted = 0;
+    uint32_t framesDropped = 0; // Incomplete frames that were given up on
+    uint32_t chunksReceived = 0;
+    uint32_t chunksDuplicate = 0;
+    uint32_t chunksStale = 0;
+    uint32_t chunksInvalid = 0;
+    uint32_t senderRestarts = 0;
+  };
+
+  explicit VideoFrameReassembler(size_t slotCount = 4,
+                                 size_t maxFrameBytes = 512 * 1024);
+
+  PushResult push(const uint8_t *datagram, size_t length);
+
+  // Valid after push() returned FrameComplete, until the next push()
+  const uint8_t *lastFrameData() const { return lastFrame.data(); }
+  size_t lastFrameLength() const { return lastFrame.size(); }
+  const VideoChunkHeader &lastFrameHeader() const { return lastHeader; }
+
+  const Stats &stats() const { return counters; }
+
+private:
+  struct Slot {
+    bool inUse = false;
+    uint32_t frameId = 0;
+    uint32_t frameLength = 0;
+    uint16_t chunkCount = 0;
+    uint16_t chunksReceived = 0;
+    uint32_t chunkSize = 0; // Payload of every chunk but the last, 0 unknown
+    VideoChunkHeader firstHeader{};
+    std::vector<uint8_t> data;
+    std::vector<bool> received;
+  };
+
+  static uint32_t impliedChunkSize(const VideoChunkHeader &header,
+                                   size_t payloadLength);
+  Slot *findSlot(uint32_t frameId);
+  Slot *claimSlot(const VideoChunkHeader &header);
+  void release(Slot &slot, bool dropped);
+  bool senderRestarted(uint32_t frameId) const;
+  void restart();
+  PushResult stale();
+  // Serial number comparison so frame ids can wrap around
+  static bool isNewer(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+
+  std::vector<Slot> slots;
+  size_t maxFrameBytes;
+  std::vector<uint8_t> lastFrame;
+  VideoChunkHeader lastHeader{};
+  // Frames at or before this id were completed or dropped already
+  bool haveFloor = false;
+  uint32_t floorId = 0;
+  uint32_t staleRun = 0; // Stale chunks since the last stored one
+  Stats counters;
+};
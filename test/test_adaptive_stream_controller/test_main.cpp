@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <utils/video/AdaptiveStreamController.h>
+
+constexpr StreamSettings CEILING = {12, STREAM_FRAME_SIZE_COUNT - 1, 10};
+constexpr uint8_t SOFT_QUALITY_LIMIT = 25;
+constexpr uint8_t MIN_FPS = 2;
+
+// Camera and link stand-in. Frames follow the same size model the
+// controller predicts with, so its guesses hold and the tests see the
+// control law alone.
+struct StreamSimulation {
+  AdaptiveStreamController controller;
+  uint32_t nowMs = 0;
+  uint32_t framesCompleted = 0;
+  uint32_t framesDropped = 0;
+
+  explicit StreamSimulation(uint32_t targetBytesPerSec) {
+    AdaptiveStreamConfig config;
+    config.targetBytesPerSec = targetBytesPerSec;
+    config.ceiling = CEILING;
+    config.softQualityLimit = SOFT_QUALITY_LIMIT;
+    config.minFps = MIN_FPS;
+    controller.configure(config);
+    controller.onReceiverReport(0, 0); // The receiver's baseline
+    controller.update(nowMs);          // Starts the first period
+  }
+
+  static uint32_t frameBytes(const StreamSettings &settings) {
+    const StreamFrameSize &size = STREAM_FRAME_SIZES[settings.frameSizeLevel];
+    return uint32_t(size.width) * size.height * 2 / (settings.jpegQuality + 5);
+  }
+
+  // One second of frames, dropping every dropEvery-th at the receiver (0
+  // drops none). Returns true when the controller changed the settings.
+  bool period(uint32_t dropEvery = 0) {
+    const StreamSettings &settings = controller.settings();
+    for (uint8_t i = 0; i < settings.fps; i++) {
+      controller.onFrameSent(frameBytes(settings), 1);
+      if (dropEvery && (i + 1) % dropEvery == 0) {
+        framesDropped++;
+      } else {
+        framesCompleted++;
+      }
+    }
+    controller.onReceiverReport(framesCompleted, framesDropped);
+    nowMs += 1000;
+    return controller.update(nowMs);
+  }
+};
+
+// Clean periods until the settings change, giving up after a minute
+int cleanPeriodsUntilChange(StreamSimulation &sim) {
+  for (int periods = 1; periods <= 60; periods++) {
+    if (sim.period()) {
+      return periods;
+    }
+  }
+  return 0;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_settings_stay_at_the_ceiling_inside_the_budget() {
+  StreamSimulation sim(400000);
+  for (int i = 0; i < 20; i++) {
+    TEST_ASSERT_FALSE(sim.period());
+  }
+  TEST_ASSERT_TRUE(sim.controller.settings() == CEILING);
+}
+
+// Lower budgets reach further down the ladder: quality up to the soft
+// limit, then frame size, then fps, then quality again
+void test_degrade_order() {
+  StreamSimulation qualityOnly(300000);
+  qualityOnly.period();
+  StreamSettings settings = qualityOnly.controller.settings();
+  TEST_ASSERT_GREATER_THAN(CEILING.jpegQuality, settings.jpegQuality);
+  TEST_ASSERT_LESS_OR_EQUAL(SOFT_QUALITY_LIMIT, settings.jpegQuality);
+  TEST_ASSERT_EQUAL_UINT8(CEILING.frameSizeLevel, settings.frameSizeLevel);
+  TEST_ASSERT_EQUAL_UINT8(CEILING.fps, settings.fps);
+
+  StreamSimulation frameSize(100000);
+  frameSize.period();
+  settings = frameSize.controller.settings();
+  TEST_ASSERT_EQUAL_UINT8(SOFT_QUALITY_LIMIT, settings.jpegQuality);
+  TEST_ASSERT_LESS_THAN(CEILING.frameSizeLevel, settings.frameSizeLevel);
+  TEST_ASSERT_GREATER_THAN(0, settings.frameSizeLevel);
+  TEST_ASSERT_EQUAL_UINT8(CEILING.fps, settings.fps);
+
+  StreamSimulation fps(10000);
+  fps.period();
+  settings = fps.controller.settings();
+  TEST_ASSERT_EQUAL_UINT8(SOFT_QUALITY_LIMIT, settings.jpegQuality);
+  TEST_ASSERT_EQUAL_UINT8(0, settings.frameSizeLevel);
+  TEST_ASSERT_LESS_THAN(CEILING.fps, settings.fps);
+
+  StreamSimulation qualityAgain(2000);
+  qualityAgain.period();
+  settings = qualityAgain.controller.settings();
+  TEST_ASSERT_GREATER_THAN(SOFT_QUALITY_LIMIT, settings.jpegQuality);
+  TEST_ASSERT_EQUAL_UINT8(0, settings.frameSizeLevel);
+  TEST_ASSERT_EQUAL_UINT8(MIN_FPS, settings.fps);
+}
+
+void test_loss_backs_off_and_clean_periods_recover_additively() {
+  const uint32_t target = 400000;
+  StreamSimulation sim(target);
+  TEST_ASSERT_TRUE(sim.period(5)); // 20% loss
+  uint32_t backedOff = uint32_t(target * 0.7f);
+  TEST_ASSERT_EQUAL_UINT32(backedOff, sim.controller.budgetBytesPerSec());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.2, sim.controller.lastLossRatio());
+  StreamSettings degraded = sim.controller.settings();
+  TEST_ASSERT_GREATER_THAN(CEILING.jpegQuality, degraded.jpegQuality);
+
+  // The budget holds until cleanPeriodsBeforeUpgrade clean periods, then
+  // grows by a tenth of the target per period up to the target
+  TEST_ASSERT_FALSE(sim.period());
+  TEST_ASSERT_FALSE(sim.period());
+  TEST_ASSERT_EQUAL_UINT32(backedOff, sim.controller.budgetBytesPerSec());
+  TEST_ASSERT_FALSE(sim.period());
+  TEST_ASSERT_EQUAL_UINT32(backedOff + target / 10,
+                           sim.controller.budgetBytesPerSec());
+  TEST_ASSERT_FALSE(sim.period());
+  TEST_ASSERT_EQUAL_UINT32(backedOff + 2 * target / 10,
+                           sim.controller.budgetBytesPerSec());
+  // Enough headroom for one notch up
+  TEST_ASSERT_TRUE(sim.period());
+  TEST_ASSERT_EQUAL_UINT32(target, sim.controller.budgetBytesPerSec());
+  TEST_ASSERT_LESS_THAN(degraded.jpegQuality,
+                        sim.controller.settings().jpegQuality);
+}
+
+void test_knocked_back_upgrade_doubles_the_hold() {
+  StreamSimulation sim(400000);
+  sim.period(5);
+  // Upgrades on the 5th clean period, see the test above
+  TEST_ASSERT_EQUAL(5, cleanPeriodsUntilChange(sim));
+
+  // Loss right after the upgrade knocks it back
+  TEST_ASSERT_TRUE(sim.period(5));
+  // Same budget recovery, but the hold is now 6 periods instead of 3
+  TEST_ASSERT_EQUAL(6, cleanPeriodsUntilChange(sim));
+}
+
+void test_restarted_receiver_is_not_counted_as_loss() {
+  StreamSimulation sim(400000);
+  sim.controller.onReceiverReport(1000, 10); // Baseline
+  sim.controller.onReceiverReport(1100, 10);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, sim.controller.lastLossRatio());
+  // Counters back near zero, the deltas would wrap around
+  sim.controller.onReceiverReport(5, 5);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, sim.controller.lastLossRatio());
+  // Later reports are taken against the new counters
+  sim.controller.onReceiverReport(10, 50);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.9, sim.controller.lastLossRatio());
+
+  // A restart alone leaves the settings alone
+  StreamSimulation clean(400000);
+  clean.framesCompleted = 5000;
+  clean.period();
+  clean.framesCompleted = 0;
+  TEST_ASSERT_FALSE(clean.period());
+  TEST_ASSERT_TRUE(clean.controller.settings() == CEILING);
+  TEST_ASSERT_EQUAL_UINT32(400000, clean.controller.budgetBytesPerSec());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_settings_stay_at_the_ceiling_inside_the_budget);
+  RUN_TEST(test_degrade_order);
+  RUN_TEST(test_loss_backs_off_and_clean_periods_recover_additively);
+  RUN_TEST(test_knocked_back_upgrade_doubles_the_hold);
+  RUN_TEST(test_restarted_receiver_is_not_counted_as_loss);
+  return UNITY_END();
+}
@@ -0,0 +1,69 @@
+#include <NativeHal.h>
+#include <devices/CameraDevice.h>
+#include <unity.h>
+
+uint32_t uptimeSec;
+
+// A streaming camera board's report, only the uptime moves between them
+CameraTelemetry report(uint8_t jpegQuality = 12) {
+  CameraTelemetry telemetry = {};
+  initCameraMessageHeader(telemetry.header, CameraMessageType::Telemetry, 0);
+  telemetry.achievedFps = 9.8f;
+  telemetry.avgFrameBytes = 18000;
+  telemetry.jpegQuality = jpegQuality;
+  telemetry.frameSizeLevel = STREAM_FRAME_SIZE_COUNT - 1;
+  telemetry.streamFps = 10;
+  telemetry.adaptiveEnabled = 1;
+  telemetry.uptimeSec = uptimeSec;
+  return telemetry;
+}
+
+// One report a second for a while, returns how often the version moved
+uint32_t streamFor(CameraDevice &camera, uint32_t seconds) {
+  uint32_t before = camera.getStateVersion();
+  for (uint32_t i = 0; i < seconds; i++) {
+    nativeHal::advanceMillis(CAMERA_STREAMING_TELEMETRY_INTERVAL_MS);
+    uptimeSec++;
+    camera.onTelemetry(report());
+    camera.update();
+  }
+  return camera.getStateVersion() - before;
+}
+
+void setUp() {
+  nativeHal::setMillis(100000);
+  uptimeSec = 0;
+}
+void tearDown() {}
+
+void test_telemetry_alone_is_published_at_its_own_cadence() {
+  CameraDevice camera("camera");
+  // The first report sets what the stream runs with
+  TEST_ASSERT_EQUAL_UINT32(1, streamFor(camera, 1));
+  // Then only the counters move, once every 30 s is enough
+  TEST_ASSERT_EQUAL_UINT32(0, streamFor(camera, 29));
+  TEST_ASSERT_EQUAL_UINT32(1, streamFor(camera, 1));
+  TEST_ASSERT_EQUAL_UINT32(10, streamFor(camera, 300));
+}
+
+void test_stream_settings_change_goes_out_straight_away() {
+  CameraDevice camera("camera");
+  streamFor(camera, 1);
+  uint32_t before = camera.getStateVersion();
+  nativeHal::advanceMillis(CAMERA_STREAMING_TELEMETRY_INTERVAL_MS);
+  camera.onTelemetry(report(20)); // The controller lowered the quality
+  camera.update();
+  TEST_ASSERT_EQUAL_UINT32(before + 1, camera.getStateVersion());
+  // And restarts the telemetry cadence
+  nativeHal::advanceMillis(CAMERA_STREAMING_TELEMETRY_INTERVAL_MS);
+  camera.onTelemetry(report(20));
+  camera.update();
+  TEST_ASSERT_EQUAL_UINT32(before + 1, camera.getStateVersion());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_telemetry_alone_is_published_at_its_own_cadence);
+  RUN_TEST(test_stream_settings_change_goes_out_straight_away);
+  return UNITY_END();
+}
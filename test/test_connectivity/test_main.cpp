@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <utils/Connectivity.h>
+#include <vector>
+
+// No jitter so attempts land on exact times
+constexpr RetryPolicy TEST_POLICY = {
+    1000,  // initialDelayMs
+    8000,  // maxDelayMs
+    2,     // multiplier
+    0,     // jitterPercent
+    30000, // deadlineMs
+    10000, // probeIntervalMs
+};
+constexpr uint32_t STEP_MS = 10;
+
+// Access point that associates a while after each attempt, as long as it is
+// reachable. An attempt restarts the association like WiFi.begin() does.
+struct SimulatedLink {
+  bool reachable = true;
+  uint32_t associateMs = 500; // Well inside the first delay
+  bool associating = false;
+  uint32_t attemptStartMs = 0;
+  bool up = false;
+  bool timeValid = false;
+
+  void connect(uint32_t nowMs) {
+    associating = true;
+    attemptStartMs = nowMs;
+  }
+  void drop() {
+    up = false;
+    associating = false;
+  }
+  void step(uint32_t nowMs) {
+    if (associating && reachable && nowMs - attemptStartMs >= associateMs) {
+      associating = false;
+      up = true;
+    }
+  }
+};
+
+std::vector<ConnectivityEvent> events;
+void recordEvent(ConnectivityEvent event) { events.push_back(event); }
+
+uint32_t nowMs;
+std::vector<uint32_t> attemptTimes;
+
+// Runs the owner's loop, WiFiHelper in the firmware, until untilMs
+void run(Connectivity &connectivity, SimulatedLink &link, uint32_t untilMs) {
+  for (; nowMs <= untilMs; nowMs += STEP_MS) {
+    link.step(nowMs);
+    if (connectivity.update(nowMs, link.up, link.timeValid)) {
+      attemptTimes.push_back(nowMs);
+      link.connect(nowMs);
+    }
+  }
+}
+
+void setUp() {
+  events.clear();
+  attemptTimes.clear();
+  nowMs = 0;
+}
+void tearDown() {}
+
+void test_connects_at_boot() {
+  Connectivity connectivity(TEST_POLICY);
+  connectivity.addListener(recordEvent);
+  SimulatedLink link;
+  run(connectivity, link, 10000);
+  TEST_ASSERT_EQUAL_size_t(1, attemptTimes.size());
+  TEST_ASSERT_EQUAL_UINT32(0, attemptTimes[0]);
+  TEST_ASSERT_TRUE(connectivity.isOnline());
+  TEST_ASSERT_EQUAL_size_t(2, events.size());
+  TEST_ASSERT_TRUE(events[0] == ConnectivityEvent::LinkUp);
+  TEST_ASSERT_TRUE(events[1] == ConnectivityEvent::Online);
+}
+
+void test_slow_association_is_restarted_with_backoff() {
+  Connectivity connectivity(TEST_POLICY);
+  SimulatedLink link;
+  link.associateMs = 5000; // Longer than the first two delays
+  run(connectivity, link, 20000);
+  // 0, then 1 s and 3 s restart the association, the 7 s one gets through
+  const uint32_t expected[] = {0, 1000, 3000, 7000};
+  TEST_ASSERT_EQUAL_size_t(4, attemptTimes.size());
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_UINT32(expected[i], attemptTimes[i]);
+  }
+  TEST_ASSERT_TRUE(connectivity.isLinkUp());
+}
+
+void test_unreachable_access_point_is_probed_slowly() {
+  Connectivity connectivity(TEST_POLICY);
+  SimulatedLink link;
+  link.reachable = false;
+  run(connectivity, link, 60000);
+  // Backoff until the 30 s deadline, then a probe every 10 s
+  const uint32_t expected[] = {0,     1000,  3000,  7000, 15000,
+                               23000, 40000, 50000, 60000};
+  TEST_ASSERT_EQUAL_size_t(9, attemptTimes.size());
+  for (size_t i = 0; i < 9; i++) {
+    TEST_ASSERT_EQUAL_UINT32(expected[i], attemptTimes[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(9, connectivity.connectAttempts());
+
+  link.reachable = true;
+  run(connectivity, link, 80000);
+  TEST_ASSERT_TRUE(connectivity.isOnline()); // From the 70 s probe
+}
+
+void test_link_drop_reconnects_right_away() {
+  Connectivity connectivity(TEST_POLICY);
+  connectivity.addListener(recordEvent);
+  SimulatedLink link;
+  run(connectivity, link, 5000);
+  events.clear();
+  link.drop();
+  uint32_t droppedAtMs = nowMs;
+  run(connectivity, link, 10000);
+  TEST_ASSERT_EQUAL_UINT32(1, connectivity.linkDrops());
+  TEST_ASSERT_EQUAL_UINT32(droppedAtMs, attemptTimes[1]);
+  // Offline goes out before the link is reported down
+  TEST_ASSERT_EQUAL_size_t(4, events.size());
+  TEST_ASSERT_TRUE(events[0] == ConnectivityEvent::Offline);
+  TEST_ASSERT_TRUE(events[1] == ConnectivityEvent::LinkDown);
+  TEST_ASSERT_TRUE(events[2] == ConnectivityEvent::LinkUp);
+  TEST_ASSERT_TRUE(events[3] == ConnectivityEvent::Online);
+}
+
+void test_online_waits_for_the_clock_when_required() {
+  Connectivity connectivity(TEST_POLICY);
+  connectivity.setRequireTime(true);
+  connectivity.addListener(recordEvent);
+  SimulatedLink link;
+  run(connectivity, link, 5000);
+  TEST_ASSERT_TRUE(connectivity.isLinkUp());
+  TEST_ASSERT_FALSE(connectivity.isOnline());
+  TEST_ASSERT_EQUAL_size_t(1, events.size());
+
+  link.timeValid = true;
+  run(connectivity, link, 6000);
+  TEST_ASSERT_TRUE(connectivity.isOnline());
+  TEST_ASSERT_TRUE(events.back() == ConnectivityEvent::Online);
+
+  // Losing the clock alone takes the board offline but keeps the link
+  link.timeValid = false;
+  run(connectivity, link, 7000);
+  TEST_ASSERT_FALSE(connectivity.isOnline());
+  TEST_ASSERT_TRUE(connectivity.isLinkUp());
+  TEST_ASSERT_TRUE(events.back() == ConnectivityEvent::Offline);
+  TEST_ASSERT_EQUAL_size_t(1, attemptTimes.size());
+}
+
+void test_listener_table_is_bounded() {
+  Connectivity connectivity(TEST_POLICY);
+  for (size_t i = 0; i < Connectivity::MAX_LISTENERS; i++) {
+    TEST_ASSERT_TRUE(connectivity.addListener(recordEvent));
+  }
+  TEST_ASSERT_FALSE(connectivity.addListener(recordEvent));
+  TEST_ASSERT_FALSE(Connectivity(TEST_POLICY).addListener(nullptr));
+  SimulatedLink link;
+  run(connectivity, link, 5000);
+  TEST_ASSERT_EQUAL_size_t(2 * Connectivity::MAX_LISTENERS, events.size());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connects_at_boot);
+  RUN_TEST(test_slow_association_is_restarted_with_backoff);
+  RUN_TEST(test_unreachable_access_point_is_probed_slowly);
+  RUN_TEST(test_link_drop_reconnects_right_away);
+  RUN_TEST(test_online_waits_for_the_clock_when_required);
+  RUN_TEST(test_listener_table_is_bounded);
+  return UNITY_END();
+}
@@ -0,0 +1,207 @@
+#include <ArduinoJson.h>
+#include <MemoryKeyValueStore.h>
+#include <cstring>
+#include <devices/CameraDevice.h>
+#include <devices/DeviceStateStore.h>
+#include <devices/HeatLamp.h>
+#include <devices/Light.h>
+#include <string>
+#include <unity.h>
+#include <utils/ArenaAllocator.h>
+#include <utils/firebase/DesiredStateMerge.h>
+#include <utils/firebase/DesiredStreamPath.h>
+#include <utils/firebase/FirebaseMessages.h>
+#include <vector>
+
+// FirebaseWrapper::DESIRED_STATE_ARENA_SIZE, sized for the ESP32. On a
+// 64-bit host ArduinoJson's pools hold twice the slots at twice the size, so
+// the same documents get four times the room here.
+constexpr size_t DESIRED_STATE_ARENA_SIZE = 8192;
+constexpr size_t HOST_ARENA_SIZE =
+    DESIRED_STATE_ARENA_SIZE * (sizeof(void *) == 4 ? 1 : 4);
+
+// Stream payloads as the web app writes them, whole documents carry keys
+// the devices never read
+const char HEAT_LAMP_PUT[] =
+    R"({"state":true,"onAbove":75.5,"offAbove":82,"label":"Basking lamp",)"
+    R"("icon":"lamp","order":2,"ui":{"collapsed":false,"color":"#ff8800"}})";
+const char LIGHT_PUT[] =
+    R"({"state":false,"onTime":"08:00","offTime":"20:30","label":"UVB",)"
+    R"("icon":"sun","order":1,"schedule":{"mon":["08:00","20:30"],)"
+    R"("tue":["08:00","20:30"],"wed":["08:00","20:30"]}})";
+const char CAMERA_PUT[] =
+    R"({"state":true,"fps":10,"quality":12,"frameSize":"VGA",)"
+    R"("targetKbps":800,"label":"Tank cam","order":3,)"
+    R"("ui":{"overlay":true,"zoom":1.5}})";
+
+ArenaAllocator<HOST_ARENA_SIZE> arena;
+MemoryKeyValueStore nvs;
+DeviceStateStore states(nvs);
+HeatLamp heatLamp("heatLamp", 4, 75, 82);
+Light light("lights", 5, TimeOfDay(8, 0), TimeOfDay(20, 30));
+CameraDevice camera("camera");
+
+// FirebaseWrapper::applyDesiredState() for one update. Returns the state
+// applied to the device, empty when it already had it.
+std::string applyUpdate(Device &device, const char *field, const char *json,
+                        bool patch) {
+  std::string applied;
+  {
+    JsonDocument filter(&arena);
+    device.desiredStateFilter(filter);
+    bool merge = patch || *field != '\0';
+    JsonDocument doc(&arena);
+    DeserializationError err =
+        merge ? deserializeJson(doc, json)
+              : deserializeJson(doc, json,
+                                DeserializationOption::Filter(filter));
+    TEST_ASSERT_EQUAL_STRING("Ok", err.c_str());
+    JsonDocument merged(&arena);
+    if (merge) {
+      JsonDocument current(&arena);
+      states.load(device, current);
+      mergeDesiredEvent(current, field, doc.as<JsonVariantConst>(), patch);
+      TEST_ASSERT_TRUE(filterDesiredState(current.as<JsonVariantConst>(),
+                                          filter, merged));
+    }
+    JsonVariantConst desired = merge ? merged.as<JsonVariantConst>()
+                                     : doc.as<JsonVariantConst>();
+    if (states.update(device, desired)) {
+      device.applyState(desired);
+      serializeJson(desired, applied);
+    }
+  }
+  // Never full, and empty again once the update's documents are gone
+  TEST_ASSERT_EQUAL_UINT32(0, arena.failedAllocations());
+  TEST_ASSERT_EQUAL_size_t(0, arena.bytesUsed());
+  return applied;
+}
+
+// A stream event below a device, routed like the stream callback does
+std::string streamEvent(const char *event, const char *path,
+                        const char *json) {
+  char name[FIREBASE_DEVICE_NAME_SIZE];
+  char field[FIREBASE_FIELD_PATH_SIZE];
+  DesiredStreamPath kind = classifyDesiredStreamPath(
+      event, path, name, sizeof(name), field, sizeof(field));
+  TEST_ASSERT_TRUE(kind == DesiredStreamPath::Device ||
+                   kind == DesiredStreamPath::Field);
+  TEST_ASSERT_LESS_THAN(FIREBASE_PAYLOAD_SIZE, strlen(json));
+  Device *device = Device::getDevice(name);
+  TEST_ASSERT_NOT_NULL(device);
+  return applyUpdate(*device, field, json, strcmp(event, "patch") == 0);
+}
+
+// The largest desired document an update holds (see DesiredStateUpdate),
+// the camera's settings padded with a history of one-digit numbers so that
+// nearly every two bytes are another value to store
+std::string largestCameraDocument(int fps) {
+  std::string json = R"({"state":true,"fps":)" + std::to_string(fps) +
+                     R"(,"quality":12,"frameSize":"VGA","targetKbps":800,)"
+                     R"("history":[1)";
+  while (json.size() + 4 < FIREBASE_PAYLOAD_SIZE) {
+    json += ",1";
+  }
+  return json + "]}";
+}
+
+void setUp() { nvs.clear(); }
+void tearDown() {}
+
+void test_put_keeps_only_what_the_device_reads() {
+  TEST_ASSERT_EQUAL_STRING(R"({"state":true,"onAbove":75.5,"offAbove":82})",
+                           streamEvent("put", "/heatLamp", HEAT_LAMP_PUT)
+                               .c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":false,"onTime":"08:00","offTime":"20:30"})",
+      streamEvent("put", "/lights", LIGHT_PUT).c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"fps":10,"quality":12,"frameSize":"VGA",)"
+      R"("targetKbps":800})",
+      streamEvent("put", "/camera", CAMERA_PUT).c_str());
+  // The same document again, e.g. the snapshot after a reconnect
+  TEST_ASSERT_EQUAL_STRING("",
+                           streamEvent("put", "/camera", CAMERA_PUT).c_str());
+}
+
+void test_field_put_and_patch_merge_into_the_saved_state() {
+  streamEvent("put", "/heatLamp", HEAT_LAMP_PUT);
+  TEST_ASSERT_EQUAL_STRING(R"({"state":true,"onAbove":76,"offAbove":82})",
+                           streamEvent("put", "/heatLamp/onAbove", "76")
+                               .c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"onAbove":76,"offAbove":84})",
+      streamEvent("patch", "/heatLamp",
+                  R"({"offAbove":84,"label":"Basking lamp (new bulb)"})")
+          .c_str());
+  // Only a key the device never reads, nothing to apply
+  TEST_ASSERT_EQUAL_STRING(
+      "", streamEvent("put", "/heatLamp/label", R"("Basking")").c_str());
+
+  streamEvent("put", "/lights", LIGHT_PUT);
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":false,"onTime":"07:30","offTime":"21:00"})",
+      streamEvent("patch", "/lights",
+                  R"({"onTime":"07:30","offTime":"21:00"})")
+          .c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"onTime":"07:30","offTime":"21:00"})",
+      streamEvent("put", "/lights/state", "true").c_str());
+}
+
+// A multi-location update at the desired root, split per device the way
+// postDesiredSnapshot() does
+void test_root_patch_reaches_each_device() {
+  streamEvent("put", "/heatLamp", HEAT_LAMP_PUT);
+  streamEvent("put", "/camera", CAMERA_PUT);
+  JsonDocument changes;
+  deserializeJson(changes,
+                  R"({"heatLamp/onAbove":74,"camera/fps":8,"ghost/state":1})");
+  std::vector<std::string> applied;
+  for (JsonPairConst change : changes.as<JsonObjectConst>()) {
+    char name[FIREBASE_DEVICE_NAME_SIZE];
+    char field[FIREBASE_FIELD_PATH_SIZE];
+    TEST_ASSERT_TRUE(splitDesiredPath(change.key().c_str(), name,
+                                      sizeof(name), field, sizeof(field)));
+    Device *device = Device::getDevice(name);
+    if (!device) {
+      continue;
+    }
+    char json[FIREBASE_PAYLOAD_SIZE];
+    serializeJson(change.value(), json, sizeof(json));
+    applied.push_back(applyUpdate(*device, field, json, false));
+  }
+  TEST_ASSERT_EQUAL_size_t(2, applied.size());
+  TEST_ASSERT_EQUAL_STRING(R"({"state":true,"onAbove":74,"offAbove":82})",
+                           applied[0].c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"fps":8,"quality":12,"frameSize":"VGA",)"
+      R"("targetKbps":800})",
+      applied[1].c_str());
+}
+
+void test_largest_document_fits_the_arena() {
+  std::string put = largestCameraDocument(10);
+  TEST_ASSERT_GREATER_THAN(FIREBASE_PAYLOAD_SIZE - 4, put.size());
+  // Filtered while parsing, the history is skipped
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"fps":10,"quality":12,"frameSize":"VGA",)"
+      R"("targetKbps":800})",
+      streamEvent("put", "/camera", put.c_str()).c_str());
+  // A patch is parsed whole and merged with the saved state before the
+  // filter, the most the arena ever holds at once
+  std::string patch = largestCameraDocument(6);
+  TEST_ASSERT_EQUAL_STRING(
+      R"({"state":true,"fps":6,"quality":12,"frameSize":"VGA",)"
+      R"("targetKbps":800})",
+      streamEvent("patch", "/camera", patch.c_str()).c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_put_keeps_only_what_the_device_reads);
+  RUN_TEST(test_field_put_and_patch_merge_into_the_saved_state);
+  RUN_TEST(test_root_patch_reaches_each_device);
+  RUN_TEST(test_largest_document_fits_the_arena);
+  return UNITY_END();
+}
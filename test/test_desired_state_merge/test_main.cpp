@@ -0,0 +1,112 @@
+#include <ArduinoJson.h>
+#include <string>
+#include <unity.h>
+#include <utils/firebase/DesiredStateMerge.h>
+
+// Last whole desired state of one device, as the stream would have built it
+JsonDocument state;
+
+void applyEvent(const char *path, const char *json, bool patch) {
+  JsonDocument data;
+  TEST_ASSERT_FALSE(deserializeJson(data, json));
+  mergeDesiredEvent(state, path, data.as<JsonVariantConst>(), patch);
+}
+
+void assertState(const char *expected) {
+  std::string json;
+  serializeJson(state, json);
+  TEST_ASSERT_EQUAL_STRING(expected, json.c_str());
+}
+
+void setUp() {
+  state.clear();
+  deserializeJson(state, "{\"threshold\":30,\"override\":false,"
+                         "\"schedule\":{\"on\":\"08:00\",\"off\":\"20:00\"}}");
+}
+void tearDown() {}
+
+void test_put_at_the_device_replaces_everything() {
+  applyEvent("", "{\"threshold\":25}", false);
+  assertState("{\"threshold\":25}");
+}
+
+void test_put_at_a_field_keeps_the_rest() {
+  applyEvent("threshold", "28", false);
+  applyEvent("schedule/off", "\"21:30\"", false);
+  assertState("{\"threshold\":28,\"override\":false,"
+              "\"schedule\":{\"on\":\"08:00\",\"off\":\"21:30\"}}");
+}
+
+void test_put_creates_missing_objects() {
+  applyEvent("alarm/high", "35", false);
+  TEST_ASSERT_EQUAL(35, state["alarm"]["high"].as<int>());
+  TEST_ASSERT_EQUAL(30, state["threshold"].as<int>());
+}
+
+void test_null_removes_the_field() {
+  applyEvent("schedule", "null", false);
+  assertState("{\"threshold\":30,\"override\":false}");
+}
+
+void test_patch_replaces_only_its_children() {
+  applyEvent("", "{\"override\":true,\"schedule/on\":\"07:00\"}", true);
+  assertState("{\"threshold\":30,\"override\":true,"
+              "\"schedule\":{\"on\":\"07:00\",\"off\":\"20:00\"}}");
+}
+
+void test_patch_below_the_device() {
+  applyEvent("schedule", "{\"off\":\"22:00\",\"on\":null}", true);
+  assertState("{\"threshold\":30,\"override\":false,"
+              "\"schedule\":{\"off\":\"22:00\"}}");
+}
+
+void test_bad_paths_change_nothing() {
+  applyEvent("schedule//on", "\"09:00\"", false);
+  applyEvent("aKeyThatIsLongerThanDesiredKeySize", "1", false);
+  assertState("{\"threshold\":30,\"override\":false,"
+              "\"schedule\":{\"on\":\"08:00\",\"off\":\"20:00\"}}");
+}
+
+void test_merge_starts_from_nothing() {
+  state.clear();
+  applyEvent("threshold", "27", false);
+  assertState("{\"threshold\":27}");
+}
+
+void test_filter_keeps_only_what_the_device_reads() {
+  JsonDocument filter;
+  filter["threshold"] = true;
+  filter["schedule"]["on"] = true;
+  JsonDocument filtered;
+  TEST_ASSERT_TRUE(filterDesiredState(state.as<JsonVariantConst>(), filter,
+                                      filtered));
+  std::string json;
+  serializeJson(filtered, json);
+  TEST_ASSERT_EQUAL_STRING("{\"threshold\":30,\"schedule\":{\"on\":\"08:00\"}}",
+                           json.c_str());
+}
+
+void test_filter_refuses_states_that_are_too_big() {
+  std::string note(DESIRED_PACKED_SIZE, 'x');
+  state["note"] = note;
+  JsonDocument filter;
+  filter.set(true);
+  JsonDocument filtered;
+  TEST_ASSERT_FALSE(filterDesiredState(state.as<JsonVariantConst>(), filter,
+                                       filtered));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_put_at_the_device_replaces_everything);
+  RUN_TEST(test_put_at_a_field_keeps_the_rest);
+  RUN_TEST(test_put_creates_missing_objects);
+  RUN_TEST(test_null_removes_the_field);
+  RUN_TEST(test_patch_replaces_only_its_children);
+  RUN_TEST(test_patch_below_the_device);
+  RUN_TEST(test_bad_paths_change_nothing);
+  RUN_TEST(test_merge_starts_from_nothing);
+  RUN_TEST(test_filter_keeps_only_what_the_device_reads);
+  RUN_TEST(test_filter_refuses_states_that_are_too_big);
+  return UNITY_END();
+}
@@ -0,0 +1,89 @@
+#include <unity.h>
+#include <utils/firebase/DesiredStreamPath.h>
+
+char name[16];
+char field[16];
+
+DesiredStreamPath classify(const char *event, const char *path) {
+  return classifyDesiredStreamPath(event, path, name, sizeof(name), field,
+                                   sizeof(field));
+}
+
+void assertPath(DesiredStreamPath expected, const char *event,
+                const char *path) {
+  TEST_ASSERT_EQUAL(static_cast<int>(expected),
+                    static_cast<int>(classify(event, path)));
+}
+
+void setUp() {
+  name[0] = '\0';
+  field[0] = '\0';
+}
+void tearDown() {}
+
+void test_root_is_the_snapshot() {
+  assertPath(DesiredStreamPath::Snapshot, "put", "/");
+  assertPath(DesiredStreamPath::Snapshot, "patch", "/");
+  assertPath(DesiredStreamPath::Snapshot, "put", "");
+}
+
+void test_device_path() {
+  assertPath(DesiredStreamPath::Device, "put", "/heatLamp");
+  TEST_ASSERT_EQUAL_STRING("heatLamp", name);
+  TEST_ASSERT_EQUAL_STRING("", field);
+  // A trailing slash still names the whole device
+  assertPath(DesiredStreamPath::Device, "patch", "/lights/");
+  TEST_ASSERT_EQUAL_STRING("lights", name);
+  TEST_ASSERT_EQUAL_STRING("", field);
+}
+
+void test_deeper_paths_are_fields() {
+  assertPath(DesiredStreamPath::Field, "put", "/heatLamp/threshold");
+  TEST_ASSERT_EQUAL_STRING("heatLamp", name);
+  TEST_ASSERT_EQUAL_STRING("threshold", field);
+  assertPath(DesiredStreamPath::Field, "patch", "/lights/schedule/on");
+  TEST_ASSERT_EQUAL_STRING("lights", name);
+  TEST_ASSERT_EQUAL_STRING("schedule/on", field);
+}
+
+void test_events_without_data_are_ignored() {
+  assertPath(DesiredStreamPath::Ignored, "keep-alive", "/heatLamp");
+  assertPath(DesiredStreamPath::Ignored, "cancel", "/");
+  assertPath(DesiredStreamPath::Ignored, "auth_revoked", "/");
+  assertPath(DesiredStreamPath::Ignored, "", "/heatLamp");
+}
+
+void test_paths_that_do_not_fit_are_ignored() {
+  assertPath(DesiredStreamPath::Ignored, "put", "//threshold");
+  assertPath(DesiredStreamPath::Ignored, "put", "/aDeviceNameTooLong");
+  assertPath(DesiredStreamPath::Ignored, "put", "/lights/fieldPathTooLong");
+  // One short of the buffers still fits
+  assertPath(DesiredStreamPath::Field, "put",
+             "/fifteenCharsXYZ/fifteenCharsXYZ");
+}
+
+void test_split_snapshot_keys() {
+  // Keys of a root patch are paths too
+  TEST_ASSERT_TRUE(splitDesiredPath("heatLamp", name, sizeof(name), field,
+                                    sizeof(field)));
+  TEST_ASSERT_EQUAL_STRING("heatLamp", name);
+  TEST_ASSERT_EQUAL_STRING("", field);
+  TEST_ASSERT_TRUE(splitDesiredPath("heatLamp/threshold", name, sizeof(name),
+                                    field, sizeof(field)));
+  TEST_ASSERT_EQUAL_STRING("threshold", field);
+  TEST_ASSERT_FALSE(
+      splitDesiredPath("", name, sizeof(name), field, sizeof(field)));
+  TEST_ASSERT_FALSE(
+      splitDesiredPath("/threshold", name, sizeof(name), field, sizeof(field)));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_root_is_the_snapshot);
+  RUN_TEST(test_device_path);
+  RUN_TEST(test_deeper_paths_are_fields);
+  RUN_TEST(test_events_without_data_are_ignored);
+  RUN_TEST(test_paths_that_do_not_fit_are_ignored);
+  RUN_TEST(test_split_snapshot_keys);
+  return UNITY_END();
+}
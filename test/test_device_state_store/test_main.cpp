@@ -0,0 +1,153 @@
+#include <ArduinoJson.h>
+#include <MemoryKeyValueStore.h>
+#include <cstdio>
+#include <cstring>
+#include <devices/DeviceStateStore.h>
+#include <unity.h>
+#include <utils/Hash.h>
+
+// Records what it was given, the store only cares about applyState()
+class StubDevice : public Device {
+public:
+  explicit StubDevice(const char *name) : Device(name) {}
+  void begin() override {}
+  void update() override {}
+  void turnOn() override {}
+  void turnOff() override {}
+  void applyState(JsonVariantConst desired) override {
+    applied++;
+    threshold = desired["threshold"] | -1;
+  }
+  void reportState(JsonDocument &doc) override {}
+  void logState(JsonDocument &doc) override {}
+
+  int applied = 0;
+  int threshold = -1;
+};
+
+MemoryKeyValueStore nvs;
+
+void desiredWithThreshold(JsonDocument &desired, int threshold) {
+  desired["threshold"] = threshold;
+  desired["override"] = false;
+}
+
+// The key DeviceStateStore derives from the device name
+void keyFor(const Device &device, char *key, size_t size) {
+  const char *name = device.getName();
+  snprintf(key, size, "ds%08x",
+           unsigned(fnv1a(reinterpret_cast<const uint8_t *>(name),
+                          strlen(name))));
+}
+
+void setUp() { nvs.clear(); }
+void tearDown() {}
+
+void test_unchanged_state_is_not_written_again() {
+  StubDevice lamp("heatLamp");
+  DeviceStateStore states(nvs);
+  JsonDocument desired;
+  desiredWithThreshold(desired, 30);
+  TEST_ASSERT_TRUE(states.update(lamp, desired.as<JsonVariantConst>()));
+  TEST_ASSERT_EQUAL_UINT32(1, nvs.writes());
+  // The cloud snapshot after a reconnect carries the same state
+  TEST_ASSERT_FALSE(states.update(lamp, desired.as<JsonVariantConst>()));
+  TEST_ASSERT_EQUAL_UINT32(1, nvs.writes());
+
+  desiredWithThreshold(desired, 31);
+  TEST_ASSERT_TRUE(states.update(lamp, desired.as<JsonVariantConst>()));
+  TEST_ASSERT_EQUAL_UINT32(2, nvs.writes());
+}
+
+void test_state_survives_a_restart() {
+  {
+    StubDevice lamp("heatLamp");
+    DeviceStateStore states(nvs);
+    JsonDocument desired;
+    desiredWithThreshold(desired, 28);
+    states.update(lamp, desired.as<JsonVariantConst>());
+  }
+  StubDevice lamp("heatLamp");
+  DeviceStateStore states(nvs);
+  TEST_ASSERT_TRUE(states.restore(lamp));
+  TEST_ASSERT_EQUAL(1, lamp.applied);
+  TEST_ASSERT_EQUAL(28, lamp.threshold);
+
+  JsonDocument loaded;
+  TEST_ASSERT_TRUE(states.load(lamp, loaded));
+  TEST_ASSERT_EQUAL(28, loaded["threshold"].as<int>());
+  TEST_ASSERT_FALSE(loaded["override"].as<bool>());
+}
+
+void test_restore_all_skips_devices_without_state() {
+  StubDevice lamp("heatLamp");
+  StubDevice light("lights");
+  DeviceStateStore states(nvs);
+  JsonDocument desired;
+  desiredWithThreshold(desired, 25);
+  states.update(light, desired.as<JsonVariantConst>());
+  TEST_ASSERT_EQUAL_size_t(1, states.restoreAll());
+  TEST_ASSERT_EQUAL(0, lamp.applied);
+  TEST_ASSERT_EQUAL(1, light.applied);
+}
+
+void test_cleared_state_is_gone() {
+  StubDevice lamp("heatLamp");
+  DeviceStateStore states(nvs);
+  JsonDocument desired;
+  desiredWithThreshold(desired, 30);
+  states.update(lamp, desired.as<JsonVariantConst>());
+  TEST_ASSERT_TRUE(states.clear(lamp));
+  TEST_ASSERT_FALSE(states.restore(lamp));
+  TEST_ASSERT_FALSE(states.clear(lamp));
+  // Saved again, the old hash is not remembered anywhere
+  TEST_ASSERT_TRUE(states.update(lamp, desired.as<JsonVariantConst>()));
+}
+
+void test_corrupt_blob_is_ignored() {
+  StubDevice lamp("heatLamp");
+  DeviceStateStore states(nvs);
+  JsonDocument desired;
+  desiredWithThreshold(desired, 30);
+  states.update(lamp, desired.as<JsonVariantConst>());
+
+  char key[16];
+  keyFor(lamp, key, sizeof(key));
+  uint8_t blob[64];
+  size_t size = nvs.get(key, blob, sizeof(blob));
+  TEST_ASSERT_GREATER_THAN(8, size);
+  blob[size - 1] ^= 0x01; // Flipped bit in the payload
+  nvs.put(key, blob, size);
+  TEST_ASSERT_FALSE(states.restore(lamp));
+  TEST_ASSERT_EQUAL(0, lamp.applied);
+  // The hash no longer matches either, so the good state is written back
+  TEST_ASSERT_TRUE(states.update(lamp, desired.as<JsonVariantConst>()));
+  TEST_ASSERT_TRUE(states.restore(lamp));
+
+  nvs.put(key, blob, 4); // Shorter than the header
+  TEST_ASSERT_FALSE(states.restore(lamp));
+}
+
+void test_oversized_state_is_applied_but_not_kept() {
+  StubDevice lamp("heatLamp");
+  DeviceStateStore states(nvs);
+  JsonDocument desired;
+  char note[DeviceStateStore::MAX_STATE_SIZE + 1];
+  memset(note, 'x', sizeof(note) - 1);
+  note[sizeof(note) - 1] = '\0';
+  desired["note"] = note;
+  TEST_ASSERT_TRUE(states.update(lamp, desired.as<JsonVariantConst>()));
+  TEST_ASSERT_EQUAL_UINT32(0, nvs.writes());
+  TEST_ASSERT_FALSE(states.restore(lamp));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unchanged_state_is_not_written_again);
+  RUN_TEST(test_state_survives_a_restart);
+  RUN_TEST(test_restore_all_skips_devices_without_state);
+  RUN_TEST(test_cleared_state_is_gone);
+  RUN_TEST(test_corrupt_blob_is_ignored);
+  RUN_TEST(test_oversized_state_is_applied_but_not_kept);
+  return UNITY_END();
+}
@@ -0,0 +1,131 @@
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include <utils/video/FrameQueue.h>
+
+// Frames are indices into a table of flags, so the tests can check that
+// each one was handed out or released exactly once
+constexpr uint32_t FRAME_COUNT = 100000;
+constexpr uint32_t MAX_AGE_MS = 50;
+
+std::atomic<uint8_t> released[FRAME_COUNT];
+std::atomic<uint32_t> releaseCount{0};
+
+void releaseFrame(uint32_t frame) {
+  released[frame].fetch_add(1, std::memory_order_relaxed);
+  releaseCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void setUp() {
+  for (std::atomic<uint8_t> &flag : released) {
+    flag.store(0, std::memory_order_relaxed);
+  }
+  releaseCount = 0;
+}
+void tearDown() {}
+
+void test_fresh_frames_come_out_in_order() {
+  FrameQueue<uint32_t, 4> queue(MAX_AGE_MS, releaseFrame);
+  TEST_ASSERT_TRUE(queue.push(1, 100));
+  TEST_ASSERT_TRUE(queue.push(2, 110));
+  uint32_t frame, queuedAt;
+  TEST_ASSERT_TRUE(queue.pop(frame, queuedAt, 120));
+  TEST_ASSERT_EQUAL_UINT32(1, frame);
+  TEST_ASSERT_EQUAL_UINT32(100, queuedAt);
+  TEST_ASSERT_TRUE(queue.pop(frame, queuedAt, 120));
+  TEST_ASSERT_EQUAL_UINT32(2, frame);
+  TEST_ASSERT_FALSE(queue.pop(frame, queuedAt, 120));
+  TEST_ASSERT_EQUAL_UINT32(0, releaseCount);
+}
+
+void test_full_queue_releases_the_new_frame() {
+  FrameQueue<uint32_t, 2> queue(MAX_AGE_MS, releaseFrame);
+  queue.push(1, 0);
+  queue.push(2, 0);
+  TEST_ASSERT_FALSE(queue.push(3, 0));
+  TEST_ASSERT_EQUAL_UINT8(1, released[3].load());
+  TEST_ASSERT_EQUAL_UINT32(1, queue.framesDroppedFull());
+  TEST_ASSERT_EQUAL_size_t(2, queue.size());
+}
+
+void test_stale_frames_are_released_on_pop() {
+  FrameQueue<uint32_t, 4> queue(MAX_AGE_MS, releaseFrame);
+  queue.push(1, 0);
+  queue.push(2, 10);
+  queue.push(3, 60);
+  uint32_t frame, queuedAt;
+  TEST_ASSERT_TRUE(queue.pop(frame, queuedAt, 60 + 1)); // 1 and 2 are stale
+  TEST_ASSERT_EQUAL_UINT32(3, frame);
+  TEST_ASSERT_EQUAL_UINT8(1, released[1].load());
+  TEST_ASSERT_EQUAL_UINT8(1, released[2].load());
+  TEST_ASSERT_EQUAL_UINT32(2, queue.framesDroppedStale());
+}
+
+void test_age_survives_the_millis_wrap() {
+  FrameQueue<uint32_t, 4> queue(MAX_AGE_MS, releaseFrame);
+  queue.push(1, UINT32_MAX - 10);
+  uint32_t frame, queuedAt;
+  TEST_ASSERT_TRUE(queue.pop(frame, queuedAt, 20));
+  TEST_ASSERT_EQUAL_UINT32(1, frame);
+}
+
+void test_release_all_empties_the_queue() {
+  FrameQueue<uint32_t, 4> queue(MAX_AGE_MS, releaseFrame);
+  queue.push(1, 0);
+  queue.push(2, 0);
+  queue.releaseAll();
+  TEST_ASSERT_EQUAL_size_t(0, queue.size());
+  TEST_ASSERT_EQUAL_UINT32(2, releaseCount);
+}
+
+// Capture and transmit on their own threads with a shared fake clock. Every
+// frame has to end up either sent or released, exactly once.
+void test_threads_hand_off_every_frame_once() {
+  static FrameQueue<uint32_t, 4> queue(MAX_AGE_MS, releaseFrame);
+  static std::atomic<uint32_t> nowMs{0};
+  static std::atomic<bool> captureDone{false};
+  static std::atomic<uint8_t> sent[FRAME_COUNT];
+  for (std::atomic<uint8_t> &flag : sent) {
+    flag.store(0, std::memory_order_relaxed);
+  }
+  std::thread capture([] {
+    for (uint32_t frame = 0; frame < FRAME_COUNT; frame++) {
+      queue.push(frame, nowMs.fetch_add(1, std::memory_order_relaxed));
+    }
+    captureDone = true;
+  });
+  uint32_t frame, queuedAt;
+  uint32_t sentCount = 0;
+  for (;;) {
+    bool done = captureDone.load();
+    if (queue.pop(frame, queuedAt, nowMs.load(std::memory_order_relaxed))) {
+      sent[frame].fetch_add(1, std::memory_order_relaxed);
+      sentCount++;
+    } else if (done) {
+      break;
+    }
+  }
+  capture.join();
+  queue.releaseAll();
+
+  bool everyFrameOnce = true;
+  for (uint32_t i = 0; i < FRAME_COUNT; i++) {
+    everyFrameOnce &= sent[i].load() + released[i].load() == 1;
+  }
+  TEST_ASSERT_TRUE(everyFrameOnce);
+  TEST_ASSERT_EQUAL_UINT32(FRAME_COUNT, sentCount + releaseCount.load());
+  TEST_ASSERT_EQUAL_UINT32(releaseCount.load(),
+                           queue.framesDroppedFull() +
+                               queue.framesDroppedStale());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fresh_frames_come_out_in_order);
+  RUN_TEST(test_full_queue_releases_the_new_frame);
+  RUN_TEST(test_stale_frames_are_released_on_pop);
+  RUN_TEST(test_age_survives_the_millis_wrap);
+  RUN_TEST(test_release_all_empties_the_queue);
+  RUN_TEST(test_threads_hand_off_every_frame_once);
+  return UNITY_END();
+}
@@ -0,0 +1,165 @@
+#include <ArduinoJson.h>
+#include <cstdio>
+#include <unity.h>
+#include <utils/Instrumentation.h>
+
+// The probe table is a singleton that lives for the whole run, so every test
+// uses its own probe names and the table full test runs last
+uint32_t nowUs = 0;
+uint32_t fakeClock() { return nowUs; }
+
+void setUp() {
+  nowUs = 0;
+  Instrumentation::get().begin(fakeClock);
+}
+void tearDown() { Instrumentation::get().reset(); }
+
+void test_histogram_buckets_are_log2() {
+  LatencyHistogram histogram;
+  histogram.record(0);
+  histogram.record(1);
+  histogram.record(2);
+  histogram.record(3);
+  histogram.record(1024);
+  histogram.record(UINT32_MAX);
+  TEST_ASSERT_EQUAL_UINT32(1, histogram.bucket(0));
+  TEST_ASSERT_EQUAL_UINT32(1, histogram.bucket(1));
+  TEST_ASSERT_EQUAL_UINT32(2, histogram.bucket(2));
+  TEST_ASSERT_EQUAL_UINT32(1, histogram.bucket(11));
+  TEST_ASSERT_EQUAL_UINT32(1, histogram.bucket(LATENCY_BUCKET_COUNT - 1));
+  TEST_ASSERT_EQUAL_UINT32(6, histogram.count());
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, histogram.max());
+}
+
+void test_histogram_percentiles() {
+  LatencyHistogram histogram;
+  TEST_ASSERT_EQUAL_UINT32(0, histogram.percentileUs(50));
+  for (int i = 0; i < 90; i++) {
+    histogram.record(10);
+  }
+  for (int i = 0; i < 10; i++) {
+    histogram.record(1000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(15, histogram.percentileUs(50)); // [8, 16)
+  TEST_ASSERT_EQUAL_UINT32(15, histogram.percentileUs(90));
+  // Bucket bound is 1023, capped at the largest sample
+  TEST_ASSERT_EQUAL_UINT32(1000, histogram.percentileUs(99));
+  TEST_ASSERT_EQUAL_UINT32(15, histogram.percentileUs(0));
+  TEST_ASSERT_EQUAL_UINT32(109, histogram.average());
+  histogram.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, histogram.count());
+  TEST_ASSERT_EQUAL_UINT32(0, histogram.max());
+}
+
+void test_probes_are_looked_up_by_name_and_kind() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  int timer = instrumentation.timer("lookup");
+  TEST_ASSERT_NOT_EQUAL(Instrumentation::INVALID_PROBE, timer);
+  TEST_ASSERT_EQUAL(timer, instrumentation.timer("lookup"));
+  int counter = instrumentation.counter("lookup");
+  TEST_ASSERT_NOT_EQUAL(timer, counter);
+  TEST_ASSERT_EQUAL(counter, instrumentation.counter("lookup"));
+}
+
+void test_scoped_timer_records_the_scope() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  int timer = instrumentation.timer("scope");
+  nowUs = 1000;
+  {
+    ScopedTimer scoped(timer);
+    nowUs += 250;
+  }
+  const LatencyHistogram *histogram = instrumentation.histogram(timer);
+  TEST_ASSERT_NOT_NULL(histogram);
+  TEST_ASSERT_EQUAL_UINT32(1, histogram->count());
+  TEST_ASSERT_EQUAL_UINT32(250, histogram->max());
+}
+
+void test_counters_add_up() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  int counter = instrumentation.counter("adds");
+  instrumentation.add(counter);
+  instrumentation.add(counter, 4);
+  TEST_ASSERT_EQUAL_UINT32(5, instrumentation.count(counter));
+}
+
+void test_invalid_probes_are_ignored() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  instrumentation.record(Instrumentation::INVALID_PROBE, 10);
+  instrumentation.add(Instrumentation::INVALID_PROBE);
+  instrumentation.add(int(Instrumentation::MAX_PROBES));
+  TEST_ASSERT_NULL(instrumentation.histogram(Instrumentation::INVALID_PROBE));
+  TEST_ASSERT_EQUAL_UINT32(
+      0, instrumentation.count(Instrumentation::INVALID_PROBE));
+}
+
+void test_report_layout() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  int timer = instrumentation.timer("report");
+  int counter = instrumentation.counter("reported");
+  instrumentation.record(timer, 10);
+  instrumentation.record(timer, 300);
+  instrumentation.add(counter, 3);
+  instrumentation.sampleHeap(5000);
+  instrumentation.sampleHeap(7000);
+
+  JsonDocument doc;
+  instrumentation.report(doc.to<JsonObject>());
+  JsonArrayConst values = doc["t"]["report"];
+  TEST_ASSERT_EQUAL_size_t(4, values.size());
+  TEST_ASSERT_EQUAL_UINT32(2, values[0].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(15, values[1].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(300, values[2].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(300, values[3].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(3, doc["c"]["reported"].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(7000, doc["heap"][0].as<uint32_t>());
+  TEST_ASSERT_EQUAL_UINT32(5000, doc["heap"][1].as<uint32_t>());
+}
+
+void test_reset_keeps_probes_and_heap_low_water_mark() {
+  Instrumentation &instrumentation = Instrumentation::get();
+  int timer = instrumentation.timer("reset");
+  instrumentation.record(timer, 10);
+  instrumentation.sampleHeap(100);
+  instrumentation.reset();
+  TEST_ASSERT_EQUAL(timer, instrumentation.timer("reset"));
+  TEST_ASSERT_EQUAL_UINT32(0, instrumentation.histogram(timer)->count());
+
+  JsonDocument doc;
+  instrumentation.report(doc.to<JsonObject>());
+  TEST_ASSERT_EQUAL_UINT32(100, doc["heap"][1].as<uint32_t>());
+}
+
+void test_table_full() {
+  static char names[Instrumentation::MAX_PROBES][8];
+  Instrumentation &instrumentation = Instrumentation::get();
+  int last = Instrumentation::INVALID_PROBE;
+  for (size_t i = 0; i < Instrumentation::MAX_PROBES; i++) {
+    snprintf(names[i], sizeof(names[i]), "full%u", unsigned(i));
+    int id = instrumentation.counter(names[i]);
+    if (id == Instrumentation::INVALID_PROBE) {
+      break;
+    }
+    last = id;
+  }
+  TEST_ASSERT_EQUAL(int(Instrumentation::MAX_PROBES) - 1, last);
+  TEST_ASSERT_EQUAL(Instrumentation::INVALID_PROBE,
+                    instrumentation.timer("one too many"));
+  // Existing probes are still found
+  TEST_ASSERT_NOT_EQUAL(Instrumentation::INVALID_PROBE,
+                        instrumentation.timer("lookup"));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_histogram_buckets_are_log2);
+  RUN_TEST(test_histogram_percentiles);
+  RUN_TEST(test_probes_are_looked_up_by_name_and_kind);
+  RUN_TEST(test_scoped_timer_records_the_scope);
+  RUN_TEST(test_counters_add_up);
+  RUN_TEST(test_invalid_probes_are_ignored);
+  RUN_TEST(test_report_layout);
+  RUN_TEST(test_reset_keeps_probes_and_heap_low_water_mark);
+  RUN_TEST(test_table_full);
+  return UNITY_END();
+}
@@ -0,0 +1,199 @@
+#include <ArduinoJson.h>
+#include <FakeFirebase.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+#include <utils/firebase/LogBatchWrite.h>
+
+constexpr const char *BASE_PATH = "user_logs/alice/tanks/reef";
+constexpr const char *PROJECT_ID = "tank-test";
+constexpr uint8_t MAX_RECORDS = 10;
+
+char tempDir[] = "/tmp/logbatchXXXXXX";
+std::string spoolDir;
+uint8_t buffer[LogSpool::MAX_RECORD_SIZE];
+FakeFirestore firestore;
+
+void removeTree(const std::string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    return;
+  }
+  while (dirent *entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      std::string child = path + "/" + entry->d_name;
+      removeTree(child);
+      unlink(child.c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+// Spools a record like FirebaseWrapper::postLogRecord() and returns the hash
+// its document id is built from
+uint32_t spoolRecord(LogSpool &spool, const char *collection, int64_t timeSec,
+                     const char *fieldsJson) {
+  JsonDocument fields;
+  deserializeJson(fields, fieldsJson);
+  JsonDocument record;
+  record["c"] = collection;
+  record["t"] = timeSec;
+  record["f"] = fields;
+  uint8_t packed[LogSpool::MAX_RECORD_SIZE];
+  size_t length = serializeMsgPack(record, packed, sizeof(packed));
+  TEST_ASSERT_TRUE(spool.append(packed, length));
+  return fnv1a(packed, length);
+}
+
+// Builds the next batch's request body
+uint8_t readBatch(LogSpool &spool, JsonDocument &body, uint8_t maxRecords) {
+  return readLogBatch(spool, BASE_PATH, buffer, sizeof(buffer), maxRecords,
+                      [&](const LogWrite &write) {
+                        addLogBatchWrite(body, PROJECT_ID, write);
+                      });
+}
+
+// Reads the next batch and sends it to the fake, returns how many it held
+uint8_t sendBatch(LogSpool &spool) {
+  JsonDocument body;
+  uint8_t count = readBatch(spool, body, MAX_RECORDS);
+  if (count > 0) {
+    std::string json;
+    serializeJson(body, json);
+    TEST_ASSERT_TRUE(firestore.batchWrite(json.c_str()));
+  }
+  return count;
+}
+
+void setUp() {
+  spoolDir = std::string(tempDir) + "/spool";
+  firestore.clear();
+}
+void tearDown() { removeTree(spoolDir); }
+
+void test_document_is_named_after_time_and_hash() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  uint32_t hash =
+      spoolRecord(spool, "devices/heatLamp/events", 1700000000, "{}");
+  size_t length = spool.read(buffer, sizeof(buffer));
+  JsonDocument doc;
+  LogWrite write;
+  TEST_ASSERT_TRUE(decodeLogWrite(buffer, length, BASE_PATH, doc, write));
+  char expected[LOG_DOCUMENT_PATH_SIZE];
+  snprintf(expected, sizeof(expected),
+           "user_logs/alice/tanks/reef/devices/heatLamp/events/"
+           "1700000000-%08x",
+           unsigned(hash));
+  TEST_ASSERT_EQUAL_STRING(expected, write.path);
+  TEST_ASSERT_EQUAL_STRING("2023-11-14T22:13:20Z", write.timeString);
+}
+
+void test_body_encodes_every_field_type() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  spoolRecord(spool, "devices/heatLamp/events", 1700000000,
+              "{\"eventType\":\"on\",\"temperature\":24.5,\"threshold\":30,"
+              "\"override\":true,\"note\":null,"
+              "\"data\":{\"humidity\":61}}");
+  JsonDocument body;
+  TEST_ASSERT_EQUAL_UINT8(1, readBatch(spool, body, MAX_RECORDS));
+  TEST_ASSERT_EQUAL_size_t(1, body["writes"].size());
+  JsonObjectConst update = body["writes"][0]["update"];
+  const char *prefix = "projects/tank-test/databases/(default)/documents/"
+                       "user_logs/alice/tanks/reef/devices/heatLamp/events/";
+  TEST_ASSERT_EQUAL_INT(0, strncmp(prefix, update["name"].as<const char *>(),
+                                   strlen(prefix)));
+  std::string fields;
+  serializeJson(update["fields"], fields);
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"timeString\":{\"timestampValue\":\"2023-11-14T22:13:20Z\"},"
+      "\"eventType\":{\"stringValue\":\"on\"},"
+      "\"temperature\":{\"doubleValue\":24.5},"
+      "\"threshold\":{\"integerValue\":\"30\"},"
+      "\"override\":{\"booleanValue\":true},"
+      "\"note\":{\"nullValue\":null},"
+      "\"data\":{\"mapValue\":{\"fields\":"
+      "{\"humidity\":{\"integerValue\":\"61\"}}}}}",
+      fields.c_str());
+}
+
+void test_batches_hold_at_most_max_records() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  for (int i = 0; i < 25; i++) {
+    spoolRecord(spool, "sensors/temperature/events", 1700000000 + i, "{}");
+  }
+  TEST_ASSERT_EQUAL_UINT8(10, sendBatch(spool));
+  spool.commit();
+  TEST_ASSERT_EQUAL_UINT8(10, sendBatch(spool));
+  spool.commit();
+  TEST_ASSERT_EQUAL_UINT8(5, sendBatch(spool));
+  spool.commit();
+  TEST_ASSERT_EQUAL_UINT8(0, sendBatch(spool));
+  TEST_ASSERT_EQUAL_UINT32(3, firestore.requests());
+  TEST_ASSERT_EQUAL_size_t(25, firestore.all().size());
+  TEST_ASSERT_EQUAL_STRING(
+      "user_logs/alice/tanks/reef/sensors/temperature/events",
+      firestore.all()[0].collection.c_str());
+}
+
+void test_resent_batch_leaves_one_copy() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  spoolRecord(spool, "devices/lights/events", 1700000000, "{\"on\":true}");
+  // Same second, different fields, so a different document
+  spoolRecord(spool, "devices/lights/events", 1700000000, "{\"on\":false}");
+  TEST_ASSERT_EQUAL_UINT8(2, sendBatch(spool));
+  size_t firstBytes = firestore.bytesReceived();
+  spool.rewind(); // The answer was lost
+  TEST_ASSERT_EQUAL_UINT8(2, sendBatch(spool));
+  TEST_ASSERT_EQUAL_UINT32(2, firestore.requests());
+  TEST_ASSERT_EQUAL_size_t(2 * firstBytes, firestore.bytesReceived());
+  TEST_ASSERT_EQUAL_size_t(2, firestore.all().size());
+}
+
+void test_unreadable_records_are_skipped() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  const uint8_t garbage[] = {0xc1, 0xc1, 0xc1};
+  spool.append(garbage, sizeof(garbage));
+  spoolRecord(spool, "devices/lights/events", 1700000000, "{}");
+  // A record without a collection has nowhere to go either
+  JsonDocument record;
+  record["t"] = 1700000001;
+  uint8_t packed[32];
+  spool.append(packed, serializeMsgPack(record, packed, sizeof(packed)));
+  TEST_ASSERT_EQUAL_UINT8(1, sendBatch(spool));
+  TEST_ASSERT_EQUAL_size_t(1, firestore.all().size());
+}
+
+void test_paths_that_do_not_fit_are_skipped() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  std::string collection(LOG_DOCUMENT_PATH_SIZE, 'c');
+  spoolRecord(spool, collection.c_str(), 1700000000, "{}");
+  spoolRecord(spool, "devices/lights/events", 1700000000, "{}");
+  TEST_ASSERT_EQUAL_UINT8(1, sendBatch(spool));
+}
+
+int main(int argc, char **argv) {
+  if (!mkdtemp(tempDir)) {
+    return 1;
+  }
+  UNITY_BEGIN();
+  RUN_TEST(test_document_is_named_after_time_and_hash);
+  RUN_TEST(test_body_encodes_every_field_type);
+  RUN_TEST(test_batches_hold_at_most_max_records);
+  RUN_TEST(test_resent_batch_leaves_one_copy);
+  RUN_TEST(test_unreadable_records_are_skipped);
+  RUN_TEST(test_paths_that_do_not_fit_are_skipped);
+  int failures = UNITY_END();
+  removeTree(tempDir);
+  return failures;
+}
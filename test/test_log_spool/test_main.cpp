@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+#include <utils/LogSpool.h>
+
+// Each test gets a fresh spool directory inside a temporary directory
+char tempDir[] = "/tmp/logspoolXXXXXX";
+std::string spoolDir;
+
+void removeTree(const std::string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    return;
+  }
+  while (dirent *entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      std::string child = path + "/" + entry->d_name;
+      removeTree(child);
+      unlink(child.c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+bool appendText(LogSpool &spool, const char *text) {
+  return spool.append(reinterpret_cast<const uint8_t *>(text), strlen(text));
+}
+
+// Next record as a string, "" when there is none
+std::string readText(LogSpool &spool) {
+  char buffer[LogSpool::MAX_RECORD_SIZE];
+  size_t length =
+      spool.read(reinterpret_cast<uint8_t *>(buffer), sizeof(buffer));
+  return std::string(buffer, length);
+}
+
+void assertNext(LogSpool &spool, const char *expected) {
+  TEST_ASSERT_EQUAL_STRING(expected, readText(spool).c_str());
+}
+
+void setUp() { spoolDir = std::string(tempDir) + "/spool"; }
+void tearDown() { removeTree(spoolDir); }
+
+void test_records_come_back_in_order() {
+  LogSpool spool(spoolDir.c_str());
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_TRUE(spool.empty());
+  appendText(spool, "one");
+  appendText(spool, "two");
+  TEST_ASSERT_FALSE(spool.empty());
+  assertNext(spool, "one");
+  assertNext(spool, "two");
+  assertNext(spool, "");
+  spool.commit();
+  TEST_ASSERT_TRUE(spool.empty());
+}
+
+void test_rewind_delivers_the_batch_again() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  appendText(spool, "one");
+  appendText(spool, "two");
+  appendText(spool, "three");
+  assertNext(spool, "one");
+  spool.commit();
+  assertNext(spool, "two");
+  assertNext(spool, "three");
+  spool.rewind(); // Upload failed
+  assertNext(spool, "two");
+  assertNext(spool, "three");
+  spool.commit();
+  TEST_ASSERT_TRUE(spool.empty());
+}
+
+void test_resumes_after_a_restart() {
+  {
+    LogSpool spool(spoolDir.c_str());
+    spool.begin();
+    appendText(spool, "sent");
+    appendText(spool, "pending");
+    assertNext(spool, "sent");
+    spool.commit();
+    assertNext(spool, "pending"); // Read but never acknowledged
+  }
+  LogSpool spool(spoolDir.c_str());
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_FALSE(spool.empty());
+  assertNext(spool, "pending");
+  assertNext(spool, "");
+  appendText(spool, "after");
+  assertNext(spool, "after");
+}
+
+void test_full_spool_drops_the_oldest_segments() {
+  // Room for two records per segment, at most three segments
+  LogSpool spool(spoolDir.c_str(), 2 * (8 + 4), 3);
+  spool.begin();
+  char text[8];
+  for (int i = 0; i < 10; i++) {
+    snprintf(text, sizeof(text), "r%03d", i);
+    TEST_ASSERT_TRUE(appendText(spool, text));
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, spool.segmentCount());
+  TEST_ASSERT_EQUAL_UINT32(2, spool.droppedSegments());
+  // The newest records survive
+  assertNext(spool, "r004");
+  assertNext(spool, "r005");
+  spool.commit();
+  for (int i = 6; i < 10; i++) {
+    snprintf(text, sizeof(text), "r%03d", i);
+    assertNext(spool, text);
+  }
+  spool.commit();
+  TEST_ASSERT_TRUE(spool.empty());
+}
+
+void test_torn_record_is_skipped_after_a_restart() {
+  {
+    LogSpool spool(spoolDir.c_str());
+    spool.begin();
+    appendText(spool, "whole");
+  }
+  // A write cut short by a reset: half a header at the end of the segment
+  std::string segment = spoolDir + "/seg00000000.log";
+  FILE *file = fopen(segment.c_str(), "ab");
+  TEST_ASSERT_NOT_NULL(file);
+  fputc(0x53, file);
+  fputc(0x4C, file);
+  fputc(0x40, file);
+  fclose(file);
+
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  appendText(spool, "next");
+  assertNext(spool, "whole");
+  assertNext(spool, "next");
+}
+
+void test_corrupt_meta_starts_over() {
+  {
+    LogSpool spool(spoolDir.c_str());
+    spool.begin();
+    appendText(spool, "lost");
+  }
+  FILE *file = fopen((spoolDir + "/meta").c_str(), "wb");
+  fputs("garbage", file);
+  fclose(file);
+
+  LogSpool spool(spoolDir.c_str());
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_TRUE(spool.empty());
+  appendText(spool, "fresh");
+  assertNext(spool, "fresh");
+}
+
+void test_bad_records_are_refused() {
+  LogSpool spool(spoolDir.c_str());
+  uint8_t big[LogSpool::MAX_RECORD_SIZE + 1] = {};
+  TEST_ASSERT_FALSE(spool.append(big, 4)); // Before begin()
+  spool.begin();
+  TEST_ASSERT_FALSE(spool.append(big, 0));
+  TEST_ASSERT_FALSE(spool.append(nullptr, 4));
+  TEST_ASSERT_FALSE(spool.append(big, sizeof(big)));
+  TEST_ASSERT_TRUE(spool.empty());
+}
+
+void test_records_too_big_for_the_buffer_are_skipped() {
+  LogSpool spool(spoolDir.c_str());
+  spool.begin();
+  appendText(spool, "much too long");
+  appendText(spool, "ok");
+  uint8_t buffer[4];
+  TEST_ASSERT_EQUAL_size_t(2, spool.read(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_MEMORY("ok", buffer, 2);
+}
+
+int main(int argc, char **argv) {
+  if (!mkdtemp(tempDir)) {
+    return 1;
+  }
+  UNITY_BEGIN();
+  RUN_TEST(test_records_come_back_in_order);
+  RUN_TEST(test_rewind_delivers_the_batch_again);
+  RUN_TEST(test_resumes_after_a_restart);
+  RUN_TEST(test_full_spool_drops_the_oldest_segments);
+  RUN_TEST(test_torn_record_is_skipped_after_a_restart);
+  RUN_TEST(test_corrupt_meta_starts_over);
+  RUN_TEST(test_bad_records_are_refused);
+  RUN_TEST(test_records_too_big_for_the_buffer_are_skipped);
+  int failures = UNITY_END();
+  removeTree(tempDir);
+  return failures;
+}
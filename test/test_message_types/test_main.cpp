@@ -0,0 +1,259 @@
+#include <cstring>
+#include <unity.h>
+#include <utils/MessageTypes.h>
+
+constexpr uint8_t FRAME_SIZE_COUNT = 5;
+
+// Fixed seed so a failure reproduces
+uint32_t randomState = 0x12345678;
+uint32_t nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+CameraCommand makeCommand() {
+  CameraCommand command = {};
+  initCameraMessageHeader(command.header, CameraMessageType::Command, 42);
+  command.fields = CAMERA_FIELDS_ALL;
+  command.streaming = 1;
+  command.fps = 15;
+  command.quality = 12;
+  command.frameSizeLevel = 3;
+  command.targetKbps = 800;
+  return command;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_header_is_initialized() {
+  CameraMessageHeader header;
+  initCameraMessageHeader(header, CameraMessageType::Ack, 0xBEEF);
+  TEST_ASSERT_EQUAL_UINT8(CAMERA_PROTOCOL_MAGIC, header.magic);
+  TEST_ASSERT_EQUAL_UINT8(CAMERA_PROTOCOL_VERSION, header.version);
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(CameraMessageType::Ack), header.type);
+  TEST_ASSERT_EQUAL_UINT8(0, header.flags);
+  TEST_ASSERT_EQUAL_UINT16(0xBEEF, header.sequence);
+}
+
+void test_command_round_trip() {
+  CameraCommand sent = makeCommand();
+  uint8_t bytes[sizeof(CameraCommand)];
+  memcpy(bytes, &sent, sizeof(sent));
+
+  CameraCommand received;
+  TEST_ASSERT_TRUE(parseCameraCommand(bytes, sizeof(bytes), received));
+  TEST_ASSERT_EQUAL_MEMORY(&sent, &received, sizeof(sent));
+}
+
+void test_ack_round_trip() {
+  CameraAck sent = {};
+  initCameraMessageHeader(sent.header, CameraMessageType::Ack, 7);
+  sent.status = uint8_t(CameraAckStatus::Rejected);
+  sent.appliedFields = CAMERA_FIELD_STREAMING;
+  sent.rejectedFields = CAMERA_FIELD_FPS;
+  sent.streaming = 1;
+
+  CameraAck received;
+  TEST_ASSERT_TRUE(parseCameraAck(reinterpret_cast<const uint8_t *>(&sent),
+                                  sizeof(sent), received));
+  TEST_ASSERT_EQUAL_MEMORY(&sent, &received, sizeof(sent));
+}
+
+void test_telemetry_round_trip() {
+  CameraTelemetry sent = {};
+  initCameraMessageHeader(sent.header, CameraMessageType::Telemetry, 0);
+  sent.achievedFps = 14.5f;
+  sent.avgFrameBytes = 23456;
+  sent.droppedFrames = 3;
+  sent.wifiRssi = -61;
+  sent.uptimeSec = 3600;
+
+  CameraTelemetry received;
+  TEST_ASSERT_TRUE(parseCameraTelemetry(
+      reinterpret_cast<const uint8_t *>(&sent), sizeof(sent), received));
+  TEST_ASSERT_EQUAL_MEMORY(&sent, &received, sizeof(sent));
+}
+
+void test_messages_are_not_parsed_as_another_type() {
+  CameraCommand command = makeCommand();
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&command);
+  CameraAck ack;
+  TEST_ASSERT_FALSE(parseCameraAck(bytes, sizeof(command), ack));
+}
+
+void test_unknown_command_fields_are_cleared() {
+  CameraCommand sent = makeCommand();
+  sent.fields = 0xFF;
+  CameraCommand received;
+  TEST_ASSERT_TRUE(parseCameraCommand(reinterpret_cast<const uint8_t *>(&sent),
+                                      sizeof(sent), received));
+  TEST_ASSERT_EQUAL_UINT8(CAMERA_FIELDS_ALL, received.fields);
+}
+
+void test_valid_command_has_no_invalid_fields() {
+  TEST_ASSERT_EQUAL_UINT8(
+      0, invalidCameraCommandFields(makeCommand(), FRAME_SIZE_COUNT));
+}
+
+void test_out_of_range_fields_are_reported() {
+  constexpr uint8_t ALL_CHECKED = CAMERA_FIELD_STREAMING | CAMERA_FIELD_FPS |
+                                  CAMERA_FIELD_QUALITY |
+                                  CAMERA_FIELD_FRAME_SIZE;
+  CameraCommand command = makeCommand();
+  command.streaming = 2;
+  command.fps = CAMERA_MAX_FPS + 1;
+  command.quality = CAMERA_MIN_QUALITY - 1;
+  command.frameSizeLevel = FRAME_SIZE_COUNT;
+  TEST_ASSERT_EQUAL_UINT8(
+      ALL_CHECKED, invalidCameraCommandFields(command, FRAME_SIZE_COUNT));
+  command.fps = 0;
+  command.quality = CAMERA_MAX_QUALITY + 1;
+  TEST_ASSERT_EQUAL_UINT8(
+      ALL_CHECKED, invalidCameraCommandFields(command, FRAME_SIZE_COUNT));
+}
+
+void test_fields_not_sent_are_not_checked() {
+  CameraCommand command = makeCommand();
+  command.fps = 0;
+  command.fields = CAMERA_FIELD_STREAMING;
+  TEST_ASSERT_EQUAL_UINT8(
+      0, invalidCameraCommandFields(command, FRAME_SIZE_COUNT));
+}
+
+void test_truncated_messages_are_rejected() {
+  CameraCommand sent = makeCommand();
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&sent);
+  CameraCommand received;
+  for (size_t length = 0; length < sizeof(sent); length++) {
+    TEST_ASSERT_FALSE(parseCameraCommand(bytes, length, received));
+  }
+  CameraMessageHeader header;
+  TEST_ASSERT_FALSE(
+      parseCameraMessageHeader(bytes, sizeof(header) - 1, header));
+  TEST_ASSERT_FALSE(parseCameraMessageHeader(nullptr, 64, header));
+  TEST_ASSERT_FALSE(parseCameraCommand(nullptr, sizeof(sent), received));
+}
+
+void test_longer_messages_ignore_the_extra_bytes() {
+  uint8_t bytes[sizeof(CameraCommand) + 16];
+  memset(bytes, 0xEE, sizeof(bytes));
+  CameraCommand sent = makeCommand();
+  memcpy(bytes, &sent, sizeof(sent));
+  CameraCommand received;
+  TEST_ASSERT_TRUE(parseCameraCommand(bytes, sizeof(bytes), received));
+  TEST_ASSERT_EQUAL_MEMORY(&sent, &received, sizeof(sent));
+}
+
+void test_wrong_magic_is_rejected() {
+  CameraCommand sent = makeCommand();
+  sent.header.magic = CAMERA_PROTOCOL_MAGIC ^ 0xFF;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&sent);
+  CameraMessageHeader header;
+  CameraCommand received;
+  TEST_ASSERT_FALSE(parseCameraMessageHeader(bytes, sizeof(sent), header));
+  TEST_ASSERT_FALSE(parseCameraCommand(bytes, sizeof(sent), received));
+}
+
+void test_other_versions_only_parse_the_header() {
+  CameraCommand sent = makeCommand();
+  sent.header.version = CAMERA_PROTOCOL_VERSION + 1;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&sent);
+  CameraMessageHeader header;
+  CameraCommand received;
+  // The header still parses so the receiver can answer UnsupportedVersion
+  TEST_ASSERT_TRUE(parseCameraMessageHeader(bytes, sizeof(sent), header));
+  TEST_ASSERT_EQUAL_UINT8(CAMERA_PROTOCOL_VERSION + 1, header.version);
+  TEST_ASSERT_EQUAL_UINT16(42, header.sequence);
+  TEST_ASSERT_FALSE(parseCameraCommand(bytes, sizeof(sent), received));
+  sent.header.version = CAMERA_PROTOCOL_VERSION - 1;
+  TEST_ASSERT_FALSE(parseCameraCommand(bytes, sizeof(sent), received));
+}
+
+void test_unknown_types_are_rejected() {
+  uint8_t bytes[64] = {};
+  CameraMessageHeader header;
+  initCameraMessageHeader(header, CameraMessageType::Command, 1);
+  CameraCommand command;
+  CameraAck ack;
+  CameraTelemetry telemetry;
+  const uint8_t unknownTypes[] = {0, 4, 0xFF};
+  for (uint8_t type : unknownTypes) {
+    header.type = type;
+    memcpy(bytes, &header, sizeof(header));
+    TEST_ASSERT_FALSE(parseCameraCommand(bytes, sizeof(bytes), command));
+    TEST_ASSERT_FALSE(parseCameraAck(bytes, sizeof(bytes), ack));
+    TEST_ASSERT_FALSE(parseCameraTelemetry(bytes, sizeof(bytes), telemetry));
+  }
+}
+
+// Random payloads behind a valid header survive the round trip unchanged
+void test_random_round_trips() {
+  for (int i = 0; i < 1000; i++) {
+    CameraTelemetry sent;
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&sent);
+    for (size_t j = 0; j < sizeof(sent); j++) {
+      bytes[j] = uint8_t(nextRandom());
+    }
+    initCameraMessageHeader(sent.header, CameraMessageType::Telemetry,
+                            uint16_t(nextRandom()));
+    CameraTelemetry received;
+    TEST_ASSERT_TRUE(parseCameraTelemetry(bytes, sizeof(sent), received));
+    TEST_ASSERT_EQUAL_MEMORY(&sent, &received, sizeof(sent));
+  }
+}
+
+// Random bytes of random lengths parse only when they happen to start with
+// a valid header for the type and are long enough
+void test_random_garbage_is_rejected() {
+  uint8_t bytes[64];
+  for (int i = 0; i < 10000; i++) {
+    size_t length = nextRandom() % sizeof(bytes);
+    for (size_t j = 0; j < sizeof(bytes); j++) {
+      bytes[j] = uint8_t(nextRandom());
+    }
+    // Bias towards the interesting cases
+    if (nextRandom() % 2) {
+      bytes[0] = CAMERA_PROTOCOL_MAGIC;
+      bytes[1] = CAMERA_PROTOCOL_VERSION;
+      bytes[2] = uint8_t(1 + nextRandom() % 3);
+    }
+    bool validHeader = length >= sizeof(CameraMessageHeader) &&
+                       bytes[0] == CAMERA_PROTOCOL_MAGIC &&
+                       bytes[1] == CAMERA_PROTOCOL_VERSION;
+    CameraCommand command;
+    CameraAck ack;
+    CameraTelemetry telemetry;
+    TEST_ASSERT_EQUAL(validHeader && bytes[2] == 1 &&
+                          length >= sizeof(command),
+                      parseCameraCommand(bytes, length, command));
+    TEST_ASSERT_EQUAL(validHeader && bytes[2] == 2 && length >= sizeof(ack),
+                      parseCameraAck(bytes, length, ack));
+    TEST_ASSERT_EQUAL(validHeader && bytes[2] == 3 &&
+                          length >= sizeof(telemetry),
+                      parseCameraTelemetry(bytes, length, telemetry));
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_is_initialized);
+  RUN_TEST(test_command_round_trip);
+  RUN_TEST(test_ack_round_trip);
+  RUN_TEST(test_telemetry_round_trip);
+  RUN_TEST(test_messages_are_not_parsed_as_another_type);
+  RUN_TEST(test_unknown_command_fields_are_cleared);
+  RUN_TEST(test_valid_command_has_no_invalid_fields);
+  RUN_TEST(test_out_of_range_fields_are_reported);
+  RUN_TEST(test_fields_not_sent_are_not_checked);
+  RUN_TEST(test_truncated_messages_are_rejected);
+  RUN_TEST(test_longer_messages_ignore_the_extra_bytes);
+  RUN_TEST(test_wrong_magic_is_rejected);
+  RUN_TEST(test_other_versions_only_parse_the_header);
+  RUN_TEST(test_unknown_types_are_rejected);
+  RUN_TEST(test_random_round_trips);
+  RUN_TEST(test_random_garbage_is_rejected);
+  return UNITY_END();
+}
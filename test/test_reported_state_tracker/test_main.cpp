@@ -0,0 +1,140 @@
+#include <unity.h>
+#include <utils/firebase/ReportedStateTracker.h>
+#include <vector>
+
+constexpr uint32_t PASS_INTERVAL_MS = 5000;
+constexpr uint32_t FULL_SYNC_MS =
+    ReportedStateTracker::DEFAULT_FULL_SYNC_INTERVAL_MS;
+constexpr uint32_t DAY_MS = 24 * 60 * 60 * 1000;
+
+struct FakeDevice {
+  const char *name;
+  uint32_t version;
+  uint32_t hash; // Stands in for the hash of the reported document
+  uint32_t publishes;
+};
+
+uint32_t fakeClock;
+std::vector<FakeDevice> devices;
+
+// The publish pass FirebaseWrapper runs, sending at most queueSpace
+// documents before the command queue is full
+void publishPass(ReportedStateTracker &tracker, size_t queueSpace = SIZE_MAX) {
+  tracker.beginPass(fakeClock);
+  for (FakeDevice &device : devices) {
+    if (!tracker.mayHaveChanged(device.name, device.version)) {
+      continue;
+    }
+    if (tracker.needsPublish(device.name, device.hash)) {
+      if (queueSpace == 0) {
+        return;
+      }
+      queueSpace--;
+      device.publishes++;
+    }
+    tracker.markPublished(device.name, device.version, device.hash);
+  }
+}
+
+// Passes every PASS_INTERVAL_MS for durationMs, calling change() before each
+template <typename Change>
+void runFor(ReportedStateTracker &tracker, uint32_t durationMs,
+            Change change) {
+  for (uint32_t elapsed = 0; elapsed < durationMs;
+       elapsed += PASS_INTERVAL_MS) {
+    change(elapsed);
+    publishPass(tracker);
+    fakeClock += PASS_INTERVAL_MS;
+  }
+}
+
+void runFor(ReportedStateTracker &tracker, uint32_t durationMs) {
+  runFor(tracker, durationMs, [](uint32_t) {});
+}
+
+uint32_t totalPublishes() {
+  uint32_t total = 0;
+  for (const FakeDevice &device : devices) {
+    total += device.publishes;
+  }
+  return total;
+}
+
+void setUp() {
+  // Half a day before millis() wraps, so the day crosses it
+  fakeClock = UINT32_MAX - DAY_MS / 2;
+  devices = {{"heatLamp", 1, 0x1111, 0},
+             {"lights", 1, 0x2222, 0},
+             {"pump", 1, 0x3333, 0}};
+}
+void tearDown() {}
+
+void test_unchanged_devices_publish_only_on_full_syncs() {
+  ReportedStateTracker tracker;
+  runFor(tracker, DAY_MS);
+  for (const FakeDevice &device : devices) {
+    TEST_ASSERT_EQUAL_UINT32(DAY_MS / FULL_SYNC_MS, device.publishes);
+  }
+}
+
+void test_version_bump_is_published_once() {
+  ReportedStateTracker tracker;
+  runFor(tracker, DAY_MS, [](uint32_t elapsed) {
+    // Once an hour, a minute after the full sync
+    if (elapsed % (60 * 60 * 1000) == 60 * 1000) {
+      devices[1].version++;
+      devices[1].hash++;
+    }
+  });
+  TEST_ASSERT_EQUAL_UINT32(DAY_MS / FULL_SYNC_MS, devices[0].publishes);
+  TEST_ASSERT_EQUAL_UINT32(DAY_MS / FULL_SYNC_MS + 24, devices[1].publishes);
+  TEST_ASSERT_EQUAL_UINT32(DAY_MS / FULL_SYNC_MS, devices[2].publishes);
+}
+
+void test_bump_without_a_new_document_is_not_published() {
+  ReportedStateTracker tracker;
+  publishPass(tracker);
+  devices[0].version++; // Version moved, document hashes the same
+  fakeClock += PASS_INTERVAL_MS;
+  publishPass(tracker);
+  TEST_ASSERT_EQUAL_UINT32(1, devices[0].publishes);
+  // And it is not rebuilt on the passes after it either
+  TEST_ASSERT_FALSE(tracker.mayHaveChanged("heatLamp", devices[0].version));
+}
+
+void test_full_sync_cut_short_carries_on() {
+  ReportedStateTracker tracker;
+  publishPass(tracker, 1);
+  TEST_ASSERT_EQUAL_UINT32(1, totalPublishes());
+  fakeClock += PASS_INTERVAL_MS;
+  publishPass(tracker, 1);
+  fakeClock += PASS_INTERVAL_MS;
+  publishPass(tracker, 1);
+  for (const FakeDevice &device : devices) {
+    TEST_ASSERT_EQUAL_UINT32(1, device.publishes);
+  }
+  // Everyone is synced, the passes until the next full sync send nothing
+  runFor(tracker, FULL_SYNC_MS - 2 * PASS_INTERVAL_MS);
+  TEST_ASSERT_EQUAL_UINT32(3, totalPublishes());
+}
+
+void test_invalidate_republishes_everything() {
+  ReportedStateTracker tracker;
+  publishPass(tracker);
+  fakeClock += PASS_INTERVAL_MS;
+  tracker.invalidate(); // Reconnected
+  publishPass(tracker);
+  for (const FakeDevice &device : devices) {
+    TEST_ASSERT_EQUAL_UINT32(2, device.publishes);
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unchanged_devices_publish_only_on_full_syncs);
+  RUN_TEST(test_version_bump_is_published_once);
+  RUN_TEST(test_bump_without_a_new_document_is_not_published);
+  RUN_TEST(test_full_sync_cut_short_carries_on);
+  RUN_TEST(test_invalidate_republishes_everything);
+  return UNITY_END();
+}
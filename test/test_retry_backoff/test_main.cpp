@@ -0,0 +1,145 @@
+#include <unity.h>
+#include <utils/RetryBackoff.h>
+
+// No jitter so every attempt lands on an exact time
+constexpr RetryPolicy EXACT_POLICY = {
+    100,  // initialDelayMs
+    400,  // maxDelayMs
+    2,    // multiplier
+    0,    // jitterPercent
+    1000, // deadlineMs
+    5000, // probeIntervalMs
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_idle_until_started() {
+  RetryBackoff retry(EXACT_POLICY);
+  TEST_ASSERT_FALSE(retry.isActive());
+  TEST_ASSERT_FALSE(retry.poll(0));
+  TEST_ASSERT_FALSE(retry.poll(100000));
+}
+
+void test_delays_grow_up_to_the_maximum() {
+  RetryBackoff retry(EXACT_POLICY);
+  retry.start(0);
+  TEST_ASSERT_TRUE(retry.poll(0)); // First attempt right away
+  TEST_ASSERT_FALSE(retry.poll(99));
+  TEST_ASSERT_TRUE(retry.poll(100));
+  TEST_ASSERT_FALSE(retry.poll(299));
+  TEST_ASSERT_TRUE(retry.poll(300));
+  TEST_ASSERT_FALSE(retry.poll(699));
+  TEST_ASSERT_TRUE(retry.poll(700)); // 400, capped from 800
+  TEST_ASSERT_EQUAL_UINT32(4, retry.attempts());
+  TEST_ASSERT_TRUE(retry.state() == RetryBackoff::State::Retrying);
+}
+
+void test_deadline_fails_then_probes() {
+  RetryBackoff retry(EXACT_POLICY);
+  retry.start(0);
+  retry.poll(0);
+  TEST_ASSERT_FALSE(retry.poll(1000)); // Deadline, no attempt
+  TEST_ASSERT_TRUE(retry.isFailed());
+  TEST_ASSERT_EQUAL_UINT32(1, retry.failures());
+  TEST_ASSERT_FALSE(retry.poll(5999));
+  TEST_ASSERT_TRUE(retry.poll(6000));
+  TEST_ASSERT_FALSE(retry.poll(10999));
+  TEST_ASSERT_TRUE(retry.poll(11000));
+}
+
+void test_no_probes_when_interval_is_zero() {
+  RetryPolicy policy = EXACT_POLICY;
+  policy.probeIntervalMs = 0;
+  RetryBackoff retry(policy);
+  retry.start(0);
+  retry.poll(0);
+  retry.poll(1000);
+  TEST_ASSERT_TRUE(retry.isFailed());
+  TEST_ASSERT_FALSE(retry.poll(100000));
+}
+
+void test_succeed_stops_attempts() {
+  RetryBackoff retry(EXACT_POLICY);
+  retry.start(0);
+  retry.poll(0);
+  retry.succeed();
+  TEST_ASSERT_FALSE(retry.isActive());
+  TEST_ASSERT_FALSE(retry.poll(100));
+  TEST_ASSERT_EQUAL_UINT32(0, retry.failures());
+}
+
+void test_start_restarts_a_failed_operation() {
+  RetryBackoff retry(EXACT_POLICY);
+  retry.start(0);
+  retry.poll(0);
+  retry.poll(1000);
+  TEST_ASSERT_TRUE(retry.isFailed());
+  retry.start(2000);
+  TEST_ASSERT_TRUE(retry.state() == RetryBackoff::State::Retrying);
+  TEST_ASSERT_TRUE(retry.poll(2000));
+  TEST_ASSERT_EQUAL_UINT32(1, retry.attempts());
+}
+
+void test_jitter_stays_within_the_percentage() {
+  RetryPolicy policy = EXACT_POLICY;
+  policy.initialDelayMs = 1000;
+  policy.maxDelayMs = 1000;
+  policy.jitterPercent = 25;
+  policy.deadlineMs = 1000000;
+  RetryBackoff retry(policy, 42);
+  retry.start(0);
+  uint32_t lastAttempt = 0;
+  bool sawDifferentWaits = false;
+  uint32_t firstWait = 0;
+  TEST_ASSERT_TRUE(retry.poll(0));
+  for (uint32_t now = 1; now < 50000; now++) {
+    if (!retry.poll(now)) {
+      continue;
+    }
+    uint32_t wait = now - lastAttempt;
+    TEST_ASSERT_UINT32_WITHIN(250, 1000, wait);
+    if (firstWait == 0) {
+      firstWait = wait;
+    } else if (wait != firstWait) {
+      sawDifferentWaits = true;
+    }
+    lastAttempt = now;
+  }
+  TEST_ASSERT_TRUE(sawDifferentWaits);
+}
+
+void test_same_seed_replays_the_same_schedule() {
+  RetryPolicy policy = EXACT_POLICY;
+  policy.jitterPercent = 50;
+  RetryBackoff first(policy, 7), second(policy, 7);
+  first.start(0);
+  second.start(0);
+  for (uint32_t now = 0; now < 20000; now++) {
+    TEST_ASSERT_EQUAL(first.poll(now), second.poll(now));
+  }
+}
+
+void test_works_across_the_millis_wrap() {
+  RetryBackoff retry(EXACT_POLICY);
+  uint32_t start = UINT32_MAX - 50;
+  retry.start(start);
+  TEST_ASSERT_TRUE(retry.poll(start));
+  TEST_ASSERT_FALSE(retry.poll(start + 99));
+  TEST_ASSERT_TRUE(retry.poll(start + 100)); // Wrapped past 0
+  TEST_ASSERT_FALSE(retry.isFailed());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_idle_until_started);
+  RUN_TEST(test_delays_grow_up_to_the_maximum);
+  RUN_TEST(test_deadline_fails_then_probes);
+  RUN_TEST(test_no_probes_when_interval_is_zero);
+  RUN_TEST(test_succeed_stops_attempts);
+  RUN_TEST(test_start_restarts_a_failed_operation);
+  RUN_TEST(test_jitter_stays_within_the_percentage);
+  RUN_TEST(test_same_seed_replays_the_same_schedule);
+  RUN_TEST(test_works_across_the_millis_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,102 @@
+#include <ArduinoJson.h>
+#include <FakeFirebase.h>
+#include <string>
+#include <unity.h>
+#include <utils/firebase/RtdbWriteBatch.h>
+
+#define BASE_PATH "users/alice/tanks/reef"
+
+FakeRtdb rtdb;
+
+std::string body(const RtdbWriteBatch &batch) {
+  std::string json;
+  batch.serialize(json);
+  return json;
+}
+
+void setUp() { rtdb.clear(); }
+void tearDown() {}
+
+void test_body_is_one_multi_location_update() {
+  RtdbWriteBatch batch("/" BASE_PATH);
+  TEST_ASSERT_EQUAL_STRING(BASE_PATH, batch.path().c_str());
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/status/time", "12:00"));
+  TEST_ASSERT_TRUE(batch.add("/" BASE_PATH "/sensors/temperature", 42));
+  JsonDocument reported;
+  reported["on"] = true;
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/devices/heatLamp/reported",
+                             reported));
+  TEST_ASSERT_EQUAL_size_t(3, batch.size());
+  TEST_ASSERT_EQUAL_STRING("{\"status/time\":\"12:00\","
+                           "\"sensors/temperature\":42,"
+                           "\"devices/heatLamp/reported\":{\"on\":true}}",
+                           body(batch).c_str());
+
+  // The database ends up with every value in its place
+  TEST_ASSERT_TRUE(rtdb.update(batch.path().c_str(), body(batch).c_str()));
+  TEST_ASSERT_EQUAL_UINT32(1, rtdb.requests());
+  TEST_ASSERT_EQUAL_STRING(
+      "12:00", rtdb.get(BASE_PATH "/status/time").as<const char *>());
+  TEST_ASSERT_EQUAL_INT(
+      42, rtdb.get(BASE_PATH "/sensors/temperature").as<int>());
+  TEST_ASSERT_TRUE(
+      rtdb.get(BASE_PATH "/devices/heatLamp/reported/on").as<bool>());
+}
+
+void test_same_path_keeps_the_latest_value() {
+  RtdbWriteBatch batch(BASE_PATH);
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/status/time", "12:00"));
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/sensors/humidity", 61));
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/status/time", "12:01"));
+  TEST_ASSERT_EQUAL_size_t(2, batch.size());
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"status/time\":\"12:01\",\"sensors/humidity\":61}",
+      body(batch).c_str());
+}
+
+void test_ancestors_and_descendants_are_refused() {
+  RtdbWriteBatch batch(BASE_PATH);
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/devices/heatLamp", 1));
+  // RTDB rejects an update holding both, the caller sets these on their own
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH "/devices/heatLamp/reported", 2));
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH "/devices", 3));
+  // A shared prefix is not an ancestor
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/devices/heatLamp2", 4));
+  TEST_ASSERT_EQUAL_STRING("{\"devices/heatLamp\":1,\"devices/heatLamp2\":4}",
+                           body(batch).c_str());
+}
+
+void test_paths_outside_the_base_are_refused() {
+  RtdbWriteBatch batch(BASE_PATH);
+  TEST_ASSERT_FALSE(batch.add("users/bob/tanks/reef/status/time", 1));
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH "er/status/time", 1));
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH, 1));
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH "/", 1));
+  TEST_ASSERT_FALSE(batch.add(nullptr, 1));
+  TEST_ASSERT_TRUE(batch.empty());
+}
+
+void test_full_batch_only_takes_overwrites() {
+  RtdbWriteBatch batch(BASE_PATH, 2);
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/a", 1));
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/b", 2));
+  TEST_ASSERT_FALSE(batch.add(BASE_PATH "/c", 3));
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/a", 4));
+  TEST_ASSERT_EQUAL_STRING("{\"a\":4,\"b\":2}", body(batch).c_str());
+
+  // Sent, there is room again
+  batch.clear();
+  TEST_ASSERT_TRUE(batch.empty());
+  TEST_ASSERT_TRUE(batch.add(BASE_PATH "/c", 3));
+  TEST_ASSERT_EQUAL_STRING("{\"c\":3}", body(batch).c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_body_is_one_multi_location_update);
+  RUN_TEST(test_same_path_keeps_the_latest_value);
+  RUN_TEST(test_ancestors_and_descendants_are_refused);
+  RUN_TEST(test_paths_outside_the_base_are_refused);
+  RUN_TEST(test_full_batch_only_takes_overwrites);
+  return UNITY_END();
+}
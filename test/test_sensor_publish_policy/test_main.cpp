@@ -0,0 +1,136 @@
+#include <cmath>
+#include <sensors/SensorPublishPolicy.h>
+#include <unity.h>
+
+// TEMPERATURE_PUBLISH_CONFIG in main.cpp
+const SensorPublishConfig TEMPERATURE = {0.3f, 0.0f, 5000, 300000};
+constexpr uint32_t SAMPLE_INTERVAL_MS = 2000;
+constexpr float LAMP_ON_BELOW = 78.5f;
+constexpr float LAMP_OFF_ABOVE = 82.0f;
+
+// AHT20 readings in F, one every 2 s: the lamp warms the tank up to its
+// cutoff, then the tank drifts back down with the usual sensor jitter
+const float TRACE[] = {
+    78.21f, 78.25f, 78.19f, 78.30f, 78.36f, 78.33f, 78.47f, 78.52f, 78.61f,
+    78.58f, 78.72f, 78.81f, 78.79f, 78.95f, 79.04f, 79.11f, 79.09f, 79.26f,
+    79.34f, 79.41f, 79.52f, 79.50f, 79.66f, 79.73f, 79.85f, 79.92f, 79.90f,
+    80.07f, 80.16f, 80.21f, 80.34f, 80.41f, 80.39f, 80.55f, 80.63f, 80.72f,
+    80.80f, 80.78f, 80.93f, 81.02f, 81.11f, 81.09f, 81.24f, 81.33f, 81.41f,
+    81.48f, 81.46f, 81.61f, 81.70f, 81.78f, 81.86f, 81.91f, 81.97f, 82.03f,
+    82.08f, 82.06f, 82.04f, 81.99f, 81.96f, 81.98f, 81.93f, 81.88f, 81.90f,
+    81.84f, 81.81f, 81.83f, 81.77f, 81.74f, 81.76f, 81.71f, 81.69f, 81.70f,
+    NAN,    81.66f, 81.64f, 81.65f, 81.62f, 81.60f, 81.61f, 81.58f, 81.57f,
+};
+constexpr size_t TRACE_LENGTH = sizeof(TRACE) / sizeof(TRACE[0]);
+
+void setUp() {}
+void tearDown() {}
+
+bool crosses(float from, float to, float threshold) {
+  return (from < threshold) != (to < threshold);
+}
+
+void test_trace_is_thinned_out() {
+  SensorPublishPolicy policy(TEMPERATURE);
+  policy.setThresholds({LAMP_ON_BELOW, LAMP_OFF_ABOVE});
+  uint32_t nowMs = 0;
+  uint32_t published = 0;
+  uint32_t lastMs = 0;
+  float lastValue = 0.0f;
+  for (size_t i = 0; i < TRACE_LENGTH; i++, nowMs += SAMPLE_INTERVAL_MS) {
+    float value = TRACE[i];
+    if (!policy.update(value, nowMs)) {
+      continue;
+    }
+    if (published > 0) {
+      // Either a threshold went by, or the interval and deadband are met
+      bool crossed = crosses(lastValue, value, LAMP_ON_BELOW) ||
+                     crosses(lastValue, value, LAMP_OFF_ABOVE);
+      TEST_ASSERT_TRUE(crossed || nowMs - lastMs >= TEMPERATURE.minIntervalMs);
+      TEST_ASSERT_TRUE(crossed || std::fabs(value - lastValue) >= 0.3f);
+    }
+    TEST_ASSERT_FALSE(std::isnan(value));
+    published++;
+    lastMs = nowMs;
+    lastValue = value;
+  }
+  // 81 readings: the first, the 0.3 F steps on the way up, the cutoff both
+  // ways and one step on the way down
+  TEST_ASSERT_EQUAL_UINT32(14, published);
+  TEST_ASSERT_EQUAL_FLOAT(81.66f, policy.lastPublishedValue());
+}
+
+void test_absolute_and_relative_deadband() {
+  SensorPublishPolicy policy({0.5f, 0.01f, 0, 0});
+  policy.update(80.0f, 0);
+  // 1% of 80 is wider than 0.5
+  TEST_ASSERT_FALSE(policy.isDue(80.6f, 1000));
+  TEST_ASSERT_FALSE(policy.isDue(79.4f, 1000));
+  TEST_ASSERT_TRUE(policy.isDue(80.8f, 1000));
+  policy.update(10.0f, 1000);
+  // 1% of 10 is narrower, the absolute band applies
+  TEST_ASSERT_FALSE(policy.isDue(10.4f, 2000));
+  TEST_ASSERT_TRUE(policy.isDue(10.5f, 2000));
+
+  // No deadband at all passes on any change
+  SensorPublishPolicy anyChange;
+  anyChange.update(80.0f, 0);
+  TEST_ASSERT_FALSE(anyChange.isDue(80.0f, 1000));
+  TEST_ASSERT_TRUE(anyChange.isDue(80.01f, 1000));
+}
+
+void test_min_interval_suppresses_changes() {
+  SensorPublishPolicy policy(TEMPERATURE);
+  TEST_ASSERT_TRUE(policy.update(78.0f, 10000));
+  TEST_ASSERT_FALSE(policy.update(80.0f, 12000));
+  TEST_ASSERT_FALSE(policy.update(80.0f, 14999));
+  TEST_ASSERT_TRUE(policy.update(80.0f, 15000));
+}
+
+void test_unchanged_value_is_refreshed_at_max_interval() {
+  SensorPublishPolicy policy(TEMPERATURE);
+  policy.update(78.0f, 0);
+  uint32_t nowMs = SAMPLE_INTERVAL_MS;
+  for (; nowMs < TEMPERATURE.maxIntervalMs; nowMs += SAMPLE_INTERVAL_MS) {
+    TEST_ASSERT_FALSE(policy.update(78.1f, nowMs));
+  }
+  TEST_ASSERT_TRUE(policy.update(78.1f, nowMs));
+  TEST_ASSERT_FALSE(policy.update(78.1f, nowMs + SAMPLE_INTERVAL_MS));
+
+  // Off by default
+  SensorPublishPolicy never({0.3f, 0.0f, 5000, 0});
+  never.update(78.0f, 0);
+  TEST_ASSERT_FALSE(never.isDue(78.0f, 24 * 60 * 60 * 1000));
+}
+
+void test_threshold_crossing_inside_min_interval_is_published() {
+  SensorPublishPolicy policy(TEMPERATURE);
+  policy.setThresholds({LAMP_ON_BELOW, LAMP_OFF_ABOVE});
+  policy.update(81.95f, 0);
+  // Inside both the interval and the deadband, but past the cutoff
+  TEST_ASSERT_TRUE(policy.update(82.01f, 1000));
+  // And back under it
+  TEST_ASSERT_TRUE(policy.update(81.99f, 2000));
+  TEST_ASSERT_FALSE(policy.update(81.90f, 3000));
+}
+
+void test_nan_is_never_published() {
+  SensorPublishPolicy policy(TEMPERATURE);
+  TEST_ASSERT_FALSE(policy.update(NAN, 0));
+  TEST_ASSERT_FALSE(policy.hasValue());
+  policy.update(78.0f, 0);
+  // Not even when a refresh is due
+  TEST_ASSERT_FALSE(policy.update(NAN, TEMPERATURE.maxIntervalMs));
+  TEST_ASSERT_EQUAL_FLOAT(78.0f, policy.lastPublishedValue());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_trace_is_thinned_out);
+  RUN_TEST(test_absolute_and_relative_deadband);
+  RUN_TEST(test_min_interval_suppresses_changes);
+  RUN_TEST(test_unchanged_value_is_refreshed_at_max_interval);
+  RUN_TEST(test_threshold_crossing_inside_min_interval_is_published);
+  RUN_TEST(test_nan_is_never_published);
+  return UNITY_END();
+}
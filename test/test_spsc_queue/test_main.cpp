@@ -0,0 +1,130 @@
+#include <thread>
+#include <unity.h>
+#include <utils/SpscQueue.h>
+
+// The threaded tests are meant for `pio test -e native_tsan`, which runs
+// them under ThreadSanitizer. Plain native runs still check the ordering.
+constexpr uint32_t ITEM_COUNT = 200000;
+
+// Big enough that a torn copy would show in the check field
+struct Item {
+  uint32_t sequence;
+  uint32_t check;
+  uint8_t padding[24];
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_push_pop_in_order() {
+  SpscQueue<int, 4> queue;
+  int value;
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(value));
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+  }
+  TEST_ASSERT_FALSE(queue.push(4)); // Full
+  TEST_ASSERT_EQUAL_size_t(4, queue.size());
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(i, value);
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_reserve_publish_and_peek_drop() {
+  SpscQueue<int, 2> queue;
+  int *slot = queue.reserve();
+  TEST_ASSERT_NOT_NULL(slot);
+  *slot = 7;
+  TEST_ASSERT_NULL(queue.peek()); // Not published yet
+  queue.publish();
+  TEST_ASSERT_NOT_NULL(queue.reserve());
+  queue.publish();
+  TEST_ASSERT_NULL(queue.reserve()); // Full
+  TEST_ASSERT_EQUAL(7, *queue.peek());
+  TEST_ASSERT_TRUE(queue.drop());
+  TEST_ASSERT_TRUE(queue.drop());
+  TEST_ASSERT_FALSE(queue.drop());
+}
+
+void test_indices_keep_working_after_many_wraps() {
+  SpscQueue<uint32_t, 4> queue;
+  uint32_t value;
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL_UINT32(i, value);
+  }
+}
+
+void test_threads_push_pop() {
+  static SpscQueue<Item, 64> queue;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < ITEM_COUNT;) {
+      Item item = {i, ~i, {}};
+      if (queue.push(item)) {
+        i++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t expected = 0;
+  bool inOrder = true;
+  while (expected < ITEM_COUNT) {
+    Item item;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    inOrder &= item.sequence == expected && item.check == ~expected;
+    expected++;
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(inOrder);
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// The zero-copy path used by the Firebase queues
+void test_threads_reserve_peek() {
+  static SpscQueue<Item, 8> queue;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < ITEM_COUNT;) {
+      Item *slot = queue.reserve();
+      if (!slot) {
+        std::this_thread::yield();
+        continue;
+      }
+      slot->sequence = i;
+      slot->check = ~i;
+      queue.publish();
+      i++;
+    }
+  });
+  uint32_t expected = 0;
+  bool inOrder = true;
+  while (expected < ITEM_COUNT) {
+    Item *item = queue.peek();
+    if (!item) {
+      std::this_thread::yield();
+      continue;
+    }
+    inOrder &= item->sequence == expected && item->check == ~expected;
+    queue.drop();
+    expected++;
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(inOrder);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_push_pop_in_order);
+  RUN_TEST(test_reserve_publish_and_peek_drop);
+  RUN_TEST(test_indices_keep_working_after_many_wraps);
+  RUN_TEST(test_threads_push_pop);
+  RUN_TEST(test_threads_reserve_peek);
+  return UNITY_END();
+}
@@ -0,0 +1,203 @@
+#include <unity.h>
+#include <utils/TaskScheduler.h>
+
+// Fake clock, tasks can advance it to pretend they took a while
+uint32_t nowMs = 0;
+uint32_t fakeClock() { return nowMs; }
+
+TaskScheduler *scheduler = nullptr;
+char order[16];
+size_t orderLength = 0;
+uint32_t taskDurationMs = 0;
+int selfId = TaskScheduler::INVALID_TASK;
+
+void record(char name) {
+  if (orderLength + 1 < sizeof(order)) {
+    order[orderLength++] = name;
+    order[orderLength] = '\0';
+  }
+}
+void taskA() { record('A'); }
+void taskB() { record('B'); }
+void taskC() { record('C'); }
+void slowTask() {
+  record('S');
+  nowMs += taskDurationMs;
+}
+// Lets the higher priority task in halfway through
+void yieldingTask() {
+  record('Y');
+  nowMs += 10;
+  scheduler->yield();
+  record('y');
+}
+void cancelSelf() {
+  record('X');
+  scheduler->cancel(selfId);
+}
+void rescheduleSelf() {
+  record('R');
+  scheduler->runAfter(selfId, 500);
+}
+
+void setUp() {
+  nowMs = 0;
+  order[0] = '\0';
+  orderLength = 0;
+  taskDurationMs = 0;
+  selfId = TaskScheduler::INVALID_TASK;
+}
+void tearDown() {}
+
+void test_periodic_task_runs_at_a_fixed_rate() {
+  TaskScheduler tasks(fakeClock);
+  int id = tasks.addPeriodic("a", 100, taskA);
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run());
+  TEST_ASSERT_EQUAL_size_t(0, tasks.run());
+  TEST_ASSERT_EQUAL_UINT32(100, tasks.msUntilNext());
+  nowMs = 130; // Late, the next deadline stays on the 100 ms grid
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run());
+  TEST_ASSERT_EQUAL_UINT32(70, tasks.msUntilNext());
+  TEST_ASSERT_EQUAL_UINT32(30, tasks.stats(id)->lastJitterMs);
+  TEST_ASSERT_EQUAL_UINT32(2, tasks.stats(id)->runs);
+}
+
+void test_missed_periods_are_skipped() {
+  TaskScheduler tasks(fakeClock);
+  int id = tasks.addPeriodic("a", 100, taskA);
+  tasks.run();
+  nowMs = 450;
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run()); // Not four times back to back
+  TEST_ASSERT_EQUAL_STRING("AA", order);
+  TEST_ASSERT_EQUAL_UINT32(3, tasks.stats(id)->skippedPeriods);
+  TEST_ASSERT_EQUAL_UINT32(50, tasks.msUntilNext());
+}
+
+void test_higher_priority_runs_first() {
+  TaskScheduler tasks(fakeClock);
+  tasks.addPeriodic("a", 100, taskA, 0);
+  tasks.addPeriodic("b", 100, taskB, 2);
+  tasks.addPeriodic("c", 100, taskC, 1);
+  tasks.run();
+  TEST_ASSERT_EQUAL_STRING("BCA", order);
+}
+
+void test_earliest_deadline_first_within_a_priority() {
+  TaskScheduler tasks(fakeClock);
+  tasks.addOnce("a", 30, taskA);
+  tasks.addOnce("b", 10, taskB);
+  tasks.addOnce("c", 20, taskC);
+  nowMs = 50;
+  tasks.run();
+  TEST_ASSERT_EQUAL_STRING("BCA", order);
+}
+
+void test_one_shot_runs_once() {
+  TaskScheduler tasks(fakeClock);
+  int id = tasks.addOnce("a", 50, taskA);
+  TEST_ASSERT_EQUAL_size_t(0, tasks.run());
+  nowMs = 50;
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run());
+  nowMs = 1000;
+  TEST_ASSERT_EQUAL_size_t(0, tasks.run());
+  TEST_ASSERT_FALSE(tasks.isActive(id));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, tasks.msUntilNext());
+}
+
+void test_overruns_are_counted() {
+  TaskScheduler tasks(fakeClock);
+  int id = tasks.addPeriodic("slow", 100, slowTask);
+  taskDurationMs = 150;
+  tasks.run();
+  const ScheduledTaskStats *stats = tasks.stats(id);
+  TEST_ASSERT_EQUAL_UINT32(1, stats->overruns);
+  TEST_ASSERT_EQUAL_UINT32(150, stats->maxRunMs);
+  TEST_ASSERT_EQUAL_UINT32(1, stats->skippedPeriods);
+}
+
+void test_yield_runs_higher_priority_tasks_only() {
+  TaskScheduler tasks(fakeClock);
+  scheduler = &tasks;
+  tasks.addOnce("yield", 0, yieldingTask, 1);
+  tasks.addOnce("high", 5, taskA, 2);
+  tasks.addOnce("low", 5, taskB, 0);
+  tasks.run();
+  TEST_ASSERT_EQUAL_STRING("YAyB", order);
+  TEST_ASSERT_EQUAL_size_t(0, tasks.yield()); // Outside of a task
+}
+
+void test_task_can_cancel_itself() {
+  TaskScheduler tasks(fakeClock);
+  scheduler = &tasks;
+  selfId = tasks.addPeriodic("cancel", 100, cancelSelf);
+  tasks.run();
+  nowMs = 1000;
+  tasks.run();
+  TEST_ASSERT_EQUAL_STRING("X", order);
+  TEST_ASSERT_FALSE(tasks.isActive(selfId));
+}
+
+void test_run_after_from_inside_the_task_wins() {
+  TaskScheduler tasks(fakeClock);
+  scheduler = &tasks;
+  selfId = tasks.addPeriodic("reschedule", 100, rescheduleSelf);
+  tasks.run();
+  TEST_ASSERT_EQUAL_UINT32(500, tasks.msUntilNext());
+}
+
+void test_set_period_applies_from_the_next_run() {
+  TaskScheduler tasks(fakeClock);
+  int id = tasks.addPeriodic("a", 100, taskA);
+  tasks.run();
+  tasks.setPeriod(id, 300);
+  nowMs = 100;
+  tasks.run();
+  TEST_ASSERT_EQUAL_UINT32(300, tasks.msUntilNext());
+  tasks.setPeriod(id, 0); // Ignored
+  nowMs = 400;
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run());
+}
+
+void test_table_full_and_invalid_ids() {
+  TaskScheduler tasks(fakeClock);
+  for (size_t i = 0; i < TaskScheduler::MAX_TASKS; i++) {
+    TEST_ASSERT_NOT_EQUAL(TaskScheduler::INVALID_TASK,
+                          tasks.addPeriodic("a", 100, taskA));
+  }
+  TEST_ASSERT_EQUAL(TaskScheduler::INVALID_TASK,
+                    tasks.addPeriodic("a", 100, taskA));
+  TEST_ASSERT_EQUAL(TaskScheduler::INVALID_TASK,
+                    TaskScheduler(fakeClock).addPeriodic("a", 0, taskA));
+  TEST_ASSERT_NULL(tasks.stats(-1));
+  TEST_ASSERT_NULL(tasks.name(int(TaskScheduler::MAX_TASKS)));
+  tasks.cancel(3);
+  TEST_ASSERT_EQUAL(3, tasks.addOnce("b", 0, taskB));
+}
+
+void test_deadlines_work_across_the_millis_wrap() {
+  nowMs = UINT32_MAX - 20;
+  TaskScheduler tasks(fakeClock);
+  tasks.addPeriodic("a", 100, taskA);
+  tasks.run();
+  nowMs += 99;
+  TEST_ASSERT_EQUAL_size_t(0, tasks.run());
+  nowMs += 1;
+  TEST_ASSERT_EQUAL_size_t(1, tasks.run());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_periodic_task_runs_at_a_fixed_rate);
+  RUN_TEST(test_missed_periods_are_skipped);
+  RUN_TEST(test_higher_priority_runs_first);
+  RUN_TEST(test_earliest_deadline_first_within_a_priority);
+  RUN_TEST(test_one_shot_runs_once);
+  RUN_TEST(test_overruns_are_counted);
+  RUN_TEST(test_yield_runs_higher_priority_tasks_only);
+  RUN_TEST(test_task_can_cancel_itself);
+  RUN_TEST(test_run_after_from_inside_the_task_wins);
+  RUN_TEST(test_set_period_applies_from_the_next_run);
+  RUN_TEST(test_table_full_and_invalid_ids);
+  RUN_TEST(test_deadlines_work_across_the_millis_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,174 @@
+#include <cmath>
+#include <unity.h>
+#include <utils/TimeSeriesBuffer.h>
+#include <vector>
+
+using SmallBuffer = TimeSeriesBuffer<2, 4>;
+
+// 2024-01-01T00:00:00Z, on an hour boundary
+constexpr uint32_t T0 = 1704067200;
+
+bool add(SmallBuffer &buffer, uint32_t timeSec, float first,
+         float second = 0.0f) {
+  return buffer.add(timeSec, {first, second});
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_ring_evicts_the_oldest_and_keeps_times() {
+  SmallBuffer buffer;
+  const uint32_t times[] = {T0, T0 + 5, T0 + 12, T0 + 20, T0 + 21, T0 + 30};
+  for (size_t i = 0; i < 6; i++) {
+    TEST_ASSERT_TRUE(add(buffer, times[i], float(i)));
+  }
+  TEST_ASSERT_EQUAL_size_t(4, buffer.size());
+  TEST_ASSERT_EQUAL_UINT32(T0 + 30, buffer.newestTimeSec());
+
+  // The oldest time is rebuilt from the deltas of what is left
+  std::vector<uint32_t> seenTimes;
+  std::vector<int16_t> seenValues;
+  buffer.forEachSample([&](uint32_t timeSec, const int16_t *values) {
+    seenTimes.push_back(timeSec);
+    seenValues.push_back(values[0]);
+  });
+  TEST_ASSERT_EQUAL_size_t(4, seenTimes.size());
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_UINT32(times[i + 2], seenTimes[i]);
+    TEST_ASSERT_EQUAL_INT(int((i + 2) * 100), seenValues[i]);
+  }
+}
+
+void test_older_readings_are_rejected() {
+  SmallBuffer buffer;
+  TEST_ASSERT_TRUE(add(buffer, T0 + 10, 1.0f));
+  TEST_ASSERT_FALSE(add(buffer, T0 + 9, 2.0f));
+  TEST_ASSERT_TRUE(add(buffer, T0 + 10, 3.0f)); // Same second is fine
+  TEST_ASSERT_EQUAL_size_t(2, buffer.size());
+}
+
+void test_buckets_align_and_roll_over() {
+  SmallBuffer buffer;
+  add(buffer, T0 + 30, 1.0f, 10.0f);
+  add(buffer, T0 + 59, 2.0f, 30.0f);
+  // Both in the first minute, nothing closed yet
+  TEST_ASSERT_EQUAL_size_t(0, buffer.aggregateCount(TimeSeriesLevel::Minute));
+  const SmallBuffer::Aggregate &open =
+      buffer.openAggregate(TimeSeriesLevel::Minute);
+  TEST_ASSERT_EQUAL_UINT32(T0, open.startSec);
+  TEST_ASSERT_EQUAL_UINT16(2, open.count);
+
+  add(buffer, T0 + 60, 4.0f, 20.0f);
+  TEST_ASSERT_EQUAL_size_t(1, buffer.aggregateCount(TimeSeriesLevel::Minute));
+  const SmallBuffer::Aggregate &minute =
+      buffer.aggregateAt(TimeSeriesLevel::Minute, 0);
+  TEST_ASSERT_EQUAL_UINT32(T0, minute.startSec);
+  TEST_ASSERT_EQUAL_UINT16(2, minute.count);
+  TEST_ASSERT_EQUAL_INT(100, minute.min[0]);
+  TEST_ASSERT_EQUAL_INT(200, minute.max[0]);
+  TEST_ASSERT_EQUAL_INT(150, minute.mean(0));
+  TEST_ASSERT_EQUAL_INT(2000, minute.mean(1));
+  TEST_ASSERT_EQUAL_UINT32(T0 + 60,
+                           buffer.openAggregate(TimeSeriesLevel::Minute)
+                               .startSec);
+  TEST_ASSERT_EQUAL_size_t(
+      0, buffer.aggregateCount(TimeSeriesLevel::QuarterHour));
+
+  add(buffer, T0 + 15 * 60 + 7, 3.0f);
+  TEST_ASSERT_EQUAL_size_t(
+      1, buffer.aggregateCount(TimeSeriesLevel::QuarterHour));
+  const SmallBuffer::Aggregate &quarter =
+      buffer.aggregateAt(TimeSeriesLevel::QuarterHour, 0);
+  TEST_ASSERT_EQUAL_UINT32(T0, quarter.startSec);
+  TEST_ASSERT_EQUAL_UINT16(3, quarter.count);
+  TEST_ASSERT_EQUAL_INT(400, quarter.max[0]);
+  TEST_ASSERT_EQUAL_UINT32(
+      T0 + 15 * 60,
+      buffer.openAggregate(TimeSeriesLevel::QuarterHour).startSec);
+  TEST_ASSERT_EQUAL_size_t(0, buffer.aggregateCount(TimeSeriesLevel::Hour));
+
+  // A gap straight into the next hour closes one bucket per level, the
+  // hours in between have no bucket at all
+  add(buffer, T0 + 3 * 3600 + 1, 5.0f);
+  TEST_ASSERT_EQUAL_size_t(3, buffer.aggregateCount(TimeSeriesLevel::Minute));
+  TEST_ASSERT_EQUAL_size_t(
+      2, buffer.aggregateCount(TimeSeriesLevel::QuarterHour));
+  TEST_ASSERT_EQUAL_size_t(1, buffer.aggregateCount(TimeSeriesLevel::Hour));
+  const SmallBuffer::Aggregate &hour =
+      buffer.aggregateAt(TimeSeriesLevel::Hour, 0);
+  TEST_ASSERT_EQUAL_UINT32(T0, hour.startSec);
+  TEST_ASSERT_EQUAL_UINT16(4, hour.count);
+  TEST_ASSERT_EQUAL_INT(100, hour.min[0]);
+  TEST_ASSERT_EQUAL_INT(400, hour.max[0]);
+  TEST_ASSERT_EQUAL_INT(250, hour.mean(0));
+  TEST_ASSERT_EQUAL_UINT32(
+      T0 + 3 * 3600, buffer.openAggregate(TimeSeriesLevel::Hour).startSec);
+}
+
+void test_minute_ring_keeps_the_newest_buckets() {
+  SmallBuffer buffer;
+  const size_t minutes = SmallBuffer::MINUTE_BUCKETS + 10;
+  for (uint32_t minute = 0; minute < minutes; minute++) {
+    add(buffer, T0 + minute * 60, float(minute));
+  }
+  // The last minute is still open, the ten before the kept ones are gone
+  TEST_ASSERT_EQUAL_size_t(SmallBuffer::MINUTE_BUCKETS,
+                           buffer.aggregateCount(TimeSeriesLevel::Minute));
+  TEST_ASSERT_EQUAL_UINT32(
+      T0 + 9 * 60, buffer.aggregateAt(TimeSeriesLevel::Minute, 0).startSec);
+  TEST_ASSERT_EQUAL_UINT32(
+      T0 + (minutes - 2) * 60,
+      buffer
+          .aggregateAt(TimeSeriesLevel::Minute, SmallBuffer::MINUTE_BUCKETS - 1)
+          .startSec);
+}
+
+void test_summarize_takes_buckets_starting_in_range() {
+  SmallBuffer buffer;
+  for (uint32_t minute = 0; minute <= 120; minute++) {
+    add(buffer, T0 + minute * 60 + 30, float(minute % 60));
+  }
+  // [T0 + 3600, T0 + 7200) is the second hour's minutes only
+  SmallBuffer::Aggregate hour =
+      buffer.summarize(TimeSeriesLevel::Minute, T0 + 3600, T0 + 7200);
+  TEST_ASSERT_EQUAL_UINT32(T0 + 3600, hour.startSec);
+  TEST_ASSERT_EQUAL_UINT16(60, hour.count);
+  TEST_ASSERT_EQUAL_INT(0, hour.min[0]);
+  TEST_ASSERT_EQUAL_INT(5900, hour.max[0]);
+  // A bucket starting one second before the range is left out
+  SmallBuffer::Aggregate late =
+      buffer.summarize(TimeSeriesLevel::Minute, T0 + 3600 + 1, T0 + 7200);
+  TEST_ASSERT_EQUAL_UINT16(59, late.count);
+  TEST_ASSERT_EQUAL_UINT32(T0 + 3660, late.startSec);
+  // The open bucket never counts, nor does an empty range
+  TEST_ASSERT_EQUAL_UINT16(
+      0, buffer.summarize(TimeSeriesLevel::Minute, T0 + 7200, T0 + 7260)
+             .count);
+  TEST_ASSERT_EQUAL_UINT16(
+      0, buffer.summarize(TimeSeriesLevel::Minute, T0, T0).count);
+}
+
+void test_quantize_clamps_to_int16() {
+  SmallBuffer buffer(0.01f);
+  TEST_ASSERT_EQUAL_INT(1234, buffer.quantize(12.34f));
+  TEST_ASSERT_EQUAL_INT(-1234, buffer.quantize(-12.34f));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 12.34f, buffer.toValue(1234));
+  TEST_ASSERT_EQUAL_INT(INT16_MAX, buffer.quantize(1000.0f));
+  // INT16_MIN itself is never stored, so clamped and NaN look the same
+  TEST_ASSERT_EQUAL_INT(INT16_MIN + 1, buffer.quantize(-1000.0f));
+  TEST_ASSERT_EQUAL_INT(INT16_MIN + 1, buffer.quantize(NAN));
+  // A coarser resolution reaches further
+  SmallBuffer coarse(0.1f);
+  TEST_ASSERT_EQUAL_INT(10000, coarse.quantize(1000.0f));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_evicts_the_oldest_and_keeps_times);
+  RUN_TEST(test_older_readings_are_rejected);
+  RUN_TEST(test_buckets_align_and_roll_over);
+  RUN_TEST(test_minute_ring_keeps_the_newest_buckets);
+  RUN_TEST(test_summarize_takes_buckets_starting_in_range);
+  RUN_TEST(test_quantize_clamps_to_int16);
+  return UNITY_END();
+}
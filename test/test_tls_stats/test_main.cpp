@@ -0,0 +1,115 @@
+#include <thread>
+#include <unity.h>
+#include <utils/firebase/TlsStats.h>
+
+// Free heap as the connections see it, each open one holds some of it
+uint32_t freeHeap;
+
+// The accounting MeteredTlsClient does around connect() and stop()
+struct FakeConnection {
+  TlsStats &stats;
+  uint32_t heldBytes = 0;
+
+  bool connect(bool succeeds, uint32_t elapsedMs, uint32_t heapUsed) {
+    uint32_t freeBefore = freeHeap;
+    if (!succeeds) {
+      stats.handshakeFailed();
+      return false;
+    }
+    freeHeap -= heapUsed;
+    stats.handshakeDone(elapsedMs);
+    stats.hold(heldBytes, freeBefore, freeHeap);
+    return true;
+  }
+  void stop() {
+    freeHeap += heldBytes;
+    stats.release(heldBytes);
+  }
+};
+
+void setUp() { freeHeap = 200000; }
+void tearDown() {}
+
+void test_handshakes_are_counted_and_timed() {
+  TlsStats stats;
+  TEST_ASSERT_EQUAL_UINT32(0, stats.averageHandshakeMs());
+  stats.handshakeDone(800);
+  stats.handshakeDone(1200);
+  stats.handshakeDone(400);
+  stats.handshakeFailed();
+  TEST_ASSERT_EQUAL_UINT32(3, stats.handshakes.load());
+  TEST_ASSERT_EQUAL_UINT32(1, stats.failures.load());
+  TEST_ASSERT_EQUAL_UINT32(2400, stats.totalHandshakeMs.load());
+  TEST_ASSERT_EQUAL_UINT32(800, stats.averageHandshakeMs());
+  TEST_ASSERT_EQUAL_UINT32(1200, stats.maxHandshakeMs.load());
+}
+
+void test_open_connections_hold_heap() {
+  TlsStats stats;
+  FakeConnection rtdb{stats}, stream{stats};
+  rtdb.connect(true, 900, 40000);
+  stream.connect(true, 1100, 38000);
+  TEST_ASSERT_EQUAL_UINT32(78000, stats.residentBytes.load());
+  rtdb.stop();
+  TEST_ASSERT_EQUAL_UINT32(38000, stats.residentBytes.load());
+  rtdb.stop(); // Stopping twice gives nothing back twice
+  stream.stop();
+  TEST_ASSERT_EQUAL_UINT32(0, stats.residentBytes.load());
+}
+
+void test_reconnect_replaces_the_held_estimate() {
+  TlsStats stats;
+  FakeConnection rtdb{stats};
+  rtdb.connect(true, 900, 40000);
+  rtdb.connect(true, 900, 41000); // Dropped by the server, no stop()
+  TEST_ASSERT_EQUAL_UINT32(41000, stats.residentBytes.load());
+  TEST_ASSERT_EQUAL_UINT32(2, stats.handshakes.load());
+}
+
+void test_failed_handshake_holds_nothing() {
+  TlsStats stats;
+  FakeConnection rtdb{stats};
+  TEST_ASSERT_FALSE(rtdb.connect(false, 5000, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, stats.residentBytes.load());
+  TEST_ASSERT_EQUAL_UINT32(0, stats.handshakes.load());
+  TEST_ASSERT_EQUAL_UINT32(0, stats.maxHandshakeMs.load());
+}
+
+void test_heap_growing_meanwhile_counts_as_nothing() {
+  TlsStats stats;
+  uint32_t held = 0;
+  stats.hold(held, 100000, 120000); // Another task freed more than we took
+  TEST_ASSERT_EQUAL_UINT32(0, held);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.residentBytes.load());
+}
+
+// Both clients report from their own threads, the worst one has to stick
+void test_max_survives_concurrent_handshakes() {
+  static TlsStats stats;
+  // One walks up through the even durations, the other down the odd ones
+  std::thread rising([] {
+    for (uint32_t i = 0; i < 10000; i++) {
+      stats.handshakeDone(2 * i);
+    }
+  });
+  std::thread falling([] {
+    for (uint32_t i = 0; i < 10000; i++) {
+      stats.handshakeDone(19999 - 2 * i);
+    }
+  });
+  rising.join();
+  falling.join();
+  TEST_ASSERT_EQUAL_UINT32(19999, stats.maxHandshakeMs.load());
+  TEST_ASSERT_EQUAL_UINT32(20000, stats.handshakes.load());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_handshakes_are_counted_and_timed);
+  RUN_TEST(test_open_connections_hold_heap);
+  RUN_TEST(test_reconnect_replaces_the_held_estimate);
+  RUN_TEST(test_failed_handshake_holds_nothing);
+  RUN_TEST(test_heap_growing_meanwhile_counts_as_nothing);
+  RUN_TEST(test_max_survives_concurrent_handshakes);
+  return UNITY_END();
+}
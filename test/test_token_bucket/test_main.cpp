@@ -0,0 +1,86 @@
+#include <unity.h>
+#include <utils/video/TokenBucket.h>
+
+constexpr uint32_t RATE = 250000; // Bytes per second
+constexpr uint32_t BURST = 8192;
+constexpr uint32_t CHUNK = 1400; // One datagram
+
+uint32_t fakeClock;
+
+// Offers a chunk every stepUs for durationUs, returns the bytes let through
+uint32_t sendFor(TokenBucket &bucket, uint32_t durationUs, uint32_t stepUs) {
+  uint32_t sent = 0;
+  for (uint32_t elapsed = 0; elapsed < durationUs; elapsed += stepUs) {
+    if (bucket.tryConsume(CHUNK, fakeClock)) {
+      sent += CHUNK;
+    }
+    fakeClock += stepUs;
+  }
+  return sent;
+}
+
+void setUp() { fakeClock = 1000000; }
+void tearDown() {}
+
+void test_steady_state_holds_the_rate() {
+  TokenBucket bucket(RATE, BURST);
+  sendFor(bucket, 1000000, 100); // Empties the burst
+  // Offered far faster than the rate, let through at the rate
+  uint32_t sent = sendFor(bucket, 10000000, 100);
+  TEST_ASSERT_UINT32_WITHIN(CHUNK, 10 * RATE, sent);
+}
+
+void test_burst_is_capped() {
+  TokenBucket bucket(RATE, BURST);
+  bucket.tryConsume(0, fakeClock); // Starts the clock
+  fakeClock += 60000000;           // A minute idle
+  uint32_t burst = 0;
+  while (bucket.tryConsume(CHUNK, fakeClock)) {
+    burst += CHUNK;
+  }
+  TEST_ASSERT_EQUAL_UINT32(BURST / CHUNK * CHUNK, burst);
+}
+
+void test_refund_after_a_failed_send() {
+  TokenBucket bucket(RATE, 2 * CHUNK);
+  TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  TEST_ASSERT_FALSE(bucket.tryConsume(CHUNK, fakeClock));
+  bucket.refund(CHUNK); // The second one never left
+  TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  TEST_ASSERT_FALSE(bucket.tryConsume(CHUNK, fakeClock));
+  // Refunds never overfill the bucket
+  bucket.refund(CHUNK);
+  bucket.refund(CHUNK);
+  bucket.refund(CHUNK);
+  TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  TEST_ASSERT_FALSE(bucket.tryConsume(CHUNK, fakeClock));
+}
+
+void test_micros_wraparound() {
+  fakeClock = UINT32_MAX - 500000; // Half a second before micros() wraps
+  TokenBucket bucket(RATE, BURST);
+  sendFor(bucket, 200000, 100);
+  // Carries on at the same rate across the wrap
+  uint32_t sent = sendFor(bucket, 2000000, 100);
+  TEST_ASSERT_LESS_THAN(2000000, fakeClock); // Wrapped
+  TEST_ASSERT_UINT32_WITHIN(CHUNK, 2 * RATE, sent);
+}
+
+void test_zero_rate_is_burst_mode() {
+  TokenBucket bucket;
+  for (int i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(bucket.tryConsume(CHUNK, fakeClock));
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_state_holds_the_rate);
+  RUN_TEST(test_burst_is_capped);
+  RUN_TEST(test_refund_after_a_failed_send);
+  RUN_TEST(test_micros_wraparound);
+  RUN_TEST(test_zero_rate_is_burst_mode);
+  return UNITY_END();
+}
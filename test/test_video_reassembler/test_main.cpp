@@ -0,0 +1,321 @@
+#include <cstring>
+#include <unity.h>
+#include <utils/video/VideoProtocol.h>
+#include <vector>
+
+using PushResult = VideoFrameReassembler::PushResult;
+using Datagram = std::vector<uint8_t>;
+
+// Small datagrams so a frame spans a handful of chunks
+constexpr size_t DATAGRAM_SIZE = VIDEO_CHUNK_HEADER_SIZE + 100;
+constexpr size_t FRAME_LENGTH = 450; // 4 full chunks and a short one
+
+std::vector<uint8_t> makeFrame(uint8_t seed, size_t length = FRAME_LENGTH) {
+  std::vector<uint8_t> frame(length);
+  for (size_t i = 0; i < length; i++) {
+    frame[i] = uint8_t(seed + i * 7);
+  }
+  return frame;
+}
+
+Datagram toDatagram(const VideoChunk &chunk) {
+  Datagram datagram(VIDEO_CHUNK_HEADER_SIZE + chunk.payloadLength);
+  memcpy(datagram.data(), &chunk.header, VIDEO_CHUNK_HEADER_SIZE);
+  memcpy(datagram.data() + VIDEO_CHUNK_HEADER_SIZE, chunk.payload,
+         chunk.payloadLength);
+  return datagram;
+}
+
+// Every chunk of the next frame, in order
+std::vector<Datagram> chunkFrame(VideoFrameChunker &chunker,
+                                 const std::vector<uint8_t> &frame) {
+  std::vector<Datagram> datagrams;
+  uint16_t count = chunker.beginFrame(frame.data(), frame.size(), 1234);
+  for (uint16_t i = 0; i < count; i++) {
+    VideoChunk chunk;
+    chunker.chunkAt(i, chunk);
+    datagrams.push_back(toDatagram(chunk));
+  }
+  return datagrams;
+}
+
+PushResult push(VideoFrameReassembler &reassembler,
+                const Datagram &datagram) {
+  return reassembler.push(datagram.data(), datagram.size());
+}
+
+VideoChunkHeader headerOf(const Datagram &datagram) {
+  VideoChunkHeader header;
+  memcpy(&header, datagram.data(), VIDEO_CHUNK_HEADER_SIZE);
+  return header;
+}
+
+void setHeader(Datagram &datagram, const VideoChunkHeader &header) {
+  memcpy(datagram.data(), &header, VIDEO_CHUNK_HEADER_SIZE);
+}
+
+void assertFrame(const VideoFrameReassembler &reassembler,
+                 const std::vector<uint8_t> &frame) {
+  TEST_ASSERT_EQUAL_size_t(frame.size(), reassembler.lastFrameLength());
+  TEST_ASSERT_EQUAL_MEMORY(frame.data(), reassembler.lastFrameData(),
+                           frame.size());
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_in_order_frame_completes() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> frame = makeFrame(1);
+  std::vector<Datagram> chunks = chunkFrame(chunker, frame);
+  TEST_ASSERT_EQUAL_size_t(5, chunks.size());
+  for (size_t i = 0; i + 1 < chunks.size(); i++) {
+    TEST_ASSERT_TRUE(push(reassembler, chunks[i]) == PushResult::Accepted);
+  }
+  TEST_ASSERT_TRUE(push(reassembler, chunks.back()) ==
+                   PushResult::FrameComplete);
+  assertFrame(reassembler, frame);
+  TEST_ASSERT_EQUAL_UINT32(0, reassembler.lastFrameHeader().frameId);
+  TEST_ASSERT_EQUAL_UINT32(1234, reassembler.lastFrameHeader().captureTimeMs);
+  TEST_ASSERT_EQUAL_UINT32(1, reassembler.stats().framesCompleted);
+}
+
+void test_reordered_chunks_complete_the_frame() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> frame = makeFrame(2);
+  std::vector<Datagram> chunks = chunkFrame(chunker, frame);
+  const size_t order[] = {4, 1, 3, 0, 2}; // Short last chunk first
+  for (size_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(push(reassembler, chunks[order[i]]) ==
+                     PushResult::Accepted);
+  }
+  TEST_ASSERT_TRUE(push(reassembler, chunks[order[4]]) ==
+                   PushResult::FrameComplete);
+  assertFrame(reassembler, frame);
+}
+
+void test_interleaved_frames_complete() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> first = makeFrame(3), second = makeFrame(4, 120);
+  std::vector<Datagram> firstChunks = chunkFrame(chunker, first);
+  std::vector<Datagram> secondChunks = chunkFrame(chunker, second);
+  for (size_t i = 0; i + 1 < firstChunks.size(); i++) {
+    push(reassembler, firstChunks[i]);
+  }
+  push(reassembler, secondChunks[1]);
+  TEST_ASSERT_TRUE(push(reassembler, firstChunks.back()) ==
+                   PushResult::FrameComplete);
+  assertFrame(reassembler, first);
+  TEST_ASSERT_TRUE(push(reassembler, secondChunks[0]) ==
+                   PushResult::FrameComplete);
+  assertFrame(reassembler, second);
+  TEST_ASSERT_EQUAL_UINT32(0, reassembler.stats().framesDropped);
+}
+
+void test_duplicates_are_counted_once() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> frame = makeFrame(5);
+  std::vector<Datagram> chunks = chunkFrame(chunker, frame);
+  push(reassembler, chunks[0]);
+  TEST_ASSERT_TRUE(push(reassembler, chunks[0]) == PushResult::Duplicate);
+  for (size_t i = 1; i < chunks.size(); i++) {
+    push(reassembler, chunks[i]);
+  }
+  assertFrame(reassembler, frame);
+  // Completed frames are gone, a late copy is stale
+  TEST_ASSERT_TRUE(push(reassembler, chunks[2]) == PushResult::Stale);
+  const VideoFrameReassembler::Stats &stats = reassembler.stats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.chunksDuplicate);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.chunksStale);
+  TEST_ASSERT_EQUAL_UINT32(5, stats.chunksReceived);
+}
+
+void test_lost_chunk_drops_the_frame_once_a_newer_one_completes() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> lost = makeFrame(6), next = makeFrame(7);
+  std::vector<Datagram> lostChunks = chunkFrame(chunker, lost);
+  std::vector<Datagram> nextChunks = chunkFrame(chunker, next);
+  for (size_t i = 0; i < lostChunks.size(); i++) {
+    if (i != 2) {
+      push(reassembler, lostChunks[i]);
+    }
+  }
+  for (const Datagram &chunk : nextChunks) {
+    push(reassembler, chunk);
+  }
+  assertFrame(reassembler, next);
+  TEST_ASSERT_EQUAL_UINT32(1, reassembler.stats().framesDropped);
+  TEST_ASSERT_TRUE(push(reassembler, lostChunks[2]) == PushResult::Stale);
+}
+
+void test_oldest_frame_is_evicted_when_slots_run_out() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler(2);
+  std::vector<uint8_t> frames[3] = {makeFrame(8), makeFrame(9),
+                                    makeFrame(10)};
+  std::vector<Datagram> chunks[3];
+  for (int i = 0; i < 3; i++) {
+    chunks[i] = chunkFrame(chunker, frames[i]);
+    push(reassembler, chunks[i][0]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, reassembler.stats().framesDropped);
+  TEST_ASSERT_TRUE(push(reassembler, chunks[0][1]) == PushResult::Stale);
+  // The two newer frames are still in flight
+  for (size_t i = 1; i < chunks[1].size(); i++) {
+    push(reassembler, chunks[1][i]);
+  }
+  assertFrame(reassembler, frames[1]);
+}
+
+void test_frame_ids_wrap() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<uint8_t> frame = makeFrame(11, 80);
+  const uint32_t ids[] = {UINT32_MAX - 1, UINT32_MAX, 0, 1};
+  for (uint32_t id : ids) {
+    std::vector<Datagram> chunks = chunkFrame(chunker, frame);
+    VideoChunkHeader header = headerOf(chunks[0]);
+    header.frameId = id;
+    setHeader(chunks[0], header);
+    TEST_ASSERT_TRUE(push(reassembler, chunks[0]) ==
+                     PushResult::FrameComplete);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, reassembler.stats().framesCompleted);
+}
+
+// Pushes frameCount frames from a fresh sender, returns how many completed
+uint32_t streamFrames(VideoFrameReassembler &reassembler,
+                      uint32_t frameCount) {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  uint32_t completed = 0;
+  for (uint32_t i = 0; i < frameCount; i++) {
+    std::vector<uint8_t> frame = makeFrame(uint8_t(i));
+    for (const Datagram &chunk : chunkFrame(chunker, frame)) {
+      if (push(reassembler, chunk) == PushResult::FrameComplete) {
+        completed++;
+      }
+    }
+  }
+  return completed;
+}
+
+void test_sender_restarts_from_frame_id_zero() {
+  VideoFrameReassembler reassembler;
+  TEST_ASSERT_EQUAL_UINT32(100, streamFrames(reassembler, 100));
+  TEST_ASSERT_EQUAL_UINT32(0, reassembler.stats().senderRestarts);
+  // Far behind the last frame, recognized on the first chunk
+  TEST_ASSERT_EQUAL_UINT32(100, streamFrames(reassembler, 100));
+  TEST_ASSERT_EQUAL_UINT32(1, reassembler.stats().senderRestarts);
+  TEST_ASSERT_EQUAL_UINT32(0, reassembler.stats().chunksStale);
+}
+
+void test_quick_sender_restart_is_found_by_stale_run() {
+  VideoFrameReassembler reassembler;
+  streamFrames(reassembler, 10);
+  // Ids 0 to 9 are close behind the old ones, so they look late until the
+  // run of stale chunks gives the restart away. The 31 chunks before that
+  // cost frames 0 to 6.
+  TEST_ASSERT_EQUAL_UINT32(93, streamFrames(reassembler, 100));
+  TEST_ASSERT_EQUAL_UINT32(1, reassembler.stats().senderRestarts);
+  TEST_ASSERT_EQUAL_UINT32(VideoFrameReassembler::RESTART_STALE_CHUNKS - 1,
+                           reassembler.stats().chunksStale);
+}
+
+void test_malformed_chunks_are_invalid() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<Datagram> chunks = chunkFrame(chunker, makeFrame(12));
+
+  Datagram wrongMagic = chunks[1];
+  VideoChunkHeader header = headerOf(wrongMagic);
+  header.magic ^= 0xFFFF;
+  setHeader(wrongMagic, header);
+  TEST_ASSERT_TRUE(push(reassembler, wrongMagic) == PushResult::Invalid);
+
+  TEST_ASSERT_TRUE(reassembler.push(chunks[1].data(),
+                                    VIDEO_CHUNK_HEADER_SIZE - 1) ==
+                   PushResult::Invalid);
+  TEST_ASSERT_TRUE(reassembler.push(chunks[1].data(),
+                                    VIDEO_CHUNK_HEADER_SIZE) ==
+                   PushResult::Invalid); // No payload
+
+  // Offsets and lengths that do not match the chunk index
+  Datagram shifted = chunks[1];
+  header = headerOf(shifted);
+  header.offset += 1;
+  setHeader(shifted, header);
+  TEST_ASSERT_TRUE(push(reassembler, shifted) == PushResult::Invalid);
+
+  Datagram shortMiddle = chunks[1];
+  shortMiddle.pop_back();
+  TEST_ASSERT_TRUE(push(reassembler, shortMiddle) == PushResult::Invalid);
+
+  Datagram pastEnd = chunks[4];
+  header = headerOf(pastEnd);
+  header.frameLength -= 1;
+  setHeader(pastEnd, header);
+  TEST_ASSERT_TRUE(push(reassembler, pastEnd) == PushResult::Invalid);
+
+  Datagram badIndex = chunks[1];
+  header = headerOf(badIndex);
+  header.chunkIndex = header.chunkCount;
+  setHeader(badIndex, header);
+  TEST_ASSERT_TRUE(push(reassembler, badIndex) == PushResult::Invalid);
+
+  TEST_ASSERT_EQUAL_UINT32(7, reassembler.stats().chunksInvalid);
+  TEST_ASSERT_EQUAL_UINT32(0, reassembler.stats().chunksReceived);
+}
+
+void test_chunks_must_agree_with_their_frame() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler;
+  std::vector<Datagram> chunks = chunkFrame(chunker, makeFrame(13));
+  push(reassembler, chunks[0]);
+
+  // Consistent on its own and the same chunk count, but split differently
+  // than the first chunk, its bytes would land in the wrong place
+  VideoFrameChunker otherSplit(VIDEO_CHUNK_HEADER_SIZE + 95);
+  std::vector<uint8_t> frame = makeFrame(13);
+  std::vector<Datagram> other = chunkFrame(otherSplit, frame);
+  TEST_ASSERT_EQUAL_size_t(chunks.size(), other.size());
+  VideoChunkHeader header = headerOf(other[1]);
+  header.frameId = headerOf(chunks[0]).frameId;
+  setHeader(other[1], header);
+  TEST_ASSERT_TRUE(push(reassembler, other[1]) == PushResult::Invalid);
+
+  Datagram longer = chunks[1];
+  header = headerOf(longer);
+  header.frameLength += 100;
+  header.chunkCount += 1;
+  setHeader(longer, header);
+  TEST_ASSERT_TRUE(push(reassembler, longer) == PushResult::Invalid);
+}
+
+void test_oversized_frames_are_rejected() {
+  VideoFrameChunker chunker(DATAGRAM_SIZE);
+  VideoFrameReassembler reassembler(4, 400);
+  std::vector<Datagram> chunks = chunkFrame(chunker, makeFrame(14));
+  TEST_ASSERT_TRUE(push(reassembler, chunks[0]) == PushResult::Invalid);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_in_order_frame_completes);
+  RUN_TEST(test_reordered_chunks_complete_the_frame);
+  RUN_TEST(test_interleaved_frames_complete);
+  RUN_TEST(test_duplicates_are_counted_once);
+  RUN_TEST(test_lost_chunk_drops_the_frame_once_a_newer_one_completes);
+  RUN_TEST(test_oldest_frame_is_evicted_when_slots_run_out);
+  RUN_TEST(test_frame_ids_wrap);
+  RUN_TEST(test_sender_restarts_from_frame_id_zero);
+  RUN_TEST(test_quick_sender_restart_is_found_by_stale_run);
+  RUN_TEST(test_malformed_chunks_are_invalid);
+  RUN_TEST(test_chunks_must_agree_with_their_frame);
+  RUN_TEST(test_oversized_frames_are_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unity.h>
+#include <utils/SpscQueue.h>
+#include <utils/firebase/FirebaseMessages.h>
+#include <utils/firebase/FirebasePaths.h>
+
+// Every operator new in the program is counted. The host String is a
+// std::string, so a path built from Strings shows up here like it does on
+// the ESP32's heap.
+size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *ptr = malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+// The paths main.cpp writes every tick
+constexpr FirebasePath STATUS_TIME_PATH = FIREBASE_PATH("/status/time");
+constexpr FirebasePath SENSOR_PATHS[] = {
+    FIREBASE_PATH("/sensors/AHT20/reported/temperature"),
+    FIREBASE_PATH("/sensors/AHT20/reported/humidity"),
+    FIREBASE_PATH("/sensors/MLX90614/reported/ambientTempF"),
+    FIREBASE_PATH("/sensors/MLX90614/reported/objectTempF"),
+};
+
+// FirebaseWrapper's command queue and the control loop side of it
+SpscQueue<FirebaseCommand, 16> commands;
+
+FirebaseCommand *reserveCommand(FirebaseCommand::Type type, const char *path,
+                                size_t pathLength) {
+  FirebaseCommand *command = commands.reserve();
+  if (!command || pathLength >= sizeof(command->path)) {
+    return nullptr;
+  }
+  command->type = type;
+  command->length = 0;
+  command->number = 0;
+  memcpy(command->path, path, pathLength);
+  command->path[pathLength] = '\0';
+  return command;
+}
+
+void setValue(const FirebasePath &path, const char *value) {
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetString,
+                                            path.value, path.length);
+  if (command) {
+    strcpy(command->payload, value);
+    commands.publish();
+  }
+}
+
+void setValue(const FirebasePath &path, float value) {
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetFloat,
+                                            path.value, path.length);
+  if (command) {
+    command->number = value;
+    commands.publish();
+  }
+}
+
+// What the network task takes off the queue
+size_t drainCommands() {
+  size_t count = 0;
+  while (commands.peek()) {
+    commands.drop();
+    count++;
+  }
+  return count;
+}
+
+void setUp() { drainCommands(); }
+void tearDown() {}
+
+// One control tick's writes: the status time, the four sensor values and
+// the flush marker
+void test_steady_state_tick_does_not_allocate() {
+  size_t before = allocations;
+  for (int tick = 0; tick < 100; tick++) {
+    char timeBuffer[20];
+    snprintf(timeBuffer, sizeof(timeBuffer), "2024-01-01 12:%02d:%02d",
+             tick / 60, tick % 60);
+    setValue(STATUS_TIME_PATH, timeBuffer);
+    for (const FirebasePath &path : SENSOR_PATHS) {
+      setValue(path, 78.4f + tick * 0.01f);
+    }
+    FirebaseCommand *flush =
+        reserveCommand(FirebaseCommand::Type::FlushWrites, "", 0);
+    TEST_ASSERT_NOT_NULL(flush);
+    commands.publish();
+    TEST_ASSERT_EQUAL_size_t(6, drainCommands());
+  }
+  TEST_ASSERT_EQUAL_size_t(0, allocations - before);
+}
+
+// A reported state path goes through a stack buffer
+void test_formatted_path_does_not_allocate() {
+  size_t before = allocations;
+  char path[FIREBASE_PATH_SIZE];
+  int length = snprintf(path, sizeof(path), FIREBASE_DEVICES_PATH
+                        "/%s/reported", "heatLamp");
+  FirebaseCommand *command = reserveCommand(FirebaseCommand::Type::SetJson,
+                                            path, size_t(length));
+  TEST_ASSERT_NOT_NULL(command);
+  commands.publish();
+  TEST_ASSERT_EQUAL_size_t(0, allocations - before);
+  TEST_ASSERT_EQUAL_STRING(FIREBASE_DEVICES_PATH "/heatLamp/reported",
+                           command->path);
+}
+
+// The counter does see the String concatenation the handles replaced
+void test_string_paths_are_counted() {
+  size_t before = allocations;
+  String path = String(FIREBASE_BASE_PATH) +
+                "/sensors/AHT20/reported/temperature";
+  TEST_ASSERT_GREATER_THAN(0, allocations - before);
+  TEST_ASSERT_EQUAL_STRING(SENSOR_PATHS[0].value, path.c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_state_tick_does_not_allocate);
+  RUN_TEST(test_formatted_path_does_not_allocate);
+  RUN_TEST(test_string_paths_are_counted);
+  return UNITY_END();
+}